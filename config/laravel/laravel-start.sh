@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# Build mode: dependencies, assets and caches are already in the image. Only the storage
+# directory is bind-mounted from the host, so make sure Laravel can write to it.
+mkdir -p /app/storage/app/public /app/storage/framework/cache /app/storage/framework/sessions /app/storage/framework/views /app/storage/logs
+chown application:application /app/storage /app/storage/app /app/storage/app/public /app/storage/framework \
+  /app/storage/framework/cache /app/storage/framework/sessions /app/storage/framework/views /app/storage/logs
@@ -0,0 +1,41 @@
+#ifndef BASE_IMAGE_H
+#define BASE_IMAGE_H
+
+#include "sha256.h"
+
+// Node.js release installed into base images when the repository has no usable .nvmrc
+#define BASE_NODE_VERSION "18.16.0"
+
+// Label carrying the hash a base image was built from
+#define BASE_IMAGE_LABEL "dployer.base"
+
+// Per-repository Dockerfile template; its presence under config/<framework> enables shared bases
+#define BASE_APP_DOCKERFILE "app.dockerfile"
+
+// Final stage of build mode, after the dependency stages dployer generates from the lockfiles
+#define BASE_BUILD_DOCKERFILE "app.build.dockerfile"
+
+// Dockerfiles generated into the staged docker/ directory, starting FROM the shared base
+#define BASE_GENERATED_DOCKERFILE "dployer.dockerfile"
+#define BASE_BUILD_GENERATED_DOCKERFILE "dployer.build.dockerfile"
+
+// A shared base image for one (framework, PHP version, Node version) tuple
+struct base_image
+{
+    char tag[256];
+    char hash[SHA256_HEX_SIZE]; // Base Dockerfile content and Node version
+    char php_version[8];        // "81", "82"
+    char node_version[32];
+    int built;                  // Built by this call rather than reused
+};
+
+// Function declarations for shared base images
+void base_image_node_version(const char *repo_path, char *version, size_t size);
+int base_image_ensure(const char *framework, const char *config_source, const char *php_version, const char *node_version,
+                      struct base_image *base);
+int base_image_write_dockerfile(const struct base_image *base, const char *config_source, const char *docker_dir);
+int base_image_write_build_dockerfile(const struct base_image *base, const char *config_source, const char *repo_path,
+                                      const char *docker_dir);
+void print_base_images();
+
+#endif // BASE_IMAGE_H
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef BUILD_CACHE_H
+#define BUILD_CACHE_H
+
+#include <stddef.h>
+
+// Cache mount IDs shared by the dependency installs of every repository
+#define BUILD_CACHE_COMPOSER_ID "dployer-composer"
+#define BUILD_CACHE_NPM_ID "dployer-npm"
+#define BUILD_CACHE_YARN_ID "dployer-yarn"
+
+// Size `cache gc` trims the build cache down to when --keep is not given
+#define BUILD_CACHE_DEFAULT_KEEP "10G"
+
+// One BuildKit cache record as listed by /system/df
+struct build_cache_record
+{
+    char id[96];
+    char type[32];     // "regular", "exec.cachemount", "source.local", ...
+    char mount_id[64]; // id= of a cache mount, empty for other records
+    long long size;
+    long long usage_count;
+    int in_use;
+};
+
+// The daemon's build cache at one point in time, sorted by record ID
+struct build_cache_snapshot
+{
+    struct build_cache_record *records;
+    size_t count;
+};
+
+// Build cache a build reused, from snapshots taken before and after it
+struct build_cache_hits
+{
+    long long layer_bytes; // Cached layers and build steps
+    long long mount_bytes; // Cache mounts: the composer, npm and yarn downloads
+    long long new_bytes;   // Records the build added
+};
+
+// Function declarations for build cache accounting and garbage collection
+int build_cache_snapshot(struct build_cache_snapshot *snapshot);
+void build_cache_snapshot_free(struct build_cache_snapshot *snapshot);
+void build_cache_compare(const struct build_cache_snapshot *before, const struct build_cache_snapshot *after,
+                         struct build_cache_hits *hits);
+void format_cache_hits(const struct build_cache_hits *hits, char *summary, size_t size);
+int parse_byte_size(const char *text, long long *bytes);
+int print_build_cache();
+int collect_build_cache_garbage(long long keep_bytes);
+
+#endif // BUILD_CACHE_H
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stddef.h>
+
+struct docker_stream;
+
+// Receives the tar stream; returns 0 to continue or -1 to abort packing
+typedef int (*context_sink)(const void *data, size_t length, void *sink_context);
+
+// One .dockerignore line after cleaning
+struct ignore_rule
+{
+    char *pattern;
+    int exception; // Pattern started with '!' and re-includes matches
+};
+
+// Ordered ignore rules; the last matching rule decides
+struct ignore_list
+{
+    struct ignore_rule *rules;
+    size_t count;
+    size_t capacity;
+    int has_exceptions;
+};
+
+// Counters filled in while packing
+struct context_stats
+{
+    size_t files;
+    size_t directories;
+    size_t excluded;             // Entries skipped by an ignore rule
+    unsigned long long bytes;    // Size of the tar stream
+    double seconds;
+};
+
+// A build context rooted at `directory`, filtered by `ignore`
+struct build_context
+{
+    const char *directory;
+    const char *dockerfile; // Always included, like the docker CLI does
+    struct ignore_list ignore;
+    struct context_stats stats;
+};
+
+// Function declarations for build context packing
+void ignore_list_init(struct ignore_list *list);
+void ignore_list_add(struct ignore_list *list, const char *pattern);
+int ignore_list_load(struct ignore_list *list, const char *path);
+int ignore_list_matches(const struct ignore_list *list, const char *path);
+void ignore_list_free(struct ignore_list *list);
+int build_context_init(struct build_context *context, const char *directory, const char *framework, const char *dockerfile);
+int build_context_pack(struct build_context *context, context_sink sink, void *sink_context);
+int build_context_writer(struct docker_stream *stream, void *context);
+void build_context_free(struct build_context *context);
+void format_context_stats(const struct context_stats *stats, char *summary, size_t size);
+
+#endif // CONTEXT_H
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stddef.h>
+
+// Socket file created in {HOME}/.config/dployer unless DPLOYER_SOCKET is set
+#define CONTROL_SOCKET_NAME "dployer.sock"
+
+// Ends a command's output on the control socket; followed by "<status>\n"
+#define CONTROL_STATUS_MARKER '\x1e'
+
+// Longest command line accepted from a client, with room for an absolute file path
+#define CONTROL_COMMAND_SIZE 1024
+
+// Stops the daemon when sent by a client
+#define CONTROL_SHUTDOWN_COMMAND "shutdown"
+
+// Runs one command line with stdout/stderr connected to the client; returns its exit status
+typedef int (*control_handler)(char *command);
+
+// Extra work multiplexed into the daemon's event loop (e.g. the repository watcher)
+struct control_event_source
+{
+    int (*fd)(void *context);         // Descriptor to wait on, or -1
+    int (*timeout_ms)(void *context); // Milliseconds until it must run, or -1 for none
+    void (*run)(void *context);       // Called after every wake-up that was not a client
+    void *context;
+    void (*command_done)(const char *command, void *context); // After each client command (may be NULL)
+};
+
+// Function declarations for the daemon control socket
+void control_socket_path(char *path, size_t size);
+int run_control_daemon(control_handler handler, const struct control_event_source *source);
+int run_control_client(const char *command);
+
+#endif // CONTROL_H
\ No newline at end of file
@@ -4,13 +4,192 @@
 #include <sqlite3.h>
 #include <stdlib.h>
 
+// How long a connection waits for another process's write lock, overridable in milliseconds
+#define DATABASE_BUSY_TIMEOUT_MS 5000
+#define DATABASE_BUSY_TIMEOUT_ENV "DPLOYER_DB_BUSY_TIMEOUT"
+
 // Global database variable
 extern sqlite3 *db;
 
+// Statements prepared once by open_database() and reused for the connection's lifetime
+enum database_statement
+{
+    STMT_BEGIN,
+    STMT_COMMIT,
+    STMT_ROLLBACK,
+    STMT_SAVEPOINT,
+    STMT_SAVEPOINT_RELEASE,
+    STMT_SAVEPOINT_ROLLBACK,
+    STMT_REPOSITORY_FIND,
+    STMT_REPOSITORY_LIST,
+    STMT_REPOSITORY_INSERT,
+    STMT_REPOSITORY_UPDATE_REF,
+    STMT_REPOSITORY_UPDATE_FINGERPRINT,
+    STMT_REPOSITORY_UPDATE_MODE,
+    STMT_REPOSITORY_UPDATE_HEALTH_PATH,
+    STMT_REPOSITORY_UPDATE_SERVICE,
+    STMT_REPOSITORY_DELETE,
+    STMT_RUN_INSERT,
+    STMT_RUN_PHASE_INSERT,
+    STMT_RUN_RECENT_PHASES,
+    STMT_RUN_RECENT_TOTALS,
+    STMT_RUN_RECENT_OUTCOMES,
+    STMT_RUN_HISTORY_CUTOFF,
+    STMT_RUN_DURATIONS_FOLDED,
+    STMT_RUN_DURATION_ADD,
+    STMT_RUN_TOTALS_FOLD,
+    STMT_RUN_PHASES_TRIM,
+    STMT_RUN_TRIM,
+    STMT_BASE_IMAGE_SAVE,
+    STMT_BASE_IMAGE_TOUCH,
+    STMT_BASE_IMAGE_LIST,
+    STMT_IMAGE_RECORD,
+    STMT_IMAGE_SUPERSEDED,
+    STMT_IMAGE_MARK_REMOVED,
+    STMT_IMAGE_MARK_DEPLOYED,
+    STMT_IMAGE_PREVIOUS,
+    STMT_IMAGE_DEPLOYED,
+    STMT_IMAGE_LIST,
+    STMT_MAINTENANCE_AGE,
+    STMT_MAINTENANCE_TOUCH,
+    STMT_DEPENDENCY_ADD,
+    STMT_DEPENDENCY_REMOVE,
+    STMT_DEPENDENCY_LIST,
+    STMT_DEPENDENCY_DELETE_REPOSITORY,
+    STMT_METRICS_REPOSITORY_INFO,
+    STMT_METRICS_DEPLOYS,
+    STMT_METRICS_UPDATES,
+    STMT_METRICS_FAILURES,
+    STMT_METRICS_DEPLOY_DURATIONS,
+    STMT_METRICS_PHASE_DURATIONS,
+    STMT_METRICS_FETCH_DURATIONS,
+    STMT_METRICS_CONTEXT_BYTES_TOTAL,
+    STMT_METRICS_CONTEXT_BYTES,
+    STMT_METRICS_CACHE_HIT_BYTES_TOTAL,
+    STMT_METRICS_LAST_SUCCESS,
+    STMT_METRICS_LAST_SUCCESS_AGE,
+    STMT_COUNT
+};
+
+// One row of the repositories table. The record owns every string (release it
+// with repository_free); the fingerprint columns are NULL until the first deploy
+// and deploy_mode and health_path until set with "deploy --mode" and "deploy --health".
+struct repository
+{
+    char *id;
+    char *git_url;
+    char *destination_folder;
+    char *branch_name;
+    char *docker_image_tag;
+    char *docker_port;
+    char *fingerprint_commit;
+    char *fingerprint_tree;
+    char *fingerprint_config;
+    char *deploy_mode;
+    char *health_path;
+    int replicas;          // 0 leaves the service's replica count alone
+    double cpu_limit;      // CPUs per task, 0 for no limit
+    long long memory_limit; // Bytes per task, 0 for no limit
+};
+
+struct repository_list
+{
+    struct repository *items;
+    size_t count;
+};
+
+// Edges of the repository_dependencies table: `repo_id` deploys after `depends_on`.
+// The list owns the strings.
+struct repository_dependency
+{
+    char *repo_id;
+    char *depends_on;
+};
+
+struct dependency_list
+{
+    struct repository_dependency *items;
+    size_t count;
+};
+
+// Image IDs read from repository_images; the list owns the strings
+struct image_id_list
+{
+    char **items;
+    size_t count;
+};
+
 // Function declarations related to database operations
-void initialize_database();
+int initialize_database();
 void open_database(const char *db_name);
-void execute_query(const char *sql);
+int execute_query(const char *sql);
+int ensure_column(const char *table, const char *column, const char *definition);
 void close_database();
 
+// Borrow a cached statement; the connection mutex is held until database_release()
+sqlite3_stmt *database_acquire(enum database_statement statement);
+void database_release(sqlite3_stmt *stmt);
+
+// Transactions nest: only the outermost begin/commit pair reaches SQLite, and a
+// rollback at any depth makes the outermost commit roll back instead
+int database_begin();
+int database_commit();
+int database_rollback();
+
+// A savepoint inside the open transaction: ending it failed undoes only the work
+// since database_savepoint(), and leaves the transaction itself committable
+int database_savepoint();
+int database_savepoint_end(int failed);
+
+// Typed access to the repositories table. Lookups and deletes return 0 on
+// success, 1 when the repository does not exist and -1 on SQL errors.
+int repository_find(const char *id, struct repository *repository);
+int repository_list_all(struct repository_list *list);
+int repository_insert(const struct repository *repository);
+int repository_update_ref(const char *id, const char *destination_folder, const char *branch_name, const char *docker_image_tag);
+int repository_update_fingerprint(const char *id, const char *commit, const char *tree, const char *config);
+int repository_update_mode(const char *id, const char *deploy_mode);
+int repository_update_health_path(const char *id, const char *health_path);
+int repository_update_service(const char *id, const char *docker_port, int replicas, double cpu_limit, long long memory_limit);
+int repository_delete(const char *id);
+void repository_free(struct repository *repository);
+void repository_list_free(struct repository_list *list);
+
+// Shared base images built per framework, PHP and Node version
+int base_image_save(const char *tag, const char *framework, const char *php_version, const char *node_version,
+                    const char *dockerfile_hash, const char *image_id);
+int base_image_touch(const char *tag);
+
+// Images built for each repository, with the per-commit tag they were deployed
+// under. The superseded list skips the `keep` newest images that have not been
+// removed yet. repository_image_previous() finds the latest image other than
+// `image_id` that deployed successfully and repository_image_deployed() the one
+// deployed `steps_back` deploys ago (0 is the current one); both return 0, 1 if
+// there is none and -1 on SQL errors, with an empty tag for untagged images.
+int repository_image_record(const char *repo_id, const char *image_id, const char *tag);
+int repository_image_list_superseded(const char *repo_id, int keep, struct image_id_list *list);
+int repository_image_mark_removed(const char *repo_id, const char *image_id);
+int repository_image_mark_deployed(const char *repo_id, const char *image_id);
+int repository_image_previous(const char *repo_id, const char *image_id, char *previous_id, size_t id_size, char *tag,
+                              size_t tag_size);
+int repository_image_deployed(const char *repo_id, int steps_back, char *image_id, size_t id_size, char *tag,
+                              size_t tag_size);
+void image_id_list_free(struct image_id_list *list);
+
+// Deploy-order relation between repositories. repository_dependency_remove() returns 1
+// when there was no such edge; deleting a repository drops its edges in both directions.
+int repository_dependency_add(const char *repo_id, const char *depends_on);
+int repository_dependency_remove(const char *repo_id, const char *depends_on);
+int repository_dependency_list(struct dependency_list *list);
+void dependency_list_free(struct dependency_list *list);
+
+// Last run of periodic maintenance tasks. maintenance_age() returns 0 and the
+// seconds since the task last ran, 1 if it never ran and -1 on SQL errors.
+int maintenance_age(const char *task, long long *seconds);
+int maintenance_touch(const char *task);
+
+// Hammer a scratch database from `processes` concurrent processes, `operations` write
+// transactions each, and check that every commit landed. Returns 0 when it did.
+int benchmark_database(int processes, int operations);
+
 #endif // DB_H
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef DEPENDENCY_H
+#define DEPENDENCY_H
+
+#include "pool.h"
+#include <stddef.h>
+
+struct dependency_list;
+
+// Function declarations for the deploy order between repositories
+int dependency_add(const char *repo_id, const char *depends_on);
+int dependency_remove(const char *repo_id, const char *depends_on);
+int dependency_reaches(const struct dependency_list *list, const char *from, const char *to);
+void print_dependencies(const char *repo_id);
+int dependency_edges(const char *const *repo_ids, size_t count, struct graph_edge **edges, size_t *edge_count);
+
+#endif // DEPENDENCY_H
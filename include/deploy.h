@@ -9,9 +9,29 @@
 #include <unistd.h>
 #include <limits.h>
 
+// How Laravel images get their dependencies: installed in cached build stages and baked in,
+// or installed by the container entrypoint on every start (the original behaviour)
+#define DEPLOY_MODE_BUILD "build"
+#define DEPLOY_MODE_ENTRYPOINT "entrypoint"
+
+// "deploy --health off" turns a repository's health check off again
+#define DEPLOY_HEALTH_OFF "off"
+
+// Options controlling a deploy run
+struct deploy_options
+{
+  int jobs;         // Number of repositories deployed concurrently (0 = one per CPU)
+  int force;        // Rebuild even when the source fingerprint matches the running image
+  int skip_cleanup; // Skip the global prune check; the caller runs it once afterwards
+  const char *mode; // DEPLOY_MODE_BUILD or DEPLOY_MODE_ENTRYPOINT; NULL keeps each repository's own
+  const char *health_path; // HTTP path probed after the rollout, or DEPLOY_HEALTH_OFF; NULL keeps each repository's own
+};
+
 // Function declarations related to repository management
-void deploy_repo(const char *repo_id);
-void deploy_all_repos();
+int deploy_repo(const char *repo_id, const struct deploy_options *options);
+int deploy_repos(const char *const *repo_ids, size_t count, const struct deploy_options *options);
+int deploy_all_repos(const struct deploy_options *options);
 void delete_service(const char *repo_id);
+void benchmark_build_context(const char *repo_id);
 
 #endif // DEPLOY_H
\ No newline at end of file
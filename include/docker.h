@@ -1,9 +1,111 @@
 #ifndef DOCKER_H
 #define DOCKER_H
 
+#include <stddef.h>
 #include <stdlib.h>
+#include <time.h>
+
+struct output_buffer;
+struct json_object;
+
+// Engine API version used for every request
+#define DOCKER_API_VERSION "v1.41"
+
+// Default daemon socket; DOCKER_HOST=unix:///path overrides it (e.g. for a fake daemon)
+#define DOCKER_DEFAULT_SOCKET "/var/run/docker.sock"
+
+// Builds go through BuildKit unless this is set to 0
+#define DOCKER_BUILDKIT_ENV "DPLOYER_BUILDKIT"
+
+// Receives response body bytes as they arrive (already de-chunked)
+typedef void (*docker_body_sink)(const char *data, size_t length, void *context);
+
+// An open chunked request body, written to by a docker_body_writer
+struct docker_stream
+{
+    int fd;
+    int failed;
+    size_t bytes_written;
+};
+
+// Produces a streamed request body (e.g. a build context) by calling docker_stream_write()
+typedef int (*docker_body_writer)(struct docker_stream *stream, void *context);
+
+// Desired state of a swarm service managed by dployer
+struct docker_service_spec
+{
+    const char *name;         // Service name (<repo_id>_service)
+    const char *image;        // Image reference to run
+    const char *port;         // "host_port:container_port"
+    const char *mount_source; // Host directory bind-mounted into the container
+    const char *mount_target; // Mount point inside the container
+    int replicas;
+    const char *remove_mount_target; // Mount to drop if present, like --mount-rm
+    const char *shared_source;       // Second host directory, mounted inside the first (may be NULL)
+    const char *shared_target;
+    const char *remove_port;         // "host_port:container_port" to unpublish, like --publish-rm
+    int set_resources;               // Replace the task limits with the two below (0 = no limit)
+    double cpu_limit;
+    long long memory_limit;
+};
+
+// Progress of a service rollout, from its UpdateStatus and its tasks
+struct docker_rollout_status
+{
+    char update_state[32]; // UpdateStatus.State of an update started since `since`, else empty
+    char message[256];     // Update message or the latest task error
+    int desired;           // Tasks that should be running
+    int running;           // Of those, the ones that are
+    int failed;            // Tasks of the image created since `since` that failed or were rejected
+};
+
+// Build steps BuildKit reported for one build
+struct docker_build_stats
+{
+    size_t steps;        // Dockerfile steps, not counting BuildKit's [internal] ones
+    size_t cached_steps; // Steps answered from the build cache
+};
+
+// Parameters of an image build; the context is streamed by `context_writer`
+struct docker_build_request
+{
+    const char *tag;
+    const char *dockerfile;     // Path of the Dockerfile inside the build context
+    const char *const *buildargs; // NULL terminated "KEY=VALUE" list
+    const char *const *labels;    // NULL terminated "KEY=VALUE" list
+    docker_body_writer context_writer;
+    void *context_writer_context;
+    struct docker_build_stats *stats; // Filled in when not NULL; stays zero without BuildKit
+};
+
+// Low-level Engine API transport
+int docker_api_request(const char *method, const char *path, const char *content_type,
+                       const char *body, size_t body_length, struct output_buffer *response_body);
+int docker_api_stream(const char *method, const char *path, const char *content_type,
+                      docker_body_writer writer, void *writer_context,
+                      docker_body_sink sink, void *sink_context);
+int docker_stream_write(struct docker_stream *stream, const void *data, size_t length);
+void docker_stream_sink(const char *data, size_t length, void *context);
+void docker_url_encode(const char *value, char *encoded, size_t size);
+const char *docker_socket_path();
+void docker_log_api_error(const char *action, int status, const struct output_buffer *body);
 
 // Function declarations for Docker-related operations
+int docker_ping();
+int docker_buildkit_enabled();
+int docker_swarm_ensure();
+int docker_service_inspect(const char *service_name, struct json_object **service);
+int docker_service_image(const char *service_name, char *image, size_t size);
+int docker_service_create(const struct docker_service_spec *spec);
+int docker_service_update(const struct docker_service_spec *spec, struct json_object *current);
+int docker_service_remove(const char *service_name);
+int docker_service_rollout(const char *service_name, const char *image, time_t since, struct docker_rollout_status *status);
+int docker_image_build(const struct docker_build_request *request, struct output_buffer *log, char *image_id, size_t image_id_size);
+int docker_image_label(const char *image, const char *label, char *value, size_t size);
+int docker_image_remove(const char *image_id);
+int docker_image_add_tag(const char *image, const char *repository, const char *tag);
+void docker_image_repository(const char *reference, char *repository, size_t size);
+int docker_prune(const char *resource, long long *space_reclaimed);
 void clean_up_unused_resources();
 void show_docker_service_logs(const char *repo_id);
 
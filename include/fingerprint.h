@@ -0,0 +1,23 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include "sha256.h"
+
+// Identity of everything that goes into a repository's image
+struct repo_fingerprint
+{
+  char head_commit[SHA256_HEX_SIZE]; // git rev-parse HEAD (SHA-1 or SHA-256 object name)
+  char tree_hash[SHA256_HEX_SIZE];   // Hash of uncommitted and untracked changes
+  char config_hash[SHA256_HEX_SIZE]; // Hash of the framework config bundle and Dockerfile choice
+  char combined[SHA256_HEX_SIZE];    // Hash of the three above, used as the image label
+  int dirty;                         // Whether the working tree differs from head_commit
+};
+
+// Label stored on every image built by dployer
+#define FINGERPRINT_LABEL "dployer.fingerprint"
+
+// Function declarations for source-tree fingerprinting
+int compute_repo_fingerprint(const char *repo_path, const char *config_source, const char *dockerfile_name, struct repo_fingerprint *fingerprint);
+int hash_directory_tree(const char *path, struct sha256_context *context);
+
+#endif // FINGERPRINT_H
\ No newline at end of file
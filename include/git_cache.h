@@ -0,0 +1,26 @@
+#ifndef GIT_CACHE_H
+#define GIT_CACHE_H
+
+#include <stddef.h>
+
+// Set to "0" to clone and fetch without the shared bare-repository cache. A cache never
+// prunes objects, so it grows with every fetch of its origin until the last repository
+// cloned from that origin is deleted.
+#define GIT_CACHE_ENV "DPLOYER_GIT_CACHE"
+
+// History depth of new clones and of refs fetched into them; unset or 0 keeps full history
+#define GIT_CLONE_DEPTH_ENV "DPLOYER_CLONE_DEPTH"
+
+// Partial clone filter for new clones, for example "blob:none" or "tree:0"
+#define GIT_CLONE_FILTER_ENV "DPLOYER_CLONE_FILTER"
+
+// Function declarations for shallow, partial and cache-backed git transfers
+int git_cache_sync(const char *git_url, const char *branch_or_tag, int is_tag, char *cache_path, size_t size);
+int git_cache_remove(const char *git_url);
+int git_cache_borrowed(const char *repo_path);
+int git_clone_repo(const char *git_url, const char *branch_or_tag, int is_tag, int bare, const char *destination);
+int git_fetch_ref(const char *repo_path, const char *git_url, const char *branch_or_tag, int is_tag, int limit_depth,
+                  const char *failure_message);
+int git_track_branch(const char *repo_path, const char *branch);
+
+#endif // GIT_CACHE_H
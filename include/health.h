@@ -0,0 +1,27 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <time.h>
+
+// How long a health-gated deploy waits for its tasks and its health path, in seconds
+#define HEALTH_TIMEOUT_ENV "DPLOYER_HEALTH_TIMEOUT"
+#define HEALTH_DEFAULT_TIMEOUT_SECONDS 120
+
+// Host the published port is probed on
+#define HEALTH_HOST_ENV "DPLOYER_HEALTH_HOST"
+#define HEALTH_DEFAULT_HOST "127.0.0.1"
+
+// Consecutive good answers needed, since the routing mesh spreads probes over the replicas
+#define HEALTH_REQUIRED_SUCCESSES 3
+
+// Failed tasks after which a rollout is given up before the timeout
+#define HEALTH_MAX_TASK_FAILURES 3
+
+// Function declarations for health-gated deploys
+double health_deadline();
+int health_probe(const char *host, int port, const char *path);
+int health_wait_for_rollout(const char *service_name, const char *image, int expect_update, time_t since, double deadline);
+int health_gate(const char *service_name, const char *image, int expect_update, time_t since, const char *port_mapping,
+                const char *path);
+
+#endif // HEALTH_H
\ No newline at end of file
@@ -17,7 +17,38 @@
 #define ERROR_SYMBOL "ERROR"
 #define INPUT_SYMBOL "\033[1;36m>\033[0m" // Cyan arrow for input symbol
 
+// Environment variables read once, on the first log line
+#define LOG_LEVEL_ENV "DPLOYER_LOG_LEVEL"   // info (default), ok, warning or error
+#define LOG_FORMAT_ENV "DPLOYER_LOG_FORMAT" // text (default) or json
+#define LOG_FILE_ENV "DPLOYER_LOG_FILE"     // Also append JSON lines to this file
+#define LOG_SYNC_ENV "DPLOYER_LOG_SYNC"     // 1 writes every line from the calling thread
+
+#define LOG_REPO_SIZE 64
+#define LOG_PHASE_SIZE 32
+
+// Repository and phase attached to the calling thread's log lines
+struct log_context
+{
+    char repo[LOG_REPO_SIZE];
+    char phase[LOG_PHASE_SIZE];
+};
+
+struct output_buffer;
+
 // Function declaration for logging messages
 void log_message(const char *color, const char *symbol, const char *message);
 
+// Capture the calling thread's log messages into a buffer (NULL restores stdout)
+void log_capture(struct output_buffer *buffer);
+
+// Tag this thread's lines with `repo` (saving the previous context) and restore it
+void log_context_push(struct log_context *saved, const char *repo);
+void log_context_pop(const struct log_context *saved);
+void log_set_phase(const char *phase);
+
+// Wait until every queued line is written; call before printing to stdout directly
+void log_flush();
+
+int benchmark_logger(int threads, int messages, const char *sink_path);
+
 #endif // LOGGER_H
\ No newline at end of file
@@ -0,0 +1,8 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+// Function declarations for the declarative fleet manifest
+int export_manifest(const char *path);
+int apply_manifest(const char *path, int jobs, int dry_run);
+
+#endif // MANIFEST_H
@@ -0,0 +1,15 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+struct output_buffer;
+
+// Path of the node_exporter textfile-collector file; unset disables the export
+#define METRICS_TEXTFILE_ENV "DPLOYER_METRICS_TEXTFILE"
+
+// Function declarations for the Prometheus exposition
+int render_metrics(struct output_buffer *out);
+int metrics_fold_runs(const char *repo_id, const char *kind, int keep);
+int write_metrics_textfile();
+int print_metrics();
+
+#endif // METRICS_H
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Task signature: called once for every index in [0, count)
+typedef void (*pool_task)(size_t index, void *context);
+
+// Graph task signature: called once per node, returns 0 on success
+typedef int (*graph_task)(size_t index, void *context);
+
+// Node `after` runs only once node `before` has succeeded
+struct graph_edge
+{
+    size_t before;
+    size_t after;
+};
+
+enum graph_node_state
+{
+    GRAPH_NODE_PENDING,
+    GRAPH_NODE_DONE,
+    GRAPH_NODE_FAILED,
+    GRAPH_NODE_SKIPPED // A dependency failed or was skipped, or the node is on a cycle
+};
+
+// Function declarations for the bounded worker pool
+int resolve_job_count(int jobs);
+void run_worker_pool(size_t count, int jobs, pool_task task, void *context);
+int run_task_graph(size_t count, const struct graph_edge *edges, size_t edge_count, int jobs, graph_task task,
+                   void *context, enum graph_node_state *states);
+
+#endif // POOL_H
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <stddef.h>
+
+struct output_buffer;
+
+// Receives a chunk of output from a child process as soon as it is read
+typedef void (*process_sink)(const char *data, size_t length, void *context);
+
+// Where the child's output goes; a NULL sink discards that stream
+struct process_options
+{
+    process_sink stdout_sink;
+    void *stdout_context;
+    process_sink stderr_sink;
+    void *stderr_context;
+};
+
+// Outcome of a finished child process
+struct process_result
+{
+    int exit_code;  // Exit status, or -1 if the process could not be started or was killed
+    int signal;     // Terminating signal, 0 if the process exited normally
+    double seconds; // Wall time from spawn to exit
+};
+
+// Function declarations for running child processes without a shell
+int process_run(const char *const argv[], const struct process_options *options, struct process_result *result);
+int process_run_captured(const char *const argv[], struct output_buffer *output, struct process_result *result);
+int process_run_stdout(const char *const argv[], struct output_buffer *output, struct process_result *result);
+void process_sink_buffer(const char *data, size_t length, void *context);
+void process_sink_stdout(const char *data, size_t length, void *context);
+void process_format_argv(const char *const argv[], char *buffer, size_t size);
+
+#endif // PROCESS_H
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef PRUNE_H
+#define PRUNE_H
+
+// How many of its newest images each repository keeps (the running one included)
+#define PRUNE_RETENTION_ENV "DPLOYER_IMAGE_RETENTION"
+#define PRUNE_DEFAULT_RETENTION 3
+
+// The daemon-wide prune runs at most this often ("90m", "12h", "7d" or seconds)...
+#define PRUNE_INTERVAL_ENV "DPLOYER_PRUNE_INTERVAL"
+#define PRUNE_DEFAULT_INTERVAL_SECONDS (24 * 60 * 60)
+
+// ...or sooner once images take more than this much disk ("50G"); unset disables it
+#define PRUNE_THRESHOLD_ENV "DPLOYER_PRUNE_THRESHOLD"
+
+// Name of the global prune in the maintenance table
+#define PRUNE_GLOBAL_TASK "global_prune"
+
+// Function declarations for image retention and the scheduled global prune
+int prune_repository_images(const char *repo_id);
+int prune_if_due();
+int prune_now();
+
+#endif // PRUNE_H
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef RELEASE_H
+#define RELEASE_H
+
+#include <stddef.h>
+
+// How many releases each repository keeps (the current one included, at least two)
+#define RELEASE_RETENTION_ENV "DPLOYER_RELEASE_RETENTION"
+#define RELEASE_DEFAULT_RETENTION 3
+
+// Counters filled in while creating a release
+struct release_copy_stats
+{
+    size_t files;
+    size_t cloned;  // Reflinks of the checkout's files
+    size_t copied;  // Plain copies, when neither works
+    unsigned long long bytes;
+};
+
+// Function declarations for immutable release directories behind a "current" symlink
+int release_path(const char *repo_id, const char *name, char *path, size_t size);
+int release_shared_storage(const char *repo_id, const char *source_dir, char *path, size_t size);
+int release_create(const char *repo_id, const char *source_dir, const char *commit_tag, char *name, size_t size,
+                   struct release_copy_stats *stats);
+int release_current(const char *repo_id, char *name, size_t size);
+int release_find(const char *repo_id, const char *commit_tag, char *name, size_t size);
+int release_activate(const char *repo_id, const char *name);
+int release_collect_garbage(const char *repo_id);
+int release_remove_all(const char *repo_id);
+
+#endif // RELEASE_H
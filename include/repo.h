@@ -11,15 +11,18 @@
 
 // Function declarations related to repository management
 void ensure_repositories_folder_exists();
-void clone_new_repo(const char *repo_id, const char *git_url, const char *destination_folder, const char *branch_name, const char *docker_image_prefix, const char *docker_port);
+int clone_new_repo(const char *repo_id, const char *git_url, const char *destination_folder, const char *branch_name, const char *docker_image_prefix, const char *docker_port);
 void list_repositories();
-void pull_latest_repo(const char *repo_id);
-void pull_all_repos();
+int fetch_repo(const char *repo_id);
+int integrate_repo(const char *repo_id);
+int pull_latest_repo(const char *repo_id);
+int pull_all_repos(int jobs);
 void switch_to_branch_or_tag(const char *repo_id, const char *branch_or_tag);
-void deploy_repo(const char *repo_id);
-void deploy_all_repos();
 const char *check_repo_framework(const char *repo_path);
 int check_laravel_and_php_versions(const char *repo_path); // Add this line
 void delete_repo(const char *repo_id);
+void prune_stale_worktrees(const char *repo_path);
+int is_version_tag(const char *branch_or_tag);
+int run_git_step(const char *const argv[], const char *failure_message);
 
 #endif // REPO_H
\ No newline at end of file
@@ -0,0 +1,11 @@
+#ifndef ROLLBACK_H
+#define ROLLBACK_H
+
+#include "docker.h"
+
+// Function declarations for moving a service back to images built earlier
+int roll_back_failed_deploy(const char *repo_id, const char *failed_image_id, struct docker_service_spec *spec);
+int rollback_repository(const char *repo_id, int steps_back);
+void print_repository_images(const char *repo_id);
+
+#endif // ROLLBACK_H
\ No newline at end of file
@@ -0,0 +1,26 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE 65 // 64 hex characters plus the terminator
+
+// Incremental SHA-256 state
+struct sha256_context
+{
+    uint32_t state[8];
+    uint64_t bit_count;
+    uint8_t block[64];
+    size_t block_length;
+};
+
+// Function declarations for SHA-256 hashing
+void sha256_init(struct sha256_context *context);
+void sha256_update(struct sha256_context *context, const void *data, size_t length);
+void sha256_final(struct sha256_context *context, uint8_t digest[SHA256_DIGEST_SIZE]);
+void sha256_final_hex(struct sha256_context *context, char hex[SHA256_HEX_SIZE]);
+int sha256_file_hex(const char *path, char hex[SHA256_HEX_SIZE]);
+
+#endif // SHA256_H
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "logger.h"
+#include <stddef.h>
+
+#define RUN_TIMER_MAX_PHASES 16
+
+// Kinds of timed runs stored in deploy_runs
+#define RUN_KIND_DEPLOY "deploy"
+#define RUN_KIND_UPDATE "update"
+#define RUN_KIND_FLEET "fleet"
+#define RUN_KIND_ROLLBACK "rollback"
+
+// Runs kept per repository and kind; older ones only remain in the metrics totals
+#define RUN_HISTORY_KEEP 500
+
+// One timed phase of a run
+struct run_phase
+{
+    const char *name;
+    double seconds;
+};
+
+// Monotonic per-phase timer for one deploy or update run
+struct run_timer
+{
+    const char *kind;
+    char repo_id[128];
+    const char *outcome; // "ok", "failed" or "skipped"
+    unsigned long long context_bytes; // Build context sent to the daemon, 0 if none
+    unsigned long long cache_hit_bytes; // Build cache BuildKit reused, 0 if not measured
+    double started;
+    double total_seconds; // Set by run_timer_stop()
+    long long finished_at; // Unix time, set by run_timer_stop()
+    double phase_started;
+    const char *current_phase;
+    size_t phase_count;
+    struct run_phase phases[RUN_TIMER_MAX_PHASES];
+    struct log_context log_context; // Restored when the run finishes
+};
+
+// Function declarations for run timing and the stats report
+void run_timer_start(struct run_timer *timer, const char *kind, const char *repo_id);
+void run_timer_phase(struct run_timer *timer, const char *phase);
+void run_timer_add(struct run_timer *timer, const char *phase, double seconds);
+void run_timer_stop(struct run_timer *timer, int status);
+void run_timer_record(const struct run_timer *timer);
+void run_timer_finish(struct run_timer *timer, int status);
+void print_run_stats(const char *repo_id, int last_runs);
+
+#endif // STATS_H
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+
+// Timestamp given to every staged file and directory, so unchanged config packs into
+// byte-identical tar entries (1980-01-01, the earliest date every archive format records)
+#define CONFIG_STORE_MTIME 315532800
+
+// Counters filled in while staging a config bundle
+struct config_stage_stats
+{
+    size_t files;
+    size_t linked;  // Hard links to a store object
+    size_t cloned;  // Reflinks, when the store is on another filesystem
+    size_t copied;  // Plain copies, when neither works
+    size_t stored;  // Objects added to the store by this staging
+    unsigned long long bytes;
+};
+
+// Function declarations for the content-addressed config store
+int config_store_stage(const char *source_dir, const char *destination_dir, struct config_stage_stats *stats);
+void format_stage_stats(const struct config_stage_stats *stats, char *summary, size_t size);
+
+#endif // STORE_H
\ No newline at end of file
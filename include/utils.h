@@ -4,10 +4,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+
+// Growable text buffer used to capture the output of a single job
+struct output_buffer
+{
+  char *data;
+  size_t length;
+  size_t capacity;
+};
 
 // Function declarations for utility functions
 void get_input(const char *prompt, char *input, size_t size);
-void execute_command(const char *command);
+int run_command(const char *const argv[], struct output_buffer *output);
 void check_requirements();
 
+int copy_file(const char *source_path, const char *destination_path, mode_t mode);
+int clone_file(const char *source_path, const char *destination_path, mode_t mode);
+int remove_directory(const char *path);
+
+void output_buffer_init(struct output_buffer *buffer);
+void output_buffer_append(struct output_buffer *buffer, const char *data, size_t length);
+void output_buffer_appendf(struct output_buffer *buffer, const char *format, ...);
+void output_buffer_free(struct output_buffer *buffer);
+
+double monotonic_seconds();
+
 #endif // UTILS_H
\ No newline at end of file
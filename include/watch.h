@@ -0,0 +1,64 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "sha256.h"
+#include <stddef.h>
+
+// Tuning for watch mode
+struct watch_options
+{
+    double remote_interval; // Seconds between git ls-remote checks (0 disables them)
+    double debounce;        // Quiet period after the last change before a repository is deployed
+    int jobs;               // Repositories deployed concurrently per batch
+};
+
+// One repository under watch
+struct watched_repo
+{
+    char *repo_id;
+    char *path;
+    char *git_dir;    // The checkout's own HEAD lives here
+    char *common_dir; // Refs and packed-refs live here; differs from git_dir for worktrees
+    char *branch_name;
+    char head[SHA256_HEX_SIZE];             // HEAD when the repository was last handled
+    char remote_signature[SHA256_HEX_SIZE]; // Hash of the last ls-remote answer (tag tracking)
+    unsigned long long ref_signature;       // mtime/size digest of the refs (polling fallback)
+    int pending;                            // A change was seen and is waiting out the debounce
+    int needs_update;                       // The remote moved; fetch and integrate before deploying
+    double changed_at;
+};
+
+// An inotify watch descriptor and the repository it belongs to
+struct watch_handle
+{
+    int descriptor;
+    size_t repo;
+    char *path;
+    int is_git_dir; // The .git directory itself: only HEAD and packed-refs matter
+};
+
+struct watcher
+{
+    struct watch_options options;
+    struct watched_repo *repos;
+    size_t count;
+    int inotify_fd; // -1 when falling back to polling
+    struct watch_handle *handles;
+    size_t handle_count;
+    size_t handle_capacity;
+    double next_remote_check;
+    double next_poll;
+};
+
+// Function declarations for watch mode
+void watch_options_init(struct watch_options *options);
+int watcher_init(struct watcher *watcher, const struct watch_options *options);
+int watcher_fd(const struct watcher *watcher);
+int watcher_timeout_ms(const struct watcher *watcher);
+void watcher_run(struct watcher *watcher);
+int watcher_reload(struct watcher *watcher);
+void watcher_reload_on_sighup();
+void watcher_free(struct watcher *watcher);
+int watch_repositories(const struct watch_options *options);
+
+#endif // WATCH_H
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef WORKTREE_H
+#define WORKTREE_H
+
+#include <stddef.h>
+
+// Bare object store of a repository cloned by dployer, inside its destination folder.
+// Each branch or tag it deploys is a worktree next to it.
+#define WORKTREE_STORE_NAME ".store"
+
+// Unused worktrees younger than this are left alone: a clone or switch may not have recorded them yet
+#define WORKTREE_GC_GRACE_SECONDS 600
+
+// Function declarations for per-repository object stores and their worktrees
+int git_dirs(const char *repo_path, char *git_dir, size_t git_dir_size, char *common_dir, size_t common_dir_size);
+int worktree_store_exists(const char *destination_folder);
+int worktree_checkout(const char *repo_path, const char *branch_or_tag, int is_tag, char *worktree_path, size_t size);
+int worktree_remove(const char *worktree_path, const char *const in_use[], size_t in_use_count);
+int worktree_collect_garbage(const char *repo_path, const char *const in_use[], size_t in_use_count);
+int worktree_remove_store(const char *repo_path);
+
+#endif // WORKTREE_H
@@ -0,0 +1,400 @@
+#include "base_image.h"
+#include "build_cache.h"
+#include "context.h"
+#include "database.h"
+#include "docker.h"
+#include "logger.h"
+#include "store.h"
+#include "utils.h"
+#include <json-c/json.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// An exact release such as "20.11.1"
+static int is_release_version(const char *version)
+{
+    int parts = 0;
+    int digits = 0;
+    for (const char *c = version; *c; c++)
+    {
+        if (isdigit((unsigned char)*c))
+        {
+            digits++;
+        }
+        else if (*c == '.' && digits > 0)
+        {
+            parts++;
+            digits = 0;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    return parts == 2 && digits > 0;
+}
+
+// Use the repository's .nvmrc when it pins an exact release ("v20.11.1"). Aliases such as
+// "lts/*" would need a lookup against nodejs.org, so they fall back to the default.
+void base_image_node_version(const char *repo_path, char *version, size_t size)
+{
+    snprintf(version, size, "%s", BASE_NODE_VERSION);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.nvmrc", repo_path);
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return;
+    }
+
+    char line[64];
+    if (fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, " \t\r\n")] = '\0';
+        const char *start = line[0] == 'v' ? line + 1 : line;
+        if (is_release_version(start))
+        {
+            snprintf(version, size, "%s", start);
+        }
+    }
+    fclose(file);
+}
+
+// Serialize work on one base image across threads and processes. flock() locks belong to the
+// open file description, so two threads of the daemon also exclude each other.
+static int lock_base_image(const struct base_image *base)
+{
+    const char *home_dir = getenv("HOME");
+    if (!home_dir)
+    {
+        return -1;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.config/dployer/store", home_dir);
+    if (mkdir(path, 0700) != 0 && errno != EEXIST)
+    {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/.config/dployer/store/base-%.12s.lock", home_dir, base->hash);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    while (flock(fd, LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static int build_base_image(struct base_image *base, const char *framework, const char *base_dir, const char *dockerfile_name)
+{
+    char log_msg[512];
+    snprintf(log_msg, sizeof(log_msg), "Building shared base image %s; later %s deploys on PHP %s and Node %s reuse it.",
+             base->tag, framework, base->php_version, base->node_version);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+
+    // The base context is just the base/ directory: no application files go into it
+    struct build_context context;
+    if (build_context_init(&context, base_dir, NULL, dockerfile_name) != 0)
+    {
+        return -1;
+    }
+
+    char node_arg[64];
+    char label_arg[SHA256_HEX_SIZE + 32];
+    snprintf(node_arg, sizeof(node_arg), "NODE_VERSION=%s", base->node_version);
+    snprintf(label_arg, sizeof(label_arg), "%s=%s", BASE_IMAGE_LABEL, base->hash);
+    const char *build_args[] = {node_arg, NULL};
+    const char *labels[] = {label_arg, NULL};
+
+    struct docker_build_request request = {base->tag, dockerfile_name, build_args, labels, build_context_writer, &context, NULL};
+
+    struct output_buffer build_log;
+    output_buffer_init(&build_log);
+
+    char image_id[128] = "";
+    double started = monotonic_seconds();
+    int status = docker_image_build(&request, &build_log, image_id, sizeof(image_id));
+    build_context_free(&context);
+
+    if (status != 0)
+    {
+        snprintf(log_msg, sizeof(log_msg), "Base image build failed after %.1fs.", monotonic_seconds() - started);
+        log_message(ERROR, ERROR_SYMBOL, log_msg);
+        if (build_log.length > 0)
+        {
+            log_message(ERROR, ERROR_SYMBOL, build_log.data);
+        }
+        output_buffer_free(&build_log);
+        return -1;
+    }
+    output_buffer_free(&build_log);
+
+    snprintf(log_msg, sizeof(log_msg), "Base image %s built in %.1fs.", base->tag, monotonic_seconds() - started);
+    log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+    base->built = 1;
+
+    if (base_image_save(base->tag, framework, base->php_version, base->node_version, base->hash, image_id) != 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "Failed to record the base image.");
+    }
+    return 0;
+}
+
+// Make sure the base image for this tuple exists, building it from
+// config/<framework>/base/php<version>.dockerfile only when its hash is new
+int base_image_ensure(const char *framework, const char *config_source, const char *php_version, const char *node_version,
+                      struct base_image *base)
+{
+    memset(base, 0, sizeof(*base));
+    snprintf(base->php_version, sizeof(base->php_version), "%s", php_version);
+    snprintf(base->node_version, sizeof(base->node_version), "%s", node_version);
+
+    char base_dir[PATH_MAX];
+    char dockerfile_name[32];
+    char dockerfile_path[PATH_MAX + 32];
+    snprintf(base_dir, sizeof(base_dir), "%s/base", config_source);
+    snprintf(dockerfile_name, sizeof(dockerfile_name), "php%s.dockerfile", php_version);
+    snprintf(dockerfile_path, sizeof(dockerfile_path), "%s/%s", base_dir, dockerfile_name);
+
+    char file_hash[SHA256_HEX_SIZE];
+    if (sha256_file_hex(dockerfile_path, file_hash) != 0)
+    {
+        char error_msg[PATH_MAX + 64];
+        snprintf(error_msg, sizeof(error_msg), "Cannot read base Dockerfile %s.", dockerfile_path);
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        return -1;
+    }
+
+    struct sha256_context context;
+    sha256_init(&context);
+    sha256_update(&context, file_hash, strlen(file_hash) + 1);
+    sha256_update(&context, node_version, strlen(node_version) + 1);
+    sha256_final_hex(&context, base->hash);
+    snprintf(base->tag, sizeof(base->tag), "dployer-base/%s:php%s-node%s-%.12s", framework, php_version, node_version, base->hash);
+
+    // Parallel deploys of the same stack wait here for one build and then reuse it
+    int lock_fd = lock_base_image(base);
+    if (lock_fd < 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to lock the base image.");
+        return -1;
+    }
+
+    int status = 0;
+    char label[SHA256_HEX_SIZE];
+    if (docker_image_label(base->tag, BASE_IMAGE_LABEL, label, sizeof(label)) == 0 && strcmp(label, base->hash) == 0)
+    {
+        char log_msg[320];
+        snprintf(log_msg, sizeof(log_msg), "Reusing shared base image %s.", base->tag);
+        log_message(INFO, INFO_SYMBOL, log_msg);
+        base_image_touch(base->tag);
+    }
+    else
+    {
+        status = build_base_image(base, framework, base_dir, dockerfile_name);
+    }
+
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    return status;
+}
+
+// Write `header` followed by the template at `template_path` into `output_path`
+static int write_generated_dockerfile(const char *header, const char *template_path, const char *output_path)
+{
+    FILE *template = fopen(template_path, "r");
+    if (!template)
+    {
+        return -1;
+    }
+
+    // Never write through a link into the config store
+    unlink(output_path);
+    FILE *output = fopen(output_path, "w");
+    if (!output)
+    {
+        fclose(template);
+        return -1;
+    }
+
+    int status = fputs(header, output) < 0 ? -1 : 0;
+    char chunk[4096];
+    size_t read_bytes;
+    while (status == 0 && (read_bytes = fread(chunk, 1, sizeof(chunk), template)) > 0)
+    {
+        if (fwrite(chunk, 1, read_bytes, output) != read_bytes)
+        {
+            status = -1;
+        }
+    }
+    if (ferror(template))
+    {
+        status = -1;
+    }
+    fclose(template);
+    if (fclose(output) != 0)
+    {
+        status = -1;
+    }
+
+    // Same timestamp as the staged files, so an unchanged Dockerfile packs identically
+    struct timespec times[2] = {{CONFIG_STORE_MTIME, 0}, {CONFIG_STORE_MTIME, 0}};
+    if (status == 0 && utimensat(AT_FDCWD, output_path, times, 0) != 0)
+    {
+        status = -1;
+    }
+    return status;
+}
+
+// Write docker/dployer.dockerfile: FROM the base, then the framework's per-repository steps
+int base_image_write_dockerfile(const struct base_image *base, const char *config_source, const char *docker_dir)
+{
+    char template_path[PATH_MAX];
+    char output_path[PATH_MAX];
+    snprintf(template_path, sizeof(template_path), "%s/%s", config_source, BASE_APP_DOCKERFILE);
+    snprintf(output_path, sizeof(output_path), "%s/%s", docker_dir, BASE_GENERATED_DOCKERFILE);
+
+    char header[320];
+    snprintf(header, sizeof(header), "FROM %s\n", base->tag);
+    return write_generated_dockerfile(header, template_path, output_path);
+}
+
+static int repo_file_exists(const char *repo_path, const char *name)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", repo_path, name);
+    return access(path, F_OK) == 0;
+}
+
+// The package.json script that builds the assets, "prod" first as laravel-init.sh does
+static const char *asset_build_script(const char *repo_path)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/package.json", repo_path);
+
+    struct json_object *package = json_object_from_file(path);
+    struct json_object *scripts;
+    const char *script = NULL;
+    if (package && json_object_object_get_ex(package, "scripts", &scripts))
+    {
+        if (json_object_object_get_ex(scripts, "prod", NULL))
+        {
+            script = "prod";
+        }
+        else if (json_object_object_get_ex(scripts, "build", NULL))
+        {
+            script = "build";
+        }
+    }
+    json_object_put(package);
+    return script;
+}
+
+// Write docker/dployer.build.dockerfile for build mode. The "vendor" and "assets" stages copy
+// only the manifests and lockfiles before installing, so their layers stay cached until one
+// of those files changes; the final stage from app.build.dockerfile copies the results in.
+int base_image_write_build_dockerfile(const struct base_image *base, const char *config_source, const char *repo_path,
+                                      const char *docker_dir)
+{
+    char template_path[PATH_MAX];
+    char output_path[PATH_MAX];
+    snprintf(template_path, sizeof(template_path), "%s/%s", config_source, BASE_BUILD_DOCKERFILE);
+    snprintf(output_path, sizeof(output_path), "%s/%s", docker_dir, BASE_BUILD_GENERATED_DOCKERFILE);
+
+    struct output_buffer header;
+    output_buffer_init(&header);
+    output_buffer_appendf(&header, "# Generated by dployer from the lockfiles present at deploy time\n\n");
+
+    // With BuildKit, package downloads go to cache mounts that every repository on the daemon
+    // shares. Yarn 1 breaks when two installs write its cache at once, so that mount is locked.
+    int cache_mounts = docker_buildkit_enabled();
+
+    // PHP dependencies; the autoloader is dumped in the final stage, once the code is there
+    output_buffer_appendf(&header, "FROM %s AS vendor\nWORKDIR /app\n", base->tag);
+    if (repo_file_exists(repo_path, "composer.json"))
+    {
+        output_buffer_appendf(&header, "COPY composer.json %s./\n", repo_file_exists(repo_path, "composer.lock") ? "composer.lock " : "");
+        output_buffer_appendf(&header, "RUN %scomposer install --no-scripts --no-autoloader --prefer-dist --no-interaction --no-progress\n\n",
+                              cache_mounts ? "--mount=type=cache,id=" BUILD_CACHE_COMPOSER_ID ",target=/root/.cache/composer "
+                                             "COMPOSER_CACHE_DIR=/root/.cache/composer "
+                                           : "");
+    }
+    else
+    {
+        output_buffer_appendf(&header, "RUN mkdir -p vendor\n\n");
+    }
+
+    // Node dependencies and the compiled assets; only public/ is kept
+    output_buffer_appendf(&header, "FROM %s AS assets\nWORKDIR /app\n", base->tag);
+    if (repo_file_exists(repo_path, "package.json"))
+    {
+        int yarn = repo_file_exists(repo_path, "yarn.lock");
+        int npm_lock = !yarn && repo_file_exists(repo_path, "package-lock.json");
+        const char *script = asset_build_script(repo_path);
+
+        output_buffer_appendf(&header, "COPY package.json %s./\n", yarn ? "yarn.lock " : npm_lock ? "package-lock.json " : "");
+        const char *mount = !cache_mounts ? ""
+                            : yarn        ? "--mount=type=cache,id=" BUILD_CACHE_YARN_ID ",target=/root/.cache/yarn,sharing=locked "
+                                            "YARN_CACHE_FOLDER=/root/.cache/yarn "
+                                          : "--mount=type=cache,id=" BUILD_CACHE_NPM_ID ",target=/root/.npm ";
+        output_buffer_appendf(&header, "RUN %s%s%s\n", mount,
+                              yarn ? "yarn install --frozen-lockfile --non-interactive" : npm_lock ? "npm ci" : "npm install",
+                              cache_mounts ? " --prefer-offline" : "");
+        if (script)
+        {
+            output_buffer_appendf(&header, "COPY . .\nRUN %s %s\n", yarn ? "yarn" : "npm run", script);
+        }
+    }
+    output_buffer_appendf(&header, "RUN mkdir -p public\n\n");
+
+    output_buffer_appendf(&header, "FROM %s\n", base->tag);
+
+    int status = header.data ? write_generated_dockerfile(header.data, template_path, output_path) : -1;
+    output_buffer_free(&header);
+    return status;
+}
+
+void print_base_images()
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_BASE_IMAGE_LIST);
+
+    log_flush();
+    printf("\n%-55s %-10s %-5s %-10s %-20s %-20s\n", "Tag", "Framework", "PHP", "Node", "Built", "Last used");
+    printf("%-55s %-10s %-5s %-10s %-20s %-20s\n", "-------------------------------------------------------", "----------",
+           "-----", "----------", "--------------------", "--------------------");
+
+    int rows = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        printf("%-55s %-10s %-5s %-10s %-20s %-20s\n",
+               (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1),
+               (const char *)sqlite3_column_text(stmt, 2), (const char *)sqlite3_column_text(stmt, 3),
+               (const char *)sqlite3_column_text(stmt, 4), (const char *)sqlite3_column_text(stmt, 5));
+        rows++;
+    }
+    database_release(stmt);
+
+    if (rows == 0)
+    {
+        printf("No base images built yet.\n");
+    }
+    printf("\n");
+}
\ No newline at end of file
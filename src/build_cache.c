@@ -0,0 +1,338 @@
+#include "build_cache.h"
+#include "docker.h"
+#include "logger.h"
+#include "utils.h"
+#include <ctype.h>
+#include <json-c/json.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUILD_CACHE_MOUNT_TYPE "exec.cachemount"
+
+static int compare_records(const void *left, const void *right)
+{
+    return strcmp(((const struct build_cache_record *)left)->id, ((const struct build_cache_record *)right)->id);
+}
+
+static const char *json_string_field(struct json_object *object, const char *key)
+{
+    struct json_object *value;
+    return json_object_object_get_ex(object, key, &value) && json_object_is_type(value, json_type_string)
+               ? json_object_get_string(value)
+               : "";
+}
+
+static long long json_int_field(struct json_object *object, const char *key)
+{
+    struct json_object *value;
+    return json_object_object_get_ex(object, key, &value) ? json_object_get_int64(value) : 0;
+}
+
+// Cache mounts are described as `cached mount /root/.npm from exec ... with id "/dployer-npm"`
+static void parse_mount_id(const char *description, char *mount_id, size_t size)
+{
+    mount_id[0] = '\0';
+    const char *start = strstr(description, "with id \"");
+    if (!start)
+    {
+        return;
+    }
+    start += strlen("with id \"");
+    while (*start == '/')
+    {
+        start++;
+    }
+
+    const char *end = strchr(start, '"');
+    if (end)
+    {
+        snprintf(mount_id, size, "%.*s", (int)(end - start), start);
+    }
+}
+
+// List the daemon's build cache records. Returns 0 on success and -1 on failure.
+int build_cache_snapshot(struct build_cache_snapshot *snapshot)
+{
+    snapshot->records = NULL;
+    snapshot->count = 0;
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("GET", "/system/df", NULL, NULL, 0, &body);
+    if (status != 200 || !body.data)
+    {
+        docker_log_api_error("Docker disk usage", status, &body);
+        output_buffer_free(&body);
+        return -1;
+    }
+
+    struct json_object *usage = json_tokener_parse(body.data);
+    output_buffer_free(&body);
+    if (!usage)
+    {
+        return -1;
+    }
+
+    // BuildCache is null when the daemon has never run BuildKit
+    struct json_object *records;
+    if (json_object_object_get_ex(usage, "BuildCache", &records) && json_object_is_type(records, json_type_array) &&
+        json_object_array_length(records) > 0)
+    {
+        size_t count = json_object_array_length(records);
+        snapshot->records = calloc(count, sizeof(*snapshot->records));
+        if (!snapshot->records)
+        {
+            json_object_put(usage);
+            return -1;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            struct json_object *item = json_object_array_get_idx(records, i);
+            struct build_cache_record *record = &snapshot->records[snapshot->count++];
+            struct json_object *in_use;
+
+            snprintf(record->id, sizeof(record->id), "%s", json_string_field(item, "ID"));
+            snprintf(record->type, sizeof(record->type), "%s", json_string_field(item, "Type"));
+            record->size = json_int_field(item, "Size");
+            record->usage_count = json_int_field(item, "UsageCount");
+            record->in_use = json_object_object_get_ex(item, "InUse", &in_use) && json_object_get_boolean(in_use);
+            if (strcmp(record->type, BUILD_CACHE_MOUNT_TYPE) == 0)
+            {
+                parse_mount_id(json_string_field(item, "Description"), record->mount_id, sizeof(record->mount_id));
+            }
+        }
+        qsort(snapshot->records, snapshot->count, sizeof(*snapshot->records), compare_records);
+    }
+
+    json_object_put(usage);
+    return 0;
+}
+
+void build_cache_snapshot_free(struct build_cache_snapshot *snapshot)
+{
+    free(snapshot->records);
+    snapshot->records = NULL;
+    snapshot->count = 0;
+}
+
+// A record counts as reused when BuildKit bumped its usage count during the
+// build, so the snapshots must not span another build.
+void build_cache_compare(const struct build_cache_snapshot *before, const struct build_cache_snapshot *after,
+                         struct build_cache_hits *hits)
+{
+    memset(hits, 0, sizeof(*hits));
+
+    for (size_t i = 0; i < after->count; i++)
+    {
+        const struct build_cache_record *current = &after->records[i];
+        const struct build_cache_record *previous = before->count > 0
+                                                        ? bsearch(current, before->records, before->count,
+                                                                  sizeof(*before->records), compare_records)
+                                                        : NULL;
+        if (!previous)
+        {
+            hits->new_bytes += current->size;
+        }
+        else if (current->usage_count > previous->usage_count)
+        {
+            if (strcmp(current->type, BUILD_CACHE_MOUNT_TYPE) == 0)
+            {
+                hits->mount_bytes += previous->size;
+            }
+            else if (strcmp(current->type, "regular") == 0)
+            {
+                hits->layer_bytes += previous->size;
+            }
+        }
+    }
+}
+
+static void format_size(long long bytes, char *text, size_t size)
+{
+    if (bytes >= 1024LL * 1024 * 1024)
+    {
+        snprintf(text, size, "%.1f GiB", (double)bytes / (1024.0 * 1024.0 * 1024.0));
+    }
+    else
+    {
+        snprintf(text, size, "%.1f MiB", (double)bytes / (1024.0 * 1024.0));
+    }
+}
+
+void format_cache_hits(const struct build_cache_hits *hits, char *summary, size_t size)
+{
+    char reused[32];
+    char mounts[32];
+    char added[32];
+    format_size(hits->layer_bytes + hits->mount_bytes, reused, sizeof(reused));
+    format_size(hits->mount_bytes, mounts, sizeof(mounts));
+    format_size(hits->new_bytes, added, sizeof(added));
+
+    snprintf(summary, size, "%s reused (%s from dependency caches), %s new", reused, mounts, added);
+}
+
+// Parse sizes like "512M", "10G" or "10GiB" (powers of 1024); a bare number is in bytes
+int parse_byte_size(const char *text, long long *bytes)
+{
+    char *end;
+    double value = strtod(text, &end);
+    if (end == text || value < 0)
+    {
+        return -1;
+    }
+
+    const char *units = "KMGT";
+    double multiplier = 1;
+    const char *unit = *end != '\0' ? strchr(units, toupper((unsigned char)*end)) : NULL;
+    if (unit)
+    {
+        for (const char *u = units; u <= unit; u++)
+        {
+            multiplier *= 1024;
+        }
+        end++;
+        if (*end == 'i')
+        {
+            end++;
+        }
+    }
+    if (*end == 'B' || *end == 'b')
+    {
+        end++;
+    }
+    if (*end != '\0')
+    {
+        return -1;
+    }
+
+    *bytes = (long long)(value * multiplier);
+    return 0;
+}
+
+// Totals per record type, then the shared dependency caches
+int print_build_cache()
+{
+    struct build_cache_snapshot snapshot;
+    if (build_cache_snapshot(&snapshot) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to read the build cache.");
+        return -1;
+    }
+
+    long long total = 0;
+    long long reclaimable = 0;
+    for (size_t i = 0; i < snapshot.count; i++)
+    {
+        total += snapshot.records[i].size;
+        reclaimable += snapshot.records[i].in_use ? 0 : snapshot.records[i].size;
+    }
+
+    char total_text[32];
+    char reclaimable_text[32];
+    format_size(total, total_text, sizeof(total_text));
+    format_size(reclaimable, reclaimable_text, sizeof(reclaimable_text));
+
+    log_flush();
+    printf("\nBuild cache: %s in %zu records, %s reclaimable\n", total_text, snapshot.count, reclaimable_text);
+
+    printf("\n  %-24s %8s %12s\n", "Type", "Records", "Size");
+    printf("  %-24s %8s %12s\n", "------------------------", "--------", "------------");
+    for (size_t i = 0; i < snapshot.count; i++)
+    {
+        // Print each type once, at its first record
+        size_t earlier = 0;
+        while (earlier < i && strcmp(snapshot.records[earlier].type, snapshot.records[i].type) != 0)
+        {
+            earlier++;
+        }
+        if (earlier < i)
+        {
+            continue;
+        }
+
+        size_t records = 0;
+        long long bytes = 0;
+        for (size_t j = i; j < snapshot.count; j++)
+        {
+            if (strcmp(snapshot.records[j].type, snapshot.records[i].type) == 0)
+            {
+                records++;
+                bytes += snapshot.records[j].size;
+            }
+        }
+
+        char size_text[32];
+        format_size(bytes, size_text, sizeof(size_text));
+        printf("  %-24s %8zu %12s\n", snapshot.records[i].type[0] != '\0' ? snapshot.records[i].type : "(unknown)", records, size_text);
+    }
+
+    const char *const mount_ids[] = {BUILD_CACHE_COMPOSER_ID, BUILD_CACHE_NPM_ID, BUILD_CACHE_YARN_ID, NULL};
+    printf("\n  %-24s %8s %12s\n", "Dependency cache", "Uses", "Size");
+    printf("  %-24s %8s %12s\n", "------------------------", "--------", "------------");
+    for (size_t i = 0; mount_ids[i]; i++)
+    {
+        long long uses = 0;
+        long long bytes = 0;
+        for (size_t j = 0; j < snapshot.count; j++)
+        {
+            if (strcmp(snapshot.records[j].mount_id, mount_ids[i]) == 0)
+            {
+                uses += snapshot.records[j].usage_count;
+                bytes += snapshot.records[j].size;
+            }
+        }
+
+        char size_text[32];
+        format_size(bytes, size_text, sizeof(size_text));
+        printf("  %-24s %8lld %12s\n", mount_ids[i], uses, size_text);
+    }
+    printf("\n");
+
+    build_cache_snapshot_free(&snapshot);
+    return 0;
+}
+
+// Trim the build cache to `keep_bytes`; BuildKit drops the least recently used
+// records first and never touches what a running build holds.
+int collect_build_cache_garbage(long long keep_bytes)
+{
+    char keep_text[32];
+    format_size(keep_bytes, keep_text, sizeof(keep_text));
+
+    char log_msg[128];
+    snprintf(log_msg, sizeof(log_msg), "Trimming the build cache to %s...", keep_text);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+
+    char path[128];
+    snprintf(path, sizeof(path), "/build/prune?keep-storage=%lld", keep_bytes);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("POST", path, NULL, NULL, 0, &body);
+    if (status != 200)
+    {
+        docker_log_api_error("Docker build cache prune", status, &body);
+        output_buffer_free(&body);
+        return -1;
+    }
+
+    long long reclaimed = 0;
+    struct json_object *response = body.data ? json_tokener_parse(body.data) : NULL;
+    struct json_object *value;
+    if (response && json_object_object_get_ex(response, "SpaceReclaimed", &value))
+    {
+        reclaimed = json_object_get_int64(value);
+    }
+    json_object_put(response);
+    output_buffer_free(&body);
+
+    char reclaimed_text[32];
+    format_size(reclaimed, reclaimed_text, sizeof(reclaimed_text));
+    snprintf(log_msg, sizeof(log_msg), "Build cache trimmed; %s reclaimed.", reclaimed_text);
+    log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+    return 0;
+}
\ No newline at end of file
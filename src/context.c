@@ -0,0 +1,758 @@
+#include "context.h"
+#include "docker.h"
+#include "logger.h"
+#include "utils.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_BUFFER_SIZE (64 * 1024)
+
+// Never sent to the daemon, whatever .dockerignore says
+static const char *const default_ignores[] = {".git", NULL};
+
+// Extra defaults for Laravel applications; .dockerignore can re-include them with '!'
+static const char *const laravel_ignores[] = {"storage/logs", "node_modules", NULL};
+
+void ignore_list_init(struct ignore_list *list)
+{
+    list->rules = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    list->has_exceptions = 0;
+}
+
+// Normalize a pattern the way the docker CLI does: strip leading '/', "./"
+// components, duplicate and trailing slashes
+static void clean_pattern(const char *pattern, char *cleaned, size_t size)
+{
+    size_t length = 0;
+
+    while (*pattern && length + 1 < size)
+    {
+        while (*pattern == '/')
+        {
+            pattern++;
+        }
+        if (pattern[0] == '.' && (pattern[1] == '/' || pattern[1] == '\0'))
+        {
+            pattern++;
+            continue;
+        }
+        if (*pattern == '\0')
+        {
+            break;
+        }
+
+        if (length > 0)
+        {
+            cleaned[length++] = '/';
+        }
+        while (*pattern && *pattern != '/' && length + 1 < size)
+        {
+            cleaned[length++] = *pattern++;
+        }
+    }
+
+    cleaned[length] = '\0';
+}
+
+void ignore_list_add(struct ignore_list *list, const char *pattern)
+{
+    int exception = 0;
+    while (isspace((unsigned char)*pattern))
+    {
+        pattern++;
+    }
+    if (*pattern == '!')
+    {
+        exception = 1;
+        pattern++;
+        while (isspace((unsigned char)*pattern))
+        {
+            pattern++;
+        }
+    }
+
+    char cleaned[PATH_MAX];
+    clean_pattern(pattern, cleaned, sizeof(cleaned));
+    if (cleaned[0] == '\0')
+    {
+        return;
+    }
+
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        struct ignore_rule *rules = realloc(list->rules, capacity * sizeof(*rules));
+        if (!rules)
+        {
+            return;
+        }
+        list->rules = rules;
+        list->capacity = capacity;
+    }
+
+    list->rules[list->count].pattern = strdup(cleaned);
+    list->rules[list->count].exception = exception;
+    list->count++;
+    list->has_exceptions |= exception;
+}
+
+// Append the rules from a .dockerignore file. A missing file is not an error.
+int ignore_list_load(struct ignore_list *list, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    char line[PATH_MAX];
+    while (fgets(line, sizeof(line), file))
+    {
+        size_t length = strcspn(line, "\r\n");
+        while (length > 0 && isspace((unsigned char)line[length - 1]))
+        {
+            length--;
+        }
+        line[length] = '\0';
+
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+        ignore_list_add(list, line);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// Match a bracket expression at `pattern` (just past '['); returns the
+// position after ']' or NULL if the character does not match
+static const char *match_class(const char *pattern, char c)
+{
+    int negate = 0;
+    int matched = 0;
+
+    if (*pattern == '^' || *pattern == '!')
+    {
+        negate = 1;
+        pattern++;
+    }
+
+    do
+    {
+        char low = *pattern;
+        if (low == '\\' && pattern[1])
+        {
+            low = *++pattern;
+        }
+        if (low == '\0')
+        {
+            return NULL;
+        }
+
+        char high = low;
+        if (pattern[1] == '-' && pattern[2] && pattern[2] != ']')
+        {
+            high = pattern[2];
+            pattern += 2;
+        }
+        pattern++;
+
+        if (c >= low && c <= high)
+        {
+            matched = 1;
+        }
+    } while (*pattern != ']');
+
+    return matched != negate ? pattern + 1 : NULL;
+}
+
+// Glob match with Go filepath.Match rules plus "**" spanning directories
+static int glob_match(const char *pattern, const char *path)
+{
+    while (*pattern)
+    {
+        if (pattern[0] == '*' && pattern[1] == '*')
+        {
+            while (*pattern == '*')
+            {
+                pattern++;
+            }
+            // "**/" may also match zero directories
+            if (*pattern == '/' && glob_match(pattern + 1, path))
+            {
+                return 1;
+            }
+            for (const char *rest = path; ; rest++)
+            {
+                if (glob_match(pattern, rest))
+                {
+                    return 1;
+                }
+                if (*rest == '\0')
+                {
+                    return 0;
+                }
+            }
+        }
+
+        if (*pattern == '*')
+        {
+            pattern++;
+            for (const char *rest = path; ; rest++)
+            {
+                if (glob_match(pattern, rest))
+                {
+                    return 1;
+                }
+                if (*rest == '\0' || *rest == '/')
+                {
+                    return 0;
+                }
+            }
+        }
+
+        if (*path == '\0')
+        {
+            return 0;
+        }
+
+        if (*pattern == '?')
+        {
+            if (*path == '/')
+            {
+                return 0;
+            }
+            pattern++;
+        }
+        else if (*pattern == '[')
+        {
+            if (*path == '/' || !(pattern = match_class(pattern + 1, *path)))
+            {
+                return 0;
+            }
+        }
+        else
+        {
+            if (*pattern == '\\' && pattern[1])
+            {
+                pattern++;
+            }
+            if (*pattern != *path)
+            {
+                return 0;
+            }
+            pattern++;
+        }
+        path++;
+    }
+
+    return *path == '\0';
+}
+
+// A pattern matches a path or any of its parent directories
+static int rule_matches(const char *pattern, const char *path)
+{
+    if (glob_match(pattern, path))
+    {
+        return 1;
+    }
+
+    char prefix[PATH_MAX];
+    for (const char *slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/'))
+    {
+        snprintf(prefix, sizeof(prefix), "%.*s", (int)(slash - path), path);
+        if (glob_match(pattern, prefix))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// True when `path` (relative to the context root) is excluded
+int ignore_list_matches(const struct ignore_list *list, const char *path)
+{
+    int excluded = 0;
+
+    for (size_t i = 0; i < list->count; i++)
+    {
+        // Only rules that could flip the current verdict need testing
+        if (list->rules[i].exception != excluded)
+        {
+            continue;
+        }
+        if (rule_matches(list->rules[i].pattern, path))
+        {
+            excluded = !list->rules[i].exception;
+        }
+    }
+
+    return excluded;
+}
+
+// True when an exception rule names something inside `directory`, so an
+// excluded directory still has to be walked (same shortcut as the docker CLI)
+static int has_exception_within(const struct ignore_list *list, const char *directory)
+{
+    size_t length = strlen(directory);
+
+    for (size_t i = 0; i < list->count; i++)
+    {
+        const char *pattern = list->rules[i].pattern;
+        if (list->rules[i].exception && strncmp(pattern, directory, length) == 0 && pattern[length] == '/')
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void ignore_list_free(struct ignore_list *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        free(list->rules[i].pattern);
+    }
+    free(list->rules);
+    ignore_list_init(list);
+}
+
+// Set up a context for `directory` with the framework defaults and the
+// repository's .dockerignore. `framework` may be NULL for no filtering at all.
+int build_context_init(struct build_context *context, const char *directory, const char *framework, const char *dockerfile)
+{
+    context->directory = directory;
+    context->dockerfile = dockerfile;
+    ignore_list_init(&context->ignore);
+    memset(&context->stats, 0, sizeof(context->stats));
+
+    if (!framework)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; default_ignores[i]; i++)
+    {
+        ignore_list_add(&context->ignore, default_ignores[i]);
+    }
+    if (strcmp(framework, "laravel") == 0)
+    {
+        for (size_t i = 0; laravel_ignores[i]; i++)
+        {
+            ignore_list_add(&context->ignore, laravel_ignores[i]);
+        }
+    }
+
+    char ignore_path[PATH_MAX];
+    snprintf(ignore_path, sizeof(ignore_path), "%s/.dockerignore", directory);
+    if (ignore_list_load(&context->ignore, ignore_path) != 0)
+    {
+        char error_msg[PATH_MAX + 64];
+        snprintf(error_msg, sizeof(error_msg), "Failed to read %s: %s", ignore_path, strerror(errno));
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        build_context_free(context);
+        return -1;
+    }
+
+    return 0;
+}
+
+void build_context_free(struct build_context *context)
+{
+    ignore_list_free(&context->ignore);
+}
+
+// Buffered tar stream in front of the sink
+struct tar_writer
+{
+    context_sink sink;
+    void *sink_context;
+    char buffer[TAR_BUFFER_SIZE];
+    size_t used;
+    int failed;
+    unsigned long long bytes;
+};
+
+static int tar_flush(struct tar_writer *writer)
+{
+    if (writer->failed)
+    {
+        return -1;
+    }
+    if (writer->used > 0 && writer->sink(writer->buffer, writer->used, writer->sink_context) != 0)
+    {
+        writer->failed = 1;
+        return -1;
+    }
+
+    writer->bytes += writer->used;
+    writer->used = 0;
+    return 0;
+}
+
+static int tar_write(struct tar_writer *writer, const void *data, size_t length)
+{
+    const char *bytes = data;
+
+    while (length > 0)
+    {
+        if (writer->used == sizeof(writer->buffer) && tar_flush(writer) != 0)
+        {
+            return -1;
+        }
+
+        size_t space = sizeof(writer->buffer) - writer->used;
+        size_t take = length < space ? length : space;
+        memcpy(writer->buffer + writer->used, bytes, take);
+        writer->used += take;
+        bytes += take;
+        length -= take;
+    }
+    return writer->failed ? -1 : 0;
+}
+
+// Zero padding up to the next 512 byte block boundary
+static int tar_pad(struct tar_writer *writer, unsigned long long size)
+{
+    static const char zeros[TAR_BLOCK_SIZE];
+    size_t remainder = (size_t)(size % TAR_BLOCK_SIZE);
+    return remainder ? tar_write(writer, zeros, TAR_BLOCK_SIZE - remainder) : 0;
+}
+
+static void tar_octal(char *field, size_t size, unsigned long long value)
+{
+    snprintf(field, size, "%0*llo", (int)(size - 1), value);
+}
+
+// Append one "<length> key=value\n" PAX record
+static void pax_record(struct output_buffer *records, const char *key, const char *value)
+{
+    size_t payload = strlen(key) + strlen(value) + 3; // ' ', '=', '\n'
+    size_t length = payload + 1;
+    char digits[32];
+
+    // The length field counts its own digits
+    while (snprintf(digits, sizeof(digits), "%zu", length), strlen(digits) + payload != length)
+    {
+        length = strlen(digits) + payload;
+    }
+    output_buffer_appendf(records, "%zu %s=%s\n", length, key, value);
+}
+
+static int tar_header(struct tar_writer *writer, const char *name, char type, mode_t mode,
+                      unsigned long long size, time_t mtime, const char *link_target)
+{
+    char header[TAR_BLOCK_SIZE];
+    memset(header, 0, sizeof(header));
+
+    struct output_buffer pax;
+    output_buffer_init(&pax);
+
+    // ustar fits names up to 100 bytes, or 255 when split at a '/' into prefix + name
+    size_t name_length = strlen(name);
+    const char *split = NULL;
+    if (name_length > 100)
+    {
+        for (const char *slash = strchr(name, '/'); slash; slash = strchr(slash + 1, '/'))
+        {
+            if ((size_t)(slash - name) <= 155 && name_length - (size_t)(slash - name) - 1 <= 100 && slash[1])
+            {
+                split = slash;
+                break;
+            }
+        }
+        if (!split)
+        {
+            pax_record(&pax, "path", name);
+        }
+    }
+    if (link_target && strlen(link_target) > 100)
+    {
+        pax_record(&pax, "linkpath", link_target);
+    }
+    if (size > 077777777777ULL)
+    {
+        char size_text[32];
+        snprintf(size_text, sizeof(size_text), "%llu", size);
+        pax_record(&pax, "size", size_text);
+    }
+
+    if (pax.length > 0)
+    {
+        int status = tar_header(writer, "PaxHeader", 'x', 0644, pax.length, mtime, NULL);
+        if (status == 0)
+        {
+            status = tar_write(writer, pax.data, pax.length);
+        }
+        if (status == 0)
+        {
+            status = tar_pad(writer, pax.length);
+        }
+        output_buffer_free(&pax);
+        if (status != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (split)
+    {
+        memcpy(header + 345, name, (size_t)(split - name));
+        memcpy(header, split + 1, name_length - (size_t)(split - name) - 1);
+    }
+    else
+    {
+        memcpy(header, name, name_length < 100 ? name_length : 100);
+    }
+
+    tar_octal(header + 100, 8, mode & 07777);
+    tar_octal(header + 108, 8, 0); // uid, like the docker CLI
+    tar_octal(header + 116, 8, 0); // gid
+    tar_octal(header + 124, 12, size > 077777777777ULL ? 0 : size);
+    tar_octal(header + 136, 12, mtime > 0 ? (unsigned long long)mtime : 0);
+    header[156] = type;
+    if (link_target)
+    {
+        size_t link_length = strlen(link_target);
+        memcpy(header + 157, link_target, link_length < 100 ? link_length : 100);
+    }
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    // Checksum is computed with its own field set to spaces
+    memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (size_t i = 0; i < sizeof(header); i++)
+    {
+        checksum += (unsigned char)header[i];
+    }
+    snprintf(header + 148, 8, "%06o", checksum);
+    header[155] = ' ';
+
+    return tar_write(writer, header, sizeof(header));
+}
+
+// Copy a regular file's data, exactly `size` bytes even if it changes underneath
+static int tar_file_data(struct tar_writer *writer, int fd, unsigned long long size)
+{
+    unsigned long long remaining = size;
+
+    while (remaining > 0)
+    {
+        if (writer->used == sizeof(writer->buffer) && tar_flush(writer) != 0)
+        {
+            return -1;
+        }
+
+        size_t space = sizeof(writer->buffer) - writer->used;
+        size_t want = remaining < space ? (size_t)remaining : space;
+        ssize_t count = read(fd, writer->buffer + writer->used, want);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            // File shrank while packing: keep the declared size with zeros
+            memset(writer->buffer + writer->used, 0, want);
+            count = (ssize_t)want;
+        }
+
+        writer->used += (size_t)count;
+        remaining -= (unsigned long long)count;
+    }
+
+    return tar_pad(writer, size);
+}
+
+// The Dockerfile and .dockerignore are always sent, as are the directories leading to them
+static int is_forced(const struct build_context *context, const char *path)
+{
+    if (strcmp(path, ".dockerignore") == 0 || !context->dockerfile)
+    {
+        return strcmp(path, ".dockerignore") == 0;
+    }
+
+    size_t length = strlen(path);
+    return strncmp(context->dockerfile, path, length) == 0 &&
+           (context->dockerfile[length] == '\0' || context->dockerfile[length] == '/');
+}
+
+static int pack_directory(struct build_context *context, struct tar_writer *writer, const char *path, const char *relative_path)
+{
+    struct dirent **entries;
+    int count = scandir(path, &entries, NULL, alphasort);
+    if (count < 0)
+    {
+        char error_msg[PATH_MAX + 64];
+        snprintf(error_msg, sizeof(error_msg), "Failed to read %s: %s", path, strerror(errno));
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        return -1;
+    }
+
+    int status = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const char *name = entries[i]->d_name;
+        if (status != 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            free(entries[i]);
+            continue;
+        }
+
+        char full_path[PATH_MAX];
+        char entry_path[PATH_MAX];
+        snprintf(full_path, sizeof(full_path), "%s/%s", path, name);
+        if (relative_path[0])
+        {
+            snprintf(entry_path, sizeof(entry_path), "%s/%s", relative_path, name);
+        }
+        else
+        {
+            snprintf(entry_path, sizeof(entry_path), "%s", name);
+        }
+        free(entries[i]);
+
+        struct stat st;
+        if (lstat(full_path, &st) != 0)
+        {
+            continue;
+        }
+
+        int excluded = ignore_list_matches(&context->ignore, entry_path) && !is_forced(context, entry_path);
+
+        if (S_ISDIR(st.st_mode))
+        {
+            if (excluded && !(context->ignore.has_exceptions && has_exception_within(&context->ignore, entry_path)))
+            {
+                context->stats.excluded++;
+                continue;
+            }
+            if (!excluded)
+            {
+                char dir_name[PATH_MAX + 1];
+                snprintf(dir_name, sizeof(dir_name), "%s/", entry_path);
+                status = tar_header(writer, dir_name, '5', st.st_mode, 0, st.st_mtime, NULL);
+                context->stats.directories++;
+            }
+            // An exception rule re-includes something below this excluded directory
+            if (status == 0)
+            {
+                status = pack_directory(context, writer, full_path, entry_path);
+            }
+            continue;
+        }
+
+        if (excluded)
+        {
+            context->stats.excluded++;
+            continue;
+        }
+
+        if (S_ISREG(st.st_mode))
+        {
+            int fd = open(full_path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                char error_msg[PATH_MAX + 64];
+                snprintf(error_msg, sizeof(error_msg), "Failed to open %s: %s", full_path, strerror(errno));
+                log_message(ERROR, ERROR_SYMBOL, error_msg);
+                status = -1;
+                continue;
+            }
+
+            status = tar_header(writer, entry_path, '0', st.st_mode, (unsigned long long)st.st_size, st.st_mtime, NULL);
+            if (status == 0)
+            {
+                status = tar_file_data(writer, fd, (unsigned long long)st.st_size);
+            }
+            close(fd);
+            context->stats.files++;
+        }
+        else if (S_ISLNK(st.st_mode))
+        {
+            char target[PATH_MAX];
+            ssize_t length = readlink(full_path, target, sizeof(target) - 1);
+            if (length < 0)
+            {
+                continue;
+            }
+            target[length] = '\0';
+            status = tar_header(writer, entry_path, '2', st.st_mode, 0, st.st_mtime, target);
+            context->stats.files++;
+        }
+        // Sockets, FIFOs and devices have no place in a build context
+    }
+
+    free(entries);
+    return status;
+}
+
+// Stream the context as an uncompressed tar archive into `sink`
+int build_context_pack(struct build_context *context, context_sink sink, void *sink_context)
+{
+    struct tar_writer *writer = malloc(sizeof(*writer));
+    if (!writer)
+    {
+        return -1;
+    }
+    writer->sink = sink;
+    writer->sink_context = sink_context;
+    writer->used = 0;
+    writer->failed = 0;
+    writer->bytes = 0;
+
+    memset(&context->stats, 0, sizeof(context->stats));
+    double started = monotonic_seconds();
+
+    int status = pack_directory(context, writer, context->directory, "");
+
+    // End of archive: two zero blocks
+    static const char zeros[2 * TAR_BLOCK_SIZE];
+    if (status == 0)
+    {
+        status = tar_write(writer, zeros, sizeof(zeros));
+    }
+    if (status == 0)
+    {
+        status = tar_flush(writer);
+    }
+
+    context->stats.bytes = writer->bytes;
+    context->stats.seconds = monotonic_seconds() - started;
+    free(writer);
+    return status;
+}
+
+static int docker_stream_context_sink(const void *data, size_t length, void *sink_context)
+{
+    return docker_stream_write((struct docker_stream *)sink_context, data, length);
+}
+
+// docker_body_writer that streams a struct build_context into a build request
+int build_context_writer(struct docker_stream *stream, void *context)
+{
+    return build_context_pack((struct build_context *)context, docker_stream_context_sink, stream);
+}
+
+void format_context_stats(const struct context_stats *stats, char *summary, size_t size)
+{
+    double mebibytes = (double)stats->bytes / (1024.0 * 1024.0);
+    double throughput = stats->seconds > 0 ? mebibytes / stats->seconds : 0;
+
+    snprintf(summary, size, "%.1f MiB, %zu files, %zu directories (%zu excluded), packed in %.2fs (%.1f MiB/s)",
+             mebibytes, stats->files, stats->directories, stats->excluded, stats->seconds, throughput);
+}
\ No newline at end of file
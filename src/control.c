@@ -0,0 +1,380 @@
+#include "control.h"
+#include "logger.h"
+#include "utils.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A client has this long to send its command before it is dropped
+#define CONTROL_READ_TIMEOUT_SECONDS 5
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop_signal(int signal_number)
+{
+    stop_requested = 1;
+}
+
+void control_socket_path(char *path, size_t size)
+{
+    const char *configured = getenv("DPLOYER_SOCKET");
+    if (configured && configured[0] != '\0')
+    {
+        snprintf(path, size, "%s", configured);
+        return;
+    }
+
+    const char *home_dir = getenv("HOME");
+    snprintf(path, size, "%s/.config/dployer/%s", home_dir ? home_dir : ".", CONTROL_SOCKET_NAME);
+}
+
+static int fill_socket_address(struct sockaddr_un *address, const char *path)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(address->sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+static int connect_control_socket(const char *path)
+{
+    struct sockaddr_un address;
+    if (fill_socket_address(&address, path) != 0)
+    {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+// Read one newline terminated command. Returns its length or -1.
+static ssize_t read_command(int fd, char *command, size_t size)
+{
+    size_t length = 0;
+
+    while (length + 1 < size)
+    {
+        ssize_t count = read(fd, command + length, 1);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0 || command[length] == '\n')
+        {
+            break;
+        }
+        length++;
+    }
+
+    if (length + 1 >= size)
+    {
+        return -1;
+    }
+
+    command[length] = '\0';
+    return (ssize_t)length;
+}
+
+// Bind the control socket, replacing a stale one left by a crashed daemon
+static int listen_control_socket(const char *path)
+{
+    int existing = connect_control_socket(path);
+    if (existing >= 0)
+    {
+        close(existing);
+        char error_msg[PATH_MAX + 64];
+        snprintf(error_msg, sizeof(error_msg), "A dployer daemon is already listening on %s.", path);
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        return -1;
+    }
+    unlink(path);
+
+    struct sockaddr_un address;
+    if (fill_socket_address(&address, path) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Control socket path is too long.");
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    // Only the owner may drive deployments
+    mode_t old_umask = umask(077);
+    int bound = bind(fd, (struct sockaddr *)&address, sizeof(address));
+    umask(old_umask);
+
+    if (bound != 0 || listen(fd, 16) != 0)
+    {
+        char error_msg[PATH_MAX + 128];
+        snprintf(error_msg, sizeof(error_msg), "Failed to listen on %s: %s", path, strerror(errno));
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Serve commands until SIGINT/SIGTERM or a shutdown command. Commands run
+// one at a time with stdout and stderr redirected to the requesting client.
+// `source` (may be NULL) is serviced between commands.
+int run_control_daemon(control_handler handler, const struct control_event_source *source)
+{
+    char path[PATH_MAX];
+    control_socket_path(path, sizeof(path));
+
+    int listen_fd = listen_control_socket(path);
+    if (listen_fd < 0)
+    {
+        return -1;
+    }
+
+    // A client that goes away mid-command must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction stop_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = handle_stop_signal;
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, NULL);
+    sigaction(SIGTERM, &stop_action, NULL);
+
+    char log_msg[PATH_MAX + 64];
+    snprintf(log_msg, sizeof(log_msg), "Daemon listening on %s", path);
+    log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+
+    int console_stdout = dup(STDOUT_FILENO);
+    int console_stderr = dup(STDERR_FILENO);
+
+    while (!stop_requested)
+    {
+        struct pollfd descriptors[2] = {{listen_fd, POLLIN, 0}, {-1, POLLIN, 0}};
+        int poll_timeout = -1;
+        if (source)
+        {
+            descriptors[1].fd = source->fd(source->context);
+            poll_timeout = source->timeout_ms(source->context);
+        }
+
+        int ready = poll(descriptors, 2, poll_timeout);
+        if (ready < 0 && errno != EINTR)
+        {
+            log_message(ERROR, ERROR_SYMBOL, "Control socket poll failed.");
+            break;
+        }
+        if (stop_requested)
+        {
+            break;
+        }
+
+        if (ready <= 0 || !(descriptors[0].revents & POLLIN))
+        {
+            if (source)
+            {
+                source->run(source->context);
+            }
+            continue;
+        }
+
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd < 0)
+        {
+            if (errno != EINTR)
+            {
+                log_message(WARNING, WARNING_SYMBOL, "Failed to accept a control connection.");
+            }
+            continue;
+        }
+
+        struct timeval timeout = {CONTROL_READ_TIMEOUT_SECONDS, 0};
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        char command[CONTROL_COMMAND_SIZE];
+        char trailer[32];
+        int status;
+        int ran_command = 0;
+        ssize_t command_length = read_command(client_fd, command, sizeof(command));
+
+        if (command_length == 0)
+        {
+            // Liveness probe (e.g. a second daemon checking for this one)
+            close(client_fd);
+            continue;
+        }
+        else if (command_length < 0)
+        {
+            const char *message = "Command too long or not newline terminated.\n";
+            write_all(client_fd, message, strlen(message));
+            status = 2;
+            snprintf(command, sizeof(command), "(invalid)");
+        }
+        else if (strcmp(command, CONTROL_SHUTDOWN_COMMAND) == 0)
+        {
+            stop_requested = 1;
+            status = 0;
+        }
+        else
+        {
+            double started = monotonic_seconds();
+
+            log_flush();
+            fflush(stdout);
+            fflush(stderr);
+            dup2(client_fd, STDOUT_FILENO);
+            dup2(client_fd, STDERR_FILENO);
+
+            status = handler(command);
+
+            log_flush();
+            fflush(stdout);
+            fflush(stderr);
+            dup2(console_stdout, STDOUT_FILENO);
+            dup2(console_stderr, STDERR_FILENO);
+
+            snprintf(log_msg, sizeof(log_msg), "Command '%s' finished with status %d in %.2fs", command, status, monotonic_seconds() - started);
+            log_message(status == 0 ? INFO : WARNING, status == 0 ? INFO_SYMBOL : WARNING_SYMBOL, log_msg);
+            ran_command = 1;
+        }
+
+        int trailer_length = snprintf(trailer, sizeof(trailer), "%c%d\n", CONTROL_STATUS_MARKER, status);
+        write_all(client_fd, trailer, (size_t)trailer_length);
+        close(client_fd);
+
+        // Once the client has its answer, so it does not wait for the source
+        if (ran_command && source && source->command_done)
+        {
+            source->command_done(command, source->context);
+        }
+    }
+
+    close(console_stdout);
+    close(console_stderr);
+    close(listen_fd);
+    unlink(path);
+    log_message(INFO, INFO_SYMBOL, "Daemon stopped.");
+    return 0;
+}
+
+// Send one command to a running daemon and stream its output to stdout.
+// Returns the command's exit status, or -1 (errno set) if no daemon answered.
+int run_control_client(const char *command)
+{
+    char path[PATH_MAX];
+    control_socket_path(path, sizeof(path));
+
+    int fd = connect_control_socket(path);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (write_all(fd, command, strlen(command)) != 0 || write_all(fd, "\n", 1) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    // Everything before the marker is command output, the rest is the status
+    char buffer[4096];
+    char status_text[32];
+    size_t status_length = 0;
+    int seen_marker = 0;
+    ssize_t count;
+
+    while ((count = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        size_t output_length = (size_t)count;
+        if (!seen_marker)
+        {
+            char *marker = memchr(buffer, CONTROL_STATUS_MARKER, (size_t)count);
+            if (marker)
+            {
+                output_length = (size_t)(marker - buffer);
+                seen_marker = 1;
+                size_t rest = (size_t)count - output_length - 1;
+                memcpy(status_text, marker + 1, rest < sizeof(status_text) - 1 ? rest : sizeof(status_text) - 1);
+                status_length = rest < sizeof(status_text) - 1 ? rest : sizeof(status_text) - 1;
+            }
+            fwrite(buffer, 1, output_length, stdout);
+            fflush(stdout);
+        }
+        else
+        {
+            size_t space = sizeof(status_text) - 1 - status_length;
+            size_t take = (size_t)count < space ? (size_t)count : space;
+            memcpy(status_text + status_length, buffer, take);
+            status_length += take;
+        }
+    }
+    close(fd);
+
+    if (!seen_marker)
+    {
+        fprintf(stderr, "Connection to the dployer daemon was lost before the command finished.\n");
+        return 1;
+    }
+
+    status_text[status_length] = '\0';
+    return atoi(status_text);
+}
\ No newline at end of file
@@ -1,10 +1,13 @@
 #include "database.h"
 #include "logger.h"
+#include "utils.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sqlite3.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #if defined(__APPLE__) && defined(__MACH__)
@@ -17,6 +20,198 @@
 
 sqlite3 *db = NULL; // Definition of the global database variable
 
+// The last ?2 runs of the outer row's kind, optionally only those of repository ?1
+#define RECENT_RUNS "SELECT id FROM deploy_runs recent WHERE recent.kind = r.kind AND (?1 IS NULL OR recent.repo_id = ?1) ORDER BY recent.id DESC LIMIT ?2"
+
+static const char *const statement_sql[STMT_COUNT] = {
+    [STMT_BEGIN] = "BEGIN IMMEDIATE;",
+    [STMT_COMMIT] = "COMMIT;",
+    [STMT_ROLLBACK] = "ROLLBACK;",
+    [STMT_SAVEPOINT] = "SAVEPOINT nested;",
+    [STMT_SAVEPOINT_RELEASE] = "RELEASE nested;",
+    [STMT_SAVEPOINT_ROLLBACK] = "ROLLBACK TO nested;",
+    [STMT_REPOSITORY_FIND] = "SELECT id, git_url, destination_folder, branch_name, docker_image_tag, docker_port, "
+                             "fingerprint_commit, fingerprint_tree, fingerprint_config, deploy_mode, health_path, replicas, cpu_limit, memory_limit "
+                             "FROM repositories WHERE id = ?;",
+    [STMT_REPOSITORY_LIST] = "SELECT id, git_url, destination_folder, branch_name, docker_image_tag, docker_port, "
+                             "fingerprint_commit, fingerprint_tree, fingerprint_config, deploy_mode, health_path, replicas, cpu_limit, memory_limit "
+                             "FROM repositories;",
+    [STMT_REPOSITORY_INSERT] = "INSERT INTO repositories (id, git_url, destination_folder, branch_name, docker_image_tag, docker_port) "
+                               "VALUES (?, ?, ?, ?, ?, ?);",
+    [STMT_REPOSITORY_UPDATE_REF] = "UPDATE repositories SET destination_folder = ?, branch_name = ?, docker_image_tag = ? WHERE id = ?;",
+    [STMT_REPOSITORY_UPDATE_FINGERPRINT] = "UPDATE repositories SET fingerprint_commit = ?, fingerprint_tree = ?, fingerprint_config = ? WHERE id = ?;",
+    [STMT_REPOSITORY_UPDATE_MODE] = "UPDATE repositories SET deploy_mode = ? WHERE id = ?;",
+    [STMT_REPOSITORY_UPDATE_HEALTH_PATH] = "UPDATE repositories SET health_path = ? WHERE id = ?;",
+    [STMT_REPOSITORY_UPDATE_SERVICE] = "UPDATE repositories SET docker_port = ?, replicas = ?, cpu_limit = ?, memory_limit = ? WHERE id = ?;",
+    [STMT_REPOSITORY_DELETE] = "DELETE FROM repositories WHERE id = ?;",
+    [STMT_RUN_INSERT] = "INSERT INTO deploy_runs (repo_id, kind, outcome, total_seconds, context_bytes, cache_hit_bytes, finished_at) "
+                        "VALUES (?, ?, ?, ?, ?, ?, datetime(?, 'unixepoch'));",
+    [STMT_RUN_PHASE_INSERT] = "INSERT INTO deploy_run_phases (run_id, position, phase, seconds) VALUES (?, ?, ?, ?);",
+    [STMT_RUN_RECENT_PHASES] = "SELECT r.kind, p.phase, p.seconds FROM deploy_runs r JOIN deploy_run_phases p ON p.run_id = r.id "
+                               "WHERE r.id IN (" RECENT_RUNS ") ORDER BY r.kind, p.position;",
+    [STMT_RUN_RECENT_TOTALS] = "SELECT r.kind, 'total', r.total_seconds FROM deploy_runs r WHERE r.id IN (" RECENT_RUNS ") ORDER BY r.kind;",
+    [STMT_RUN_RECENT_OUTCOMES] = "SELECT outcome, COUNT(*) FROM deploy_runs r WHERE r.kind = ?3 AND r.id IN (" RECENT_RUNS ") "
+                                 "GROUP BY outcome ORDER BY outcome;",
+    [STMT_RUN_HISTORY_CUTOFF] = "SELECT id FROM deploy_runs WHERE repo_id = ? AND kind = ? ORDER BY id DESC LIMIT 1 OFFSET ?;",
+    [STMT_RUN_DURATIONS_FOLDED] = "SELECT 'dployer_deploy_duration_seconds', repo_id, total_seconds FROM deploy_runs "
+                                  "WHERE repo_id = ?1 AND kind = ?2 AND id <= ?3 AND kind = 'deploy' AND outcome != 'failed' "
+                                  "UNION ALL SELECT 'dployer_deploy_phase_duration_seconds', p.phase, p.seconds "
+                                  "FROM deploy_run_phases p JOIN deploy_runs r ON r.id = p.run_id "
+                                  "WHERE r.repo_id = ?1 AND r.kind = ?2 AND r.id <= ?3 AND r.kind = 'deploy' "
+                                  "UNION ALL SELECT 'dployer_git_fetch_duration_seconds', r.repo_id, p.seconds "
+                                  "FROM deploy_run_phases p JOIN deploy_runs r ON r.id = p.run_id "
+                                  "WHERE r.repo_id = ?1 AND r.kind = ?2 AND r.id <= ?3 AND r.kind = 'update' AND p.phase = 'fetch';",
+    [STMT_RUN_DURATION_ADD] = "INSERT INTO run_durations (metric, label, bucket, observations, seconds) VALUES (?, ?, ?, 1, ?) "
+                              "ON CONFLICT (metric, label, bucket) DO UPDATE SET observations = observations + 1, "
+                              "seconds = seconds + excluded.seconds;",
+    [STMT_RUN_TOTALS_FOLD] = "INSERT INTO run_totals (repo_id, kind, outcome, runs, context_bytes, cache_hit_bytes, finished_at) "
+                             "SELECT repo_id, kind, outcome, COUNT(*), TOTAL(context_bytes), TOTAL(cache_hit_bytes), MAX(finished_at) "
+                             "FROM deploy_runs WHERE repo_id = ?1 AND kind = ?2 AND id <= ?3 GROUP BY outcome "
+                             "ON CONFLICT (repo_id, kind, outcome) DO UPDATE SET runs = runs + excluded.runs, "
+                             "context_bytes = context_bytes + excluded.context_bytes, "
+                             "cache_hit_bytes = cache_hit_bytes + excluded.cache_hit_bytes, "
+                             "finished_at = MAX(COALESCE(finished_at, excluded.finished_at), COALESCE(excluded.finished_at, finished_at));",
+    [STMT_RUN_PHASES_TRIM] = "DELETE FROM deploy_run_phases WHERE run_id IN "
+                             "(SELECT id FROM deploy_runs WHERE repo_id = ?1 AND kind = ?2 AND id <= ?3);",
+    [STMT_RUN_TRIM] = "DELETE FROM deploy_runs WHERE repo_id = ?1 AND kind = ?2 AND id <= ?3;",
+    [STMT_BASE_IMAGE_SAVE] = "INSERT OR REPLACE INTO base_images (tag, framework, php_version, node_version, dockerfile_hash, image_id, last_used) "
+                             "VALUES (?, ?, ?, ?, ?, ?, CURRENT_TIMESTAMP);",
+    [STMT_BASE_IMAGE_TOUCH] = "UPDATE base_images SET last_used = CURRENT_TIMESTAMP WHERE tag = ?;",
+    [STMT_BASE_IMAGE_LIST] = "SELECT tag, framework, php_version, node_version, built_at, COALESCE(last_used, built_at) "
+                             "FROM base_images ORDER BY framework, php_version, node_version, built_at DESC;",
+    [STMT_IMAGE_RECORD] = "INSERT OR REPLACE INTO repository_images (repo_id, image_id, tag) VALUES (?, ?, ?);",
+    [STMT_IMAGE_SUPERSEDED] = "SELECT image_id FROM repository_images WHERE repo_id = ? AND removed_at IS NULL "
+                              "ORDER BY built_at DESC, rowid DESC LIMIT -1 OFFSET ?;",
+    [STMT_IMAGE_MARK_REMOVED] = "UPDATE repository_images SET removed_at = CURRENT_TIMESTAMP WHERE repo_id = ? AND image_id = ?;",
+    [STMT_IMAGE_MARK_DEPLOYED] = "UPDATE repository_images SET deployed_at = CURRENT_TIMESTAMP WHERE repo_id = ? AND image_id = ?;",
+    [STMT_IMAGE_PREVIOUS] = "SELECT image_id, tag FROM repository_images WHERE repo_id = ? AND image_id != ? AND deployed_at IS NOT NULL "
+                            "AND removed_at IS NULL ORDER BY deployed_at DESC, rowid DESC LIMIT 1;",
+    [STMT_IMAGE_DEPLOYED] = "SELECT image_id, tag FROM repository_images WHERE repo_id = ? AND deployed_at IS NOT NULL "
+                            "AND removed_at IS NULL ORDER BY deployed_at DESC, rowid DESC LIMIT 1 OFFSET ?;",
+    [STMT_IMAGE_LIST] = "SELECT image_id, COALESCE(tag, '-'), built_at, deployed_at FROM repository_images "
+                        "WHERE repo_id = ? AND removed_at IS NULL ORDER BY deployed_at IS NULL, deployed_at DESC, rowid DESC;",
+    [STMT_MAINTENANCE_AGE] = "SELECT CAST(strftime('%s', 'now') - strftime('%s', last_run) AS INTEGER) FROM maintenance WHERE task = ?;",
+    [STMT_MAINTENANCE_TOUCH] = "INSERT OR REPLACE INTO maintenance (task, last_run) VALUES (?, CURRENT_TIMESTAMP);",
+    [STMT_DEPENDENCY_ADD] = "INSERT OR IGNORE INTO repository_dependencies (repo_id, depends_on) VALUES (?, ?);",
+    [STMT_DEPENDENCY_REMOVE] = "DELETE FROM repository_dependencies WHERE repo_id = ? AND depends_on = ?;",
+    [STMT_DEPENDENCY_LIST] = "SELECT repo_id, depends_on FROM repository_dependencies ORDER BY repo_id, depends_on;",
+    [STMT_DEPENDENCY_DELETE_REPOSITORY] = "DELETE FROM repository_dependencies WHERE repo_id = ?1 OR depends_on = ?1;",
+    [STMT_METRICS_REPOSITORY_INFO] = "SELECT id, branch_name, docker_image_tag, 1 FROM repositories ORDER BY id;",
+    [STMT_METRICS_DEPLOYS] = "SELECT repo_id, outcome, SUM(runs) FROM (SELECT repo_id, outcome, COUNT(*) AS runs FROM deploy_runs "
+                             "WHERE kind = 'deploy' GROUP BY repo_id, outcome UNION ALL SELECT repo_id, outcome, runs FROM run_totals "
+                             "WHERE kind = 'deploy') GROUP BY repo_id, outcome ORDER BY repo_id, outcome;",
+    [STMT_METRICS_UPDATES] = "SELECT repo_id, outcome, SUM(runs) FROM (SELECT repo_id, outcome, COUNT(*) AS runs FROM deploy_runs "
+                             "WHERE kind = 'update' GROUP BY repo_id, outcome UNION ALL SELECT repo_id, outcome, runs FROM run_totals "
+                             "WHERE kind = 'update') GROUP BY repo_id, outcome ORDER BY repo_id, outcome;",
+    [STMT_METRICS_FAILURES] = "SELECT r.id, k.kind, (SELECT COUNT(*) FROM deploy_runs d WHERE d.repo_id = r.id "
+                              "AND d.kind = k.kind AND d.outcome = 'failed') + COALESCE((SELECT runs FROM run_totals t "
+                              "WHERE t.repo_id = r.id AND t.kind = k.kind AND t.outcome = 'failed'), 0) "
+                              "FROM repositories r CROSS JOIN (SELECT 'deploy' AS kind UNION ALL SELECT 'update') k "
+                              "ORDER BY r.id, k.kind;",
+    [STMT_METRICS_DEPLOY_DURATIONS] = "SELECT repo_id, 1, total_seconds, total_seconds FROM deploy_runs WHERE kind = 'deploy' "
+                                      "AND outcome != 'failed' UNION ALL SELECT label, observations, seconds, bucket FROM run_durations "
+                                      "WHERE metric = 'dployer_deploy_duration_seconds' ORDER BY 1;",
+    [STMT_METRICS_PHASE_DURATIONS] = "SELECT p.phase, 1, p.seconds, p.seconds FROM deploy_run_phases p JOIN deploy_runs r ON r.id = p.run_id "
+                                     "WHERE r.kind = 'deploy' UNION ALL SELECT label, observations, seconds, bucket FROM run_durations "
+                                     "WHERE metric = 'dployer_deploy_phase_duration_seconds' ORDER BY 1;",
+    [STMT_METRICS_FETCH_DURATIONS] = "SELECT r.repo_id, 1, p.seconds, p.seconds FROM deploy_run_phases p JOIN deploy_runs r ON r.id = p.run_id "
+                                     "WHERE r.kind = 'update' AND p.phase = 'fetch' UNION ALL SELECT label, observations, seconds, bucket "
+                                     "FROM run_durations WHERE metric = 'dployer_git_fetch_duration_seconds' ORDER BY 1;",
+    [STMT_METRICS_CONTEXT_BYTES_TOTAL] = "SELECT repo_id, SUM(bytes) FROM (SELECT repo_id, context_bytes AS bytes FROM deploy_runs "
+                                         "WHERE kind = 'deploy' AND context_bytes IS NOT NULL UNION ALL SELECT repo_id, context_bytes "
+                                         "FROM run_totals WHERE kind = 'deploy' AND context_bytes > 0) GROUP BY repo_id ORDER BY repo_id;",
+    [STMT_METRICS_CONTEXT_BYTES] = "SELECT repo_id, context_bytes FROM deploy_runs d WHERE id = (SELECT MAX(id) FROM deploy_runs "
+                                   "WHERE repo_id = d.repo_id AND kind = 'deploy' AND context_bytes IS NOT NULL) ORDER BY repo_id;",
+    [STMT_METRICS_CACHE_HIT_BYTES_TOTAL] = "SELECT repo_id, SUM(bytes) FROM (SELECT repo_id, cache_hit_bytes AS bytes FROM deploy_runs "
+                                           "WHERE kind = 'deploy' AND cache_hit_bytes IS NOT NULL UNION ALL SELECT repo_id, cache_hit_bytes "
+                                           "FROM run_totals WHERE kind = 'deploy' AND cache_hit_bytes > 0) GROUP BY repo_id ORDER BY repo_id;",
+    [STMT_METRICS_LAST_SUCCESS] = "SELECT repo_id, CAST(strftime('%s', MAX(finished_at)) AS INTEGER) FROM (SELECT repo_id, finished_at "
+                                  "FROM deploy_runs WHERE kind = 'deploy' AND outcome = 'ok' UNION ALL SELECT repo_id, finished_at "
+                                  "FROM run_totals WHERE kind = 'deploy' AND outcome = 'ok') GROUP BY repo_id ORDER BY repo_id;",
+    [STMT_METRICS_LAST_SUCCESS_AGE] = "SELECT repo_id, CAST(strftime('%s', 'now') AS INTEGER) - CAST(strftime('%s', MAX(finished_at)) AS INTEGER) "
+                                      "FROM (SELECT repo_id, finished_at FROM deploy_runs WHERE kind = 'deploy' AND outcome = 'ok' "
+                                      "UNION ALL SELECT repo_id, finished_at FROM run_totals WHERE kind = 'deploy' AND outcome = 'ok') "
+                                      "GROUP BY repo_id ORDER BY repo_id;",
+};
+
+static sqlite3_stmt *statements[STMT_COUNT];
+
+// Nesting depth of database_begin() calls, and the state of the outermost transaction
+static int transaction_depth = 0;
+static int transaction_open = 0;
+static int transaction_failed = 0;
+
+// Switch the connection to WAL with NORMAL syncs. Returns 0 when WAL is in effect.
+static int configure_journal()
+{
+    sqlite3_stmt *stmt;
+    int wal = 0;
+
+    if (sqlite3_prepare_v2(db, "PRAGMA journal_mode = WAL;", -1, &stmt, 0) != SQLITE_OK)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const char *mode = (const char *)sqlite3_column_text(stmt, 0);
+        wal = mode && strcmp(mode, "wal") == 0;
+    }
+    sqlite3_finalize(stmt);
+
+    // In WAL mode NORMAL never corrupts the file; a power loss can only drop the latest commits
+    if (!wal || execute_query("PRAGMA synchronous = NORMAL;") != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Open `db_path`, switch it to WAL and bring the schema up to date. Exits on failure.
+static void open_database_file(const char *db_path)
+{
+    // Open the SQLite database
+    if (sqlite3_open(db_path, &db) != SQLITE_OK)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Can't open database.");
+        fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db));
+        exit(1);
+    }
+
+    // Other dployer processes may hold the write lock; wait for it instead of failing with SQLITE_BUSY
+    int busy_timeout = DATABASE_BUSY_TIMEOUT_MS;
+    const char *timeout_env = getenv(DATABASE_BUSY_TIMEOUT_ENV);
+    if (timeout_env && atoi(timeout_env) > 0)
+    {
+        busy_timeout = atoi(timeout_env);
+    }
+    sqlite3_busy_timeout(db, busy_timeout);
+
+    // WAL lets readers run alongside the single writer; it persists in the file once set
+    if (configure_journal() != 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "WAL journal unavailable; concurrent dployer processes will serialize on the database.");
+    }
+
+    // Initialize the database
+    if (initialize_database() != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to initialize the database schema.");
+        exit(1);
+    }
+
+    // Prepare every statement up front; a failure here means the schema is unusable
+    for (int i = 0; i < STMT_COUNT; i++)
+    {
+        if (sqlite3_prepare_v3(db, statement_sql[i], -1, SQLITE_PREPARE_PERSISTENT, &statements[i], NULL) != SQLITE_OK)
+        {
+            log_message(ERROR, ERROR_SYMBOL, "Failed to prepare database statements.");
+            fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+            exit(1);
+        }
+    }
+}
+
 void open_database(const char *db_name)
 {
     // Get the HOME environment variable
@@ -39,7 +234,8 @@ void open_database(const char *db_name)
     struct stat st = {0};
     if (stat(config_dir, &st) == -1)
     {
-        if (mkdir(config_dir, 0700) != 0)
+        // Another dployer process may create it first
+        if (mkdir(config_dir, 0700) != 0 && errno != EEXIST)
         {
             perror("mkdir");
             log_message(ERROR, ERROR_SYMBOL, "Failed to create configuration directory.");
@@ -55,35 +251,309 @@ void open_database(const char *db_name)
         exit(1);
     }
 
-    // Open the SQLite database
-    if (sqlite3_open(db_path, &db) != SQLITE_OK)
+    open_database_file(db_path);
+}
+
+static int schema_version()
+{
+    sqlite3_stmt *stmt;
+    int version = -1;
+
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, 0) != SQLITE_OK)
     {
-        log_message(ERROR, ERROR_SYMBOL, "Can't open database.");
-        fprintf(stderr, "Error: %s\n", sqlite3_errmsg(db));
-        exit(1);
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        version = sqlite3_column_int(stmt, 0);
     }
+    sqlite3_finalize(stmt);
+    return version;
+}
 
-    // Initialize the database
-    initialize_database();
+// Schema migrations. Databases created before versioning report user_version 0 but may
+// already have some of these objects, so every step must be safe to run again.
+static int migrate_repositories()
+{
+    return execute_query("CREATE TABLE IF NOT EXISTS repositories ("
+                         "id TEXT PRIMARY KEY,"
+                         "git_url TEXT NOT NULL,"
+                         "destination_folder TEXT NOT NULL,"
+                         "branch_name TEXT NOT NULL,"
+                         "docker_image_tag TEXT NOT NULL,"
+                         "docker_port TEXT NOT NULL,"
+                         "last_updated DATETIME DEFAULT CURRENT_TIMESTAMP"
+                         ");");
 }
 
-void initialize_database()
+// Fingerprint of the source tree behind the last successful deploy
+static int migrate_fingerprints()
 {
-    const char *sql = "CREATE TABLE IF NOT EXISTS repositories ("
-                      "id TEXT PRIMARY KEY,"
-                      "git_url TEXT NOT NULL,"
-                      "destination_folder TEXT NOT NULL,"
-                      "branch_name TEXT NOT NULL,"
-                      "docker_image_tag TEXT NOT NULL,"
-                      "docker_port TEXT NOT NULL,"
-                      "last_updated DATETIME DEFAULT CURRENT_TIMESTAMP"
-                      ");";
+    if (ensure_column("repositories", "fingerprint_commit", "TEXT") != 0 ||
+        ensure_column("repositories", "fingerprint_tree", "TEXT") != 0 ||
+        ensure_column("repositories", "fingerprint_config", "TEXT") != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
 
-    execute_query(sql);
+// Timed history of deploy and update runs, one row per phase in deploy_run_phases
+static int migrate_deploy_runs()
+{
+    if (execute_query("CREATE TABLE IF NOT EXISTS deploy_runs ("
+                      "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                      "repo_id TEXT NOT NULL,"
+                      "kind TEXT NOT NULL,"
+                      "outcome TEXT NOT NULL,"
+                      "total_seconds REAL NOT NULL,"
+                      "started_at DATETIME DEFAULT CURRENT_TIMESTAMP"
+                      ");") != 0 ||
+        execute_query("CREATE TABLE IF NOT EXISTS deploy_run_phases ("
+                      "run_id INTEGER NOT NULL REFERENCES deploy_runs(id) ON DELETE CASCADE,"
+                      "position INTEGER NOT NULL,"
+                      "phase TEXT NOT NULL,"
+                      "seconds REAL NOT NULL,"
+                      "PRIMARY KEY (run_id, position)"
+                      ");") != 0 ||
+        execute_query("CREATE INDEX IF NOT EXISTS deploy_runs_repo_kind ON deploy_runs (repo_id, kind, id);") != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int migrate_context_bytes()
+{
+    return ensure_column("deploy_runs", "context_bytes", "INTEGER");
+}
+
+// Shared base images, one per framework, PHP and Node version and base Dockerfile hash
+static int migrate_base_images()
+{
+    return execute_query("CREATE TABLE IF NOT EXISTS base_images ("
+                         "tag TEXT PRIMARY KEY,"
+                         "framework TEXT NOT NULL,"
+                         "php_version TEXT NOT NULL,"
+                         "node_version TEXT NOT NULL,"
+                         "dockerfile_hash TEXT NOT NULL,"
+                         "image_id TEXT,"
+                         "built_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
+                         "last_used DATETIME"
+                         ");");
+}
+
+// How the image is built: "build" bakes dependencies in, "entrypoint" installs them at startup
+static int migrate_deploy_mode()
+{
+    return ensure_column("repositories", "deploy_mode", "TEXT");
+}
+
+// Bytes of BuildKit cache a deploy's build reused, NULL when it was not measured
+static int migrate_cache_hit_bytes()
+{
+    return ensure_column("deploy_runs", "cache_hit_bytes", "INTEGER");
+}
+
+// Images dployer built per repository, so it can remove its own superseded ones,
+// and when daemon-wide maintenance such as the global prune last ran
+static int migrate_repository_images()
+{
+    if (execute_query("CREATE TABLE IF NOT EXISTS repository_images ("
+                      "repo_id TEXT NOT NULL,"
+                      "image_id TEXT NOT NULL,"
+                      "tag TEXT,"
+                      "built_at DATETIME DEFAULT CURRENT_TIMESTAMP,"
+                      "removed_at DATETIME,"
+                      "PRIMARY KEY (repo_id, image_id)"
+                      ");") != 0)
+    {
+        return -1;
+    }
+    return execute_query("CREATE TABLE IF NOT EXISTS maintenance ("
+                         "task TEXT PRIMARY KEY,"
+                         "last_run DATETIME NOT NULL"
+                         ");");
+}
+
+// Health-gated deploys: the probe path per repository, and which images deployed
+// successfully so a failed one can be rolled back. Images recorded before this
+// step were deployed by the build that recorded them.
+static int migrate_health_checks()
+{
+    if (ensure_column("repositories", "health_path", "TEXT") != 0 ||
+        ensure_column("repository_images", "deployed_at", "DATETIME") != 0)
+    {
+        return -1;
+    }
+    return execute_query("UPDATE repository_images SET deployed_at = built_at WHERE deployed_at IS NULL;");
+}
+
+// Images are tagged per commit from here on. Earlier rows hold the repository's
+// moving tag, which newer builds took over, so it no longer names their image.
+static int migrate_commit_tags()
+{
+    return execute_query("UPDATE repository_images SET tag = NULL;");
+}
+
+// Repositories that must deploy before another one, for dependency-ordered fleet deploys
+static int migrate_dependencies()
+{
+    return execute_query("CREATE TABLE IF NOT EXISTS repository_dependencies ("
+                         "repo_id TEXT NOT NULL,"
+                         "depends_on TEXT NOT NULL,"
+                         "PRIMARY KEY (repo_id, depends_on)"
+                         ");");
+}
+
+// Service settings declared in fleet manifests; NULL leaves them to Docker's defaults
+static int migrate_service_settings()
+{
+    if (ensure_column("repositories", "replicas", "INTEGER") != 0 ||
+        ensure_column("repositories", "cpu_limit", "REAL") != 0 ||
+        ensure_column("repositories", "memory_limit", "INTEGER") != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// When each run finished, and the totals of runs trimmed from deploy_runs so that the
+// metrics counters and histograms keep counting them
+static int migrate_run_rollups()
+{
+    if (ensure_column("deploy_runs", "finished_at", "DATETIME") != 0 ||
+        // Earlier rows were inserted when their run was recorded, right after it ended
+        execute_query("UPDATE deploy_runs SET finished_at = started_at WHERE finished_at IS NULL;") != 0 ||
+        execute_query("CREATE TABLE IF NOT EXISTS run_totals ("
+                      "repo_id TEXT NOT NULL,"
+                      "kind TEXT NOT NULL,"
+                      "outcome TEXT NOT NULL,"
+                      "runs INTEGER NOT NULL,"
+                      "context_bytes INTEGER NOT NULL DEFAULT 0,"
+                      "cache_hit_bytes INTEGER NOT NULL DEFAULT 0,"
+                      "finished_at DATETIME,"
+                      "PRIMARY KEY (repo_id, kind, outcome)"
+                      ");") != 0 ||
+        execute_query("CREATE TABLE IF NOT EXISTS run_durations ("
+                      "metric TEXT NOT NULL,"
+                      "label TEXT NOT NULL,"
+                      "bucket REAL NOT NULL,"
+                      "observations INTEGER NOT NULL,"
+                      "seconds REAL NOT NULL,"
+                      "PRIMARY KEY (metric, label, bucket)"
+                      ");") != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Append new steps at the end; user_version is the number of steps applied
+static int (*const migrations[])() = {
+    migrate_repositories,
+    migrate_fingerprints,
+    migrate_deploy_runs,
+    migrate_context_bytes,
+    migrate_base_images,
+    migrate_deploy_mode,
+    migrate_cache_hit_bytes,
+    migrate_repository_images,
+    migrate_health_checks,
+    migrate_commit_tags,
+    migrate_dependencies,
+    migrate_service_settings,
+    migrate_run_rollups,
+};
+
+#define SCHEMA_VERSION ((int)(sizeof(migrations) / sizeof(migrations[0])))
+
+int initialize_database()
+{
+    // Up to date: no need to take the write lock
+    int version = schema_version();
+    if (version == SCHEMA_VERSION)
+    {
+        return 0;
+    }
+
+    // Migrate under the write lock and re-read the version, since another process may have just done it
+    if (execute_query("BEGIN IMMEDIATE;") != 0)
+    {
+        return -1;
+    }
+
+    version = schema_version();
+    if (version > SCHEMA_VERSION)
+    {
+        char error_msg[128];
+        snprintf(error_msg, sizeof(error_msg), "Database schema version %d is newer than this dployer supports (%d).", version, SCHEMA_VERSION);
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        execute_query("ROLLBACK;");
+        return -1;
+    }
+
+    for (; version >= 0 && version < SCHEMA_VERSION; version++)
+    {
+        if (migrations[version]() != 0)
+        {
+            execute_query("ROLLBACK;");
+            return -1;
+        }
+    }
+
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA user_version = %d;", SCHEMA_VERSION);
+    if (version < 0 || execute_query(sql) != 0 || execute_query("COMMIT;") != 0)
+    {
+        execute_query("ROLLBACK;");
+        return -1;
+    }
+    return 0;
+}
+
+// Add a column to an existing table unless it is already there
+int ensure_column(const char *table, const char *column, const char *definition)
+{
+    char sql[512];
+    sqlite3_stmt *stmt;
+
+    snprintf(sql, sizeof(sql), "PRAGMA table_info(%s);", table);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to inspect database schema.");
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+
+    int exists = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        if (strcmp((const char *)sqlite3_column_text(stmt, 1), column) == 0)
+        {
+            exists = 1;
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    if (!exists)
+    {
+        snprintf(sql, sizeof(sql), "ALTER TABLE %s ADD COLUMN %s %s;", table, column, definition);
+        return execute_query(sql);
+    }
+    return 0;
 }
 
 void close_database()
 {
+    for (int i = 0; i < STMT_COUNT; i++)
+    {
+        sqlite3_finalize(statements[i]);
+        statements[i] = NULL;
+    }
+
     if (sqlite3_close(db) != SQLITE_OK)
     {
         log_message(ERROR, ERROR_SYMBOL, "Can't close database.");
@@ -92,7 +562,8 @@ void close_database()
     }
 }
 
-void execute_query(const char *sql)
+// Run one or more statements that return no rows. Returns 0 on success and -1 on failure.
+int execute_query(const char *sql)
 {
     char *err_msg = NULL;
     if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK)
@@ -100,6 +571,916 @@ void execute_query(const char *sql)
         log_message(ERROR, ERROR_SYMBOL, "SQL error occurred.");
         fprintf(stderr, "SQL error: %s\n", err_msg);
         sqlite3_free(err_msg);
-        exit(1);
+        return -1;
+    }
+    return 0;
+}
+
+sqlite3_stmt *database_acquire(enum database_statement statement)
+{
+    // Workers share the connection: the mutex keeps bind/step/reset of one use together
+    sqlite3_mutex_enter(sqlite3_db_mutex(db));
+    return statements[statement];
+}
+
+void database_release(sqlite3_stmt *stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    sqlite3_mutex_leave(sqlite3_db_mutex(db));
+}
+
+// Step a statement that returns no rows and release it
+static int step_and_release(sqlite3_stmt *stmt)
+{
+    int status = 0;
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        status = -1;
+    }
+    database_release(stmt);
+    return status;
+}
+
+int database_begin()
+{
+    int status = 0;
+    sqlite3_mutex_enter(sqlite3_db_mutex(db));
+
+    if (transaction_depth++ == 0)
+    {
+        transaction_failed = 0;
+        transaction_open = step_and_release(database_acquire(STMT_BEGIN)) == 0;
+        status = transaction_open ? 0 : -1;
+    }
+
+    sqlite3_mutex_leave(sqlite3_db_mutex(db));
+    return status;
+}
+
+// Close one level; the outermost level commits, or rolls back if any level failed
+static int end_transaction(int failed)
+{
+    int status = 0;
+    sqlite3_mutex_enter(sqlite3_db_mutex(db));
+
+    if (failed)
+    {
+        transaction_failed = 1;
+    }
+
+    if (transaction_depth > 0 && --transaction_depth == 0 && transaction_open)
+    {
+        transaction_open = 0;
+        if (!transaction_failed && step_and_release(database_acquire(STMT_COMMIT)) == 0)
+        {
+            status = 0;
+        }
+        else
+        {
+            // A failed COMMIT leaves the transaction open; never leave it dangling
+            step_and_release(database_acquire(STMT_ROLLBACK));
+            status = -1;
+        }
+    }
+
+    sqlite3_mutex_leave(sqlite3_db_mutex(db));
+    return status;
+}
+
+int database_commit()
+{
+    return end_transaction(0);
+}
+
+int database_rollback()
+{
+    return end_transaction(1);
+}
+
+int database_savepoint()
+{
+    return step_and_release(database_acquire(STMT_SAVEPOINT));
+}
+
+// ROLLBACK TO keeps the savepoint open, so it is released either way
+int database_savepoint_end(int failed)
+{
+    int status = failed ? step_and_release(database_acquire(STMT_SAVEPOINT_ROLLBACK)) : 0;
+    return step_and_release(database_acquire(STMT_SAVEPOINT_RELEASE)) == 0 ? status : -1;
+}
+
+// Copy a nullable text column; sets *failed when the copy itself fails
+static char *column_copy(sqlite3_stmt *stmt, int column, int *failed)
+{
+    const char *value = (const char *)sqlite3_column_text(stmt, column);
+    if (!value)
+    {
+        return NULL;
+    }
+
+    char *copy = strdup(value);
+    if (!copy)
+    {
+        *failed = 1;
+    }
+    return copy;
+}
+
+// Copy the current row of a FIND or LIST statement into `repository`
+static int read_repository_row(sqlite3_stmt *stmt, struct repository *repository)
+{
+    int failed = 0;
+    repository->id = column_copy(stmt, 0, &failed);
+    repository->git_url = column_copy(stmt, 1, &failed);
+    repository->destination_folder = column_copy(stmt, 2, &failed);
+    repository->branch_name = column_copy(stmt, 3, &failed);
+    repository->docker_image_tag = column_copy(stmt, 4, &failed);
+    repository->docker_port = column_copy(stmt, 5, &failed);
+    repository->fingerprint_commit = column_copy(stmt, 6, &failed);
+    repository->fingerprint_tree = column_copy(stmt, 7, &failed);
+    repository->fingerprint_config = column_copy(stmt, 8, &failed);
+    repository->deploy_mode = column_copy(stmt, 9, &failed);
+    repository->health_path = column_copy(stmt, 10, &failed);
+    repository->replicas = sqlite3_column_int(stmt, 11);
+    repository->cpu_limit = sqlite3_column_double(stmt, 12);
+    repository->memory_limit = sqlite3_column_int64(stmt, 13);
+
+    if (failed)
+    {
+        repository_free(repository);
+        return -1;
+    }
+    return 0;
+}
+
+int repository_find(const char *id, struct repository *repository)
+{
+    memset(repository, 0, sizeof(*repository));
+
+    sqlite3_stmt *stmt = database_acquire(STMT_REPOSITORY_FIND);
+    sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
+
+    int status;
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+    {
+        status = read_repository_row(stmt, repository);
+    }
+    else if (rc == SQLITE_DONE)
+    {
+        status = 1;
+    }
+    else
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        status = -1;
+    }
+
+    database_release(stmt);
+    return status;
+}
+
+int repository_list_all(struct repository_list *list)
+{
+    list->items = NULL;
+    list->count = 0;
+
+    sqlite3_stmt *stmt = database_acquire(STMT_REPOSITORY_LIST);
+    size_t capacity = 0;
+    int status = 0;
+    int rc;
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        if (list->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            struct repository *items = realloc(list->items, capacity * sizeof(*items));
+            if (!items)
+            {
+                status = -1;
+                break;
+            }
+            list->items = items;
+        }
+
+        if (read_repository_row(stmt, &list->items[list->count]) != 0)
+        {
+            status = -1;
+            break;
+        }
+        list->count++;
+    }
+
+    if (status == 0 && rc != SQLITE_DONE)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        status = -1;
+    }
+
+    database_release(stmt);
+
+    if (status != 0)
+    {
+        repository_list_free(list);
+    }
+    return status;
+}
+
+int repository_insert(const struct repository *repository)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_REPOSITORY_INSERT);
+    sqlite3_bind_text(stmt, 1, repository->id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, repository->git_url, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, repository->destination_folder, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, repository->branch_name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 5, repository->docker_image_tag, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 6, repository->docker_port, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int repository_update_ref(const char *id, const char *destination_folder, const char *branch_name, const char *docker_image_tag)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_REPOSITORY_UPDATE_REF);
+    sqlite3_bind_text(stmt, 1, destination_folder, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, branch_name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, docker_image_tag, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, id, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int repository_update_fingerprint(const char *id, const char *commit, const char *tree, const char *config)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_REPOSITORY_UPDATE_FINGERPRINT);
+    sqlite3_bind_text(stmt, 1, commit, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, tree, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, config, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, id, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int repository_update_mode(const char *id, const char *deploy_mode)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_REPOSITORY_UPDATE_MODE);
+    sqlite3_bind_text(stmt, 1, deploy_mode, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, id, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int repository_update_health_path(const char *id, const char *health_path)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_REPOSITORY_UPDATE_HEALTH_PATH);
+    sqlite3_bind_text(stmt, 1, health_path, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, id, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+// Zero replicas and limits are stored as NULL: not managed by dployer
+int repository_update_service(const char *id, const char *docker_port, int replicas, double cpu_limit, long long memory_limit)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_REPOSITORY_UPDATE_SERVICE);
+    sqlite3_bind_text(stmt, 1, docker_port, -1, SQLITE_STATIC);
+    if (replicas > 0)
+    {
+        sqlite3_bind_int(stmt, 2, replicas);
+    }
+    if (cpu_limit > 0)
+    {
+        sqlite3_bind_double(stmt, 3, cpu_limit);
+    }
+    if (memory_limit > 0)
+    {
+        sqlite3_bind_int64(stmt, 4, memory_limit);
+    }
+    sqlite3_bind_text(stmt, 5, id, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int repository_delete(const char *id)
+{
+    database_begin();
+
+    sqlite3_stmt *stmt = database_acquire(STMT_REPOSITORY_DELETE);
+    sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
+
+    int status = -1;
+    if (sqlite3_step(stmt) == SQLITE_DONE)
+    {
+        status = sqlite3_changes(db) > 0 ? 0 : 1;
+    }
+    else
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    }
+    database_release(stmt);
+
+    // Repositories that depended on this one no longer wait for it
+    if (status == 0)
+    {
+        stmt = database_acquire(STMT_DEPENDENCY_DELETE_REPOSITORY);
+        sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
+        status = step_and_release(stmt);
+    }
+
+    if ((status < 0 ? database_rollback() : database_commit()) != 0)
+    {
+        status = -1;
+    }
+    return status;
+}
+
+int base_image_save(const char *tag, const char *framework, const char *php_version, const char *node_version,
+                    const char *dockerfile_hash, const char *image_id)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_BASE_IMAGE_SAVE);
+    sqlite3_bind_text(stmt, 1, tag, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, framework, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, php_version, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, node_version, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 5, dockerfile_hash, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 6, image_id && image_id[0] ? image_id : NULL, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int base_image_touch(const char *tag)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_BASE_IMAGE_TOUCH);
+    sqlite3_bind_text(stmt, 1, tag, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int repository_image_record(const char *repo_id, const char *image_id, const char *tag)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_IMAGE_RECORD);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, image_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, tag, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int repository_image_list_superseded(const char *repo_id, int keep, struct image_id_list *list)
+{
+    list->items = NULL;
+    list->count = 0;
+
+    sqlite3_stmt *stmt = database_acquire(STMT_IMAGE_SUPERSEDED);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, keep);
+
+    size_t capacity = 0;
+    int status = 0;
+    int rc;
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        if (list->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 8;
+            char **items = realloc(list->items, capacity * sizeof(*items));
+            if (!items)
+            {
+                status = -1;
+                break;
+            }
+            list->items = items;
+        }
+
+        list->items[list->count] = strdup((const char *)sqlite3_column_text(stmt, 0));
+        if (!list->items[list->count])
+        {
+            status = -1;
+            break;
+        }
+        list->count++;
+    }
+
+    if (status == 0 && rc != SQLITE_DONE)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        status = -1;
+    }
+
+    database_release(stmt);
+
+    if (status != 0)
+    {
+        image_id_list_free(list);
+    }
+    return status;
+}
+
+int repository_image_mark_removed(const char *repo_id, const char *image_id)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_IMAGE_MARK_REMOVED);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, image_id, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int repository_image_mark_deployed(const char *repo_id, const char *image_id)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_IMAGE_MARK_DEPLOYED);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, image_id, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+// Copy an image row's ID and tag (empty when unknown) out of a statement
+static void read_image_row(sqlite3_stmt *stmt, char *image_id, size_t id_size, char *tag, size_t tag_size)
+{
+    const char *stored_tag = (const char *)sqlite3_column_text(stmt, 1);
+    snprintf(image_id, id_size, "%s", (const char *)sqlite3_column_text(stmt, 0));
+    snprintf(tag, tag_size, "%s", stored_tag ? stored_tag : "");
+}
+
+int repository_image_previous(const char *repo_id, const char *image_id, char *previous_id, size_t id_size, char *tag,
+                              size_t tag_size)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_IMAGE_PREVIOUS);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, image_id, -1, SQLITE_STATIC);
+
+    int status;
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+    {
+        read_image_row(stmt, previous_id, id_size, tag, tag_size);
+        status = 0;
+    }
+    else if (rc == SQLITE_DONE)
+    {
+        status = 1;
+    }
+    else
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        status = -1;
+    }
+
+    database_release(stmt);
+    return status;
+}
+
+int repository_image_deployed(const char *repo_id, int steps_back, char *image_id, size_t id_size, char *tag,
+                              size_t tag_size)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_IMAGE_DEPLOYED);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, steps_back);
+
+    int status;
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+    {
+        read_image_row(stmt, image_id, id_size, tag, tag_size);
+        status = 0;
+    }
+    else if (rc == SQLITE_DONE)
+    {
+        status = 1;
+    }
+    else
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        status = -1;
+    }
+
+    database_release(stmt);
+    return status;
+}
+
+void image_id_list_free(struct image_id_list *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        free(list->items[i]);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+}
+
+int repository_dependency_add(const char *repo_id, const char *depends_on)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_DEPENDENCY_ADD);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, depends_on, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+int repository_dependency_remove(const char *repo_id, const char *depends_on)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_DEPENDENCY_REMOVE);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, depends_on, -1, SQLITE_STATIC);
+
+    int status = -1;
+    if (sqlite3_step(stmt) == SQLITE_DONE)
+    {
+        status = sqlite3_changes(db) > 0 ? 0 : 1;
+    }
+    else
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    }
+
+    database_release(stmt);
+    return status;
+}
+
+int repository_dependency_list(struct dependency_list *list)
+{
+    list->items = NULL;
+    list->count = 0;
+
+    sqlite3_stmt *stmt = database_acquire(STMT_DEPENDENCY_LIST);
+    size_t capacity = 0;
+    int status = 0;
+    int rc;
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        if (list->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            struct repository_dependency *items = realloc(list->items, capacity * sizeof(*items));
+            if (!items)
+            {
+                status = -1;
+                break;
+            }
+            list->items = items;
+        }
+
+        int failed = 0;
+        struct repository_dependency *item = &list->items[list->count];
+        item->repo_id = column_copy(stmt, 0, &failed);
+        item->depends_on = column_copy(stmt, 1, &failed);
+        list->count++;
+        if (failed)
+        {
+            status = -1;
+            break;
+        }
+    }
+
+    if (status == 0 && rc != SQLITE_DONE)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        status = -1;
+    }
+
+    database_release(stmt);
+
+    if (status != 0)
+    {
+        dependency_list_free(list);
+    }
+    return status;
+}
+
+void dependency_list_free(struct dependency_list *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        free(list->items[i].repo_id);
+        free(list->items[i].depends_on);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+}
+
+int maintenance_age(const char *task, long long *seconds)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_MAINTENANCE_AGE);
+    sqlite3_bind_text(stmt, 1, task, -1, SQLITE_STATIC);
+
+    int status;
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+    {
+        *seconds = sqlite3_column_int64(stmt, 0);
+        status = 0;
+    }
+    else if (rc == SQLITE_DONE)
+    {
+        status = 1;
+    }
+    else
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        status = -1;
+    }
+
+    database_release(stmt);
+    return status;
+}
+
+int maintenance_touch(const char *task)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_MAINTENANCE_TOUCH);
+    sqlite3_bind_text(stmt, 1, task, -1, SQLITE_STATIC);
+    return step_and_release(stmt);
+}
+
+void repository_free(struct repository *repository)
+{
+    free(repository->id);
+    free(repository->git_url);
+    free(repository->destination_folder);
+    free(repository->branch_name);
+    free(repository->docker_image_tag);
+    free(repository->docker_port);
+    free(repository->fingerprint_commit);
+    free(repository->fingerprint_tree);
+    free(repository->fingerprint_config);
+    free(repository->deploy_mode);
+    free(repository->health_path);
+    memset(repository, 0, sizeof(*repository));
+}
+
+void repository_list_free(struct repository_list *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        repository_free(&list->items[i]);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+}
+
+// What one benchmark process reports over its pipe, followed by `committed` latencies
+struct benchmark_report
+{
+    int committed;
+    int failed;
+};
+
+static int write_all(int fd, const void *data, size_t length)
+{
+    const char *cursor = data;
+    while (length > 0)
+    {
+        ssize_t written = write(fd, cursor, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        cursor += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *data, size_t length)
+{
+    char *cursor = data;
+    while (length > 0)
+    {
+        ssize_t received = read(fd, cursor, length);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return -1;
+        }
+        cursor += received;
+        length -= (size_t)received;
+    }
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double left = *(const double *)a;
+    double right = *(const double *)b;
+    return (left > right) - (left < right);
+}
+
+// Body of one benchmark process: the same write path a deploy records, then a read-back
+static void benchmark_database_child(const char *db_path, int index, int operations, int fd)
+{
+    // The inherited connection belongs to the parent; this process opens its own
+    db = NULL;
+    transaction_depth = 0;
+    transaction_open = 0;
+    open_database_file(db_path);
+
+    struct benchmark_report report = {0};
+    double *samples = malloc((size_t)operations * sizeof(double));
+    if (!samples)
+    {
+        _exit(1);
+    }
+
+    char git_url[] = "https://example.invalid/bench.git";
+    char destination_folder[] = "/nonexistent";
+    char branch_name[] = "main";
+    char docker_image_tag[] = "bench:latest";
+    char docker_port[] = "0";
+
+    for (int i = 0; i < operations; i++)
+    {
+        char id[64];
+        char commit[64];
+        snprintf(id, sizeof(id), "bench-%d-%d", index, i);
+        snprintf(commit, sizeof(commit), "%040d", i);
+        struct repository repository = {
+            .id = id,
+            .git_url = git_url,
+            .destination_folder = destination_folder,
+            .branch_name = branch_name,
+            .docker_image_tag = docker_image_tag,
+            .docker_port = docker_port,
+        };
+
+        double started = monotonic_seconds();
+        int ok = database_begin() == 0 &&
+                 repository_insert(&repository) == 0 &&
+                 repository_update_fingerprint(id, commit, commit, commit) == 0;
+        ok = (ok ? database_commit() : database_rollback()) == 0 && ok;
+        double elapsed = monotonic_seconds() - started;
+
+        struct repository found = {0};
+        if (ok && repository_find(id, &found) == 0 && found.fingerprint_commit && strcmp(found.fingerprint_commit, commit) == 0)
+        {
+            samples[report.committed++] = elapsed;
+        }
+        else
+        {
+            report.failed++;
+        }
+        repository_free(&found);
+    }
+
+    int status = write_all(fd, &report, sizeof(report)) == 0 &&
+                 write_all(fd, samples, (size_t)report.committed * sizeof(double)) == 0;
+    _exit(status ? 0 : 1);
+}
+
+// Run a single-value query on a private connection; copies the text of the first column
+static int benchmark_query(sqlite3 *connection, const char *sql, char *value, size_t size)
+{
+    sqlite3_stmt *stmt;
+    int status = -1;
+
+    if (sqlite3_prepare_v2(connection, sql, -1, &stmt, 0) != SQLITE_OK)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(connection));
+        return -1;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_text(stmt, 0))
+    {
+        snprintf(value, size, "%s", (const char *)sqlite3_column_text(stmt, 0));
+        status = 0;
+    }
+    sqlite3_finalize(stmt);
+    return status;
+}
+
+int benchmark_database(int processes, int operations)
+{
+    char directory[] = "/tmp/dployer-db-bench-XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Cannot create a scratch directory for the database benchmark.");
+        return -1;
+    }
+
+    char db_path[PATH_MAX];
+    snprintf(db_path, sizeof(db_path), "%s/bench.db", directory);
+
+    size_t total = (size_t)processes * (size_t)operations;
+    double *samples = malloc(total * sizeof(double));
+    pid_t *pids = calloc((size_t)processes, sizeof(*pids));
+    int *fds = calloc((size_t)processes, sizeof(*fds));
+    if (!samples || !pids || !fds)
+    {
+        free(samples);
+        free(pids);
+        free(fds);
+        rmdir(directory);
+        log_message(ERROR, ERROR_SYMBOL, "Out of memory for the database benchmark.");
+        return -1;
+    }
+
+    char log_msg[PATH_MAX + 128];
+    snprintf(log_msg, sizeof(log_msg), "Running %d write transactions from each of %d processes against %s...", operations, processes, db_path);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+
+    // Children inherit stdio buffers; empty them so nothing is written twice
+    log_flush();
+    fflush(stdout);
+    fflush(stderr);
+
+    // Every process starts on an empty file, so they also race on creating the schema
+    double started = monotonic_seconds();
+    int spawned = 0;
+    for (; spawned < processes; spawned++)
+    {
+        int pipe_fds[2];
+        if (pipe(pipe_fds) != 0)
+        {
+            break;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(pipe_fds[0]);
+            benchmark_database_child(db_path, spawned, operations, pipe_fds[1]);
+        }
+        close(pipe_fds[1]);
+        if (pid < 0)
+        {
+            close(pipe_fds[0]);
+            break;
+        }
+        pids[spawned] = pid;
+        fds[spawned] = pipe_fds[0];
+    }
+
+    int crashed = spawned < processes ? processes - spawned : 0;
+    size_t committed = 0;
+    for (int i = 0; i < spawned; i++)
+    {
+        struct benchmark_report report = {0};
+        if (read_all(fds[i], &report, sizeof(report)) == 0 &&
+            report.committed >= 0 && report.committed <= operations &&
+            read_all(fds[i], samples + committed, (size_t)report.committed * sizeof(double)) == 0)
+        {
+            committed += (size_t)report.committed;
+        }
+        close(fds[i]);
+
+        int status = 0;
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            crashed++;
+        }
+    }
+    double elapsed = monotonic_seconds() - started;
+
+    // Check the result from a fresh connection, as the next dployer invocation would see it
+    char rows[32] = "0";
+    char integrity[128] = "unavailable";
+    char journal[32] = "unknown";
+    sqlite3 *check = NULL;
+    if (sqlite3_open_v2(db_path, &check, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK)
+    {
+        benchmark_query(check, "SELECT count(*) FROM repositories WHERE fingerprint_commit IS NOT NULL;", rows, sizeof(rows));
+        benchmark_query(check, "PRAGMA integrity_check;", integrity, sizeof(integrity));
+        benchmark_query(check, "PRAGMA journal_mode;", journal, sizeof(journal));
+    }
+    sqlite3_close(check);
+
+    const char *suffixes[] = {"", "-wal", "-shm"};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    {
+        char path[PATH_MAX + 8];
+        snprintf(path, sizeof(path), "%s%s", db_path, suffixes[i]);
+        unlink(path);
+    }
+    rmdir(directory);
+
+    double mean = 0, p50 = 0, p99 = 0, max = 0;
+    if (committed > 0)
+    {
+        for (size_t i = 0; i < committed; i++)
+        {
+            mean += samples[i];
+        }
+        mean /= (double)committed;
+        qsort(samples, committed, sizeof(double), compare_doubles);
+        p50 = samples[committed / 2];
+        p99 = samples[(committed * 99) / 100];
+        max = samples[committed - 1];
+    }
+
+    log_flush();
+    printf("\n%-10s %12s %8s %10s %10s %10s %10s %12s\n", "Processes", "Committed", "Failed", "Mean (ms)", "p50 (ms)", "p99 (ms)", "Max (ms)", "Commits/s");
+    printf("%-10d %12zu %8d %10.2f %10.2f %10.2f %10.2f %12.0f\n", processes, committed, (int)(total - committed),
+           mean * 1e3, p50 * 1e3, p99 * 1e3, max * 1e3, elapsed > 0 ? (double)committed / elapsed : 0);
+    printf("\nRows: %s of %zu, journal: %s, integrity: %s\n\n", rows, total, journal, integrity);
+
+    free(samples);
+    free(pids);
+    free(fds);
+
+    int status = crashed == 0 && committed == total && strtoull(rows, NULL, 10) == total && strcmp(integrity, "ok") == 0 ? 0 : -1;
+    if (status != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Database benchmark lost or failed transactions.");
     }
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,240 @@
+#include "dependency.h"
+#include "database.h"
+#include "logger.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Whether `from` reaches `to` over depends_on edges; `visited` has one flag per edge
+static int reaches(const struct dependency_list *list, const char *from, const char *to, char *visited)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        if (visited[i] || strcmp(list->items[i].repo_id, from) != 0)
+        {
+            continue;
+        }
+        visited[i] = 1;
+        if (strcmp(list->items[i].depends_on, to) == 0 || reaches(list, list->items[i].depends_on, to, visited))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether `from` reaches `to` over the edges of `list`. Returns -1 when out of memory.
+int dependency_reaches(const struct dependency_list *list, const char *from, const char *to)
+{
+    char *visited = calloc(list->count ? list->count : 1, 1);
+    if (!visited)
+    {
+        return -1;
+    }
+    int found = reaches(list, from, to, visited);
+    free(visited);
+    return found;
+}
+
+// Make `repo_id` deploy after `depends_on`. Both must exist and the edge must not
+// close a cycle. Returns 0 on success and -1 otherwise.
+int dependency_add(const char *repo_id, const char *depends_on)
+{
+    if (strcmp(repo_id, depends_on) == 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "A repository cannot depend on itself.");
+        return -1;
+    }
+
+    const char *ids[] = {repo_id, depends_on};
+    for (int i = 0; i < 2; i++)
+    {
+        struct repository repository;
+        int found = repository_find(ids[i], &repository);
+        if (found != 0)
+        {
+            char error_msg[300];
+            snprintf(error_msg, sizeof(error_msg), found > 0 ? "Repository %s not found." : "Failed to look up repository %s.", ids[i]);
+            log_message(ERROR, ERROR_SYMBOL, error_msg);
+            return -1;
+        }
+        repository_free(&repository);
+    }
+
+    struct dependency_list list;
+    if (repository_dependency_list(&list) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to read repository dependencies.");
+        return -1;
+    }
+
+    int cycle = dependency_reaches(&list, depends_on, repo_id) == 1;
+    dependency_list_free(&list);
+
+    if (cycle)
+    {
+        char error_msg[600];
+        snprintf(error_msg, sizeof(error_msg), "%s already depends on %s; the dependency would form a cycle.", depends_on, repo_id);
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        return -1;
+    }
+
+    if (repository_dependency_add(repo_id, depends_on) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to save the dependency.");
+        return -1;
+    }
+
+    char log_msg[600];
+    snprintf(log_msg, sizeof(log_msg), "%s now deploys after %s.", repo_id, depends_on);
+    log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+    return 0;
+}
+
+int dependency_remove(const char *repo_id, const char *depends_on)
+{
+    int status = repository_dependency_remove(repo_id, depends_on);
+    char log_msg[600];
+    if (status == 0)
+    {
+        snprintf(log_msg, sizeof(log_msg), "%s no longer depends on %s.", repo_id, depends_on);
+        log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+    }
+    else if (status > 0)
+    {
+        snprintf(log_msg, sizeof(log_msg), "%s does not depend on %s.", repo_id, depends_on);
+        log_message(WARNING, WARNING_SYMBOL, log_msg);
+    }
+    else
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to remove the dependency.");
+    }
+    return status < 0 ? -1 : 0;
+}
+
+// List what a repository waits for and what waits for it
+void print_dependencies(const char *repo_id)
+{
+    struct dependency_list list;
+    if (repository_dependency_list(&list) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to read repository dependencies.");
+        return;
+    }
+
+    log_flush();
+    const char *headings[] = {"Depends on", "Required by"};
+    for (int direction = 0; direction < 2; direction++)
+    {
+        printf("\n%s:", headings[direction]);
+        int rows = 0;
+        for (size_t i = 0; i < list.count; i++)
+        {
+            const struct repository_dependency *edge = &list.items[i];
+            if (strcmp(direction == 0 ? edge->repo_id : edge->depends_on, repo_id) == 0)
+            {
+                printf(" %s", direction == 0 ? edge->depends_on : edge->repo_id);
+                rows++;
+            }
+        }
+        printf("%s\n", rows == 0 ? " -" : "");
+    }
+    printf("\n");
+
+    dependency_list_free(&list);
+}
+
+// Index of `repo_id` in `repo_ids`, or `count` when it is not one of them
+static size_t index_of(const char *const *repo_ids, size_t count, const char *repo_id)
+{
+    size_t index = 0;
+    while (index < count && strcmp(repo_ids[index], repo_id) != 0)
+    {
+        index++;
+    }
+    return index;
+}
+
+// Collect the nodes of `repo_ids` that `from` depends on, looking through
+// repositories that are not part of the set
+static int collect_edges(const struct dependency_list *list, const char *const *repo_ids, size_t count, size_t after,
+                         const char *from, char *visited, struct graph_edge **edges, size_t *edge_count, size_t *capacity)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        if (visited[i] || strcmp(list->items[i].repo_id, from) != 0)
+        {
+            continue;
+        }
+        visited[i] = 1;
+
+        size_t before = index_of(repo_ids, count, list->items[i].depends_on);
+        if (before == count)
+        {
+            if (collect_edges(list, repo_ids, count, after, list->items[i].depends_on, visited, edges, edge_count, capacity) != 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        int known = 0;
+        for (size_t e = 0; e < *edge_count && !known; e++)
+        {
+            known = (*edges)[e].before == before && (*edges)[e].after == after;
+        }
+        if (known || before == after)
+        {
+            continue;
+        }
+
+        if (*edge_count == *capacity)
+        {
+            *capacity = *capacity ? *capacity * 2 : 16;
+            struct graph_edge *grown = realloc(*edges, *capacity * sizeof(**edges));
+            if (!grown)
+            {
+                return -1;
+            }
+            *edges = grown;
+        }
+        (*edges)[(*edge_count)++] = (struct graph_edge){before, after};
+    }
+    return 0;
+}
+
+// Deploy-order edges between the repositories in `repo_ids`, as indices into it.
+// A dependency outside the set counts as deployed, but is looked through, so that
+// A -> B -> C still orders A after C when only A and C are deployed. The caller
+// frees `*edges`. Returns 0 on success.
+int dependency_edges(const char *const *repo_ids, size_t count, struct graph_edge **edges, size_t *edge_count)
+{
+    *edges = NULL;
+    *edge_count = 0;
+
+    struct dependency_list list;
+    if (repository_dependency_list(&list) != 0)
+    {
+        return -1;
+    }
+
+    char *visited = malloc(list.count ? list.count : 1);
+    int status = visited ? 0 : -1;
+    size_t capacity = 0;
+    for (size_t after = 0; after < count && status == 0; after++)
+    {
+        memset(visited, 0, list.count ? list.count : 1);
+        status = collect_edges(&list, repo_ids, count, after, repo_ids[after], visited, edges, edge_count, &capacity);
+    }
+
+    free(visited);
+    dependency_list_free(&list);
+    if (status != 0)
+    {
+        free(*edges);
+        *edges = NULL;
+        *edge_count = 0;
+    }
+    return status;
+}
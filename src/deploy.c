@@ -3,7 +3,22 @@
 #include "utils.h"
 #include "docker.h"
 #include "repo.h"
-
+#include "deploy.h"
+#include "pool.h"
+#include "context.h"
+#include "stats.h"
+#include "metrics.h"
+#include "store.h"
+#include "base_image.h"
+#include "build_cache.h"
+#include "prune.h"
+#include "health.h"
+#include "rollback.h"
+#include "release.h"
+#include "dependency.h"
+#include "fingerprint.h"
+
+#include <json-c/json.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,43 +27,119 @@
 #include <unistd.h>
 #include <limits.h>
 #include <errno.h>
+#include <pthread.h>
+
+// True when the stored fingerprint matches and the service runs an image built from it
+static int is_fingerprint_deployed(const struct repository *repository, const char *service_name, const struct repo_fingerprint *fingerprint)
+{
+  int matches = repository->fingerprint_commit && repository->fingerprint_tree && repository->fingerprint_config &&
+                strcmp(repository->fingerprint_commit, fingerprint->head_commit) == 0 &&
+                strcmp(repository->fingerprint_tree, fingerprint->tree_hash) == 0 &&
+                strcmp(repository->fingerprint_config, fingerprint->config_hash) == 0;
+
+  if (!matches)
+  {
+    return 0;
+  }
+
+  // The database alone is not enough: the service may have been changed or removed by hand
+  char running_image[512];
+  if (docker_service_image(service_name, running_image, sizeof(running_image)) != 0)
+  {
+    return 0;
+  }
+
+  char running_fingerprint[SHA256_HEX_SIZE + 1];
+  if (docker_image_label(running_image, FINGERPRINT_LABEL, running_fingerprint, sizeof(running_fingerprint)) != 0)
+  {
+    return 0;
+  }
+
+  return strcmp(running_fingerprint, fingerprint->combined) == 0;
+}
+
+// What a deploy writes back to the database once it is over. Fleet deploys
+// keep one per job and write them all in a single transaction.
+struct deploy_record
+{
+  struct run_timer timer;
+  int save_fingerprint;
+  struct repo_fingerprint fingerprint;
+  const char *mode; // Deploy mode to remember for the repository, from "deploy --mode"
+  const char *health_path; // Health path to remember, from "deploy --health"
+};
+
+static void record_deploy(const struct deploy_record *record)
+{
+  database_begin();
+
+  if (record->save_fingerprint &&
+      repository_update_fingerprint(record->timer.repo_id, record->fingerprint.head_commit,
+                                    record->fingerprint.tree_hash, record->fingerprint.config_hash) != 0)
+  {
+    log_message(WARNING, WARNING_SYMBOL, "Failed to record the deployed fingerprint.");
+  }
+  if (record->mode && repository_update_mode(record->timer.repo_id, record->mode) != 0)
+  {
+    log_message(WARNING, WARNING_SYMBOL, "Failed to record the deploy mode.");
+  }
+  if (record->health_path &&
+      repository_update_health_path(record->timer.repo_id,
+                                    strcmp(record->health_path, DEPLOY_HEALTH_OFF) == 0 ? NULL : record->health_path) != 0)
+  {
+    log_message(WARNING, WARNING_SYMBOL, "Failed to record the health path.");
+  }
+  run_timer_record(&record->timer);
 
-void deploy_repo(const char *repo_id)
+  database_commit();
+}
+
+// Deploy a single repository. Returns 0 on success and -1 on failure.
+// The deploy pipeline proper; every phase is timed through `record->timer`
+static int run_deploy(const char *repo_id, const struct deploy_options *options, struct deploy_record *record)
 {
+  struct run_timer *timer = &record->timer;
+  struct deploy_options default_options = {0};
+  if (!options)
+  {
+    default_options.jobs = 1;
+    options = &default_options;
+  }
+
   if (repo_id == NULL || strlen(repo_id) == 0)
   {
     log_message(ERROR, ERROR_SYMBOL, "Invalid repository ID.");
-    return;
+    return -1;
   }
 
-  sqlite3_stmt *stmt;
-  char sql[256];
-  snprintf(sql, sizeof(sql), "SELECT destination_folder, docker_image_tag, docker_port FROM repositories WHERE id = ?;");
+  int status = -1;
+
+  run_timer_phase(timer, "lookup");
+
+  struct repository repository;
+  int lookup_status = repository_find(repo_id, &repository);
 
-  if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK)
+  if (lookup_status < 0)
   {
-    log_message(ERROR, ERROR_SYMBOL, "Failed to prepare statement.");
-    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
-    return;
+    log_message(ERROR, ERROR_SYMBOL, "Failed to look up the repository.");
+    return -1;
   }
 
-  sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
-
-  if (sqlite3_step(stmt) == SQLITE_ROW)
+  if (lookup_status == 0)
   {
     log_message(INFO, INFO_SYMBOL, "Repository ID found, proceeding with deployment...");
 
-    const char *destination_folder = (const char *)sqlite3_column_text(stmt, 0);
-    const char *docker_image_tag = (const char *)sqlite3_column_text(stmt, 1);
-    const char *docker_port = (const char *)sqlite3_column_text(stmt, 2);
+    const char *destination_folder = repository.destination_folder;
+    const char *docker_image_tag = repository.docker_image_tag;
+    const char *docker_port = repository.docker_port;
 
     // Convert destination_folder to an absolute path
     char absolute_destination_folder[PATH_MAX];
     if (!realpath(destination_folder, absolute_destination_folder))
     {
       log_message(ERROR, ERROR_SYMBOL, "Failed to get absolute path of destination folder.");
-      sqlite3_finalize(stmt);
-      return;
+      repository_free(&repository);
+      return -1;
     }
 
     // Determine the framework
@@ -62,8 +153,8 @@ void deploy_repo(const char *repo_id)
       use_php82 = check_laravel_and_php_versions(absolute_destination_folder);
     }
 
-    // Dockerfile path selection
-    char dockerfile_path[PATH_MAX + 100]; // Allow for extra path length
+    // Dockerfile path selection, relative to the build context
+    const char *dockerfile_path;
     char config_source[PATH_MAX + 100];
     char config_destination[PATH_MAX + 100];
 
@@ -72,8 +163,8 @@ void deploy_repo(const char *repo_id)
     if (!home_dir)
     {
       log_message(ERROR, ERROR_SYMBOL, "Failed to get home directory.");
-      sqlite3_finalize(stmt);
-      return;
+      repository_free(&repository);
+      return -1;
     }
 
     // Construct the base path to the config directory in {HOME}/.config/dployer
@@ -81,8 +172,8 @@ void deploy_repo(const char *repo_id)
     if (snprintf(config_base, sizeof(config_base), "%s/.config/dployer/config", home_dir) >= sizeof(config_base))
     {
       log_message(ERROR, ERROR_SYMBOL, "Config base directory path is too long.");
-      sqlite3_finalize(stmt);
-      return;
+      repository_free(&repository);
+      return -1;
     }
 
     // Determine the correct config source directory based on the framework
@@ -90,204 +181,688 @@ void deploy_repo(const char *repo_id)
     {
       if (use_php82)
       {
-        snprintf(dockerfile_path, sizeof(dockerfile_path), "%s/docker/php82.dockerfile", absolute_destination_folder);
+        dockerfile_path = "docker/php82.dockerfile";
       }
       else
       {
-        snprintf(dockerfile_path, sizeof(dockerfile_path), "%s/docker/Dockerfile", absolute_destination_folder);
+        dockerfile_path = "docker/Dockerfile";
       }
       snprintf(config_source, sizeof(config_source), "%s/laravel", config_base);
     }
     else if (strcmp(framework, "static-php") == 0)
     {
-      snprintf(dockerfile_path, sizeof(dockerfile_path), "%s/docker/Dockerfile", absolute_destination_folder);
+      dockerfile_path = "docker/Dockerfile";
       snprintf(config_source, sizeof(config_source), "%s/static-php", config_base);
     }
     else
     {
       log_message(ERROR, ERROR_SYMBOL, "Unknown framework. Deployment aborted.");
-      sqlite3_finalize(stmt);
-      return;
+      repository_free(&repository);
+      return -1;
+    }
+
+    // With an app.dockerfile template, the framework's slow setup (Node, yarn) lives in a
+    // shared base image and the repository's own Dockerfile is generated to start FROM it
+    char app_template[PATH_MAX + 200];
+    snprintf(app_template, sizeof(app_template), "%s/%s", config_source, BASE_APP_DOCKERFILE);
+    int use_base_image = access(app_template, F_OK) == 0;
+
+    // Build mode (the default) also needs the framework's app.build.dockerfile
+    const char *mode = options->mode ? options->mode : repository.deploy_mode ? repository.deploy_mode : DEPLOY_MODE_BUILD;
+    char build_template[PATH_MAX + 200];
+    snprintf(build_template, sizeof(build_template), "%s/%s", config_source, BASE_BUILD_DOCKERFILE);
+    int build_mode = use_base_image && strcmp(mode, DEPLOY_MODE_BUILD) == 0 && access(build_template, F_OK) == 0;
+    if (options->mode && strcmp(options->mode, DEPLOY_MODE_BUILD) == 0 && !build_mode)
+    {
+      log_message(WARNING, WARNING_SYMBOL, "Build mode needs app.dockerfile and app.build.dockerfile in the framework config; using entrypoint mode.");
+    }
+
+    // The generated Dockerfile's name differs per mode, so switching modes changes the fingerprint
+    if (use_base_image)
+    {
+      dockerfile_path = build_mode ? "docker/" BASE_BUILD_GENERATED_DOCKERFILE : "docker/" BASE_GENERATED_DOCKERFILE;
+    }
+
+    char service_name[256];
+    snprintf(service_name, sizeof(service_name), "%s_service", repo_id);
+
+    // Skip the build entirely when nothing that goes into the image has changed
+    run_timer_phase(timer, "fingerprint");
+    struct repo_fingerprint fingerprint;
+    int have_fingerprint = compute_repo_fingerprint(absolute_destination_folder, config_source, strrchr(dockerfile_path, '/') + 1, &fingerprint) == 0;
+
+    if (!have_fingerprint)
+    {
+      log_message(WARNING, WARNING_SYMBOL, "Could not fingerprint the repository; performing a full deploy.");
+    }
+    else if (options->force)
+    {
+      log_message(INFO, INFO_SYMBOL, "Forced deploy requested; skipping the fingerprint check.");
+    }
+    else if (is_fingerprint_deployed(&repository, service_name, &fingerprint))
+    {
+      char skip_msg[256];
+      snprintf(skip_msg, sizeof(skip_msg), "No changes since the last deploy of %s (commit %.12s); skipping. Use --force to rebuild.", repo_id, fingerprint.head_commit);
+      log_message(SUCCESS, SUCCESS_SYMBOL, skip_msg);
+      timer->outcome = "skipped";
+      repository_free(&repository);
+      return 0;
     }
 
     // Ensure the docker directory exists in the destination folder
+    run_timer_phase(timer, "config_stage");
     snprintf(config_destination, sizeof(config_destination), "%s/docker", absolute_destination_folder);
     if (mkdir(config_destination, 0700) == -1 && errno != EEXIST)
     {
       log_message(ERROR, ERROR_SYMBOL, "Failed to create docker directory in the destination.");
-      sqlite3_finalize(stmt);
-      return;
+      repository_free(&repository);
+      return -1;
     }
 
-    // Copy config files into the destination folder's docker directory
-    char copy_command[1024];
-    int ret = snprintf(copy_command, sizeof(copy_command), "cp -r %s/* %s/", config_source, config_destination);
-
-    if (ret < 0 || ret >= (int)sizeof(copy_command))
+    // Link the config files in from the content-addressed store; unchanged files keep
+    // their inode and mtime across deploys, so Docker's COPY layers stay cached
+    struct config_stage_stats stage_stats;
+    if (config_store_stage(config_source, config_destination, &stage_stats) != 0)
     {
-      fprintf(stderr, "Copy command buffer overflow. Deployment aborted.\n");
-      sqlite3_finalize(stmt);
-      return;
+      char error_msg[PATH_MAX * 3];
+      snprintf(error_msg, sizeof(error_msg), "Failed to stage config files from %s to %s: %s", config_source, config_destination, strerror(errno));
+      log_message(ERROR, ERROR_SYMBOL, error_msg);
+      repository_free(&repository);
+      return -1;
     }
 
-    ret = system(copy_command);
-    if (ret != 0)
+    char stage_summary[256];
+    char stage_msg[300];
+    format_stage_stats(&stage_stats, stage_summary, sizeof(stage_summary));
+    snprintf(stage_msg, sizeof(stage_msg), "Config staged: %s", stage_summary);
+    log_message(INFO, INFO_SYMBOL, stage_msg);
+
+    if (use_base_image)
     {
-      fprintf(stderr, "Failed to copy config files with exit code %d: %s\n", WEXITSTATUS(ret), copy_command);
-      sqlite3_finalize(stmt);
-      exit(1);
+      run_timer_phase(timer, "base_image");
+      char node_version[32];
+      struct base_image base;
+      base_image_node_version(absolute_destination_folder, node_version, sizeof(node_version));
+      if (base_image_ensure(framework, config_source, use_php82 ? "82" : "81", node_version, &base) != 0 ||
+          (build_mode ? base_image_write_build_dockerfile(&base, config_source, absolute_destination_folder, config_destination)
+                      : base_image_write_dockerfile(&base, config_source, config_destination)) != 0)
+      {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to prepare the shared base image.");
+        repository_free(&repository);
+        return -1;
+      }
     }
 
     // Get current user's UID and GID
-    char uid_str[16];
-    char gid_str[16];
-    snprintf(uid_str, sizeof(uid_str), "%d", getuid());
-    snprintf(gid_str, sizeof(gid_str), "%d", getgid());
+    char uid_arg[32];
+    char gid_arg[32];
+    snprintf(uid_arg, sizeof(uid_arg), "HOST_UID=%d", getuid());
+    snprintf(gid_arg, sizeof(gid_arg), "HOST_GID=%d", getgid());
+
+    char log_msg[256];
+    snprintf(log_msg, sizeof(log_msg), "Deploying %s repository with framework: %s%s", repo_id, framework,
+             !use_base_image ? "" : build_mode ? " (build mode)" : " (entrypoint mode)");
+    log_message(INFO, INFO_SYMBOL, log_msg);
+
+    // Label the image with its fingerprint so later deploys can recognise it
+    char label_arg[SHA256_HEX_SIZE + 32];
+    snprintf(label_arg, sizeof(label_arg), "%s=%s", FINGERPRINT_LABEL, have_fingerprint ? fingerprint.combined : "");
 
     // Build the Docker image with HOST_UID and HOST_GID as build arguments
-    char build_command[1024];
-    ret = snprintf(build_command, sizeof(build_command),
-                   "docker build --build-arg HOST_UID=%s --build-arg HOST_GID=%s -t %s -f %s %s > /dev/null 2>&1",
-                   uid_str, gid_str, docker_image_tag, dockerfile_path, absolute_destination_folder);
+    run_timer_phase(timer, "build");
+    const char *build_args[] = {uid_arg, gid_arg, NULL};
+    const char *labels[] = {label_arg, NULL};
 
-    if (ret < 0 || ret >= (int)sizeof(build_command))
+    // Stream only what the image needs, filtered by .dockerignore and the framework defaults
+    struct build_context build_context;
+    if (build_context_init(&build_context, absolute_destination_folder, framework, dockerfile_path) != 0)
+    {
+      repository_free(&repository);
+      return -1;
+    }
+    if (build_mode)
     {
-      log_message(ERROR, ERROR_SYMBOL, "Command buffer overflow. Deployment aborted.");
-      sqlite3_finalize(stmt);
-      return;
+      // The vendor stage installs from composer.lock; a host vendor/ left by entrypoint mode must not leak in
+      ignore_list_add(&build_context.ignore, "vendor");
     }
 
-    char log_msg[256];
-    snprintf(log_msg, sizeof(log_msg), "Deploying %s repository with framework: %s", repo_id, framework);
-    log_message(INFO, INFO_SYMBOL, log_msg);
+    // BuildKit's cache records before and after the build tell how much of it was reused. Each
+    // snapshot is a full /system/df, and overlapping builds bump the same records, so only a
+    // build that runs alone takes them; the others report the cached steps from their own trace.
+    struct build_cache_snapshot cache_before = {NULL, 0};
+    int cache_report = options->jobs == 1 && docker_buildkit_enabled() && build_cache_snapshot(&cache_before) == 0;
+
+    struct docker_build_stats build_stats = {0, 0};
+    struct docker_build_request build_request = {docker_image_tag, dockerfile_path, build_args, labels,
+                                                 build_context_writer, &build_context, &build_stats};
 
-    ret = system(build_command);
-    if (ret != 0)
+    struct output_buffer build_log;
+    output_buffer_init(&build_log);
+
+    char image_id[160] = "";
+    double build_started = monotonic_seconds();
+    int build_status = docker_image_build(&build_request, &build_log, image_id, sizeof(image_id));
+
+    char context_summary[256];
+    char context_msg[300];
+    format_context_stats(&build_context.stats, context_summary, sizeof(context_summary));
+    snprintf(context_msg, sizeof(context_msg), "Build context: %s", context_summary);
+    log_message(INFO, INFO_SYMBOL, context_msg);
+    timer->context_bytes = build_context.stats.bytes;
+    build_context_free(&build_context);
+
+    if (build_status != 0)
     {
-      fprintf(stderr, "Docker build failed with exit code %d: %s\n", WEXITSTATUS(ret), build_command);
-      sqlite3_finalize(stmt);
-      exit(1);
+      char error_msg[256];
+      snprintf(error_msg, sizeof(error_msg), "Docker build failed after %.1fs.", monotonic_seconds() - build_started);
+      log_message(ERROR, ERROR_SYMBOL, error_msg);
+      if (build_log.length > 0)
+      {
+        log_message(ERROR, ERROR_SYMBOL, build_log.data);
+      }
+      output_buffer_free(&build_log);
+      build_cache_snapshot_free(&cache_before);
+      repository_free(&repository);
+      return -1;
     }
+    output_buffer_free(&build_log);
     log_message(SUCCESS, SUCCESS_SYMBOL, "Docker image built successfully.");
 
-    // Check if the service already exists
-    char service_check_command[256];
-    snprintf(service_check_command, sizeof(service_check_command), "docker service ls --filter name=%s_service --format '{{.Name}}'", repo_id);
+    // The service runs a tag of its own per commit, which later builds leave alone, so that
+    // "rollback" can point it back at this image without building again. A dirty working
+    // tree adds the fingerprint, since the commit alone does not describe the image.
+    char image_name[512];
+    char commit_tag[64] = "";
+    char deploy_image[600];
+    snprintf(deploy_image, sizeof(deploy_image), "%s", docker_image_tag);
+    if (have_fingerprint)
+    {
+      snprintf(commit_tag, sizeof(commit_tag), fingerprint.dirty ? "%.12s-%.8s" : "%.12s", fingerprint.head_commit, fingerprint.combined);
+    }
+    if (have_fingerprint && image_id[0] != '\0')
+    {
+      docker_image_repository(docker_image_tag, image_name, sizeof(image_name));
+      if (docker_image_add_tag(image_id, image_name, commit_tag) == 0)
+      {
+        char tag_msg[640];
+        snprintf(deploy_image, sizeof(deploy_image), "%s:%s", image_name, commit_tag);
+        snprintf(tag_msg, sizeof(tag_msg), "Tagged image as %s.", deploy_image);
+        log_message(INFO, INFO_SYMBOL, tag_msg);
+      }
+      else
+      {
+        log_message(WARNING, WARNING_SYMBOL, "Failed to tag the image with its commit; deploying the branch tag.");
+      }
+    }
 
-    FILE *service_check = popen(service_check_command, "r");
-    if (!service_check)
+    // Remember the image so that it can be rolled back to, and removed once newer builds supersede it
+    if (image_id[0] != '\0' && repository_image_record(repo_id, image_id, strcmp(deploy_image, docker_image_tag) != 0 ? deploy_image : NULL) != 0)
     {
-      log_message(ERROR, ERROR_SYMBOL, "Failed to check existing Docker service.");
-      sqlite3_finalize(stmt);
-      return;
+      log_message(WARNING, WARNING_SYMBOL, "Failed to record the built image.");
     }
 
-    char service_name[256];
-    if (fgets(service_name, sizeof(service_name), service_check) != NULL)
+    struct build_cache_snapshot cache_after;
+    if (cache_report && build_cache_snapshot(&cache_after) == 0)
     {
-      // Service exists, update it with rolling update strategy
-      pclose(service_check);
-      char update_command[1024];
-      ret = snprintf(update_command, sizeof(update_command),
-                     "docker service update --force --publish-add %s --mount-add type=bind,source=%s,target=/app "
-                     "--update-delay 10s --update-parallelism 2 --with-registry-auth %s_service > /dev/null 2>&1",
-                     docker_port, absolute_destination_folder, repo_id);
-      if (ret < 0 || ret >= (int)sizeof(update_command))
+      struct build_cache_hits hits;
+      build_cache_compare(&cache_before, &cache_after, &hits);
+      build_cache_snapshot_free(&cache_after);
+
+      char hits_summary[256];
+      char cache_msg[384];
+      format_cache_hits(&hits, hits_summary, sizeof(hits_summary));
+      snprintf(cache_msg, sizeof(cache_msg), "Build cache: %zu of %zu steps cached, %s", build_stats.cached_steps,
+               build_stats.steps, hits_summary);
+      log_message(INFO, INFO_SYMBOL, cache_msg);
+      timer->cache_hit_bytes = (unsigned long long)(hits.layer_bytes + hits.mount_bytes);
+    }
+    else if (build_stats.steps > 0)
+    {
+      char cache_msg[128];
+      snprintf(cache_msg, sizeof(cache_msg), "Build cache: %zu of %zu steps cached.", build_stats.cached_steps, build_stats.steps);
+      log_message(INFO, INFO_SYMBOL, cache_msg);
+    }
+    build_cache_snapshot_free(&cache_before);
+
+    // storage/ lives outside the checkout and every release, so that logs, sessions and
+    // uploads survive rolling updates
+    run_timer_phase(timer, "release");
+    char storage_folder[PATH_MAX];
+    if (release_shared_storage(repo_id, absolute_destination_folder, storage_folder, sizeof(storage_folder)) != 0)
+    {
+      log_message(ERROR, ERROR_SYMBOL, "Failed to prepare the shared storage directory.");
+      repository_free(&repository);
+      return -1;
+    }
+
+    // Replicas and limits from the fleet manifest; unset ones stay as the service has them
+    struct docker_service_spec service_spec = {
+      .name = service_name,
+      .image = deploy_image,
+      .port = docker_port,
+      .replicas = repository.replicas,
+      .shared_source = storage_folder,
+      .shared_target = "/app/storage",
+      .set_resources = repository.cpu_limit > 0 || repository.memory_limit > 0,
+      .cpu_limit = repository.cpu_limit,
+      .memory_limit = repository.memory_limit,
+    };
+
+    // In build mode the code is part of the image. Otherwise the service mounts "current", a
+    // release copied from the checkout, so that updates to the checkout never reach running
+    // containers; the new tasks of the rolling update pick up the release swapped in here.
+    char current_folder[PATH_MAX];
+    char release_name[256];
+    char previous_release[256] = "";
+    int release_swapped = 0;
+    if (build_mode)
+    {
+      service_spec.remove_mount_target = "/app";
+    }
+    else
+    {
+      struct release_copy_stats release_stats;
+      if (release_path(repo_id, NULL, current_folder, sizeof(current_folder)) != 0 ||
+          release_create(repo_id, absolute_destination_folder, commit_tag[0] ? commit_tag : "untracked", release_name,
+                         sizeof(release_name), &release_stats) != 0)
       {
-        log_message(ERROR, ERROR_SYMBOL, "Update command buffer overflow. Deployment aborted.");
-        sqlite3_finalize(stmt);
-        return;
+        log_message(ERROR, ERROR_SYMBOL, "Failed to create the release directory.");
+        repository_free(&repository);
+        return -1;
       }
 
-      ret = system(update_command);
+      int had_release = release_current(repo_id, previous_release, sizeof(previous_release)) == 0;
+      if (release_activate(repo_id, release_name) != 0)
+      {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to activate the release.");
+        repository_free(&repository);
+        return -1;
+      }
+      release_swapped = had_release;
+
+      char release_msg[512];
+      snprintf(release_msg, sizeof(release_msg), "Release %s: %zu files (%zu reflinked, %zu copied).",
+               release_name, release_stats.files, release_stats.cloned, release_stats.copied);
+      log_message(INFO, INFO_SYMBOL, release_msg);
+      service_spec.mount_source = current_folder;
+      service_spec.mount_target = "/app";
+    }
+
+    // Tasks and update states from before this point belong to earlier rollouts
+    time_t rollout_started = time(NULL);
+
+    // Check if the service already exists
+    run_timer_phase(timer, "service_check");
+    struct json_object *current_service = NULL;
+    int inspect_status = docker_service_inspect(service_name, &current_service);
+    if (inspect_status < 0)
+    {
+      log_message(ERROR, ERROR_SYMBOL, "Failed to check existing Docker service.");
+      repository_free(&repository);
+      return -1;
+    }
+
+    if (inspect_status == 0)
+    {
+      // Service exists, update it with rolling update strategy
+      run_timer_phase(timer, "service_update");
+      int ret = docker_service_update(&service_spec, current_service);
+      json_object_put(current_service);
       if (ret != 0)
       {
-        fprintf(stderr, "Docker service update failed with exit code %d: %s\n", WEXITSTATUS(ret), update_command);
-        sqlite3_finalize(stmt);
-        exit(1);
+        if (release_swapped)
+        {
+          release_activate(repo_id, previous_release);
+        }
+        repository_free(&repository);
+        return -1;
       }
       log_message(SUCCESS, SUCCESS_SYMBOL, "Docker service updated successfully.");
     }
     else
     {
       // Service does not exist, create it
-      pclose(service_check);
-      char create_command[1024];
-      ret = snprintf(create_command, sizeof(create_command),
-                     "docker service create --name %s_service --replicas 1 --publish %s --mount type=bind,source=%s,target=/app "
-                     "--update-delay 10s --update-parallelism 2 --with-registry-auth %s > /dev/null 2>&1",
-                     repo_id, docker_port, absolute_destination_folder, docker_image_tag);
-
-      if (ret < 0 || ret >= (int)sizeof(create_command))
+      run_timer_phase(timer, "service_create");
+      service_spec.replicas = repository.replicas > 0 ? repository.replicas : 1;
+      if (docker_service_create(&service_spec) != 0)
       {
-        log_message(ERROR, ERROR_SYMBOL, "Create command buffer overflow. Deployment aborted.");
-        sqlite3_finalize(stmt);
-        return;
+        repository_free(&repository);
+        return -1;
       }
+      log_message(SUCCESS, SUCCESS_SYMBOL, "Docker service created successfully.");
+    }
 
-      ret = system(create_command);
-      if (ret != 0)
+    // With a health path the deploy only succeeds once the new tasks run and answer on it
+    const char *health_path = options->health_path ? options->health_path : repository.health_path;
+    if (health_path && strcmp(health_path, DEPLOY_HEALTH_OFF) != 0)
+    {
+      run_timer_phase(timer, "health");
+      if (health_gate(service_name, deploy_image, inspect_status == 0, rollout_started, docker_port, health_path) != 0)
       {
-        fprintf(stderr, "Docker service create failed with exit code %d: %s\n", WEXITSTATUS(ret), create_command);
-        sqlite3_finalize(stmt);
-        exit(1);
+        run_timer_phase(timer, "rollback");
+        if (release_swapped)
+        {
+          release_activate(repo_id, previous_release);
+        }
+        roll_back_failed_deploy(repo_id, image_id, &service_spec);
+        repository_free(&repository);
+        return -1;
       }
-      log_message(SUCCESS, SUCCESS_SYMBOL, "Docker service created successfully.");
+    }
+    if (image_id[0] != '\0')
+    {
+      repository_image_mark_deployed(repo_id, image_id);
     }
 
     // Remove the docker directory after successful deployment
-    char remove_command[1024];
-    ret = snprintf(remove_command, sizeof(remove_command), "rm -rf %s/docker > /dev/null 2>&1", absolute_destination_folder);
-    if (ret < 0 || ret >= (int)sizeof(remove_command))
+    run_timer_phase(timer, "cleanup");
+    if (remove_directory(config_destination) != 0)
     {
-      log_message(WARNING, WARNING_SYMBOL, "Remove command buffer overflow. Directory not removed.");
+      log_message(WARNING, WARNING_SYMBOL, "Failed to remove docker directory after deployment.");
     }
     else
     {
-      ret = system(remove_command);
-      if (ret != 0)
-      {
-        log_message(WARNING, WARNING_SYMBOL, "Failed to remove docker directory after deployment.");
-      }
-      else
-      {
-        log_message(SUCCESS, SUCCESS_SYMBOL, "Docker directory removed successfully after deployment.");
-      }
+      log_message(SUCCESS, SUCCESS_SYMBOL, "Docker directory removed successfully after deployment.");
     }
 
-    // Clean up dangling images and unused resources
-    clean_up_unused_resources();
+    if (have_fingerprint)
+    {
+      record->save_fingerprint = 1;
+      record->fingerprint = fingerprint;
+    }
+    record->mode = options->mode;
+    record->health_path = options->health_path;
+
+    // Remove only this repository's superseded images; the daemon-wide prune runs on a
+    // schedule or size threshold (fleet deploys check it once at the end)
+    run_timer_phase(timer, "prune");
+    prune_repository_images(repo_id);
+    if (!build_mode)
+    {
+      release_collect_garbage(repo_id);
+    }
+    // Worktrees left by a switch or a new version tag are unused once this deploy is out
+    prune_stale_worktrees(absolute_destination_folder);
+    if (!options->skip_cleanup)
+    {
+      prune_if_due();
+    }
+
+    status = 0;
   }
   else
   {
     log_message(ERROR, ERROR_SYMBOL, "Repository ID not found.");
   }
 
-  sqlite3_finalize(stmt);
+  repository_free(&repository);
+  return status;
+}
+
+// Run a timed deploy, leaving its bookkeeping in `record`
+static int deploy_into_record(const char *repo_id, const struct deploy_options *options, struct deploy_record *record)
+{
+  memset(record, 0, sizeof(*record));
+  run_timer_start(&record->timer, RUN_KIND_DEPLOY, repo_id ? repo_id : "");
+
+  int status = run_deploy(repo_id, options, record);
+
+  run_timer_stop(&record->timer, status);
+  return status;
+}
+
+int deploy_repo(const char *repo_id, const struct deploy_options *options)
+{
+  // A single repository always builds alone
+  struct deploy_options single_options = {0};
+  if (options)
+  {
+    single_options = *options;
+  }
+  single_options.jobs = 1;
+
+  struct deploy_record record;
+  int status = deploy_into_record(repo_id, &single_options, &record);
+
+  record_deploy(&record);
+  write_metrics_textfile();
+  return status;
+}
+
+// Per-repository bookkeeping for a fleet deploy
+struct deploy_job
+{
+  char *repo_id;
+  int status;
+  enum graph_node_state state;
+  double seconds;
+  struct output_buffer output;
+  struct deploy_record record;
+};
+
+struct deploy_batch
+{
+  struct deploy_job *jobs;
+  const struct deploy_options *options;
+  int capture_output;
+  pthread_mutex_t print_lock;
+};
+
+static int deploy_job_task(size_t index, void *context)
+{
+  struct deploy_batch *batch = context;
+  struct deploy_job *job = &batch->jobs[index];
+
+  // Parallel jobs write into their own buffer, printed as one block once the job ends
+  if (batch->capture_output)
+  {
+    log_capture(&job->output);
+  }
+
+  double started = monotonic_seconds();
+  job->status = deploy_into_record(job->repo_id, batch->options, &job->record);
+  job->seconds = monotonic_seconds() - started;
+
+  if (batch->capture_output)
+  {
+    log_capture(NULL);
+
+    pthread_mutex_lock(&batch->print_lock);
+    log_flush();
+    printf("\n===== %s (%s, %.1fs) =====\n", job->repo_id, job->status == 0 ? "OK" : "FAILED", job->seconds);
+    if (job->output.data)
+    {
+      fputs(job->output.data, stdout);
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&batch->print_lock);
+  }
+  return job->status;
+}
+
+static void print_deploy_summary(const struct deploy_job *jobs, size_t count, double total_seconds)
+{
+  int id_width = 25;
+  int status_width = 10;
+  int time_width = 12;
+
+  log_flush();
+  printf("\n%-*s %-*s %*s\n", id_width, "ID", status_width, "Status", time_width, "Wall Time");
+  printf("%-*s %-*s %*s\n",
+         id_width, "-------------------------",
+         status_width, "----------",
+         time_width, "------------");
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const char *color = jobs[i].state == GRAPH_NODE_DONE ? SUCCESS : jobs[i].state == GRAPH_NODE_SKIPPED ? WARNING : ERROR;
+    const char *label = jobs[i].state == GRAPH_NODE_DONE ? "OK" : jobs[i].state == GRAPH_NODE_SKIPPED ? "SKIPPED" : "FAILED";
+    printf("%-*s %s%-*s%s %*.1fs\n",
+           id_width, jobs[i].repo_id,
+           color, status_width, label, NC,
+           time_width - 1, jobs[i].seconds);
+  }
+
+  printf("\nTotal wall time: %.1fs\n\n", total_seconds);
 }
 
-void deploy_all_repos()
+// Deploy a set of repositories, pruning once at the end. Repositories start once
+// everything they depend on has deployed, up to `jobs` at a time; a failure skips
+// the repositories that depend on it and nothing else. Returns 0 when every
+// repository deployed, -1 otherwise.
+int deploy_repos(const char *const *repo_ids, size_t count, const struct deploy_options *options)
 {
-  const char *sql = "SELECT id FROM repositories;";
-  sqlite3_stmt *stmt;
+  struct deploy_job *jobs = calloc(count ? count : 1, sizeof(struct deploy_job));
+  enum graph_node_state *states = malloc((count ? count : 1) * sizeof(enum graph_node_state));
+  if (!jobs || !states)
+  {
+    log_message(ERROR, ERROR_SYMBOL, "Out of memory while collecting repositories.");
+    free(jobs);
+    free(states);
+    return -1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    jobs[i].repo_id = strdup(repo_ids[i]);
+    jobs[i].status = -1;
+    jobs[i].seconds = 0;
+    output_buffer_init(&jobs[i].output);
+  }
+
+  struct graph_edge *edges = NULL;
+  size_t edge_count = 0;
+  if (dependency_edges(repo_ids, count, &edges, &edge_count) != 0)
+  {
+    log_message(WARNING, WARNING_SYMBOL, "Failed to read repository dependencies; deploying without ordering.");
+  }
+
+  int job_count = resolve_job_count(options ? options->jobs : 1);
+  if (edge_count > 0)
+  {
+    char log_msg[256];
+    snprintf(log_msg, sizeof(log_msg), "Ordering %zu deployments by %zu dependencies.", count, edge_count);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+  }
+
+  struct deploy_options job_options = {0};
+  if (options)
+  {
+    job_options = *options;
+  }
+  job_options.skip_cleanup = 1;
+  job_options.jobs = count > 1 ? job_count : 1;
+
+  struct deploy_batch batch = {jobs, &job_options, job_count > 1, PTHREAD_MUTEX_INITIALIZER};
+
+  if (job_count > 1)
+  {
+    char log_msg[256];
+    snprintf(log_msg, sizeof(log_msg), "Running %zu deployments with %d parallel jobs...", count, job_count);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+  }
+
+  struct run_timer fleet_timer;
+  run_timer_start(&fleet_timer, RUN_KIND_FLEET, "*");
+  run_timer_phase(&fleet_timer, "deploys");
+
+  double started = monotonic_seconds();
+  run_task_graph(count, edges, edge_count, job_count, deploy_job_task, &batch, states);
+  for (size_t i = 0; i < count; i++)
+  {
+    jobs[i].state = states[i];
+  }
+  free(states);
+  free(edges);
+
+  // Check the global prune once for the whole fleet instead of once per repository
+  if (count > 0)
+  {
+    run_timer_phase(&fleet_timer, "prune");
+    prune_if_due();
+  }
+  double total_seconds = monotonic_seconds() - started;
+
+  print_deploy_summary(jobs, count, total_seconds);
+
+  // Every job's fingerprint and timings, plus the fleet run, land in one commit
+  database_begin();
 
+  int failed = 0;
+  int skipped = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (jobs[i].state == GRAPH_NODE_SKIPPED)
+    {
+      skipped++;
+      free(jobs[i].repo_id);
+      output_buffer_free(&jobs[i].output);
+      continue;
+    }
+    if (jobs[i].status != 0)
+    {
+      failed++;
+    }
+    record_deploy(&jobs[i].record);
+    free(jobs[i].repo_id);
+    output_buffer_free(&jobs[i].output);
+  }
+  free(jobs);
+  pthread_mutex_destroy(&batch.print_lock);
+
+  run_timer_stop(&fleet_timer, failed + skipped > 0 ? -1 : 0);
+  run_timer_record(&fleet_timer);
+
+  if (database_commit() != 0)
+  {
+    log_message(WARNING, WARNING_SYMBOL, "Failed to record the deploy results.");
+  }
+  write_metrics_textfile();
+
+  if (failed + skipped > 0)
+  {
+    char log_msg[256];
+    snprintf(log_msg, sizeof(log_msg), "%d of %zu repositories failed to deploy and %d were skipped.", failed, count, skipped);
+    log_message(ERROR, ERROR_SYMBOL, log_msg);
+  }
+  else
+  {
+    log_message(SUCCESS, SUCCESS_SYMBOL, "All repositories have been deployed.");
+  }
+
+  return failed + skipped > 0 ? -1 : 0;
+}
+
+// Returns 0 when every repository deployed, -1 otherwise
+int deploy_all_repos(const struct deploy_options *options)
+{
   log_message(INFO, INFO_SYMBOL, "Deploying all repositories...");
 
-  if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK)
+  struct repository_list repositories;
+  if (repository_list_all(&repositories) != 0)
   {
     log_message(ERROR, ERROR_SYMBOL, "Failed to fetch repository IDs.");
-    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
-    return;
+    return -1;
+  }
+
+  const char **repo_ids = malloc((repositories.count ? repositories.count : 1) * sizeof(char *));
+  if (!repo_ids)
+  {
+    log_message(ERROR, ERROR_SYMBOL, "Out of memory while collecting repositories.");
+    repository_list_free(&repositories);
+    return -1;
   }
 
-  while (sqlite3_step(stmt) == SQLITE_ROW)
+  for (size_t i = 0; i < repositories.count; i++)
   {
-    const char *repo_id = (const char *)sqlite3_column_text(stmt, 0);
-    deploy_repo(repo_id);
+    repo_ids[i] = repositories.items[i].id;
   }
 
-  sqlite3_finalize(stmt);
-  log_message(SUCCESS, SUCCESS_SYMBOL, "All repositories have been deployed.");
+  int status = deploy_repos(repo_ids, repositories.count, options);
+
+  free(repo_ids);
+  repository_list_free(&repositories);
+  return status;
 }
 
 void delete_service(const char *repo_id)
@@ -299,14 +874,15 @@ void delete_service(const char *repo_id)
     return;
   }
 
-  // Construct the Docker service removal command
-  char service_delete_command[512];
-  snprintf(service_delete_command, sizeof(service_delete_command), "docker service rm %s_service > /dev/null 2>&1", repo_id);
+  // Remove the Docker service
+  char service_name[256];
+  snprintf(service_name, sizeof(service_name), "%s_service", repo_id);
 
-  int ret = system(service_delete_command);
-  if (ret != 0)
+  if (docker_service_remove(service_name) != 0)
   {
-    fprintf(stderr, "Failed to delete Docker service with exit code %d: %s\n", WEXITSTATUS(ret), service_delete_command);
+    char error_msg[512];
+    snprintf(error_msg, sizeof(error_msg), "Failed to delete Docker service %s.", service_name);
+    log_message(ERROR, ERROR_SYMBOL, error_msg);
   }
   else
   {
@@ -315,4 +891,86 @@ void delete_service(const char *repo_id)
 
   // Delete the repository entry and its directory
   delete_repo(repo_id);
+}
+
+// Discards the tar stream; the benchmark only measures packing
+static int discard_context(const void *data, size_t length, void *sink_context)
+{
+  return 0;
+}
+
+// Pack a context `runs` times and keep the fastest run's stats
+static int measure_context(const char *directory, const char *framework, struct context_stats *best, int runs)
+{
+  for (int run = 0; run < runs; run++)
+  {
+    struct build_context context;
+    if (build_context_init(&context, directory, framework, NULL) != 0)
+    {
+      return -1;
+    }
+
+    int status = build_context_pack(&context, discard_context, NULL);
+    if (status == 0 && (run == 0 || context.stats.seconds < best->seconds))
+    {
+      *best = context.stats;
+    }
+    build_context_free(&context);
+
+    if (status != 0)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Compare the filtered build context against sending the whole directory
+void benchmark_build_context(const char *repo_id)
+{
+  struct repository repository;
+  if (repository_find(repo_id, &repository) != 0)
+  {
+    log_message(ERROR, ERROR_SYMBOL, "Repository ID not found.");
+    return;
+  }
+
+  char directory[PATH_MAX];
+  if (!realpath(repository.destination_folder, directory))
+  {
+    log_message(ERROR, ERROR_SYMBOL, "Failed to resolve the absolute path of the destination folder.");
+    repository_free(&repository);
+    return;
+  }
+  repository_free(&repository);
+
+  const char *framework = check_repo_framework(directory);
+  const int runs = 3;
+
+  char log_msg[PATH_MAX + 128];
+  snprintf(log_msg, sizeof(log_msg), "Packing the build context of %s (%s), best of %d runs...", repo_id, directory, runs);
+  log_message(INFO, INFO_SYMBOL, log_msg);
+
+  struct context_stats full;
+  struct context_stats filtered;
+  if (measure_context(directory, NULL, &full, runs) != 0 || measure_context(directory, framework, &filtered, runs) != 0)
+  {
+    log_message(ERROR, ERROR_SYMBOL, "Failed to pack the build context.");
+    return;
+  }
+
+  log_flush();
+  printf("\n%-16s %12s %8s %9s %9s %12s\n", "Context", "Size (MiB)", "Files", "Excluded", "Time (s)", "MiB/s");
+  const struct context_stats *rows[] = {&full, &filtered};
+  const char *names[] = {"full directory", "filtered"};
+  for (int i = 0; i < 2; i++)
+  {
+    double mebibytes = (double)rows[i]->bytes / (1024.0 * 1024.0);
+    printf("%-16s %12.1f %8zu %9zu %9.3f %12.1f\n", names[i], mebibytes, rows[i]->files, rows[i]->excluded,
+           rows[i]->seconds, rows[i]->seconds > 0 ? mebibytes / rows[i]->seconds : 0);
+  }
+
+  double saved = full.bytes > 0 ? 100.0 * (double)(full.bytes - filtered.bytes) / (double)full.bytes : 0;
+  printf("\nFiltered context is %.1f%% smaller (%.1f MiB less to upload per deploy).\n\n",
+         saved, (double)(full.bytes - filtered.bytes) / (1024.0 * 1024.0));
 }
\ No newline at end of file
@@ -1,13 +1,963 @@
 #include "docker.h"
 #include "logger.h"
+#include "utils.h"
+#include <json-c/json.h>
+#include <stdio.h>
+#include <string.h>
+
+// Return parent[key], creating an empty object there if it is missing
+static struct json_object *ensure_object(struct json_object *parent, const char *key)
+{
+    struct json_object *child;
+    if (json_object_object_get_ex(parent, key, &child) && json_object_is_type(child, json_type_object))
+    {
+        return child;
+    }
+
+    child = json_object_new_object();
+    json_object_object_add(parent, key, child);
+    return child;
+}
+
+// Walk a path of object keys; NULL if any step is missing
+static struct json_object *json_path(struct json_object *object, const char *const keys[])
+{
+    for (size_t i = 0; object && keys[i]; i++)
+    {
+        if (!json_object_object_get_ex(object, keys[i], &object))
+        {
+            return NULL;
+        }
+    }
+    return object;
+}
+
+// Parse "KEY=VALUE" pairs into a JSON object for buildargs/labels query parameters
+static struct json_object *key_value_object(const char *const *pairs)
+{
+    struct json_object *object = json_object_new_object();
+
+    for (size_t i = 0; pairs && pairs[i]; i++)
+    {
+        const char *separator = strchr(pairs[i], '=');
+        if (!separator)
+        {
+            continue;
+        }
+
+        char key[256];
+        snprintf(key, sizeof(key), "%.*s", (int)(separator - pairs[i]), pairs[i]);
+        json_object_object_add(object, key, json_object_new_string(separator + 1));
+    }
+
+    return object;
+}
+
+// Drop array entries whose `key` matches `match` (compared as strings)
+static void remove_array_entries(struct json_object *array, const char *key, struct json_object *match)
+{
+    for (size_t i = json_object_array_length(array); i > 0; i--)
+    {
+        struct json_object *item_value;
+        if (json_object_object_get_ex(json_object_array_get_idx(array, i - 1), key, &item_value) &&
+            strcmp(json_object_get_string(item_value), json_object_get_string(match)) == 0)
+        {
+            json_object_array_del_idx(array, i - 1, 1);
+        }
+    }
+}
+
+// Drop array entries whose `key` matches `match`, then append `entry`
+static void replace_array_entry(struct json_object *array, const char *key, struct json_object *match, struct json_object *entry)
+{
+    remove_array_entries(array, key, match);
+    json_object_array_add(array, entry);
+}
+
+static struct json_object *ensure_array(struct json_object *parent, const char *key)
+{
+    struct json_object *child;
+    if (json_object_object_get_ex(parent, key, &child) && json_object_is_type(child, json_type_array))
+    {
+        return child;
+    }
+
+    child = json_object_new_array();
+    json_object_object_add(parent, key, child);
+    return child;
+}
+
+// Bind-mount `source` at `target`, replacing whatever was mounted there
+static void add_bind_mount(struct json_object *container_spec, const char *source, const char *target_path)
+{
+    if (!source || !target_path)
+    {
+        return;
+    }
+
+    struct json_object *mount = json_object_new_object();
+    json_object_object_add(mount, "Type", json_object_new_string("bind"));
+    json_object_object_add(mount, "Source", json_object_new_string(source));
+    json_object_object_add(mount, "Target", json_object_new_string(target_path));
+
+    struct json_object *target = json_object_new_string(target_path);
+    replace_array_entry(ensure_array(container_spec, "Mounts"), "Target", target, mount);
+    json_object_put(target);
+}
+
+// Merge the desired state into a ServiceSpec, the API equivalent of the
+// --publish(-add), --mount(-add), --update-*, --replicas and --limit-* CLI flags
+static void apply_service_spec(struct json_object *spec, const struct docker_service_spec *desired)
+{
+    struct json_object *task_template = ensure_object(spec, "TaskTemplate");
+    struct json_object *container_spec = ensure_object(task_template, "ContainerSpec");
+
+    json_object_object_add(container_spec, "Image", json_object_new_string(desired->image));
+
+    if (desired->remove_mount_target)
+    {
+        struct json_object *target = json_object_new_string(desired->remove_mount_target);
+        remove_array_entries(ensure_array(container_spec, "Mounts"), "Target", target);
+        json_object_put(target);
+    }
+
+    add_bind_mount(container_spec, desired->mount_source, desired->mount_target);
+    add_bind_mount(container_spec, desired->shared_source, desired->shared_target);
+
+    if (desired->replicas > 0)
+    {
+        struct json_object *replicated = ensure_object(ensure_object(spec, "Mode"), "Replicated");
+        json_object_object_add(replicated, "Replicas", json_object_new_int(desired->replicas));
+    }
+
+    struct json_object *update_config = ensure_object(spec, "UpdateConfig");
+    json_object_object_add(update_config, "Parallelism", json_object_new_int(2));
+    json_object_object_add(update_config, "Delay", json_object_new_int64(10000000000LL)); // 10s in nanoseconds
+
+    if (desired->set_resources)
+    {
+        struct json_object *limits = json_object_new_object();
+        if (desired->cpu_limit > 0)
+        {
+            json_object_object_add(limits, "NanoCPUs", json_object_new_int64((long long)(desired->cpu_limit * 1e9)));
+        }
+        if (desired->memory_limit > 0)
+        {
+            json_object_object_add(limits, "MemoryBytes", json_object_new_int64(desired->memory_limit));
+        }
+        json_object_object_add(ensure_object(task_template, "Resources"), "Limits", limits);
+    }
+
+    int published_port = 0;
+    int target_port = 0;
+    if (desired->remove_port && sscanf(desired->remove_port, "%d:%d", &published_port, &target_port) == 2)
+    {
+        struct json_object *published = json_object_new_int(published_port);
+        remove_array_entries(ensure_array(ensure_object(spec, "EndpointSpec"), "Ports"), "PublishedPort", published);
+        json_object_put(published);
+    }
+
+    if (desired->port && sscanf(desired->port, "%d:%d", &published_port, &target_port) == 2)
+    {
+        struct json_object *port = json_object_new_object();
+        json_object_object_add(port, "Protocol", json_object_new_string("tcp"));
+        json_object_object_add(port, "PublishedPort", json_object_new_int(published_port));
+        json_object_object_add(port, "TargetPort", json_object_new_int(target_port));
+        json_object_object_add(port, "PublishMode", json_object_new_string("ingress"));
+
+        struct json_object *published = json_object_new_int(published_port);
+        replace_array_entry(ensure_array(ensure_object(spec, "EndpointSpec"), "Ports"), "PublishedPort", published, port);
+        json_object_put(published);
+    }
+}
+
+int docker_ping()
+{
+    return docker_api_request("GET", "/_ping", NULL, NULL, 0, NULL) == 200 ? 0 : -1;
+}
+
+// Make sure this node is a swarm manager. Returns 1 if the swarm was just
+// initialized, 0 if it was already active and -1 on failure.
+int docker_swarm_ensure()
+{
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("GET", "/info", NULL, NULL, 0, &body);
+    if (status != 200)
+    {
+        output_buffer_free(&body);
+        return -1;
+    }
+
+    struct json_object *info = json_tokener_parse(body.data);
+    const char *const state_path[] = {"Swarm", "LocalNodeState", NULL};
+    struct json_object *state = json_path(info, state_path);
+    int active = state && strcmp(json_object_get_string(state), "active") == 0;
+    json_object_put(info);
+    output_buffer_free(&body);
+
+    if (active)
+    {
+        return 0;
+    }
+
+    const char *request = "{\"ListenAddr\":\"0.0.0.0:2377\"}";
+    output_buffer_init(&body);
+    status = docker_api_request("POST", "/swarm/init", "application/json", request, strlen(request), &body);
+    output_buffer_free(&body);
+
+    return status == 200 ? 1 : -1;
+}
+
+// Fetch a service. Returns 0 and sets *service (caller releases it with
+// json_object_put) when found, 1 if it does not exist and -1 on error.
+int docker_service_inspect(const char *service_name, struct json_object **service)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "/services/%s", service_name);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("GET", path, NULL, NULL, 0, &body);
+    int result = -1;
+
+    if (status == 200 && body.data)
+    {
+        *service = json_tokener_parse(body.data);
+        result = *service ? 0 : -1;
+    }
+    else if (status == 404)
+    {
+        result = 1;
+    }
+    else
+    {
+        docker_log_api_error("Docker service inspect", status, &body);
+    }
+
+    output_buffer_free(&body);
+    return result;
+}
+
+// Image reference the service is configured to run
+int docker_service_image(const char *service_name, char *image, size_t size)
+{
+    struct json_object *service;
+    if (docker_service_inspect(service_name, &service) != 0)
+    {
+        return -1;
+    }
+
+    const char *const image_path[] = {"Spec", "TaskTemplate", "ContainerSpec", "Image", NULL};
+    struct json_object *image_object = json_path(service, image_path);
+    int result = -1;
+    if (image_object)
+    {
+        snprintf(image, size, "%s", json_object_get_string(image_object));
+        result = 0;
+    }
+
+    json_object_put(service);
+    return result;
+}
+
+int docker_service_create(const struct docker_service_spec *spec)
+{
+    struct json_object *request = json_object_new_object();
+    json_object_object_add(request, "Name", json_object_new_string(spec->name));
+    apply_service_spec(request, spec);
+
+    const char *request_body = json_object_to_json_string_ext(request, JSON_C_TO_STRING_PLAIN);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("POST", "/services/create", "application/json", request_body, strlen(request_body), &body);
+    if (status != 201)
+    {
+        docker_log_api_error("Docker service create", status, &body);
+    }
+
+    output_buffer_free(&body);
+    json_object_put(request);
+    return status == 201 ? 0 : -1;
+}
+
+// Update a service to the desired spec and force its tasks to be recreated.
+// `current` is the service as returned by docker_service_inspect().
+int docker_service_update(const struct docker_service_spec *spec, struct json_object *current)
+{
+    const char *const id_path[] = {"ID", NULL};
+    const char *const version_path[] = {"Version", "Index", NULL};
+    struct json_object *id = json_path(current, id_path);
+    struct json_object *version = json_path(current, version_path);
+    struct json_object *service_spec;
+
+    if (!id || !version || !json_object_object_get_ex(current, "Spec", &service_spec))
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Docker service update failed: unexpected service description.");
+        return -1;
+    }
+
+    apply_service_spec(service_spec, spec);
+
+    // Equivalent of --force: bumping ForceUpdate recreates the tasks even if nothing else changed
+    struct json_object *task_template = ensure_object(service_spec, "TaskTemplate");
+    struct json_object *force_update;
+    long long force_counter = 0;
+    if (json_object_object_get_ex(task_template, "ForceUpdate", &force_update))
+    {
+        force_counter = json_object_get_int64(force_update);
+    }
+    json_object_object_add(task_template, "ForceUpdate", json_object_new_int64(force_counter + 1));
+
+    char path[512];
+    snprintf(path, sizeof(path), "/services/%s/update?version=%lld", json_object_get_string(id), (long long)json_object_get_int64(version));
+
+    const char *request_body = json_object_to_json_string_ext(service_spec, JSON_C_TO_STRING_PLAIN);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("POST", path, "application/json", request_body, strlen(request_body), &body);
+    if (status != 200)
+    {
+        docker_log_api_error("Docker service update", status, &body);
+    }
+
+    output_buffer_free(&body);
+    return status == 200 ? 0 : -1;
+}
+
+int docker_service_remove(const char *service_name)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "/services/%s", service_name);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("DELETE", path, NULL, NULL, 0, &body);
+    if (status != 200)
+    {
+        docker_log_api_error("Docker service remove", status, &body);
+    }
+
+    output_buffer_free(&body);
+    return status == 200 ? 0 : -1;
+}
+
+// Parse an RFC 3339 timestamp such as "2024-05-01T10:00:00.123456789Z" (UTC); 0 if malformed
+static time_t parse_docker_time(const char *text)
+{
+    struct tm parsed;
+    memset(&parsed, 0, sizeof(parsed));
+    if (!text || sscanf(text, "%d-%d-%dT%d:%d:%d", &parsed.tm_year, &parsed.tm_mon, &parsed.tm_mday,
+                        &parsed.tm_hour, &parsed.tm_min, &parsed.tm_sec) != 6)
+    {
+        return 0;
+    }
+    parsed.tm_year -= 1900;
+    parsed.tm_mon -= 1;
+    return timegm(&parsed);
+}
+
+static const char *json_string_at(struct json_object *object, const char *const keys[])
+{
+    struct json_object *value = json_path(object, keys);
+    return value && json_object_is_type(value, json_type_string) ? json_object_get_string(value) : NULL;
+}
+
+// Read how far a service's rollout of `image` has come. Only an update started at or
+// after `since` is reported, so a stale "completed" from the previous update does not
+// count, and only failed tasks of `image` created since then are.
+int docker_service_rollout(const char *service_name, const char *image, time_t since, struct docker_rollout_status *status)
+{
+    memset(status, 0, sizeof(*status));
+
+    struct json_object *service;
+    if (docker_service_inspect(service_name, &service) != 0)
+    {
+        return -1;
+    }
+
+    const char *const started_path[] = {"UpdateStatus", "StartedAt", NULL};
+    const char *const state_path[] = {"UpdateStatus", "State", NULL};
+    const char *const message_path[] = {"UpdateStatus", "Message", NULL};
+    const char *state = json_string_at(service, state_path);
+    if (state && parse_docker_time(json_string_at(service, started_path)) >= since)
+    {
+        const char *message = json_string_at(service, message_path);
+        snprintf(status->update_state, sizeof(status->update_state), "%s", state);
+        snprintf(status->message, sizeof(status->message), "%s", message ? message : "");
+    }
+    json_object_put(service);
+
+    char filters[512];
+    char encoded_filters[1024];
+    char path[1200];
+    snprintf(filters, sizeof(filters), "{\"service\":[\"%s\"]}", service_name);
+    docker_url_encode(filters, encoded_filters, sizeof(encoded_filters));
+    snprintf(path, sizeof(path), "/tasks?filters=%s", encoded_filters);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int http_status = docker_api_request("GET", path, NULL, NULL, 0, &body);
+    struct json_object *tasks = http_status == 200 && body.data ? json_tokener_parse(body.data) : NULL;
+    if (!tasks || !json_object_is_type(tasks, json_type_array))
+    {
+        docker_log_api_error("Docker task list", http_status, &body);
+        json_object_put(tasks);
+        output_buffer_free(&body);
+        return -1;
+    }
+
+    const char *const desired_path[] = {"DesiredState", NULL};
+    const char *const task_state_path[] = {"Status", "State", NULL};
+    const char *const error_path[] = {"Status", "Err", NULL};
+    const char *const created_path[] = {"CreatedAt", NULL};
+    const char *const image_path[] = {"Spec", "ContainerSpec", "Image", NULL};
+    size_t image_length = strlen(image);
+    for (size_t i = 0; i < json_object_array_length(tasks); i++)
+    {
+        struct json_object *task = json_object_array_get_idx(tasks, i);
+        const char *desired = json_string_at(task, desired_path);
+        const char *task_state = json_string_at(task, task_state_path);
+        if (!desired || !task_state)
+        {
+            continue;
+        }
+
+        if (strcmp(desired, "running") == 0)
+        {
+            status->desired++;
+            status->running += strcmp(task_state, "running") == 0;
+        }
+        // Swarm may pin the task's image by appending "@sha256:..."
+        const char *task_image = json_string_at(task, image_path);
+        int same_image = task_image && strncmp(task_image, image, image_length) == 0 &&
+                         (task_image[image_length] == '\0' || task_image[image_length] == '@');
+
+        if ((strcmp(task_state, "failed") == 0 || strcmp(task_state, "rejected") == 0) && same_image &&
+            parse_docker_time(json_string_at(task, created_path)) >= since)
+        {
+            const char *error = json_string_at(task, error_path);
+            status->failed++;
+            snprintf(status->message, sizeof(status->message), "%s", error ? error : task_state);
+        }
+    }
+
+    json_object_put(tasks);
+    output_buffer_free(&body);
+    return 0;
+}
+
+int docker_buildkit_enabled()
+{
+    const char *setting = getenv(DOCKER_BUILDKIT_ENV);
+    return !setting || strcmp(setting, "0") != 0;
+}
+
+// A BuildKit build step, tracked by digest across its status updates
+struct build_vertex
+{
+    char digest[96];
+    int step; // Named like "[vendor 2/3] RUN ...", unlike "[internal] load .dockerignore"
+    int cached;
+    int failed;
+};
+
+// Decoder state for the JSON message stream returned by /build
+struct build_progress
+{
+    struct output_buffer pending;
+    struct output_buffer *log;
+    char error[1024];
+    char image_id[160];
+    struct build_vertex *vertices;
+    size_t vertex_count;
+    size_t vertex_capacity;
+};
+
+// Cursor over a protobuf message
+struct proto_reader
+{
+    const unsigned char *data;
+    size_t length;
+    size_t offset;
+};
+
+// One protobuf field: a varint value or a length-delimited payload
+struct proto_field
+{
+    unsigned long long number;
+    unsigned long long value;
+    struct proto_reader payload;
+};
+
+static int proto_varint(struct proto_reader *reader, unsigned long long *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && reader->offset < reader->length; shift += 7)
+    {
+        unsigned char byte = reader->data[reader->offset++];
+        *value |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Read the next field. Returns 1 for a field, 0 at the end and -1 on malformed input.
+static int proto_next(struct proto_reader *reader, struct proto_field *field)
+{
+    unsigned long long key;
+    if (reader->offset >= reader->length)
+    {
+        return 0;
+    }
+    if (proto_varint(reader, &key) != 0)
+    {
+        return -1;
+    }
+
+    memset(field, 0, sizeof(*field));
+    field->number = key >> 3;
+
+    switch (key & 7)
+    {
+    case 0: // varint
+        return proto_varint(reader, &field->value) == 0 ? 1 : -1;
+    case 1: // 64-bit
+    case 5: // 32-bit
+    {
+        size_t width = (key & 7) == 1 ? 8 : 4;
+        if (reader->length - reader->offset < width)
+        {
+            return -1;
+        }
+        reader->offset += width;
+        return 1;
+    }
+    case 2: // length-delimited
+        if (proto_varint(reader, &field->value) != 0 || field->value > reader->length - reader->offset)
+        {
+            return -1;
+        }
+        field->payload.data = reader->data + reader->offset;
+        field->payload.length = (size_t)field->value;
+        reader->offset += field->payload.length;
+        return 1;
+    default:
+        return -1;
+    }
+}
+
+static void proto_string(const struct proto_field *field, char *text, size_t size)
+{
+    snprintf(text, size, "%.*s", (int)field->payload.length, (const char *)field->payload.data);
+}
+
+// Decode standard base64 into `data`, which needs room for 3/4 of the text.
+// Returns the decoded length or -1.
+static long base64_decode(const char *text, unsigned char *data)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned int accumulator = 0;
+    int bits = 0;
+    long length = 0;
+
+    for (const char *c = text; *c != '\0' && *c != '='; c++)
+    {
+        const char *position = strchr(alphabet, *c);
+        if (!position)
+        {
+            return -1;
+        }
+        accumulator = (accumulator << 6) | (unsigned int)(position - alphabet);
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            data[length++] = (unsigned char)(accumulator >> bits);
+            accumulator &= (1u << bits) - 1;
+        }
+    }
+    return length;
+}
+
+static struct build_vertex *find_build_vertex(struct build_progress *progress, const char *digest)
+{
+    for (size_t i = 0; i < progress->vertex_count; i++)
+    {
+        if (strcmp(progress->vertices[i].digest, digest) == 0)
+        {
+            return &progress->vertices[i];
+        }
+    }
+
+    if (progress->vertex_count == progress->vertex_capacity)
+    {
+        size_t capacity = progress->vertex_capacity ? progress->vertex_capacity * 2 : 32;
+        struct build_vertex *vertices = realloc(progress->vertices, capacity * sizeof(*vertices));
+        if (!vertices)
+        {
+            return NULL;
+        }
+        progress->vertices = vertices;
+        progress->vertex_capacity = capacity;
+    }
+
+    struct build_vertex *vertex = &progress->vertices[progress->vertex_count++];
+    memset(vertex, 0, sizeof(*vertex));
+    snprintf(vertex->digest, sizeof(vertex->digest), "%s", digest);
+    return vertex;
+}
+
+// Vertex fields: digest = 1, name = 3, cached = 4, error = 7
+static void handle_trace_vertex(struct build_progress *progress, struct proto_reader message)
+{
+    char digest[96] = "";
+    char name[512] = "";
+    char error[512] = "";
+    int cached = 0;
+
+    struct proto_field field;
+    while (proto_next(&message, &field) == 1)
+    {
+        if (field.number == 1)
+        {
+            proto_string(&field, digest, sizeof(digest));
+        }
+        else if (field.number == 3)
+        {
+            proto_string(&field, name, sizeof(name));
+        }
+        else if (field.number == 4)
+        {
+            cached = field.value != 0;
+        }
+        else if (field.number == 7)
+        {
+            proto_string(&field, error, sizeof(error));
+        }
+    }
+
+    size_t known = progress->vertex_count;
+    struct build_vertex *vertex = digest[0] != '\0' ? find_build_vertex(progress, digest) : NULL;
+    if (!vertex)
+    {
+        return;
+    }
+
+    if (progress->vertex_count > known)
+    {
+        vertex->step = name[0] == '[' && strncmp(name, "[internal]", 10) != 0;
+        if (progress->log && name[0] != '\0')
+        {
+            output_buffer_appendf(progress->log, "=> %s\n", name);
+        }
+    }
+    vertex->cached |= cached;
+
+    if (error[0] != '\0' && !vertex->failed)
+    {
+        vertex->failed = 1;
+        if (progress->log)
+        {
+            output_buffer_appendf(progress->log, "ERROR: %s: %s\n", name, error);
+        }
+    }
+}
+
+// BuildKit sends its progress as base64 encoded StatusResponse protobufs:
+// vertexes = 1 (steps) and logs = 3 (their output, in the msg = 4 field)
+static void handle_buildkit_trace(struct build_progress *progress, const char *encoded)
+{
+    unsigned char *data = malloc(strlen(encoded) / 4 * 3 + 3);
+    long length = data ? base64_decode(encoded, data) : -1;
+    if (length < 0)
+    {
+        free(data);
+        return;
+    }
+
+    struct proto_reader response = {data, (size_t)length, 0};
+    struct proto_field field;
+    while (proto_next(&response, &field) == 1)
+    {
+        if (field.number == 1)
+        {
+            handle_trace_vertex(progress, field.payload);
+        }
+        else if (field.number == 3 && progress->log)
+        {
+            struct proto_field log_field;
+            while (proto_next(&field.payload, &log_field) == 1)
+            {
+                if (log_field.number == 4)
+                {
+                    output_buffer_append(progress->log, (const char *)log_field.payload.data, log_field.payload.length);
+                }
+            }
+        }
+    }
+
+    free(data);
+}
+
+static void handle_build_message(struct build_progress *progress, const char *line)
+{
+    struct json_object *message = json_tokener_parse(line);
+    if (!message)
+    {
+        return;
+    }
+
+    struct json_object *value;
+    if (json_object_object_get_ex(message, "stream", &value) && progress->log)
+    {
+        const char *text = json_object_get_string(value);
+        output_buffer_append(progress->log, text, strlen(text));
+    }
+    if (json_object_object_get_ex(message, "error", &value))
+    {
+        snprintf(progress->error, sizeof(progress->error), "%s", json_object_get_string(value));
+        if (progress->log)
+        {
+            output_buffer_appendf(progress->log, "%s\n", progress->error);
+        }
+    }
+
+    struct json_object *aux;
+    if (json_object_object_get_ex(message, "id", &value) && strcmp(json_object_get_string(value), "moby.buildkit.trace") == 0 &&
+        json_object_object_get_ex(message, "aux", &aux) && json_object_is_type(aux, json_type_string))
+    {
+        handle_buildkit_trace(progress, json_object_get_string(aux));
+    }
+
+    const char *const id_path[] = {"aux", "ID", NULL};
+    struct json_object *id = json_path(message, id_path);
+    if (id)
+    {
+        snprintf(progress->image_id, sizeof(progress->image_id), "%s", json_object_get_string(id));
+    }
+
+    json_object_put(message);
+}
+
+// Messages are newline separated JSON objects that may span several reads
+static void build_progress_sink(const char *data, size_t length, void *context)
+{
+    struct build_progress *progress = context;
+    output_buffer_append(&progress->pending, data, length);
+
+    char *line = progress->pending.data;
+    char *newline;
+    while (line && (newline = strchr(line, '\n')) != NULL)
+    {
+        *newline = '\0';
+        handle_build_message(progress, line);
+        line = newline + 1;
+    }
+
+    // Keep only the unfinished tail
+    if (line && line != progress->pending.data)
+    {
+        size_t remaining = progress->pending.length - (size_t)(line - progress->pending.data);
+        memmove(progress->pending.data, line, remaining + 1);
+        progress->pending.length = remaining;
+    }
+}
+
+// Build an image from a streamed tar context. The daemon's build output is
+// appended to `log` (may be NULL), decoded from BuildKit's trace when BuildKit
+// is on, and the new image ID copied to `image_id` (may be NULL). Returns 0 on
+// success and -1 on failure.
+int docker_image_build(const struct docker_build_request *request, struct output_buffer *log, char *image_id, size_t image_id_size)
+{
+    struct json_object *buildargs = key_value_object(request->buildargs);
+    struct json_object *labels = key_value_object(request->labels);
+
+    char encoded_tag[512];
+    char encoded_dockerfile[1024];
+    char encoded_buildargs[2048];
+    char encoded_labels[2048];
+    docker_url_encode(request->tag, encoded_tag, sizeof(encoded_tag));
+    docker_url_encode(request->dockerfile, encoded_dockerfile, sizeof(encoded_dockerfile));
+    docker_url_encode(json_object_to_json_string_ext(buildargs, JSON_C_TO_STRING_PLAIN), encoded_buildargs, sizeof(encoded_buildargs));
+    docker_url_encode(json_object_to_json_string_ext(labels, JSON_C_TO_STRING_PLAIN), encoded_labels, sizeof(encoded_labels));
+    json_object_put(buildargs);
+    json_object_put(labels);
+
+    char path[8192];
+    snprintf(path, sizeof(path), "/build?t=%s&dockerfile=%s&buildargs=%s&labels=%s&rm=1&forcerm=1%s",
+             encoded_tag, encoded_dockerfile, encoded_buildargs, encoded_labels,
+             docker_buildkit_enabled() ? "&version=2" : "");
+
+    struct build_progress progress;
+    memset(&progress, 0, sizeof(progress));
+    output_buffer_init(&progress.pending);
+    progress.log = log;
+
+    int status = docker_api_stream("POST", path, "application/x-tar",
+                                   request->context_writer, request->context_writer_context,
+                                   build_progress_sink, &progress);
+
+    // A final message without a trailing newline
+    if (progress.pending.length > 0)
+    {
+        handle_build_message(&progress, progress.pending.data);
+    }
+
+    int result = 0;
+    if (status != 200)
+    {
+        docker_log_api_error("Docker build", status, &progress.pending);
+        result = -1;
+    }
+    else if (progress.error[0] != '\0')
+    {
+        result = -1;
+    }
+
+    if (image_id && image_id_size > 0)
+    {
+        snprintf(image_id, image_id_size, "%s", progress.image_id);
+    }
+
+    if (request->stats)
+    {
+        memset(request->stats, 0, sizeof(*request->stats));
+        for (size_t i = 0; i < progress.vertex_count; i++)
+        {
+            request->stats->steps += progress.vertices[i].step;
+            request->stats->cached_steps += progress.vertices[i].step && progress.vertices[i].cached;
+        }
+    }
+
+    free(progress.vertices);
+    output_buffer_free(&progress.pending);
+    return result;
+}
+
+// Read one label from an image's config. Returns 0 if the label is set.
+int docker_image_label(const char *image, const char *label, char *value, size_t size)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "/images/%s/json", image);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int result = -1;
+    if (docker_api_request("GET", path, NULL, NULL, 0, &body) == 200 && body.data)
+    {
+        struct json_object *inspect = json_tokener_parse(body.data);
+        const char *const label_path[] = {"Config", "Labels", label, NULL};
+        struct json_object *label_value = json_path(inspect, label_path);
+        if (label_value && json_object_is_type(label_value, json_type_string))
+        {
+            snprintf(value, size, "%s", json_object_get_string(label_value));
+            result = 0;
+        }
+        json_object_put(inspect);
+    }
+
+    output_buffer_free(&body);
+    return result;
+}
+
+// Remove one image by ID without forcing. Returns 0 when it was removed, 1 if
+// it no longer exists, 2 while a container still uses it (or another tag still
+// points at it) and -1 on other errors.
+int docker_image_remove(const char *image_id)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "/images/%s", image_id);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("DELETE", path, NULL, NULL, 0, &body);
+    int result = status == 200 ? 0 : status == 404 ? 1 : status == 409 ? 2 : -1;
+    if (result < 0)
+    {
+        docker_log_api_error("Docker image remove", status, &body);
+    }
+
+    output_buffer_free(&body);
+    return result;
+}
+
+// Add repository:tag to an image (name or ID), moving the tag if it exists
+int docker_image_add_tag(const char *image, const char *repository, const char *tag)
+{
+    char encoded_repository[512];
+    char encoded_tag[256];
+    docker_url_encode(repository, encoded_repository, sizeof(encoded_repository));
+    docker_url_encode(tag, encoded_tag, sizeof(encoded_tag));
+
+    char path[1024];
+    snprintf(path, sizeof(path), "/images/%s/tag?repo=%s&tag=%s", image, encoded_repository, encoded_tag);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("POST", path, NULL, NULL, 0, &body);
+    if (status != 201)
+    {
+        docker_log_api_error("Docker image tag", status, &body);
+    }
+
+    output_buffer_free(&body);
+    return status == 201 ? 0 : -1;
+}
+
+// Repository part of an image reference: up to the last ':' that comes after the last '/'
+void docker_image_repository(const char *reference, char *repository, size_t size)
+{
+    snprintf(repository, size, "%s", reference);
+    char *tag_separator = strrchr(repository, ':');
+    if (tag_separator && !strchr(tag_separator, '/'))
+    {
+        *tag_separator = '\0';
+    }
+}
+
+// Prune unused "images" (dangling only), "networks" or "volumes"
+int docker_prune(const char *resource, long long *space_reclaimed)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/%s/prune", resource);
+
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("POST", path, NULL, NULL, 0, &body);
+    if (status == 200 && space_reclaimed && body.data)
+    {
+        struct json_object *response = json_tokener_parse(body.data);
+        struct json_object *reclaimed;
+        *space_reclaimed = json_object_object_get_ex(response, "SpaceReclaimed", &reclaimed) ? json_object_get_int64(reclaimed) : 0;
+        json_object_put(response);
+    }
+
+    output_buffer_free(&body);
+    return status == 200 ? 0 : -1;
+}
 
 void clean_up_unused_resources()
 {
     log_message(INFO, INFO_SYMBOL, "Cleaning up dangling images and unused resources...");
 
     // Remove dangling images
-    const char *remove_dangling_images_command = "docker image prune -f > /dev/null 2>&1";
-    int ret = system(remove_dangling_images_command);
+    int ret = docker_prune("images", NULL);
     if (ret != 0)
     {
         log_message(WARNING, WARNING_SYMBOL, "Failed to remove dangling images.");
@@ -18,8 +968,7 @@ void clean_up_unused_resources()
     }
 
     // Remove unused networks
-    const char *remove_unused_networks_command = "docker network prune -f > /dev/null 2>&1";
-    ret = system(remove_unused_networks_command);
+    ret = docker_prune("networks", NULL);
     if (ret != 0)
     {
         log_message(WARNING, WARNING_SYMBOL, "Failed to remove unused networks.");
@@ -30,8 +979,7 @@ void clean_up_unused_resources()
     }
 
     // Remove unused volumes
-    const char *remove_unused_volumes_command = "docker volume prune -f > /dev/null 2>&1";
-    ret = system(remove_unused_volumes_command);
+    ret = docker_prune("volumes", NULL);
     if (ret != 0)
     {
         log_message(WARNING, WARNING_SYMBOL, "Failed to remove unused volumes.");
@@ -44,30 +992,62 @@ void clean_up_unused_resources()
     log_message(SUCCESS, SUCCESS_SYMBOL, "Cleanup completed.");
 }
 
+// Demultiplexer for the stdout/stderr framed log stream (8 byte header per frame)
+struct log_stream
+{
+    unsigned char header[8];
+    size_t header_length;
+    size_t frame_remaining;
+};
+
+static void service_log_sink(const char *data, size_t length, void *context)
+{
+    struct log_stream *stream = context;
+
+    while (length > 0)
+    {
+        if (stream->frame_remaining == 0)
+        {
+            size_t needed = sizeof(stream->header) - stream->header_length;
+            size_t take = length < needed ? length : needed;
+            memcpy(stream->header + stream->header_length, data, take);
+            stream->header_length += take;
+            data += take;
+            length -= take;
+
+            if (stream->header_length == sizeof(stream->header))
+            {
+                stream->frame_remaining = ((size_t)stream->header[4] << 24) | ((size_t)stream->header[5] << 16) |
+                                          ((size_t)stream->header[6] << 8) | (size_t)stream->header[7];
+                stream->header_length = 0;
+            }
+            continue;
+        }
+
+        size_t take = length < stream->frame_remaining ? length : stream->frame_remaining;
+        fwrite(data, 1, take, stream->header[0] == 2 ? stderr : stdout);
+        fflush(stdout);
+        data += take;
+        length -= take;
+        stream->frame_remaining -= take;
+    }
+}
+
 void show_docker_service_logs(const char *repo_id)
 {
-    char command[512];
-    snprintf(command, sizeof(command), "docker service logs -f %s_service", repo_id);
+    char path[512];
+    snprintf(path, sizeof(path), "/services/%s_service/logs?follow=1&stdout=1&stderr=1", repo_id);
 
     log_message(INFO, INFO_SYMBOL, "Fetching and following Docker service logs...");
+    log_flush();
 
-    int ret = system(command);
+    struct log_stream stream = {{0}, 0, 0};
+    int status = docker_api_stream("GET", path, NULL, NULL, NULL, service_log_sink, &stream);
 
-    if (ret == -1)
+    if (status != 200)
     {
-        perror("system");
-        exit(1);
-    }
-    else if (ret != 0)
-    {
-        // Handle non-zero return codes
-        fprintf(stderr, "Command failed with exit code %d: %s\n", WEXITSTATUS(ret), command);
-
-        // Optionally, you can re-run the command without redirection for debugging:
-        char debug_command[512];
-        snprintf(debug_command, sizeof(debug_command), "%s", command);
-        system(debug_command); // Run the command again to see the output
-        exit(1);
+        docker_log_api_error("Docker service logs", status, NULL);
+        return;
     }
 
     log_message(SUCCESS, SUCCESS_SYMBOL, "Docker service logs displayed successfully.");
@@ -0,0 +1,447 @@
+#include "docker.h"
+#include "logger.h"
+#include "utils.h"
+#include <errno.h>
+#include <json-c/json.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Linux reports a closed peer with EPIPE only if SIGPIPE is suppressed per call
+#ifdef MSG_NOSIGNAL
+#define DOCKER_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define DOCKER_SEND_FLAGS 0
+#endif
+
+// Buffered reader over the daemon connection
+struct docker_reader
+{
+    int fd;
+    char buffer[16384];
+    size_t start;
+    size_t end;
+};
+
+const char *docker_socket_path()
+{
+    const char *docker_host = getenv("DOCKER_HOST");
+    if (docker_host && strncmp(docker_host, "unix://", 7) == 0)
+    {
+        return docker_host + 7;
+    }
+
+    return DOCKER_DEFAULT_SOCKET;
+}
+
+static int docker_connect()
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    const char *socket_path = docker_socket_path();
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+#ifdef SO_NOSIGPIPE
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int send_all(int fd, const void *data, size_t length)
+{
+    const char *bytes = data;
+    while (length > 0)
+    {
+        ssize_t sent = send(fd, bytes, length, DOCKER_SEND_FLAGS);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        bytes += sent;
+        length -= (size_t)sent;
+    }
+    return 0;
+}
+
+// Write one chunk of a chunked request body
+int docker_stream_write(struct docker_stream *stream, const void *data, size_t length)
+{
+    if (stream->failed)
+    {
+        return -1;
+    }
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    char header[32];
+    int header_length = snprintf(header, sizeof(header), "%zx\r\n", length);
+
+    if (send_all(stream->fd, header, (size_t)header_length) != 0 ||
+        send_all(stream->fd, data, length) != 0 ||
+        send_all(stream->fd, "\r\n", 2) != 0)
+    {
+        // The daemon closed the connection early; its response explains why
+        stream->failed = 1;
+        return -1;
+    }
+
+    stream->bytes_written += length;
+    return 0;
+}
+
+// process_sink adapter so a child's stdout can feed a request body directly
+void docker_stream_sink(const char *data, size_t length, void *context)
+{
+    docker_stream_write((struct docker_stream *)context, data, length);
+}
+
+static ssize_t reader_fill(struct docker_reader *reader)
+{
+    if (reader->start > 0)
+    {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    if (reader->end == sizeof(reader->buffer))
+    {
+        return -1;
+    }
+
+    ssize_t received;
+    do
+    {
+        received = recv(reader->fd, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end, 0);
+    } while (received < 0 && errno == EINTR);
+
+    if (received > 0)
+    {
+        reader->end += (size_t)received;
+    }
+    return received;
+}
+
+// Read one CRLF terminated line (without the CRLF). Returns its length or -1.
+static ssize_t reader_line(struct docker_reader *reader, char *line, size_t size)
+{
+    while (1)
+    {
+        char *newline = memchr(reader->buffer + reader->start, '\n', reader->end - reader->start);
+        if (newline)
+        {
+            size_t length = (size_t)(newline - (reader->buffer + reader->start));
+            size_t copy_length = length;
+            if (copy_length > 0 && reader->buffer[reader->start + copy_length - 1] == '\r')
+            {
+                copy_length--;
+            }
+            if (copy_length >= size)
+            {
+                copy_length = size - 1;
+            }
+
+            memcpy(line, reader->buffer + reader->start, copy_length);
+            line[copy_length] = '\0';
+            reader->start += length + 1;
+            return (ssize_t)copy_length;
+        }
+
+        if (reader_fill(reader) <= 0)
+        {
+            return -1;
+        }
+    }
+}
+
+// Pass exactly `length` body bytes to the sink (or all remaining bytes if length < 0)
+static int reader_body(struct docker_reader *reader, long long length, docker_body_sink sink, void *sink_context)
+{
+    while (length != 0)
+    {
+        if (reader->start == reader->end && reader_fill(reader) <= 0)
+        {
+            return length < 0 ? 0 : -1;
+        }
+
+        size_t available = reader->end - reader->start;
+        if (length > 0 && (long long)available > length)
+        {
+            available = (size_t)length;
+        }
+
+        if (sink)
+        {
+            sink(reader->buffer + reader->start, available, sink_context);
+        }
+        reader->start += available;
+        if (length > 0)
+        {
+            length -= (long long)available;
+        }
+    }
+
+    return 0;
+}
+
+static int reader_chunked_body(struct docker_reader *reader, docker_body_sink sink, void *sink_context)
+{
+    char line[256];
+
+    while (1)
+    {
+        if (reader_line(reader, line, sizeof(line)) < 0)
+        {
+            return -1;
+        }
+
+        long long chunk_length = strtoll(line, NULL, 16);
+        if (chunk_length == 0)
+        {
+            // Skip optional trailers up to the blank line that ends the message
+            while (reader_line(reader, line, sizeof(line)) > 0)
+            {
+            }
+            return 0;
+        }
+
+        if (reader_body(reader, chunk_length, sink, sink_context) != 0 ||
+            reader_line(reader, line, sizeof(line)) < 0)
+        {
+            return -1;
+        }
+    }
+}
+
+// Percent-encode a query parameter value
+void docker_url_encode(const char *value, char *encoded, size_t size)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    size_t used = 0;
+
+    for (const unsigned char *p = (const unsigned char *)value; *p && used + 4 < size; p++)
+    {
+        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') ||
+            *p == '-' || *p == '_' || *p == '.' || *p == '~')
+        {
+            encoded[used++] = (char)*p;
+        }
+        else
+        {
+            encoded[used++] = '%';
+            encoded[used++] = digits[*p >> 4];
+            encoded[used++] = digits[*p & 0x0f];
+        }
+    }
+
+    encoded[used] = '\0';
+}
+
+// Parse the status line and headers, then deliver the body. Closes fd.
+static int read_response(int fd, docker_body_sink sink, void *sink_context)
+{
+    struct docker_reader reader;
+    reader.fd = fd;
+    reader.start = 0;
+    reader.end = 0;
+
+    char line[1024];
+    int status = -1;
+
+    if (reader_line(&reader, line, sizeof(line)) < 0 || sscanf(line, "HTTP/%*s %d", &status) != 1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    long long content_length = -1;
+    int chunked = 0;
+
+    while (1)
+    {
+        ssize_t length = reader_line(&reader, line, sizeof(line));
+        if (length < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        if (length == 0)
+        {
+            break;
+        }
+
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            content_length = strtoll(line + 15, NULL, 10);
+        }
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line + 18, "chunked"))
+        {
+            chunked = 1;
+        }
+    }
+
+    int body_status;
+    if (chunked)
+    {
+        body_status = reader_chunked_body(&reader, sink, sink_context);
+    }
+    else if (status == 204 || status == 304)
+    {
+        body_status = 0;
+    }
+    else
+    {
+        // Without a length the body runs until the daemon closes the connection
+        body_status = reader_body(&reader, content_length, sink, sink_context);
+    }
+
+    close(fd);
+    return body_status == 0 ? status : -1;
+}
+
+// Send a request and stream the response body into `sink`. When `writer` is
+// set the request body is sent with chunked transfer encoding as it is
+// produced. Returns the HTTP status code, or -1 if the daemon is unreachable.
+int docker_api_stream(const char *method, const char *path, const char *content_type,
+                      docker_body_writer writer, void *writer_context,
+                      docker_body_sink sink, void *sink_context)
+{
+    int fd = docker_connect();
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    char header[4096];
+    int header_length = snprintf(header, sizeof(header),
+                                 "%s /" DOCKER_API_VERSION "%s HTTP/1.1\r\n"
+                                 "Host: docker\r\n"
+                                 "User-Agent: dployer\r\n"
+                                 "Connection: close\r\n"
+                                 "%s%s%s"
+                                 "%s"
+                                 "\r\n",
+                                 method, path,
+                                 content_type ? "Content-Type: " : "", content_type ? content_type : "", content_type ? "\r\n" : "",
+                                 writer ? "Transfer-Encoding: chunked\r\n" : "Content-Length: 0\r\n");
+
+    if (header_length < 0 || header_length >= (int)sizeof(header) || send_all(fd, header, (size_t)header_length) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (writer)
+    {
+        struct docker_stream stream = {fd, 0, 0};
+        writer(&stream, writer_context);
+
+        // Terminate the body even after a writer error so the daemon can answer
+        if (!stream.failed)
+        {
+            send_all(fd, "0\r\n\r\n", 5);
+        }
+    }
+
+    return read_response(fd, sink, sink_context);
+}
+
+static void collect_body(const char *data, size_t length, void *context)
+{
+    output_buffer_append((struct output_buffer *)context, data, length);
+}
+
+// Send a request with an in-memory body (may be NULL) and collect the response
+// body into `response_body` (may be NULL). Returns the HTTP status code, or -1.
+int docker_api_request(const char *method, const char *path, const char *content_type,
+                       const char *body, size_t body_length, struct output_buffer *response_body)
+{
+    int fd = docker_connect();
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    char header[4096];
+    int header_length = snprintf(header, sizeof(header),
+                                 "%s /" DOCKER_API_VERSION "%s HTTP/1.1\r\n"
+                                 "Host: docker\r\n"
+                                 "User-Agent: dployer\r\n"
+                                 "Connection: close\r\n"
+                                 "%s%s%s"
+                                 "Content-Length: %zu\r\n"
+                                 "\r\n",
+                                 method, path,
+                                 content_type ? "Content-Type: " : "", content_type ? content_type : "", content_type ? "\r\n" : "",
+                                 body ? body_length : 0);
+
+    if (header_length < 0 || header_length >= (int)sizeof(header) ||
+        send_all(fd, header, (size_t)header_length) != 0 ||
+        (body && body_length > 0 && send_all(fd, body, body_length) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return read_response(fd, response_body ? collect_body : NULL, response_body);
+}
+
+// Log a failed API call together with the daemon's error message
+void docker_log_api_error(const char *action, int status, const struct output_buffer *body)
+{
+    char error_msg[1024];
+
+    if (status < 0)
+    {
+        snprintf(error_msg, sizeof(error_msg), "%s failed: cannot reach the Docker daemon at %s.", action, docker_socket_path());
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        return;
+    }
+
+    const char *message = NULL;
+    struct json_object *parsed = body && body->data ? json_tokener_parse(body->data) : NULL;
+    struct json_object *message_object;
+    if (parsed && json_object_object_get_ex(parsed, "message", &message_object))
+    {
+        message = json_object_get_string(message_object);
+    }
+
+    snprintf(error_msg, sizeof(error_msg), "%s failed with HTTP %d: %s", action, status,
+             message ? message : (body && body->data ? body->data : "no details"));
+    log_message(ERROR, ERROR_SYMBOL, error_msg);
+
+    if (parsed)
+    {
+        json_object_put(parsed);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "fingerprint.h"
+#include "process.h"
+#include "utils.h"
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Hash every regular file below `path` in name order, mixing in relative paths
+static int hash_directory_entries(const char *path, const char *relative_path, struct sha256_context *context)
+{
+  struct dirent **entries;
+  int count = scandir(path, &entries, NULL, alphasort);
+  if (count < 0)
+  {
+    return -1;
+  }
+
+  int status = 0;
+  for (int i = 0; i < count; i++)
+  {
+    const char *name = entries[i]->d_name;
+    if (status != 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    {
+      free(entries[i]);
+      continue;
+    }
+
+    char child_path[PATH_MAX];
+    char child_relative_path[PATH_MAX];
+    snprintf(child_path, sizeof(child_path), "%s/%s", path, name);
+    snprintf(child_relative_path, sizeof(child_relative_path), "%s%s%s", relative_path, *relative_path ? "/" : "", name);
+
+    struct stat st;
+    if (stat(child_path, &st) != 0)
+    {
+      status = -1;
+    }
+    else if (S_ISDIR(st.st_mode))
+    {
+      status = hash_directory_entries(child_path, child_relative_path, context);
+    }
+    else if (S_ISREG(st.st_mode))
+    {
+      char file_hash[SHA256_HEX_SIZE];
+      if (sha256_file_hex(child_path, file_hash) != 0)
+      {
+        status = -1;
+      }
+      else
+      {
+        // Path, mode and content all change what ends up in the image
+        char mode[16];
+        snprintf(mode, sizeof(mode), "%o", (unsigned)(st.st_mode & 0777));
+        sha256_update(context, child_relative_path, strlen(child_relative_path) + 1);
+        sha256_update(context, mode, strlen(mode) + 1);
+        sha256_update(context, file_hash, sizeof(file_hash));
+      }
+    }
+
+    free(entries[i]);
+  }
+
+  free(entries);
+  return status;
+}
+
+int hash_directory_tree(const char *path, struct sha256_context *context)
+{
+  return hash_directory_entries(path, "", context);
+}
+
+// Hash the working tree changes relative to HEAD, including untracked files.
+// The docker/ directory is excluded because dployer stages its own files there.
+static int hash_dirty_tree(const char *repo_path, char hex[SHA256_HEX_SIZE], int *dirty)
+{
+  struct sha256_context context;
+  sha256_init(&context);
+
+  struct output_buffer status_output;
+  struct output_buffer diff_output;
+  output_buffer_init(&status_output);
+  output_buffer_init(&diff_output);
+
+  const char *status_command[] = {"git", "-C", repo_path, "status", "--porcelain=v1", "-z", "--untracked-files=all",
+                                  "--", ".", ":(exclude)docker", NULL};
+  const char *diff_command[] = {"git", "-C", repo_path, "diff", "HEAD", "--binary",
+                                "--", ".", ":(exclude)docker", NULL};
+
+  int status = -1;
+  if (process_run_stdout(status_command, &status_output, NULL) == 0 &&
+      process_run_stdout(diff_command, &diff_output, NULL) == 0)
+  {
+    status = 0;
+
+    if (status_output.length > 0)
+    {
+      sha256_update(&context, status_output.data, status_output.length);
+    }
+    if (diff_output.length > 0)
+    {
+      sha256_update(&context, diff_output.data, diff_output.length);
+    }
+
+    // git diff does not cover untracked files, so hash their content directly.
+    // Entries are NUL separated "XY path" records.
+    for (size_t offset = 0; offset < status_output.length;)
+    {
+      const char *record = status_output.data + offset;
+      size_t record_length = strlen(record);
+
+      if (record_length > 3 && strncmp(record, "?? ", 3) == 0)
+      {
+        char file_path[PATH_MAX];
+        char file_hash[SHA256_HEX_SIZE];
+        snprintf(file_path, sizeof(file_path), "%s/%s", repo_path, record + 3);
+        if (sha256_file_hex(file_path, file_hash) == 0)
+        {
+          sha256_update(&context, file_hash, sizeof(file_hash));
+        }
+      }
+
+      offset += record_length + 1;
+    }
+  }
+
+  if (status == 0)
+  {
+    sha256_final_hex(&context, hex);
+    *dirty = status_output.length > 0;
+  }
+
+  output_buffer_free(&status_output);
+  output_buffer_free(&diff_output);
+  return status;
+}
+
+// Compute the fingerprint of a repository checkout as it would be built.
+// Returns 0 on success and -1 if any part could not be determined.
+int compute_repo_fingerprint(const char *repo_path, const char *config_source, const char *dockerfile_name, struct repo_fingerprint *fingerprint)
+{
+  struct output_buffer head_output;
+  output_buffer_init(&head_output);
+
+  const char *head_command[] = {"git", "-C", repo_path, "rev-parse", "HEAD", NULL};
+  if (process_run_stdout(head_command, &head_output, NULL) != 0 ||
+      head_output.length == 0)
+  {
+    output_buffer_free(&head_output);
+    return -1;
+  }
+  head_output.data[strcspn(head_output.data, "\r\n")] = '\0';
+  snprintf(fingerprint->head_commit, sizeof(fingerprint->head_commit), "%s", head_output.data);
+  output_buffer_free(&head_output);
+
+  if (hash_dirty_tree(repo_path, fingerprint->tree_hash, &fingerprint->dirty) != 0)
+  {
+    return -1;
+  }
+
+  // The config bundle plus the Dockerfile chosen from it and the build arguments
+  struct sha256_context context;
+  sha256_init(&context);
+  if (hash_directory_tree(config_source, &context) != 0)
+  {
+    return -1;
+  }
+
+  char build_inputs[128];
+  snprintf(build_inputs, sizeof(build_inputs), "%s:%d:%d", dockerfile_name, (int)getuid(), (int)getgid());
+  sha256_update(&context, build_inputs, strlen(build_inputs) + 1);
+  sha256_final_hex(&context, fingerprint->config_hash);
+
+  sha256_init(&context);
+  sha256_update(&context, fingerprint->head_commit, strlen(fingerprint->head_commit) + 1);
+  sha256_update(&context, fingerprint->tree_hash, sizeof(fingerprint->tree_hash));
+  sha256_update(&context, fingerprint->config_hash, sizeof(fingerprint->config_hash));
+  sha256_final_hex(&context, fingerprint->combined);
+
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,328 @@
+#include "git_cache.h"
+#include "logger.h"
+#include "repo.h"
+#include "sha256.h"
+#include "utils.h"
+#include "worktree.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int git_cache_enabled()
+{
+    const char *setting = getenv(GIT_CACHE_ENV);
+    return !setting || strcmp(setting, "0") != 0;
+}
+
+// "--depth=N" when shallow clones are configured, otherwise NULL
+static const char *clone_depth_argument(char *argument, size_t size)
+{
+    const char *configured = getenv(GIT_CLONE_DEPTH_ENV);
+    char *end = NULL;
+    long depth = configured ? strtol(configured, &end, 10) : 0;
+    if (!configured || *end != '\0' || depth <= 0)
+    {
+        return NULL;
+    }
+    snprintf(argument, size, "--depth=%ld", depth);
+    return argument;
+}
+
+static const char *clone_filter_argument(char *argument, size_t size)
+{
+    const char *filter = getenv(GIT_CLONE_FILTER_ENV);
+    if (!filter || filter[0] == '\0')
+    {
+        return NULL;
+    }
+    snprintf(argument, size, "--filter=%s", filter);
+    return argument;
+}
+
+// One bare repository per origin in {HOME}/.config/dployer/git-cache, named by the URL's hash
+static int git_cache_path(const char *git_url, char *path, size_t size)
+{
+    const char *home_dir = getenv("HOME");
+    if (!home_dir)
+    {
+        return -1;
+    }
+
+    char cache_dir[PATH_MAX];
+    snprintf(cache_dir, sizeof(cache_dir), "%s/.config/dployer/git-cache", home_dir);
+    if (mkdir(cache_dir, 0700) != 0 && errno != EEXIST)
+    {
+        return -1;
+    }
+
+    struct sha256_context context;
+    char url_hash[SHA256_HEX_SIZE];
+    sha256_init(&context);
+    sha256_update(&context, git_url, strlen(git_url));
+    sha256_final_hex(&context, url_hash);
+
+    return snprintf(path, size, "%s/%.16s.git", cache_dir, url_hash) < (int)size ? 0 : -1;
+}
+
+// Serialize fetches into one cache across threads and processes, like the base image lock
+static int lock_git_cache(const char *cache_path)
+{
+    char lock_path[PATH_MAX];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", cache_path);
+
+    int fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    while (flock(fd, LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Checkouts borrow the cache's objects through alternates, so the cache must never drop
+// an object, even one that a force-pushed branch left unreachable
+static int create_git_cache(const char *cache_path, const char *git_url)
+{
+    const char *init_command[] = {"git", "init", "--bare", "--quiet", cache_path, NULL};
+    const char *remote_command[] = {"git", "-C", cache_path, "config", "remote.origin.url", git_url, NULL};
+    const char *prune_command[] = {"git", "-C", cache_path, "config", "gc.pruneExpire", "never", NULL};
+
+    if (run_git_step(init_command, "Failed to create the git object cache.") != 0 ||
+        run_git_step(remote_command, "Failed to configure the git object cache.") != 0 ||
+        run_git_step(prune_command, "Failed to configure the git object cache.") != 0)
+    {
+        remove_directory(cache_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Bring the shared cache of `git_url` up to date with one branch, or with every tag.
+// Returns 0 with the cache's path, 1 when the cache is disabled and -1 on failure.
+int git_cache_sync(const char *git_url, const char *branch_or_tag, int is_tag, char *cache_path, size_t size)
+{
+    if (!git_cache_enabled())
+    {
+        return 1;
+    }
+    if (git_cache_path(git_url, cache_path, size) != 0)
+    {
+        return -1;
+    }
+
+    int lock_fd = lock_git_cache(cache_path);
+    if (lock_fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    int status = stat(cache_path, &st) == 0 ? 0 : create_git_cache(cache_path, git_url);
+    if (status == 0)
+    {
+        char refspec[600];
+        if (is_tag)
+        {
+            snprintf(refspec, sizeof(refspec), "+refs/tags/*:refs/tags/*");
+        }
+        else
+        {
+            snprintf(refspec, sizeof(refspec), "+refs/heads/%s:refs/heads/%s", branch_or_tag, branch_or_tag);
+        }
+
+        const char *fetch_command[] = {"git", "-C", cache_path, "fetch", "--quiet", "--no-tags", "origin", refspec, NULL};
+        status = run_git_step(fetch_command, "Failed to update the git object cache.");
+    }
+
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    return status;
+}
+
+// Remove the cache of `git_url` once no repository is cloned from it any more. A fetch into
+// it finishes first; the lock file stays, so a waiter never holds a lock nobody else sees.
+// Returns 0 on success, also when there is no cache.
+int git_cache_remove(const char *git_url)
+{
+    char cache_path[PATH_MAX];
+    struct stat st;
+    if (git_cache_path(git_url, cache_path, sizeof(cache_path)) != 0)
+    {
+        return -1;
+    }
+    if (stat(cache_path, &st) != 0)
+    {
+        return 0;
+    }
+
+    int lock_fd = lock_git_cache(cache_path);
+    if (lock_fd < 0)
+    {
+        return -1;
+    }
+    int status = remove_directory(cache_path);
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+
+    if (status == 0)
+    {
+        char log_msg[PATH_MAX + 64];
+        snprintf(log_msg, sizeof(log_msg), "Removed the git object cache of %s.", git_url);
+        log_message(INFO, INFO_SYMBOL, log_msg);
+    }
+    return status;
+}
+
+// Whether a checkout, or the store its worktree belongs to, reads objects from the shared cache
+int git_cache_borrowed(const char *repo_path)
+{
+    char git_dir[PATH_MAX];
+    char common_dir[PATH_MAX];
+    if (git_dirs(repo_path, git_dir, sizeof(git_dir), common_dir, sizeof(common_dir)) != 0)
+    {
+        return 0;
+    }
+
+    char alternates[PATH_MAX + 32];
+    snprintf(alternates, sizeof(alternates), "%s/objects/info/alternates", common_dir);
+    return access(alternates, F_OK) == 0;
+}
+
+// Clone only `branch_or_tag`, shallow and filtered as configured, borrowing objects
+// from the shared cache when it is enabled. `bare` clones an object store for
+// worktrees instead of a checkout. Returns 0 on success.
+int git_clone_repo(const char *git_url, const char *branch_or_tag, int is_tag, int bare, const char *destination)
+{
+    char cache_path[PATH_MAX];
+    char depth_argument[32];
+    char filter_argument[128];
+
+    int cache_status = git_cache_sync(git_url, branch_or_tag, is_tag, cache_path, sizeof(cache_path));
+    if (cache_status < 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "Git object cache unavailable; cloning everything from the remote.");
+    }
+
+    const char *command[16];
+    size_t argc = 0;
+    command[argc++] = "git";
+    command[argc++] = "clone";
+    if (bare)
+    {
+        command[argc++] = "--bare";
+    }
+    command[argc++] = "--single-branch";
+    command[argc++] = "--branch";
+    command[argc++] = branch_or_tag;
+    if (clone_depth_argument(depth_argument, sizeof(depth_argument)))
+    {
+        command[argc++] = depth_argument;
+    }
+    if (clone_filter_argument(filter_argument, sizeof(filter_argument)))
+    {
+        command[argc++] = filter_argument;
+    }
+    if (cache_status == 0)
+    {
+        command[argc++] = "--reference";
+        command[argc++] = cache_path;
+    }
+    command[argc++] = git_url;
+    command[argc++] = destination;
+    command[argc] = NULL;
+
+    // No loader animation: apply runs clones in parallel
+    char clone_message[PATH_MAX + 64];
+    snprintf(clone_message, sizeof(clone_message), "Cloning %s (%s).", git_url, branch_or_tag);
+    log_message(INFO, INFO_SYMBOL, clone_message);
+    return run_git_step(command, "Failed to clone the repository.");
+}
+
+// Fetch one branch into its remote-tracking ref, one tag, or every tag when
+// `branch_or_tag` is NULL, instead of all of the remote's refs. The cache is
+// refreshed first for checkouts that borrow from it, so the objects usually
+// arrive from disk. `limit_depth` applies the clone depth to refs the checkout
+// may not have yet. Returns 0 on success.
+int git_fetch_ref(const char *repo_path, const char *git_url, const char *branch_or_tag, int is_tag, int limit_depth,
+                  const char *failure_message)
+{
+    char cache_path[PATH_MAX];
+    if (git_cache_borrowed(repo_path) && git_cache_sync(git_url, branch_or_tag, is_tag, cache_path, sizeof(cache_path)) < 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "Failed to refresh the git object cache; fetching from the remote.");
+    }
+
+    char refspec[600];
+    if (is_tag && !branch_or_tag)
+    {
+        snprintf(refspec, sizeof(refspec), "+refs/tags/*:refs/tags/*");
+    }
+    else if (is_tag)
+    {
+        snprintf(refspec, sizeof(refspec), "+refs/tags/%s:refs/tags/%s", branch_or_tag, branch_or_tag);
+    }
+    else
+    {
+        snprintf(refspec, sizeof(refspec), "+refs/heads/%s:refs/remotes/origin/%s", branch_or_tag, branch_or_tag);
+    }
+
+    char depth_argument[32];
+    const char *command[10];
+    size_t argc = 0;
+    command[argc++] = "git";
+    command[argc++] = "-C";
+    command[argc++] = repo_path;
+    command[argc++] = "fetch";
+    command[argc++] = "--no-tags";
+    if (limit_depth && clone_depth_argument(depth_argument, sizeof(depth_argument)))
+    {
+        command[argc++] = depth_argument;
+    }
+    command[argc++] = "origin";
+    command[argc++] = refspec;
+    command[argc] = NULL;
+
+    return run_git_step(command, failure_message);
+}
+
+// Add `branch` to the refs a single-branch checkout fetches, so that checking it out
+// sets origin/<branch> as its upstream. Returns 0 on success.
+int git_track_branch(const char *repo_path, const char *branch)
+{
+    char refspec[600];
+    snprintf(refspec, sizeof(refspec), "+refs/heads/%s:refs/remotes/origin/%s", branch, branch);
+
+    struct output_buffer configured;
+    output_buffer_init(&configured);
+    const char *get_command[] = {"git", "-C", repo_path, "config", "--get-all", "remote.origin.fetch", NULL};
+    run_command(get_command, &configured);
+
+    int tracked = 0;
+    char *save_ptr = NULL;
+    for (char *line = configured.data ? strtok_r(configured.data, "\r\n", &save_ptr) : NULL; line && !tracked;
+         line = strtok_r(NULL, "\r\n", &save_ptr))
+    {
+        tracked = strcmp(line, refspec) == 0 || strcmp(line, "+refs/heads/*:refs/remotes/origin/*") == 0;
+    }
+    output_buffer_free(&configured);
+
+    if (tracked)
+    {
+        return 0;
+    }
+    const char *add_command[] = {"git", "-C", repo_path, "config", "--add", "remote.origin.fetch", refspec, NULL};
+    return run_git_step(add_command, "Failed to track the branch.");
+}
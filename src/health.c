@@ -0,0 +1,229 @@
+#include "health.h"
+#include "docker.h"
+#include "logger.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// A single probe may take this long to connect and answer
+#define HEALTH_PROBE_TIMEOUT_MS 2000
+
+// Pause between rollout checks and between probes
+#define HEALTH_POLL_INTERVAL_MS 1000
+
+// Monotonic time by which a rollout started now has to be healthy
+double health_deadline()
+{
+    const char *configured = getenv(HEALTH_TIMEOUT_ENV);
+    char *end = NULL;
+    long seconds = configured ? strtol(configured, &end, 10) : 0;
+    if (!configured || *end != '\0' || seconds <= 0)
+    {
+        seconds = HEALTH_DEFAULT_TIMEOUT_SECONDS;
+    }
+    return monotonic_seconds() + (double)seconds;
+}
+
+static void pause_between_polls()
+{
+    poll(NULL, 0, HEALTH_POLL_INTERVAL_MS);
+}
+
+static int connect_with_timeout(const char *host, int port)
+{
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *addresses;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0)
+    {
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address && fd < 0; address = address->ai_next)
+    {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, address->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        int connected = connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+        if (!connected && errno == EINPROGRESS)
+        {
+            struct pollfd descriptor = {fd, POLLOUT, 0};
+            int error = 0;
+            socklen_t length = sizeof(error);
+            connected = poll(&descriptor, 1, HEALTH_PROBE_TIMEOUT_MS) == 1 &&
+                        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0;
+        }
+        if (!connected)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+// GET `path` over plain HTTP. Returns the response status, or -1 when there was
+// no answer within HEALTH_PROBE_TIMEOUT_MS.
+int health_probe(const char *host, int port, const char *path)
+{
+    int fd = connect_with_timeout(host, port);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    char request[1024];
+    int request_length = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\nHost: %s:%d\r\nUser-Agent: dployer\r\nConnection: close\r\n\r\n",
+                                  path, host, port);
+    if (request_length < 0 || (size_t)request_length >= sizeof(request) ||
+        send(fd, request, (size_t)request_length, MSG_NOSIGNAL) != request_length)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Only the status line matters
+    char response[64];
+    size_t length = 0;
+    while (length < sizeof(response) - 1 && !memchr(response, '\n', length))
+    {
+        struct pollfd descriptor = {fd, POLLIN, 0};
+        if (poll(&descriptor, 1, HEALTH_PROBE_TIMEOUT_MS) != 1)
+        {
+            break;
+        }
+        ssize_t count = recv(fd, response + length, sizeof(response) - 1 - length, 0);
+        if (count <= 0)
+        {
+            break;
+        }
+        length += (size_t)count;
+    }
+    close(fd);
+    response[length] = '\0';
+
+    int status;
+    return sscanf(response, "HTTP/%*d.%*d %d", &status) == 1 ? status : -1;
+}
+
+// Wait until every task of the service runs and, for an update, swarm reports it
+// completed. `image` is the reference the rollout deploys. Returns 0 once it has, -1 when it failed, paused or timed out.
+int health_wait_for_rollout(const char *service_name, const char *image, int expect_update, time_t since, double deadline)
+{
+    char log_msg[512];
+    struct docker_rollout_status status;
+
+    while (1)
+    {
+        int known = docker_service_rollout(service_name, image, since, &status) == 0;
+        if (known)
+        {
+            if (strcmp(status.update_state, "paused") == 0 || strncmp(status.update_state, "rollback", 8) == 0)
+            {
+                snprintf(log_msg, sizeof(log_msg), "Rollout of %s %s: %s", service_name, status.update_state, status.message);
+                log_message(ERROR, ERROR_SYMBOL, log_msg);
+                return -1;
+            }
+            if (status.failed >= HEALTH_MAX_TASK_FAILURES)
+            {
+                snprintf(log_msg, sizeof(log_msg), "Tasks of %s keep failing (%d so far): %s", service_name, status.failed, status.message);
+                log_message(ERROR, ERROR_SYMBOL, log_msg);
+                return -1;
+            }
+            if (status.desired > 0 && status.running == status.desired &&
+                (!expect_update || strcmp(status.update_state, "completed") == 0))
+            {
+                snprintf(log_msg, sizeof(log_msg), "All %d task%s of %s running.", status.desired, status.desired == 1 ? "" : "s", service_name);
+                log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+                return 0;
+            }
+        }
+
+        if (monotonic_seconds() >= deadline)
+        {
+            snprintf(log_msg, sizeof(log_msg), "Timed out waiting for %s: %d of %d tasks running%s%s.", service_name,
+                     known ? status.running : 0, known ? status.desired : 0,
+                     known && status.message[0] != '\0' ? "; last error: " : "", known ? status.message : "");
+            log_message(ERROR, ERROR_SYMBOL, log_msg);
+            return -1;
+        }
+        pause_between_polls();
+    }
+}
+
+// Gate a deploy on its rollout and on `path` answering 2xx or 3xx on the published
+// port HEALTH_REQUIRED_SUCCESSES times in a row. Returns 0 when healthy.
+int health_gate(const char *service_name, const char *image, int expect_update, time_t since, const char *port_mapping,
+                const char *path)
+{
+    double deadline = health_deadline();
+    if (health_wait_for_rollout(service_name, image, expect_update, since, deadline) != 0)
+    {
+        return -1;
+    }
+
+    int port = 0;
+    if (!port_mapping || sscanf(port_mapping, "%d:", &port) != 1 || port <= 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Health check needs a published port.");
+        return -1;
+    }
+
+    const char *host = getenv(HEALTH_HOST_ENV);
+    if (!host || host[0] == '\0')
+    {
+        host = HEALTH_DEFAULT_HOST;
+    }
+
+    char log_msg[512];
+    snprintf(log_msg, sizeof(log_msg), "Probing http://%s:%d%s...", host, port, path);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+
+    int successes = 0;
+    int last_status = -1;
+    while (1)
+    {
+        last_status = health_probe(host, port, path);
+        successes = last_status >= 200 && last_status < 400 ? successes + 1 : 0;
+        if (successes >= HEALTH_REQUIRED_SUCCESSES)
+        {
+            snprintf(log_msg, sizeof(log_msg), "Health check passed (HTTP %d).", last_status);
+            log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+            return 0;
+        }
+
+        if (monotonic_seconds() >= deadline)
+        {
+            if (last_status < 0)
+            {
+                snprintf(log_msg, sizeof(log_msg), "Health check failed: no answer from http://%s:%d%s.", host, port, path);
+            }
+            else
+            {
+                snprintf(log_msg, sizeof(log_msg), "Health check failed: http://%s:%d%s answered HTTP %d.", host, port, path, last_status);
+            }
+            log_message(ERROR, ERROR_SYMBOL, log_msg);
+            return -1;
+        }
+        pause_between_polls();
+    }
+}
\ No newline at end of file
@@ -1,14 +1,630 @@
 #include "logger.h"
+#include "utils.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Lines are copied into a fixed ring by the calling thread and rendered and
+// written by a background flusher, so log_message() never blocks on the
+// terminal. Longer messages bypass the ring and are written synchronously.
+#define LOG_RING_SIZE 2048 // Must be a power of two
+#define LOG_MESSAGE_SIZE 480
+
+#define LOG_SINK_TERMINAL 1
+#define LOG_SINK_FILE 2
+
+enum log_level
+{
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_SUCCESS,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR
+};
+
+static const char *const level_names[] = {"info", "ok", "warning", "error"};
+
+struct log_record
+{
+    size_t sequence; // Slot state: equals the claim position + 1 once published
+    int level;
+    int sinks;
+    const char *color;
+    const char *symbol;
+    struct timespec time;
+    char repo[LOG_REPO_SIZE];
+    char phase[LOG_PHASE_SIZE];
+    char message[LOG_MESSAGE_SIZE];
+};
+
+static struct
+{
+    struct log_record records[LOG_RING_SIZE];
+    size_t head;    // Next slot claimed by a producer
+    size_t tail;    // Next slot read by the flusher
+    size_t written; // Lines up to here have reached their sinks
+    int sleeping;
+    int flush_waiters;
+    int running;
+    int stopping;
+    int async;
+    int threshold;
+    int json_terminal;
+    FILE *terminal;
+    FILE *file;
+    pthread_t thread;
+    pthread_mutex_t lock; // Guards the wake and flushed conditions
+    pthread_cond_t wake;
+    pthread_cond_t flushed;
+    pthread_mutex_t output_lock; // Serializes writes to the sinks
+} logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .flushed = PTHREAD_COND_INITIALIZER,
+    .output_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_once_t logger_once = PTHREAD_ONCE_INIT;
+
+// Buffer receiving this thread's log lines instead of stdout (see log_capture)
+static __thread struct output_buffer *capture_buffer = NULL;
+
+// Repository and phase of the run this thread is working on
+static __thread struct log_context thread_context;
+
+void log_capture(struct output_buffer *buffer)
+{
+    capture_buffer = buffer;
+}
+
+void log_context_push(struct log_context *saved, const char *repo)
+{
+    *saved = thread_context;
+    snprintf(thread_context.repo, sizeof(thread_context.repo), "%s", repo ? repo : "");
+    thread_context.phase[0] = '\0';
+}
+
+void log_context_pop(const struct log_context *saved)
+{
+    thread_context = *saved;
+}
+
+void log_set_phase(const char *phase)
+{
+    snprintf(thread_context.phase, sizeof(thread_context.phase), "%s", phase ? phase : "");
+}
+
+static int level_of(const char *symbol)
+{
+    if (strcmp(symbol, ERROR_SYMBOL) == 0)
+    {
+        return LOG_LEVEL_ERROR;
+    }
+    if (strcmp(symbol, WARNING_SYMBOL) == 0)
+    {
+        return LOG_LEVEL_WARNING;
+    }
+    if (strcmp(symbol, SUCCESS_SYMBOL) == 0)
+    {
+        return LOG_LEVEL_SUCCESS;
+    }
+    return LOG_LEVEL_INFO;
+}
+
+// "YYYY-MM-DD HH:MM:SS" in local time; localtime_r only runs once per second per thread
+static const char *format_local_time(time_t seconds)
+{
+    static __thread time_t cached_second = -1;
+    static __thread char cached[32];
+
+    if (seconds != cached_second)
+    {
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        strftime(cached, sizeof(cached), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_second = seconds;
+    }
+    return cached;
+}
+
+static void append_json_string(struct output_buffer *out, const char *value)
+{
+    output_buffer_append(out, "\"", 1);
+    for (const unsigned char *c = (const unsigned char *)value; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            char escaped[2] = {'\\', (char)*c};
+            output_buffer_append(out, escaped, 2);
+        }
+        else if (*c == '\n')
+        {
+            output_buffer_append(out, "\\n", 2);
+        }
+        else if (*c < 0x20)
+        {
+            output_buffer_appendf(out, "\\u%04x", *c);
+        }
+        else
+        {
+            output_buffer_append(out, (const char *)c, 1);
+        }
+    }
+    output_buffer_append(out, "\"", 1);
+}
+
+// Render one line, either in the terminal format or as a JSON object
+static void render_line(struct output_buffer *out, int json, int level, const char *color, const char *symbol,
+                        const struct timespec *time, const char *repo, const char *phase, const char *message)
+{
+    if (!json)
+    {
+        // Use a consistent label "[LOG]" for all log levels and ensure alignment
+        output_buffer_appendf(out, "%s[LOG] %s [%s] %s%s\n", color, symbol, format_local_time(time->tv_sec), message, NC);
+        return;
+    }
+
+    struct tm tm;
+    gmtime_r(&time->tv_sec, &tm);
+    output_buffer_appendf(out, "{\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.%03ldZ\",\"level\":\"%s\"",
+                          tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                          time->tv_nsec / 1000000, level_names[level]);
+    if (repo[0] != '\0')
+    {
+        output_buffer_append(out, ",\"repo\":", 8);
+        append_json_string(out, repo);
+    }
+    if (phase[0] != '\0')
+    {
+        output_buffer_append(out, ",\"phase\":", 9);
+        append_json_string(out, phase);
+    }
+    output_buffer_append(out, ",\"message\":", 11);
+    append_json_string(out, message);
+    output_buffer_append(out, "}\n", 2);
+}
+
+static void render_record(struct output_buffer *terminal_out, struct output_buffer *file_out, const struct log_record *record,
+                          const char *message)
+{
+    if (record->sinks & LOG_SINK_TERMINAL)
+    {
+        render_line(terminal_out, logger.json_terminal, record->level, record->color, record->symbol,
+                    &record->time, record->repo, record->phase, message);
+    }
+    if ((record->sinks & LOG_SINK_FILE) && logger.file)
+    {
+        render_line(file_out, 1, record->level, record->color, record->symbol,
+                    &record->time, record->repo, record->phase, message);
+    }
+}
+
+// Write rendered lines to the sinks. Called with output_lock held.
+static void write_sinks(struct output_buffer *terminal_out, struct output_buffer *file_out)
+{
+    if (terminal_out->length > 0)
+    {
+        fwrite(terminal_out->data, 1, terminal_out->length, logger.terminal);
+        fflush(logger.terminal);
+        terminal_out->length = 0;
+    }
+    if (file_out->length > 0 && logger.file)
+    {
+        fwrite(file_out->data, 1, file_out->length, logger.file);
+        fflush(logger.file);
+    }
+    file_out->length = 0;
+}
+
+static int record_ready(size_t position)
+{
+    const struct log_record *record = &logger.records[position & (LOG_RING_SIZE - 1)];
+    return __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) == position + 1;
+}
+
+static void *logger_thread(void *arg)
+{
+    struct output_buffer terminal_out;
+    struct output_buffer file_out;
+    output_buffer_init(&terminal_out);
+    output_buffer_init(&file_out);
+
+    while (1)
+    {
+        // Render everything published so far, freeing each slot as soon as it is copied out
+        size_t drained = 0;
+        while (record_ready(logger.tail))
+        {
+            struct log_record *record = &logger.records[logger.tail & (LOG_RING_SIZE - 1)];
+            render_record(&terminal_out, &file_out, record, record->message);
+            __atomic_store_n(&record->sequence, logger.tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+            logger.tail++;
+            drained++;
+        }
+
+        if (drained > 0)
+        {
+            pthread_mutex_lock(&logger.output_lock);
+            write_sinks(&terminal_out, &file_out);
+            pthread_mutex_unlock(&logger.output_lock);
+
+            __atomic_store_n(&logger.written, logger.tail, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&logger.flush_waiters, __ATOMIC_SEQ_CST) > 0)
+            {
+                pthread_mutex_lock(&logger.lock);
+                pthread_cond_broadcast(&logger.flushed);
+                pthread_mutex_unlock(&logger.lock);
+            }
+            continue;
+        }
+
+        // Nothing ready: sleep until a producer publishes a line or shutdown begins
+        pthread_mutex_lock(&logger.lock);
+        __atomic_store_n(&logger.sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!record_ready(logger.tail) && !logger.stopping)
+        {
+            pthread_cond_wait(&logger.wake, &logger.lock);
+        }
+        __atomic_store_n(&logger.sleeping, 0, __ATOMIC_SEQ_CST);
+        int stop = logger.stopping && !record_ready(logger.tail);
+        pthread_mutex_unlock(&logger.lock);
+
+        if (stop)
+        {
+            break;
+        }
+    }
+
+    output_buffer_free(&terminal_out);
+    output_buffer_free(&file_out);
+    return NULL;
+}
+
+// Drain the ring and stop the flusher; later lines are written synchronously
+static void logger_shutdown()
+{
+    if (!__atomic_load_n(&logger.running, __ATOMIC_SEQ_CST))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&logger.lock);
+    logger.stopping = 1;
+    pthread_cond_signal(&logger.wake);
+    pthread_mutex_unlock(&logger.lock);
+    pthread_join(logger.thread, NULL);
+
+    __atomic_store_n(&logger.running, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&logger.async, 0, __ATOMIC_SEQ_CST);
+}
+
+// A forked child has no flusher thread, so it writes its own lines synchronously
+static void logger_after_fork()
+{
+    logger.running = 0;
+    logger.async = 0;
+    pthread_mutex_init(&logger.lock, NULL);
+    pthread_mutex_init(&logger.output_lock, NULL);
+}
+
+static void logger_init()
+{
+    logger.terminal = stdout;
+    logger.threshold = LOG_LEVEL_INFO;
+
+    const char *level = getenv(LOG_LEVEL_ENV);
+    for (int i = 0; level && i < (int)(sizeof(level_names) / sizeof(level_names[0])); i++)
+    {
+        if (strcasecmp(level, level_names[i]) == 0)
+        {
+            logger.threshold = i;
+        }
+    }
+
+    const char *format = getenv(LOG_FORMAT_ENV);
+    logger.json_terminal = format && strcasecmp(format, "json") == 0;
+
+    const char *file_path = getenv(LOG_FILE_ENV);
+    if (file_path && file_path[0] != '\0')
+    {
+        logger.file = fopen(file_path, "a");
+        if (!logger.file)
+        {
+            fprintf(stderr, "Cannot open log file %s; logging to the terminal only.\n", file_path);
+        }
+    }
+
+    for (size_t i = 0; i < LOG_RING_SIZE; i++)
+    {
+        logger.records[i].sequence = i;
+    }
+
+    const char *sync = getenv(LOG_SYNC_ENV);
+    if ((!sync || strcmp(sync, "1") != 0) && pthread_create(&logger.thread, NULL, logger_thread, NULL) == 0)
+    {
+        logger.running = 1;
+        logger.async = 1;
+        atexit(logger_shutdown);
+        pthread_atfork(NULL, NULL, logger_after_fork);
+    }
+}
+
+// Render and write one line from the calling thread, after everything queued before it
+static void write_line_now(int level, int sinks, const char *color, const char *symbol, const struct timespec *time,
+                           const char *message)
+{
+    struct log_record record = {0};
+    record.level = level;
+    record.sinks = sinks;
+    record.color = color;
+    record.symbol = symbol;
+    record.time = *time;
+    memcpy(record.repo, thread_context.repo, sizeof(record.repo));
+    memcpy(record.phase, thread_context.phase, sizeof(record.phase));
+
+    struct output_buffer terminal_out;
+    struct output_buffer file_out;
+    output_buffer_init(&terminal_out);
+    output_buffer_init(&file_out);
+
+    log_flush();
+    pthread_mutex_lock(&logger.output_lock);
+    render_record(&terminal_out, &file_out, &record, message);
+    write_sinks(&terminal_out, &file_out);
+    pthread_mutex_unlock(&logger.output_lock);
+
+    output_buffer_free(&terminal_out);
+    output_buffer_free(&file_out);
+}
+
+// Claim a slot, copy the line in and publish it. Blocks (yielding) only while the ring is full.
+static void enqueue_line(int level, int sinks, const char *color, const char *symbol, const struct timespec *time,
+                         const char *message)
+{
+    size_t length = strlen(message);
+    if (!__atomic_load_n(&logger.async, __ATOMIC_ACQUIRE) || length >= LOG_MESSAGE_SIZE)
+    {
+        write_line_now(level, sinks, color, symbol, time, message);
+        return;
+    }
+
+    size_t position = __atomic_load_n(&logger.head, __ATOMIC_RELAXED);
+    struct log_record *record;
+    while (1)
+    {
+        record = &logger.records[position & (LOG_RING_SIZE - 1)];
+        size_t sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+        long difference = (long)(sequence - position);
+
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&logger.head, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Full: let the flusher catch up
+            pthread_mutex_lock(&logger.lock);
+            pthread_cond_signal(&logger.wake);
+            pthread_mutex_unlock(&logger.lock);
+            sched_yield();
+            position = __atomic_load_n(&logger.head, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            position = __atomic_load_n(&logger.head, __ATOMIC_RELAXED);
+        }
+    }
+
+    record->level = level;
+    record->sinks = sinks;
+    record->color = color;
+    record->symbol = symbol;
+    record->time = *time;
+    memcpy(record->repo, thread_context.repo, sizeof(record->repo));
+    memcpy(record->phase, thread_context.phase, sizeof(record->phase));
+    memcpy(record->message, message, length + 1);
+    __atomic_store_n(&record->sequence, position + 1, __ATOMIC_SEQ_CST);
+
+    // Only take the lock when the flusher is (about to be) asleep
+    if (__atomic_load_n(&logger.sleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&logger.lock);
+        pthread_cond_signal(&logger.wake);
+        pthread_mutex_unlock(&logger.lock);
+    }
+}
 
 void log_message(const char *color, const char *symbol, const char *message)
 {
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
+    pthread_once(&logger_once, logger_init);
+
+    int level = level_of(symbol);
+    if (level < logger.threshold)
+    {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    // Worker threads log into their own buffer so parallel jobs don't interleave
+    if (capture_buffer)
+    {
+        render_line(capture_buffer, logger.json_terminal, level, color, symbol, &now,
+                    thread_context.repo, thread_context.phase, message);
+        if (logger.file)
+        {
+            enqueue_line(level, LOG_SINK_FILE, color, symbol, &now, message);
+        }
+        return;
+    }
+
+    enqueue_line(level, LOG_SINK_TERMINAL | LOG_SINK_FILE, color, symbol, &now, message);
+}
+
+void log_flush()
+{
+    if (!__atomic_load_n(&logger.running, __ATOMIC_SEQ_CST))
+    {
+        return;
+    }
+
+    size_t target = __atomic_load_n(&logger.head, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&logger.written, __ATOMIC_SEQ_CST) >= target)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&logger.lock);
+    __atomic_add_fetch(&logger.flush_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&logger.wake);
+    while (__atomic_load_n(&logger.written, __ATOMIC_SEQ_CST) < target)
+    {
+        pthread_cond_wait(&logger.flushed, &logger.lock);
+    }
+    __atomic_sub_fetch(&logger.flush_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&logger.lock);
+}
+
+// Per-thread state for the logger benchmark
+struct benchmark_worker
+{
+    pthread_t thread;
+    int index;
+    int messages;
+    double *samples;
+};
+
+static void *benchmark_worker_run(void *arg)
+{
+    struct benchmark_worker *worker = arg;
+    struct log_context saved;
+    char repo[32];
+    char message[160];
+
+    snprintf(repo, sizeof(repo), "bench-%d", worker->index);
+    log_context_push(&saved, repo);
+    log_set_phase("build");
+
+    for (int i = 0; i < worker->messages; i++)
+    {
+        snprintf(message, sizeof(message), "Step %d/%d : RUN composer install --no-dev --optimize-autoloader", i, worker->messages);
+        double started = monotonic_seconds();
+        log_message(INFO, INFO_SYMBOL, message);
+        worker->samples[i] = monotonic_seconds() - started;
+    }
+
+    log_context_pop(&saved);
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double left = *(const double *)a;
+    double right = *(const double *)b;
+    return (left > right) - (left < right);
+}
+
+// Measure the per-call cost of log_message() with `threads` concurrent writers,
+// first with synchronous writes and then through the ring, into `sink_path`.
+int benchmark_logger(int threads, int messages, const char *sink_path)
+{
+    pthread_once(&logger_once, logger_init);
+
+    FILE *sink = fopen(sink_path, "w");
+    if (!sink)
+    {
+        char error_msg[300];
+        snprintf(error_msg, sizeof(error_msg), "Cannot open benchmark sink %s.", sink_path);
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        return -1;
+    }
+
+    size_t total = (size_t)threads * (size_t)messages;
+    double *samples = malloc(total * sizeof(double));
+    struct benchmark_worker *workers = calloc((size_t)threads, sizeof(*workers));
+    if (!samples || !workers)
+    {
+        free(samples);
+        free(workers);
+        fclose(sink);
+        log_message(ERROR, ERROR_SYMBOL, "Out of memory for the logger benchmark.");
+        return -1;
+    }
+
+    char log_msg[300];
+    snprintf(log_msg, sizeof(log_msg), "Logging %d lines from each of %d threads into %s...", messages, threads, sink_path);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+
+    // Point the sinks at the benchmark target; the mode switch happens with the ring drained
+    log_flush();
+    pthread_mutex_lock(&logger.output_lock);
+    FILE *saved_terminal = logger.terminal;
+    FILE *saved_file = logger.file;
+    int saved_threshold = logger.threshold;
+    int saved_async = logger.async;
+    logger.terminal = sink;
+    logger.file = NULL;
+    logger.threshold = LOG_LEVEL_INFO;
+    pthread_mutex_unlock(&logger.output_lock);
+
+    const char *modes[] = {"sync", "async"};
+    double mean[2] = {0}, p50[2] = {0}, p99[2] = {0}, max[2] = {0}, rate[2] = {0};
+    int modes_run = logger.running ? 2 : 1;
+
+    for (int mode = 0; mode < modes_run; mode++)
+    {
+        __atomic_store_n(&logger.async, mode, __ATOMIC_SEQ_CST);
+
+        double started = monotonic_seconds();
+        for (int i = 0; i < threads; i++)
+        {
+            workers[i].index = i;
+            workers[i].messages = messages;
+            workers[i].samples = samples + (size_t)i * (size_t)messages;
+            pthread_create(&workers[i].thread, NULL, benchmark_worker_run, &workers[i]);
+        }
+        for (int i = 0; i < threads; i++)
+        {
+            pthread_join(workers[i].thread, NULL);
+        }
+        log_flush();
+        double elapsed = monotonic_seconds() - started;
+
+        double sum = 0;
+        for (size_t i = 0; i < total; i++)
+        {
+            sum += samples[i];
+        }
+        qsort(samples, total, sizeof(double), compare_doubles);
+        mean[mode] = sum / (double)total;
+        p50[mode] = samples[total / 2];
+        p99[mode] = samples[(total * 99) / 100];
+        max[mode] = samples[total - 1];
+        rate[mode] = elapsed > 0 ? (double)total / elapsed : 0;
+    }
+
+    pthread_mutex_lock(&logger.output_lock);
+    logger.terminal = saved_terminal;
+    logger.file = saved_file;
+    logger.threshold = saved_threshold;
+    __atomic_store_n(&logger.async, saved_async, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&logger.output_lock);
+    fclose(sink);
+
+    printf("\n%-6s %8s %10s %10s %10s %12s %14s\n", "Mode", "Threads", "Mean (us)", "p50 (us)", "p99 (us)", "Max (us)", "Lines/s");
+    for (int mode = 0; mode < modes_run; mode++)
+    {
+        printf("%-6s %8d %10.2f %10.2f %10.2f %12.1f %14.0f\n", modes[mode], threads,
+               mean[mode] * 1e6, p50[mode] * 1e6, p99[mode] * 1e6, max[mode] * 1e6, rate[mode]);
+    }
+    printf("\n");
 
-    // Use a consistent label "[LOG]" for all log levels and ensure alignment
-    printf("%s[LOG] %s [%04d-%02d-%02d %02d:%02d:%02d] %s%s\n",
-           color, symbol,
-           tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
-           tm.tm_hour, tm.tm_min, tm.tm_sec,
-           message, NC);
+    free(samples);
+    free(workers);
+    return 0;
 }
\ No newline at end of file
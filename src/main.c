@@ -4,8 +4,18 @@
 #include "docker.h"
 #include "deploy.h"
 #include "utils.h"
-
-int loading = 0; // Global variable to control the loader
+#include "control.h"
+#include "watch.h"
+#include "metrics.h"
+#include "stats.h"
+#include "base_image.h"
+#include "build_cache.h"
+#include "prune.h"
+#include "rollback.h"
+#include "dependency.h"
+#include "manifest.h"
+#include <errno.h>
+#include <limits.h>
 
 void print_banner()
 {
@@ -24,134 +34,772 @@ void print_banner()
 
 void print_help()
 {
+    log_flush();
     printf("Available commands:\n");
     printf("  new, n                                              - Create a new repository entry\n");
     printf("  list, l                                             - List all repositories\n");
     printf("  update, u                                           - Update all repositories\n");
+    printf("  update --jobs <N>, u -j <N>                         - Update all repositories, fetching N at a time\n");
     printf("  update <ID>, u <ID>                                 - Update a specific repository by ID\n");
     printf("  switch <ID> <BRANCH_OR_TAG>, s <ID> <BRANCH_OR_TAG> - Switch to a specific branch or tag for a repository\n");
     printf("  deploy, d                                           - Deploy all repositories\n");
+    printf("  deploy --jobs <N>, dep -j <N>                       - Deploy all repositories, N at a time (0 = one per CPU)\n");
     printf("  deploy <ID>, dep <ID>                               - Deploy a specific repository by ID\n");
+    printf("  deploy --force [<ID>], dep -f [<ID>]                - Rebuild even if nothing changed since the last deploy\n");
+    printf("  deploy --mode build|entrypoint [<ID>]               - Bake Laravel dependencies into the image, or install them at startup\n");
+    printf("  deploy --health PATH|off [<ID>]                     - Probe PATH after the rollout and roll back if it fails\n");
+    printf("  rollback <ID> [N]                                   - Point the service at the image it ran N deploys ago (default 1), without building\n");
+    printf("  images <ID>                                         - List the images kept for a repository and their rollback steps\n");
+    printf("  depends <ID> [add|remove <OTHER_ID>]                - Show or change what a repository waits for in fleet deploys\n");
+    printf("  apply <FILE> [--dry-run] [--jobs N]                 - Clone, reconfigure, deploy and delete until the fleet matches the manifest\n");
+    printf("  export [FILE]                                       - Write every repository as a manifest that apply accepts\n");
     printf("  delete <ID>, del <ID>                               - Delete a repository and its Docker service by ID\n"); // Fixed closing quote
+    printf("  stats [<ID>] [--last N]                             - Show p50/p95/max per deploy and update phase over the last N runs\n");
+    printf("  metrics                                             - Print Prometheus metrics (and refresh $" METRICS_TEXTFILE_ENV ")\n");
+    printf("  bases                                               - List the shared base images built per framework, PHP and Node version\n");
+    printf("  prune                                               - Remove superseded images of every repository and prune the daemon now\n");
+    printf("  cache                                               - Show the BuildKit build cache and the shared dependency caches\n");
+    printf("  cache gc [--keep SIZE]                              - Trim the build cache to SIZE (default " BUILD_CACHE_DEFAULT_KEEP "), least recently used first\n");
+    printf("  watch [--interval S] [--debounce S] [--jobs N]      - Deploy repositories as soon as their refs or remote change\n");
+    printf("  bench context <ID>                                  - Compare the filtered build context against the full directory\n");
+    printf("  bench log [--threads N] [--messages N]              - Measure the per-call cost of logging from concurrent threads\n");
+    printf("  bench db [--processes N] [--operations N]           - Commit deploy bookkeeping from concurrent processes and verify it\n");
     printf("  exit, quit, q                                       - Exit the mini terminal\n");
     printf("  help, h                                             - Show this help message\n");
     printf("\n");
 }
 
-void mini_terminal()
+// Parse "[--jobs N | -j N] [--force] [--mode MODE] [--health PATH] [<ID>]" following a deploy or
+// update command. `force`, `mode` and `health_path` may be NULL for commands that don't accept
+// them. Returns 0 on success.
+int parse_job_arguments(char *arguments, int *jobs, int *force, const char **mode, const char **health_path, const char **repo_id)
 {
-    char command[256];
+    char *save_ptr = NULL;
+    char *token = arguments ? strtok_r(arguments, " ", &save_ptr) : NULL;
 
-    while (1)
+    while (token != NULL)
     {
-        printf("[command]$ "); // Prompt
-        fgets(command, sizeof(command), stdin);
+        const char *value = NULL;
 
-        // Remove trailing newline character
-        command[strcspn(command, "\n")] = 0;
-
-        // Handle different commands
-        if (strcmp(command, "new") == 0 || strcmp(command, "n") == 0)
+        if (strcmp(token, "--jobs") == 0 || strcmp(token, "-j") == 0)
         {
-            char repo_id[128];
-            char git_url[256];
-            char destination_folder[256];
-            char branch_name[128];
-            char docker_image_prefix[128];
-            char docker_port[16];
-
-            get_input("Enter the repository ID (a unique string identifier):", repo_id, sizeof(repo_id));
-            get_input("Enter the Git repository URL:", git_url, sizeof(git_url));
-            get_input("Enter the destination folder (relative to 'repositories' folder):", destination_folder, sizeof(destination_folder));
-            get_input("Enter the branch name (default: main):", branch_name, sizeof(branch_name));
-            get_input("Enter the Docker image prefix (format: username/image):", docker_image_prefix, sizeof(docker_image_prefix));
-            get_input("Enter the Docker port to expose (format: host_port:container_port):", docker_port, sizeof(docker_port));
+            value = strtok_r(NULL, " ", &save_ptr);
+            if (value == NULL)
+            {
+                return -1;
+            }
+        }
+        else if (strncmp(token, "--jobs=", 7) == 0)
+        {
+            value = token + 7;
+        }
+        else if (force != NULL && (strcmp(token, "--force") == 0 || strcmp(token, "-f") == 0))
+        {
+            *force = 1;
+        }
+        else if (mode != NULL && strcmp(token, "--mode") == 0)
+        {
+            *mode = strtok_r(NULL, " ", &save_ptr);
+            if (*mode == NULL || (strcmp(*mode, DEPLOY_MODE_BUILD) != 0 && strcmp(*mode, DEPLOY_MODE_ENTRYPOINT) != 0))
+            {
+                return -1;
+            }
+        }
+        else if (health_path != NULL && strcmp(token, "--health") == 0)
+        {
+            *health_path = strtok_r(NULL, " ", &save_ptr);
+            if (*health_path == NULL || ((*health_path)[0] != '/' && strcmp(*health_path, DEPLOY_HEALTH_OFF) != 0))
+            {
+                return -1;
+            }
+        }
+        else if (*repo_id == NULL)
+        {
+            *repo_id = token;
+        }
+        else
+        {
+            return -1;
+        }
 
-            if (strlen(branch_name) == 0)
+        if (value != NULL)
+        {
+            char *end = NULL;
+            *jobs = (int)strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || *jobs < 0)
             {
-                strcpy(branch_name, "main");
+                return -1;
             }
+        }
+
+        token = strtok_r(NULL, " ", &save_ptr);
+    }
+
+    return 0;
+}
 
-            clone_new_repo(repo_id, git_url, destination_folder, branch_name, docker_image_prefix, docker_port);
+// Parse "[--interval SECONDS] [--debounce SECONDS] [--jobs N]" for watch mode.
+// `watch` may be NULL; otherwise a "--watch" token sets it. Returns 0 on success.
+int parse_watch_arguments(char *arguments, struct watch_options *options, int *watch)
+{
+    char *save_ptr = NULL;
+    char *token = arguments ? strtok_r(arguments, " ", &save_ptr) : NULL;
+
+    while (token != NULL)
+    {
+        if (watch != NULL && strcmp(token, "--watch") == 0)
+        {
+            *watch = 1;
+            token = strtok_r(NULL, " ", &save_ptr);
+            continue;
         }
-        else if (strcmp(command, "list") == 0 || strcmp(command, "l") == 0)
+
+        const char *value = strtok_r(NULL, " ", &save_ptr);
+        char *end = NULL;
+        double number = value ? strtod(value, &end) : -1;
+        if (value == NULL || *end != '\0' || number < 0)
         {
-            list_repositories();
+            return -1;
         }
-        else if (strcmp(command, "update") == 0 || strcmp(command, "u") == 0)
+
+        if (strcmp(token, "--interval") == 0)
         {
-            pull_all_repos();
+            options->remote_interval = number;
         }
-        else if (strncmp(command, "update ", 7) == 0 || strncmp(command, "u ", 2) == 0)
+        else if (strcmp(token, "--debounce") == 0)
+        {
+            options->debounce = number;
+        }
+        else if (strcmp(token, "--jobs") == 0 || strcmp(token, "-j") == 0)
+        {
+            options->jobs = (int)number;
+        }
+        else
+        {
+            return -1;
+        }
+
+        token = strtok_r(NULL, " ", &save_ptr);
+    }
+
+    return 0;
+}
+
+// Returned by dispatch_command() when the user asked to leave
+#define COMMAND_EXIT -1
+
+// Run one command line. Returns 0 on success, 1 if the command failed,
+// 2 for usage errors and COMMAND_EXIT for exit/quit.
+int dispatch_command(char *command)
+{
+    // Handle different commands
+    if (strcmp(command, "new") == 0 || strcmp(command, "n") == 0)
+    {
+        char repo_id[128];
+        char git_url[256];
+        char destination_folder[256];
+        char branch_name[128];
+        char docker_image_prefix[128];
+        char docker_port[16];
+
+        get_input("Enter the repository ID (a unique string identifier):", repo_id, sizeof(repo_id));
+        get_input("Enter the Git repository URL:", git_url, sizeof(git_url));
+        get_input("Enter the destination folder (relative to 'repositories' folder):", destination_folder, sizeof(destination_folder));
+        get_input("Enter the branch name (default: main):", branch_name, sizeof(branch_name));
+        get_input("Enter the Docker image prefix (format: username/image):", docker_image_prefix, sizeof(docker_image_prefix));
+        get_input("Enter the Docker port to expose (format: host_port:container_port):", docker_port, sizeof(docker_port));
+
+        if (strlen(branch_name) == 0)
+        {
+            strcpy(branch_name, "main");
+        }
+
+        return clone_new_repo(repo_id, git_url, destination_folder, branch_name, docker_image_prefix, docker_port) == 0 ? 0 : 1;
+    }
+    else if (strcmp(command, "list") == 0 || strcmp(command, "l") == 0)
+    {
+        list_repositories();
+    }
+    else if (strcmp(command, "update") == 0 || strcmp(command, "u") == 0 ||
+             strncmp(command, "update ", 7) == 0 || strncmp(command, "u ", 2) == 0)
+    {
+        int jobs = 1;
+        const char *repo_id = NULL;
+
+        if (parse_job_arguments(strchr(command, ' '), &jobs, NULL, NULL, NULL, &repo_id) != 0)
         {
-            const char *repo_id = (command[0] == 'u') ? command + 2 : command + 7;
-            pull_latest_repo(repo_id);
+            log_message(WARNING, WARNING_SYMBOL, "Usage: update [--jobs N] [<ID>]");
+            return 2;
         }
-        else if (strncmp(command, "switch ", 7) == 0 || strncmp(command, "s ", 2) == 0)
+        else if (repo_id != NULL)
         {
-            char *repo_id = strtok((command[0] == 's') ? command + 2 : command + 7, " ");
-            char *branch_or_tag = strtok(NULL, " ");
-            if (repo_id && branch_or_tag)
+            return pull_latest_repo(repo_id) == 0 ? 0 : 1;
+        }
+        else
+        {
+            return pull_all_repos(jobs) == 0 ? 0 : 1;
+        }
+    }
+    else if (strncmp(command, "switch ", 7) == 0 || strncmp(command, "s ", 2) == 0)
+    {
+        char *save_ptr = NULL;
+        char *repo_id = strtok_r(strchr(command, ' '), " ", &save_ptr);
+        char *branch_or_tag = strtok_r(NULL, " ", &save_ptr);
+        if (repo_id && branch_or_tag)
+        {
+            switch_to_branch_or_tag(repo_id, branch_or_tag);
+        }
+        else
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: switch <ID> <BRANCH_OR_TAG>");
+            return 2;
+        }
+    }
+    else if (strcmp(command, "deploy") == 0 || strcmp(command, "dep") == 0 ||
+             strncmp(command, "deploy ", 7) == 0 || strncmp(command, "dep ", 4) == 0)
+    {
+        struct deploy_options options = {0};
+        options.jobs = 1;
+        const char *repo_id = NULL;
+
+        if (parse_job_arguments(strchr(command, ' '), &options.jobs, &options.force, &options.mode, &options.health_path, &repo_id) != 0)
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: deploy [--jobs N] [--force] [--mode build|entrypoint] [--health PATH|off] [<ID>]");
+            return 2;
+        }
+        else if (repo_id != NULL)
+        {
+            char repo_message[256];
+            snprintf(repo_message, sizeof(repo_message), "Deploying repository '%s'...", repo_id);
+            log_message(INFO, INFO_SYMBOL, repo_message);
+            return deploy_repo(repo_id, &options) == 0 ? 0 : 1;
+        }
+        else
+        {
+            return deploy_all_repos(&options) == 0 ? 0 : 1;
+        }
+    }
+    else if (strncmp(command, "rollback ", 9) == 0)
+    {
+        char *save_ptr = NULL;
+        const char *repo_id = strtok_r(command + 9, " ", &save_ptr);
+        const char *steps = strtok_r(NULL, " ", &save_ptr);
+        char *end = NULL;
+        long steps_back = steps ? strtol(steps, &end, 10) : 1;
+        if (repo_id == NULL || (steps && (*end != '\0' || steps_back < 1 || steps_back > 1000)) || strtok_r(NULL, " ", &save_ptr))
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: rollback <ID> [N]");
+            return 2;
+        }
+        return rollback_repository(repo_id, (int)steps_back) == 0 ? 0 : 1;
+    }
+    else if (strncmp(command, "images ", 7) == 0)
+    {
+        char *save_ptr = NULL;
+        const char *repo_id = strtok_r(command + 7, " ", &save_ptr);
+        if (repo_id == NULL)
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: images <ID>");
+            return 2;
+        }
+        print_repository_images(repo_id);
+    }
+    else if (strncmp(command, "depends ", 8) == 0)
+    {
+        char *save_ptr = NULL;
+        const char *repo_id = strtok_r(command + 8, " ", &save_ptr);
+        const char *action = repo_id ? strtok_r(NULL, " ", &save_ptr) : NULL;
+        const char *other_id = action ? strtok_r(NULL, " ", &save_ptr) : NULL;
+        if (repo_id == NULL || (action && (!other_id || strtok_r(NULL, " ", &save_ptr) ||
+                                           (strcmp(action, "add") != 0 && strcmp(action, "remove") != 0))))
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: depends <ID> [add|remove <OTHER_ID>]");
+            return 2;
+        }
+
+        if (!action)
+        {
+            print_dependencies(repo_id);
+            return 0;
+        }
+        int status = strcmp(action, "add") == 0 ? dependency_add(repo_id, other_id) : dependency_remove(repo_id, other_id);
+        return status == 0 ? 0 : 1;
+    }
+    else if (strncmp(command, "apply ", 6) == 0)
+    {
+        char *save_ptr = NULL;
+        const char *path = NULL;
+        int dry_run = 0;
+        int jobs = 1;
+        int valid = 1;
+        for (char *token = strtok_r(command + 6, " ", &save_ptr); token && valid; token = strtok_r(NULL, " ", &save_ptr))
+        {
+            if (strcmp(token, "--dry-run") == 0)
+            {
+                dry_run = 1;
+            }
+            else if (strcmp(token, "--jobs") == 0 || strcmp(token, "-j") == 0)
+            {
+                const char *value = strtok_r(NULL, " ", &save_ptr);
+                char *end = NULL;
+                jobs = value ? (int)strtol(value, &end, 10) : -1;
+                valid = value && *value != '\0' && *end == '\0' && jobs >= 0;
+            }
+            else if (path == NULL)
             {
-                switch_to_branch_or_tag(repo_id, branch_or_tag);
+                path = token;
             }
             else
             {
-                log_message(WARNING, WARNING_SYMBOL, "Usage: switch <ID> <BRANCH_OR_TAG>");
+                valid = 0;
             }
         }
-        else if (strncmp(command, "deploy ", 7) == 0 || strncmp(command, "dep ", 4) == 0)
+        if (!valid || path == NULL)
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: apply <FILE> [--dry-run] [--jobs N]");
+            return 2;
+        }
+        return apply_manifest(path, jobs, dry_run) == 0 ? 0 : 1;
+    }
+    else if (strcmp(command, "export") == 0 || strncmp(command, "export ", 7) == 0)
+    {
+        char *save_ptr = NULL;
+        const char *path = command[6] ? strtok_r(command + 7, " ", &save_ptr) : NULL;
+        if (path && strtok_r(NULL, " ", &save_ptr))
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: export [FILE]");
+            return 2;
+        }
+        return export_manifest(path) == 0 ? 0 : 1;
+    }
+    else if (strncmp(command, "delete ", 7) == 0 || strncmp(command, "del ", 4) == 0)
+    {
+        char *save_ptr = NULL;
+        const char *repo_id = strtok_r(strchr(command, ' '), " ", &save_ptr);
+        if (repo_id == NULL)
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: delete <ID>");
+            return 2;
+        }
+        delete_service(repo_id);
+    }
+    else if (strncmp(command, "bench ", 6) == 0)
+    {
+        char *save_ptr = NULL;
+        char *target = strtok_r(command + 6, " ", &save_ptr);
+
+        if (target && strcmp(target, "context") == 0)
         {
-            const char *repo_id;
-            if (strncmp(command, "dep ", 4) == 0)
+            char *repo_id = strtok_r(NULL, " ", &save_ptr);
+            if (!repo_id)
             {
-                repo_id = command + 4;
+                log_message(WARNING, WARNING_SYMBOL, "Usage: bench context <ID>");
+                return 2;
             }
-            else
+            benchmark_build_context(repo_id);
+        }
+        else if (target && strcmp(target, "log") == 0)
+        {
+            int threads = 8;
+            int messages = 20000;
+            const char *sink_path = "/dev/null";
+            char *token;
+
+            while ((token = strtok_r(NULL, " ", &save_ptr)) != NULL)
             {
-                repo_id = command + 7;
+                char *value = strtok_r(NULL, " ", &save_ptr);
+                char *end = NULL;
+                long number = value ? strtol(value, &end, 10) : 0;
+
+                if (strcmp(token, "--sink") == 0 && value)
+                {
+                    sink_path = value;
+                }
+                else if ((strcmp(token, "--threads") == 0 || strcmp(token, "--messages") == 0) &&
+                         value && *end == '\0' && number > 0 && number <= 1000000)
+                {
+                    *(strcmp(token, "--threads") == 0 ? &threads : &messages) = (int)number;
+                }
+                else
+                {
+                    log_message(WARNING, WARNING_SYMBOL, "Usage: bench log [--threads N] [--messages N] [--sink PATH]");
+                    return 2;
+                }
             }
+            return benchmark_logger(threads, messages, sink_path) == 0 ? 0 : 1;
+        }
+        else if (target && strcmp(target, "db") == 0)
+        {
+            int processes = 8;
+            int operations = 200;
+            char *token;
 
-            // Remove any leading spaces
-            while (*repo_id == ' ')
+            while ((token = strtok_r(NULL, " ", &save_ptr)) != NULL)
             {
-                repo_id++;
+                char *value = strtok_r(NULL, " ", &save_ptr);
+                char *end = NULL;
+                long number = value ? strtol(value, &end, 10) : 0;
+
+                if ((strcmp(token, "--processes") == 0 || strcmp(token, "--operations") == 0) &&
+                    value && *end == '\0' && number > 0 && number <= 100000)
+                {
+                    *(strcmp(token, "--processes") == 0 ? &processes : &operations) = (int)number;
+                }
+                else
+                {
+                    log_message(WARNING, WARNING_SYMBOL, "Usage: bench db [--processes N] [--operations N]");
+                    return 2;
+                }
             }
+            return benchmark_database(processes, operations) == 0 ? 0 : 1;
+        }
+        else
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: bench context <ID> | bench log [--threads N] [--messages N] [--sink PATH] | bench db [--processes N] [--operations N]");
+            return 2;
+        }
+    }
+    else if (strcmp(command, "stats") == 0 || strncmp(command, "stats ", 6) == 0)
+    {
+        char *save_ptr = NULL;
+        char *arguments = strchr(command, ' ');
+        char *token = arguments ? strtok_r(arguments, " ", &save_ptr) : NULL;
+        const char *repo_id = NULL;
+        int last_runs = 20;
 
-            if (repo_id != NULL && strlen(repo_id) > 0)
+        while (token != NULL)
+        {
+            if (strcmp(token, "--last") == 0 || strcmp(token, "-n") == 0)
             {
-                char repo_message[256];
-                snprintf(repo_message, sizeof(repo_message), "Deploying repository '%s'...", repo_id);
-                log_message(INFO, INFO_SYMBOL, repo_message);
-                deploy_repo(repo_id);
+                char *value = strtok_r(NULL, " ", &save_ptr);
+                char *end = NULL;
+                last_runs = value ? (int)strtol(value, &end, 10) : 0;
+                if (!value || *end != '\0' || last_runs <= 0)
+                {
+                    log_message(WARNING, WARNING_SYMBOL, "Usage: stats [<ID>] [--last N]");
+                    return 2;
+                }
             }
             else
             {
-                log_message(WARNING, WARNING_SYMBOL, "Invalid repository ID. Usage: deploy <ID>");
+                repo_id = token;
             }
+            token = strtok_r(NULL, " ", &save_ptr);
         }
-        else if (strcmp(command, "deploy") == 0 || strcmp(command, "dep") == 0)
+
+        print_run_stats(repo_id, last_runs);
+    }
+    else if (strcmp(command, "metrics") == 0)
+    {
+        return print_metrics() == 0 ? 0 : 1;
+    }
+    else if (strcmp(command, "bases") == 0)
+    {
+        print_base_images();
+    }
+    else if (strcmp(command, "prune") == 0)
+    {
+        return prune_now() == 0 ? 0 : 1;
+    }
+    else if (strcmp(command, "cache") == 0 || strncmp(command, "cache ", 6) == 0)
+    {
+        char *save_ptr = NULL;
+        char *arguments = strchr(command, ' ');
+        char *target = arguments ? strtok_r(arguments, " ", &save_ptr) : NULL;
+
+        if (!target)
         {
-            deploy_all_repos();
+            return print_build_cache() == 0 ? 0 : 1;
         }
-        else if (strncmp(command, "delete ", 7) == 0 || strncmp(command, "del ", 4) == 0)
+
+        long long keep_bytes = 0;
+        parse_byte_size(BUILD_CACHE_DEFAULT_KEEP, &keep_bytes);
+        char *token = strcmp(target, "gc") == 0 ? strtok_r(NULL, " ", &save_ptr) : target;
+        while (token != NULL)
         {
-            const char *repo_id = (command[0] == 'd' && command[1] == 'e' && command[2] == 'l') ? command + 4 : command + 7;
-            delete_service(repo_id);
+            char *value = strcmp(token, "--keep") == 0 ? strtok_r(NULL, " ", &save_ptr) : NULL;
+            if (strcmp(target, "gc") != 0 || !value || parse_byte_size(value, &keep_bytes) != 0)
+            {
+                log_message(WARNING, WARNING_SYMBOL, "Usage: cache | cache gc [--keep SIZE]");
+                return 2;
+            }
+            token = strtok_r(NULL, " ", &save_ptr);
         }
-        else if (strcmp(command, "help") == 0 || strcmp(command, "h") == 0)
+        return collect_build_cache_garbage(keep_bytes) == 0 ? 0 : 1;
+    }
+    else if (strcmp(command, "watch") == 0 || strncmp(command, "watch ", 6) == 0)
+    {
+        struct watch_options options;
+        watch_options_init(&options);
+
+        if (parse_watch_arguments(strchr(command, ' '), &options, NULL) != 0)
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Usage: watch [--interval SECONDS] [--debounce SECONDS] [--jobs N]");
+            return 2;
+        }
+        return watch_repositories(&options) == 0 ? 0 : 1;
+    }
+    else if (strcmp(command, "help") == 0 || strcmp(command, "h") == 0)
+    {
+        print_help(); // Show available commands
+    }
+    else if (strcmp(command, "exit") == 0 || strcmp(command, "quit") == 0 || strcmp(command, "q") == 0)
+    {
+        return COMMAND_EXIT; // Exit the terminal
+    }
+    else if (command[0] != '\0')
+    {
+        char error_msg[300];
+        snprintf(error_msg, sizeof(error_msg), "Unknown command: %s (type 'help' for a list)", command);
+        log_message(WARNING, WARNING_SYMBOL, error_msg);
+        return 2;
+    }
+
+    return 0;
+}
+
+void mini_terminal()
+{
+    char command[256];
+
+    while (1)
+    {
+        log_flush();
+        printf("[command]$ "); // Prompt
+        if (fgets(command, sizeof(command), stdin) == NULL)
         {
-            print_help(); // Show available commands
+            printf("\n");
+            break; // End of input
         }
-        else if (strcmp(command, "exit") == 0 || strcmp(command, "quit") == 0 || strcmp(command, "q") == 0)
+
+        // Remove trailing newline character
+        command[strcspn(command, "\n")] = 0;
+
+        if (dispatch_command(command) == COMMAND_EXIT)
         {
             break; // Exit the terminal
         }
     }
 }
 
+// Commands received over the control socket; interactive ones are refused
+int daemon_command(char *command)
+{
+    if (strcmp(command, "new") == 0 || strcmp(command, "n") == 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "'new' prompts for input; run it from the interactive terminal.");
+        return 2;
+    }
+    if (strcmp(command, "exit") == 0 || strcmp(command, "quit") == 0 || strcmp(command, "q") == 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "Use 'shutdown' to stop the daemon.");
+        return 2;
+    }
+    if (strcmp(command, "watch") == 0 || strncmp(command, "watch ", 6) == 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "'watch' would block the daemon; start it with 'dployer --daemon --watch' instead.");
+        return 2;
+    }
+    return dispatch_command(command);
+}
+
+// Commands run by a client when no daemon is listening
+int oneshot_command(char *command)
+{
+    if (strcmp(command, "new") == 0 || strcmp(command, "n") == 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "'new' prompts for input; run it from the interactive terminal.");
+        return 2;
+    }
+
+    int status = dispatch_command(command);
+    return status == COMMAND_EXIT ? 0 : status;
+}
+
+// Adapters exposing the repository watcher to the daemon's event loop
+static int watcher_source_fd(void *context)
+{
+    return watcher_fd(context);
+}
+
+static int watcher_source_timeout(void *context)
+{
+    return watcher_timeout_ms(context);
+}
+
+static void watcher_source_run(void *context)
+{
+    watcher_run(context);
+}
+
+// Commands that add, remove or move repositories change what has to be watched.
+// Only the first word is compared; dispatch_command may have split the rest.
+static void watcher_source_command_done(const char *command, void *context)
+{
+    const char *const commands[] = {"switch", "s", "delete", "del", "apply", NULL};
+    size_t length = strcspn(command, " ");
+
+    for (size_t i = 0; commands[i]; i++)
+    {
+        if (strlen(commands[i]) == length && strncmp(command, commands[i], length) == 0)
+        {
+            watcher_reload(context);
+            return;
+        }
+    }
+}
+
+// Join argv[first..] into one command line
+void join_arguments(int argc, char *argv[], int first, char *command, size_t size)
+{
+    size_t length = 0;
+    command[0] = '\0';
+
+    for (int i = first; i < argc && length < size; i++)
+    {
+        length += snprintf(command + length, size - length, "%s%s", i > first ? " " : "", argv[i]);
+    }
+}
+
+// The daemon runs in its own working directory, so the file of "apply" and "export" is
+// sent as an absolute path. Export may create the file, so only its directory has to exist.
+// Returns 0, or -1 when the path cannot be resolved.
+static int absolute_file_argument(int argc, char *argv[], char *resolved)
+{
+    int index = 0;
+    if (strcmp(argv[1], "apply") == 0)
+    {
+        for (int i = 2; i < argc && index == 0; i++)
+        {
+            if (strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0)
+            {
+                i++;
+            }
+            else if (strcmp(argv[i], "--dry-run") != 0)
+            {
+                index = i;
+            }
+        }
+    }
+    else if (strcmp(argv[1], "export") == 0 && argc > 2)
+    {
+        index = 2;
+    }
+    if (index == 0 || argv[index][0] == '/')
+    {
+        return 0;
+    }
+
+    int failed;
+    if (index == 2 && strcmp(argv[1], "export") == 0)
+    {
+        char directory[PATH_MAX];
+        char resolved_directory[PATH_MAX];
+        snprintf(directory, sizeof(directory), "%s", argv[index]);
+        char *slash = strrchr(directory, '/');
+        const char *name = slash ? argv[index] + (slash - directory) + 1 : argv[index];
+        if (slash)
+        {
+            *slash = '\0';
+        }
+        failed = !realpath(slash ? directory : ".", resolved_directory) ||
+                 snprintf(resolved, PATH_MAX, "%s/%s", resolved_directory, name) >= PATH_MAX;
+    }
+    else
+    {
+        failed = !realpath(argv[index], resolved);
+    }
+
+    if (failed)
+    {
+        char error_msg[PATH_MAX + 64];
+        snprintf(error_msg, sizeof(error_msg), "Cannot resolve %s: %s", argv[index], errno ? strerror(errno) : "path too long");
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        return -1;
+    }
+    argv[index] = resolved;
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
+    // Daemon mode: pay the startup checks once, then serve commands over the control socket
+    if (argc >= 2 && strcmp(argv[1], "--daemon") == 0)
+    {
+        char arguments[256];
+        struct watch_options watch_options;
+        int watch = 0;
+        join_arguments(argc, argv, 2, arguments, sizeof(arguments));
+        watch_options_init(&watch_options);
+
+        if (parse_watch_arguments(arguments, &watch_options, &watch) != 0)
+        {
+            fprintf(stderr, "Usage: %s --daemon [--watch [--interval SECONDS] [--debounce SECONDS] [--jobs N]]\n", argv[0]);
+            return 2;
+        }
+
+        setvbuf(stdout, NULL, _IOLBF, 0);
+        check_requirements();
+        open_database("repositories.db");
+
+        // With --watch, ref changes are picked up between client commands
+        struct watcher watcher;
+        struct control_event_source source = {
+            .fd = watcher_source_fd,
+            .timeout_ms = watcher_source_timeout,
+            .run = watcher_source_run,
+            .context = &watcher,
+            .command_done = watcher_source_command_done,
+        };
+        if (watch && watcher_init(&watcher, &watch_options) != 0)
+        {
+            close_database();
+            return 1;
+        }
+        if (watch)
+        {
+            char log_msg[256];
+            snprintf(log_msg, sizeof(log_msg), "Watching %zu repositories (%s).", watcher.count, watcher.inotify_fd >= 0 ? "inotify" : "polling");
+            log_message(INFO, INFO_SYMBOL, log_msg);
+            watcher_reload_on_sighup();
+        }
+
+        int status = run_control_daemon(daemon_command, watch ? &source : NULL);
+
+        if (watch)
+        {
+            watcher_free(&watcher);
+        }
+        close_database();
+        return status == 0 ? 0 : 1;
+    }
+
+    // Client mode: "dployer deploy --jobs 4" hands the command to a running daemon
+    if (argc > 1)
+    {
+        char file[PATH_MAX];
+        char command[CONTROL_COMMAND_SIZE];
+        if (absolute_file_argument(argc, argv, file) != 0)
+        {
+            log_flush();
+            return 1;
+        }
+        join_arguments(argc, argv, 1, command, sizeof(command));
+
+        int status = run_control_client(command);
+        if (status >= 0)
+        {
+            return status;
+        }
+
+        // No daemon: run the command in this process instead
+        check_requirements();
+        open_database("repositories.db");
+        status = oneshot_command(command);
+        close_database();
+        return status;
+    }
+
     print_banner(); // Display the banner at the start
     print_help();   // Display available commands before starting the terminal
 
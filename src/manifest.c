@@ -0,0 +1,978 @@
+#include "manifest.h"
+#include "build_cache.h"
+#include "database.h"
+#include "dependency.h"
+#include "deploy.h"
+#include "docker.h"
+#include "logger.h"
+#include "pool.h"
+#include "repo.h"
+#include "utils.h"
+#include "worktree.h"
+#include <json-c/json.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One repository as the manifest declares it; strings point into the parsed JSON
+struct manifest_entry
+{
+    const char *id;
+    const char *git_url;
+    const char *branch;
+    const char *image; // Image prefix, "username/image"
+    const char *port;  // "host_port:container_port"
+    const char *folder; // NULL for the ID
+    const char *mode;   // NULL for the default deploy mode
+    const char *health; // NULL for no health check
+    int replicas;
+    double cpu_limit;
+    long long memory_limit;
+    struct json_object *depends_on; // Array of IDs, or NULL
+};
+
+// What apply has to do for a repository
+enum apply_action
+{
+    APPLY_CLONE = 1 << 0,
+    APPLY_SWITCH = 1 << 1,
+    APPLY_RETAG = 1 << 2,     // New image prefix; the next deploy rebuilds
+    APPLY_SETTINGS = 1 << 3,  // Deploy mode or health path
+    APPLY_SERVICE = 1 << 4,   // Port, replicas or resources
+    APPLY_DEPENDS = 1 << 5,
+    APPLY_DEPLOY = 1 << 6,
+    APPLY_DELETE = 1 << 7,
+    APPLY_CONFLICT = 1 << 8,  // Git URL or folder changed; needs a delete and a new entry
+};
+
+struct apply_step
+{
+    char *repo_id;
+    const struct manifest_entry *entry; // NULL for deletes
+    int actions;
+    char changes[512];
+    char old_port[64];
+    char folder[PATH_MAX]; // Destination folder relative to the repositories directory
+    char *git_url;
+    size_t group; // First step whose git work this one shares
+    int status;
+    struct output_buffer output;
+};
+
+// Steps of an apply as handed to the pool
+struct apply_batch
+{
+    struct apply_step *steps;
+    size_t count;
+};
+
+// Destination folder of a repository relative to the repositories directory, as given to "new".
+// The stored path is the deployed worktree, beside the ".store" object store or, for older
+// checkouts, the checkout itself or a worktree in "<folder>.worktrees".
+static void repository_folder(const char *destination_folder, char *folder, size_t size)
+{
+    const char *home_dir = getenv("HOME");
+    char prefix[PATH_MAX];
+    snprintf(prefix, sizeof(prefix), "%s/.config/dployer/repositories/", home_dir ? home_dir : "");
+    const char *relative = strncmp(destination_folder, prefix, strlen(prefix)) == 0 ? destination_folder + strlen(prefix)
+                                                                                     : destination_folder;
+    snprintf(folder, size, "%s", relative);
+
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s", destination_folder);
+    char *name = strrchr(parent, '/');
+    char *slash = strrchr(folder, '/');
+    if (!name || !slash)
+    {
+        return;
+    }
+    *name = '\0';
+
+    size_t parent_length = strlen(parent);
+    const char *suffix = ".worktrees";
+    if (worktree_store_exists(parent))
+    {
+        *slash = '\0';
+    }
+    else if (parent_length > strlen(suffix) && strcmp(parent + parent_length - strlen(suffix), suffix) == 0)
+    {
+        *slash = '\0';
+        folder[strlen(folder) - strlen(suffix)] = '\0';
+    }
+}
+
+// Image prefix and tag of the repository's moving image reference
+static void split_image_tag(const char *docker_image_tag, char *prefix, size_t prefix_size, const char **tag)
+{
+    docker_image_repository(docker_image_tag, prefix, prefix_size);
+    *tag = docker_image_tag[strlen(prefix)] == ':' ? docker_image_tag + strlen(prefix) + 1 : "latest";
+}
+
+static const char *optional_string(struct json_object *object, const char *key)
+{
+    struct json_object *value;
+    return json_object_object_get_ex(object, key, &value) && json_object_is_type(value, json_type_string)
+               ? json_object_get_string(value)
+               : NULL;
+}
+
+static int manifest_error(size_t index, const char *id, const char *problem)
+{
+    char error_msg[512];
+    snprintf(error_msg, sizeof(error_msg), "Manifest entry %zu (%s): %s", index + 1, id ? id : "no id", problem);
+    log_message(ERROR, ERROR_SYMBOL, error_msg);
+    return -1;
+}
+
+// Validate one entry of the "repositories" array and fill in its defaults
+static int parse_entry(struct json_object *object, size_t index, struct manifest_entry *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    if (!json_object_is_type(object, json_type_object))
+    {
+        return manifest_error(index, NULL, "not an object.");
+    }
+
+    entry->id = optional_string(object, "id");
+    entry->git_url = optional_string(object, "git_url");
+    entry->branch = optional_string(object, "branch");
+    entry->image = optional_string(object, "image");
+    entry->port = optional_string(object, "port");
+    entry->folder = optional_string(object, "folder");
+    entry->mode = optional_string(object, "mode");
+    entry->health = optional_string(object, "health");
+
+    int published_port;
+    int target_port;
+    if (!entry->id || !entry->id[0] || strchr(entry->id, ' '))
+    {
+        return manifest_error(index, entry->id, "\"id\" must be a non-empty string without spaces.");
+    }
+    if (!entry->git_url || !entry->image)
+    {
+        return manifest_error(index, entry->id, "\"git_url\" and \"image\" are required.");
+    }
+    if (!entry->port || sscanf(entry->port, "%d:%d", &published_port, &target_port) != 2)
+    {
+        return manifest_error(index, entry->id, "\"port\" must look like \"host_port:container_port\".");
+    }
+    if (entry->mode && strcmp(entry->mode, DEPLOY_MODE_BUILD) != 0 && strcmp(entry->mode, DEPLOY_MODE_ENTRYPOINT) != 0)
+    {
+        return manifest_error(index, entry->id, "\"mode\" must be \"" DEPLOY_MODE_BUILD "\" or \"" DEPLOY_MODE_ENTRYPOINT "\".");
+    }
+    if (entry->health && entry->health[0] != '/')
+    {
+        return manifest_error(index, entry->id, "\"health\" must be a path starting with '/'.");
+    }
+    entry->branch = entry->branch ? entry->branch : "main";
+
+    struct json_object *value;
+    entry->replicas = 1;
+    if (json_object_object_get_ex(object, "replicas", &value))
+    {
+        entry->replicas = json_object_get_int(value);
+        if (!json_object_is_type(value, json_type_int) || entry->replicas < 1)
+        {
+            return manifest_error(index, entry->id, "\"replicas\" must be a positive integer.");
+        }
+    }
+
+    struct json_object *resources;
+    if (json_object_object_get_ex(object, "resources", &resources))
+    {
+        if (json_object_object_get_ex(resources, "cpus", &value))
+        {
+            entry->cpu_limit = json_object_get_double(value);
+            if ((!json_object_is_type(value, json_type_double) && !json_object_is_type(value, json_type_int)) || entry->cpu_limit <= 0)
+            {
+                return manifest_error(index, entry->id, "\"resources.cpus\" must be a positive number.");
+            }
+        }
+        if (json_object_object_get_ex(resources, "memory", &value))
+        {
+            // A number is in bytes; strings take the same units as "cache gc --keep"
+            int valid = 0;
+            if (json_object_is_type(value, json_type_int))
+            {
+                entry->memory_limit = json_object_get_int64(value);
+                valid = 1;
+            }
+            else if (json_object_is_type(value, json_type_string))
+            {
+                valid = parse_byte_size(json_object_get_string(value), &entry->memory_limit) == 0;
+            }
+            if (!valid || entry->memory_limit <= 0)
+            {
+                return manifest_error(index, entry->id, "\"resources.memory\" must be a size such as \"512M\".");
+            }
+        }
+    }
+
+    if (json_object_object_get_ex(object, "depends_on", &entry->depends_on))
+    {
+        int valid = json_object_is_type(entry->depends_on, json_type_array);
+        for (size_t i = 0; valid && i < json_object_array_length(entry->depends_on); i++)
+        {
+            valid = json_object_is_type(json_object_array_get_idx(entry->depends_on, i), json_type_string);
+        }
+        if (!valid)
+        {
+            return manifest_error(index, entry->id, "\"depends_on\" must be an array of repository IDs.");
+        }
+    }
+    return 0;
+}
+
+// Repositories the manifest leaves out are deleted, so every depends_on ID must be declared
+// in it, and its edges alone must not form a cycle
+static int check_dependencies(const struct manifest_entry *entries, size_t count)
+{
+    size_t edge_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        edge_count += entries[i].depends_on ? json_object_array_length(entries[i].depends_on) : 0;
+    }
+
+    struct dependency_list list = {calloc(edge_count ? edge_count : 1, sizeof(struct repository_dependency)), 0};
+    int status = list.items ? 0 : -1;
+    for (size_t i = 0; status == 0 && i < count; i++)
+    {
+        for (size_t j = 0; status == 0 && entries[i].depends_on && j < json_object_array_length(entries[i].depends_on); j++)
+        {
+            const char *depends_on = json_object_get_string(json_object_array_get_idx(entries[i].depends_on, j));
+            int declared = 0;
+            for (size_t k = 0; k < count && !declared; k++)
+            {
+                declared = strcmp(entries[k].id, depends_on) == 0;
+            }
+
+            char problem[300];
+            if (!declared || strcmp(depends_on, entries[i].id) == 0)
+            {
+                snprintf(problem, sizeof(problem), declared ? "\"depends_on\" lists the repository itself."
+                                                            : "\"depends_on\" lists %s, which the manifest does not declare.",
+                         depends_on);
+                status = manifest_error(i, entries[i].id, problem);
+                break;
+            }
+            list.items[list.count].repo_id = strdup(entries[i].id);
+            list.items[list.count].depends_on = strdup(depends_on);
+            list.count++;
+        }
+    }
+
+    for (size_t i = 0; status == 0 && i < list.count; i++)
+    {
+        if (dependency_reaches(&list, list.items[i].depends_on, list.items[i].repo_id) == 1)
+        {
+            for (size_t k = 0; k < count; k++)
+            {
+                if (strcmp(entries[k].id, list.items[i].repo_id) == 0)
+                {
+                    status = manifest_error(k, entries[k].id, "\"depends_on\" forms a cycle.");
+                }
+            }
+        }
+    }
+    dependency_list_free(&list);
+    return status;
+}
+
+static int parse_manifest(struct json_object *root, struct manifest_entry **entries, size_t *count)
+{
+    struct json_object *repositories;
+    if (!json_object_object_get_ex(root, "repositories", &repositories) || !json_object_is_type(repositories, json_type_array))
+    {
+        log_message(ERROR, ERROR_SYMBOL, "The manifest needs a \"repositories\" array.");
+        return -1;
+    }
+
+    *count = json_object_array_length(repositories);
+    *entries = calloc(*count ? *count : 1, sizeof(struct manifest_entry));
+    if (!*entries)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < *count; i++)
+    {
+        if (parse_entry(json_object_array_get_idx(repositories, i), i, &(*entries)[i]) != 0)
+        {
+            return -1;
+        }
+        for (size_t j = 0; j < i; j++)
+        {
+            if (strcmp((*entries)[j].id, (*entries)[i].id) == 0)
+            {
+                return manifest_error(i, (*entries)[i].id, "the ID is declared twice.");
+            }
+        }
+    }
+    return check_dependencies(*entries, *count);
+}
+
+static int manifest_declares(const struct manifest_entry *entry, const char *repo_id)
+{
+    for (size_t i = 0; entry->depends_on && i < json_object_array_length(entry->depends_on); i++)
+    {
+        if (strcmp(json_object_get_string(json_object_array_get_idx(entry->depends_on, i)), repo_id) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether the recorded edges of `repo_id` differ from the ones the entry declares
+static int dependencies_differ(const struct manifest_entry *entry, const struct dependency_list *dependencies)
+{
+    size_t recorded = 0;
+    for (size_t i = 0; i < dependencies->count; i++)
+    {
+        if (strcmp(dependencies->items[i].repo_id, entry->id) == 0)
+        {
+            if (!manifest_declares(entry, dependencies->items[i].depends_on))
+            {
+                return 1;
+            }
+            recorded++;
+        }
+    }
+    return recorded != (entry->depends_on ? json_object_array_length(entry->depends_on) : 0);
+}
+
+// Add a comma-separated description to the step's list of changes
+static void append_change(struct apply_step *step, const char *format, ...)
+{
+    size_t length = strlen(step->changes);
+    if (length > 0 && length + 2 < sizeof(step->changes))
+    {
+        strcat(step->changes, ", ");
+        length += 2;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(step->changes + length, sizeof(step->changes) - length, format, args);
+    va_end(args);
+}
+
+// Compare a declared repository with its row and record what apply has to change
+static void plan_existing(const struct manifest_entry *entry, const struct repository *repository,
+                          const struct dependency_list *dependencies, struct apply_step *step)
+{
+    char folder[PATH_MAX];
+    char prefix[256];
+    const char *tag;
+    repository_folder(repository->destination_folder, folder, sizeof(folder));
+    split_image_tag(repository->docker_image_tag, prefix, sizeof(prefix), &tag);
+    snprintf(step->old_port, sizeof(step->old_port), "%s", repository->docker_port);
+    snprintf(step->folder, sizeof(step->folder), "%s", folder);
+
+    if (strcmp(entry->git_url, repository->git_url) != 0 || (entry->folder && strcmp(entry->folder, folder) != 0))
+    {
+        step->actions = APPLY_CONFLICT;
+        append_change(step, "git_url or folder changed; delete the repository first");
+        return;
+    }
+
+    if (strcmp(entry->branch, repository->branch_name) != 0)
+    {
+        step->actions |= APPLY_SWITCH | APPLY_DEPLOY;
+        append_change(step, "branch %s -> %s", repository->branch_name, entry->branch);
+    }
+    if (strcmp(entry->image, prefix) != 0)
+    {
+        step->actions |= APPLY_RETAG | APPLY_DEPLOY;
+        append_change(step, "image %s -> %s", prefix, entry->image);
+    }
+
+    const char *mode = repository->deploy_mode ? repository->deploy_mode : DEPLOY_MODE_BUILD;
+    if (strcmp(entry->mode ? entry->mode : DEPLOY_MODE_BUILD, mode) != 0)
+    {
+        step->actions |= APPLY_SETTINGS | APPLY_DEPLOY;
+        append_change(step, "mode %s -> %s", mode, entry->mode ? entry->mode : DEPLOY_MODE_BUILD);
+    }
+    if (strcmp(entry->health ? entry->health : "", repository->health_path ? repository->health_path : "") != 0)
+    {
+        step->actions |= APPLY_SETTINGS;
+        append_change(step, "health %s -> %s", repository->health_path ? repository->health_path : "off",
+                      entry->health ? entry->health : "off");
+    }
+
+    if (strcmp(entry->port, repository->docker_port) != 0)
+    {
+        step->actions |= APPLY_SERVICE;
+        append_change(step, "port %s -> %s", repository->docker_port, entry->port);
+    }
+    if (entry->replicas != (repository->replicas > 0 ? repository->replicas : 1) ||
+        entry->cpu_limit != repository->cpu_limit || entry->memory_limit != repository->memory_limit)
+    {
+        step->actions |= APPLY_SERVICE;
+        append_change(step, "replicas or resources");
+    }
+    if (dependencies_differ(entry, dependencies))
+    {
+        step->actions |= APPLY_DEPENDS;
+        append_change(step, "depends_on");
+    }
+}
+
+static const char *action_label(int actions)
+{
+    return actions & APPLY_CONFLICT ? "CONFLICT"
+           : actions & APPLY_DELETE ? "delete"
+           : actions & APPLY_CLONE  ? "clone"
+           : actions & APPLY_SWITCH ? "switch"
+           : actions & APPLY_DEPLOY ? "deploy"
+           : actions & APPLY_SERVICE ? "reconfigure"
+                                     : "update";
+}
+
+static void print_plan(const struct apply_step *steps, size_t count)
+{
+    log_flush();
+    printf("\n%-25s %-12s %s\n", "ID", "Action", "Changes");
+    printf("%-25s %-12s %s\n", "-------------------------", "------------", "-------------------------------");
+    int unchanged = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (steps[i].actions == 0)
+        {
+            unchanged++;
+            continue;
+        }
+        printf("%-25s %-12s %s\n", steps[i].repo_id, action_label(steps[i].actions), steps[i].changes);
+    }
+    printf("\n%d unchanged.\n\n", unchanged);
+}
+
+// Clone, switch or delete one repository
+static void apply_git_step(struct apply_step *step)
+{
+    log_capture(&step->output);
+    struct repository repository;
+    int found;
+    if (step->actions & APPLY_CLONE)
+    {
+        const struct manifest_entry *entry = step->entry;
+        int cloned = clone_new_repo(entry->id, entry->git_url, step->folder, entry->branch, entry->image, entry->port);
+        found = repository_find(step->repo_id, &repository);
+        step->status = cloned == 0 && found == 0 ? 0 : -1;
+    }
+    else if (step->actions & APPLY_SWITCH)
+    {
+        switch_to_branch_or_tag(step->repo_id, step->entry->branch);
+        found = repository_find(step->repo_id, &repository);
+        step->status = found == 0 && strcmp(repository.branch_name, step->entry->branch) == 0 ? 0 : -1;
+    }
+    else
+    {
+        delete_service(step->repo_id);
+        found = repository_find(step->repo_id, &repository);
+        step->status = found == 1 ? 0 : -1;
+    }
+    if (found == 0)
+    {
+        repository_free(&repository);
+    }
+    log_capture(NULL);
+}
+
+static int has_git_step(const struct apply_step *step)
+{
+    return (step->actions & (APPLY_CLONE | APPLY_SWITCH | APPLY_DELETE)) != 0;
+}
+
+// Repositories in one folder share its object store, and repositories cloned from one
+// origin share its git object cache, which the last delete removes. Steps linked either
+// way, directly or through others, form one group led by its first step.
+static void group_git_steps(struct apply_step *steps, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        steps[i].group = i;
+        for (size_t j = 0; j < i; j++)
+        {
+            if (!has_git_step(&steps[i]) || !has_git_step(&steps[j]) || steps[j].group == steps[i].group ||
+                (strcmp(steps[i].folder, steps[j].folder) != 0 && strcmp(steps[i].git_url, steps[j].git_url) != 0))
+            {
+                continue;
+            }
+            size_t leader = steps[i].group < steps[j].group ? steps[i].group : steps[j].group;
+            size_t merged = steps[i].group < steps[j].group ? steps[j].group : steps[i].group;
+            for (size_t k = 0; k <= i; k++)
+            {
+                steps[k].group = steps[k].group == merged ? leader : steps[k].group;
+            }
+        }
+    }
+}
+
+// The git work of apply runs in the pool, one task per group: the steps of a group run
+// one after another, deletes first
+static void git_group_task(size_t index, void *context)
+{
+    struct apply_batch *batch = context;
+    if (!has_git_step(&batch->steps[index]) || batch->steps[index].group != index)
+    {
+        return;
+    }
+
+    for (int deletes = 1; deletes >= 0; deletes--)
+    {
+        for (size_t i = index; i < batch->count; i++)
+        {
+            struct apply_step *step = &batch->steps[i];
+            if (has_git_step(step) && step->group == index && ((step->actions & APPLY_DELETE) != 0) == deletes)
+            {
+                apply_git_step(step);
+            }
+        }
+    }
+}
+
+// Repositories whose ports, replicas or limits changed but that are not redeployed get
+// a service update with the image they already run
+static void reconfigure_task(size_t index, void *context)
+{
+    struct apply_step *step = &((struct apply_step *)context)[index];
+    int port_changed = step->entry && strcmp(step->old_port, step->entry->port) != 0;
+    if (step->status != 0 || !(step->actions & APPLY_SERVICE) || (step->actions & APPLY_CLONE) ||
+        ((step->actions & APPLY_DEPLOY) && !port_changed))
+    {
+        return;
+    }
+
+    log_capture(&step->output);
+    const struct manifest_entry *entry = step->entry;
+    char service_name[256];
+    char image[512];
+    struct json_object *current_service = NULL;
+    snprintf(service_name, sizeof(service_name), "%s_service", step->repo_id);
+
+    int found = docker_service_inspect(service_name, &current_service);
+    if (found == 0 && docker_service_image(service_name, image, sizeof(image)) == 0)
+    {
+        struct docker_service_spec spec = {
+            .name = service_name,
+            .image = image,
+            .port = entry->port,
+            .replicas = entry->replicas,
+            .remove_port = port_changed ? step->old_port : NULL,
+            .set_resources = 1,
+            .cpu_limit = entry->cpu_limit,
+            .memory_limit = entry->memory_limit,
+        };
+        step->status = docker_service_update(&spec, current_service);
+    }
+    else
+    {
+        // Without a service the settings apply when it is first deployed
+        step->status = found == 1 ? 0 : -1;
+    }
+    json_object_put(current_service);
+
+    if (step->status == 0)
+    {
+        char log_msg[300];
+        snprintf(log_msg, sizeof(log_msg), "Service settings of %s applied.", step->repo_id);
+        log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+    }
+    log_capture(NULL);
+}
+
+// Write the settings and dependencies of every planned repository in one transaction
+static void apply_settings(struct apply_step *steps, size_t count, const struct dependency_list *dependencies)
+{
+    database_begin();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct apply_step *step = &steps[i];
+        const struct manifest_entry *entry = step->entry;
+        if (step->status != 0 || !entry)
+        {
+            continue;
+        }
+
+        int failed = 0;
+        if (step->actions & (APPLY_CLONE | APPLY_SERVICE))
+        {
+            failed |= repository_update_service(entry->id, entry->port, entry->replicas, entry->cpu_limit, entry->memory_limit) != 0;
+        }
+        if (step->actions & (APPLY_CLONE | APPLY_SETTINGS))
+        {
+            failed |= repository_update_mode(entry->id, entry->mode) != 0;
+            failed |= repository_update_health_path(entry->id, entry->health) != 0;
+        }
+
+        // A new prefix keeps the tag; forgetting the fingerprint makes the deploy build it
+        struct repository repository;
+        if ((step->actions & APPLY_RETAG) && repository_find(entry->id, &repository) == 0)
+        {
+            char prefix[256];
+            char docker_image_tag[512];
+            const char *tag;
+            split_image_tag(repository.docker_image_tag, prefix, sizeof(prefix), &tag);
+            snprintf(docker_image_tag, sizeof(docker_image_tag), "%s:%s", entry->image, tag);
+            failed |= repository_update_ref(entry->id, repository.destination_folder, repository.branch_name, docker_image_tag) != 0;
+            failed |= repository_update_fingerprint(entry->id, NULL, NULL, NULL) != 0;
+            repository_free(&repository);
+        }
+
+        if (failed)
+        {
+            char error_msg[300];
+            snprintf(error_msg, sizeof(error_msg), "Failed to save the settings of %s.", entry->id);
+            log_message(ERROR, ERROR_SYMBOL, error_msg);
+            step->status = -1;
+        }
+    }
+
+    // Drop stale edges before adding new ones, so that reversing an edge is not taken for a cycle
+    for (size_t i = 0; i < dependencies->count; i++)
+    {
+        for (size_t j = 0; j < count; j++)
+        {
+            const struct apply_step *step = &steps[j];
+            if (step->status == 0 && (step->actions & APPLY_DEPENDS) &&
+                strcmp(step->repo_id, dependencies->items[i].repo_id) == 0 &&
+                !manifest_declares(step->entry, dependencies->items[i].depends_on))
+            {
+                dependency_remove(step->repo_id, dependencies->items[i].depends_on);
+            }
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        struct apply_step *step = &steps[i];
+        if (step->status != 0 || !(step->actions & APPLY_DEPENDS))
+        {
+            continue;
+        }
+        size_t declared = step->entry->depends_on ? json_object_array_length(step->entry->depends_on) : 0;
+        for (size_t j = 0; j < declared; j++)
+        {
+            const char *depends_on = json_object_get_string(json_object_array_get_idx(step->entry->depends_on, j));
+            if (dependency_add(step->repo_id, depends_on) != 0)
+            {
+                step->status = -1;
+            }
+        }
+    }
+
+    if (database_commit() != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to save the manifest settings.");
+    }
+}
+
+// Print the captured log of every step that failed
+static int report_failures(const struct apply_step *steps, size_t count)
+{
+    int failed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (steps[i].status != 0)
+        {
+            failed++;
+            log_flush();
+            printf("\n===== %s (%s, FAILED) =====\n", steps[i].repo_id, action_label(steps[i].actions));
+            if (steps[i].output.data)
+            {
+                fputs(steps[i].output.data, stdout);
+            }
+        }
+    }
+    return failed;
+}
+
+// Bring the repositories in line with a manifest: clone the new ones, switch, re-tag or
+// reconfigure the changed ones, delete the ones it no longer lists, then deploy what changed
+// in dependency order. Clones, switches, deletes, reconfigures and deploys run up to
+// `jobs` at a time. Returns 0 when every step succeeded.
+int apply_manifest(const char *path, int jobs, int dry_run)
+{
+    struct json_object *root = json_object_from_file(path);
+    if (!root)
+    {
+        char error_msg[PATH_MAX + 64];
+        snprintf(error_msg, sizeof(error_msg), "Failed to read the manifest %s.", path);
+        log_message(ERROR, ERROR_SYMBOL, error_msg);
+        return -1;
+    }
+
+    struct manifest_entry *entries = NULL;
+    size_t entry_count = 0;
+    if (parse_manifest(root, &entries, &entry_count) != 0 || entry_count == 0)
+    {
+        if (entries && entry_count == 0)
+        {
+            // Applying it would delete every repository, which is never what an empty file means
+            log_message(ERROR, ERROR_SYMBOL, "The manifest declares no repositories; use delete to remove them.");
+        }
+        free(entries);
+        json_object_put(root);
+        return -1;
+    }
+
+    struct repository_list repositories;
+    struct dependency_list dependencies;
+    if (repository_list_all(&repositories) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to read the repositories.");
+        free(entries);
+        json_object_put(root);
+        return -1;
+    }
+    struct apply_step *steps = calloc(entry_count + repositories.count, sizeof(struct apply_step));
+    if (!steps || repository_dependency_list(&dependencies) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to read repository dependencies.");
+        free(steps);
+        repository_list_free(&repositories);
+        free(entries);
+        json_object_put(root);
+        return -1;
+    }
+
+    // One step per declared repository, then one per repository the manifest no longer lists
+    size_t count = 0;
+    for (size_t i = 0; i < entry_count; i++)
+    {
+        struct apply_step *step = &steps[count++];
+        step->repo_id = strdup(entries[i].id);
+        step->git_url = strdup(entries[i].git_url);
+        step->entry = &entries[i];
+        output_buffer_init(&step->output);
+
+        const struct repository *repository = NULL;
+        for (size_t j = 0; j < repositories.count && !repository; j++)
+        {
+            repository = strcmp(repositories.items[j].id, entries[i].id) == 0 ? &repositories.items[j] : NULL;
+        }
+        if (repository)
+        {
+            plan_existing(&entries[i], repository, &dependencies, step);
+        }
+        else
+        {
+            step->actions = APPLY_CLONE | APPLY_DEPLOY | (entries[i].depends_on ? APPLY_DEPENDS : 0);
+            snprintf(step->folder, sizeof(step->folder), "%s", entries[i].folder ? entries[i].folder : entries[i].id);
+            append_change(step, "new, %s@%s", entries[i].git_url, entries[i].branch);
+        }
+    }
+    for (size_t i = 0; i < repositories.count; i++)
+    {
+        int declared = 0;
+        for (size_t j = 0; j < entry_count && !declared; j++)
+        {
+            declared = strcmp(entries[j].id, repositories.items[i].id) == 0;
+        }
+        if (!declared)
+        {
+            struct apply_step *step = &steps[count++];
+            step->repo_id = strdup(repositories.items[i].id);
+            step->git_url = strdup(repositories.items[i].git_url);
+            step->actions = APPLY_DELETE;
+            repository_folder(repositories.items[i].destination_folder, step->folder, sizeof(step->folder));
+            output_buffer_init(&step->output);
+            append_change(step, "not in the manifest");
+        }
+    }
+    repository_list_free(&repositories);
+
+    print_plan(steps, count);
+
+    // Conflicts are never applied, so a dry run reports them as failures too
+    int failed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        steps[i].status = steps[i].actions & APPLY_CONFLICT ? -1 : 0;
+        failed += steps[i].status != 0;
+    }
+
+    if (!dry_run)
+    {
+        int job_count = resolve_job_count(jobs);
+        struct apply_batch batch = {steps, count};
+        group_git_steps(steps, count);
+        run_worker_pool(count, job_count, git_group_task, &batch);
+        apply_settings(steps, count, &dependencies);
+        run_worker_pool(count, job_count, reconfigure_task, steps);
+        failed = report_failures(steps, count);
+
+        // Deploys run as one fleet deploy, so dependencies are ordered and the prune runs once
+        const char **deploy_ids = malloc(count * sizeof(char *));
+        size_t deploy_count = 0;
+        for (size_t i = 0; deploy_ids && i < count; i++)
+        {
+            if (steps[i].status == 0 && (steps[i].actions & APPLY_DEPLOY))
+            {
+                deploy_ids[deploy_count++] = steps[i].repo_id;
+            }
+        }
+        struct deploy_options options = {.jobs = job_count};
+        if (deploy_count > 0 && deploy_repos(deploy_ids, deploy_count, &options) != 0)
+        {
+            failed++;
+        }
+        free(deploy_ids);
+
+        if (failed > 0)
+        {
+            log_message(ERROR, ERROR_SYMBOL, "Some repositories could not be brought in line with the manifest.");
+        }
+        else
+        {
+            log_message(SUCCESS, SUCCESS_SYMBOL, "The repositories match the manifest.");
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        free(steps[i].repo_id);
+        free(steps[i].git_url);
+        output_buffer_free(&steps[i].output);
+    }
+    free(steps);
+    dependency_list_free(&dependencies);
+    free(entries);
+    json_object_put(root);
+    return failed > 0 ? -1 : 0;
+}
+
+// Sizes that are whole mebibytes or gibibytes read back as "512M" or "2G"
+static struct json_object *memory_value(long long bytes)
+{
+    char text[32];
+    const long long mebibyte = 1024LL * 1024;
+    if (bytes % (mebibyte * 1024) == 0)
+    {
+        snprintf(text, sizeof(text), "%lldG", bytes / (mebibyte * 1024));
+    }
+    else if (bytes % mebibyte == 0)
+    {
+        snprintf(text, sizeof(text), "%lldM", bytes / mebibyte);
+    }
+    else
+    {
+        return json_object_new_int64(bytes);
+    }
+    return json_object_new_string(text);
+}
+
+// Write the repositories as a manifest that "apply" accepts, to `path` or to stdout when it is NULL
+int export_manifest(const char *path)
+{
+    struct repository_list repositories;
+    struct dependency_list dependencies;
+    if (repository_list_all(&repositories) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to read the repositories.");
+        return -1;
+    }
+    if (repository_dependency_list(&dependencies) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to read repository dependencies.");
+        repository_list_free(&repositories);
+        return -1;
+    }
+
+    struct json_object *root = json_object_new_object();
+    struct json_object *array = json_object_new_array();
+    json_object_object_add(root, "repositories", array);
+
+    for (size_t i = 0; i < repositories.count; i++)
+    {
+        const struct repository *repository = &repositories.items[i];
+        struct json_object *object = json_object_new_object();
+        char folder[PATH_MAX];
+        char prefix[256];
+        const char *tag;
+        repository_folder(repository->destination_folder, folder, sizeof(folder));
+        split_image_tag(repository->docker_image_tag, prefix, sizeof(prefix), &tag);
+
+        json_object_object_add(object, "id", json_object_new_string(repository->id));
+        json_object_object_add(object, "git_url", json_object_new_string(repository->git_url));
+        json_object_object_add(object, "branch", json_object_new_string(repository->branch_name));
+        json_object_object_add(object, "image", json_object_new_string(prefix));
+        json_object_object_add(object, "port", json_object_new_string(repository->docker_port));
+        json_object_object_add(object, "replicas", json_object_new_int(repository->replicas > 0 ? repository->replicas : 1));
+        if (repository->cpu_limit > 0 || repository->memory_limit > 0)
+        {
+            struct json_object *resources = json_object_new_object();
+            if (repository->cpu_limit > 0)
+            {
+                json_object_object_add(resources, "cpus", json_object_new_double(repository->cpu_limit));
+            }
+            if (repository->memory_limit > 0)
+            {
+                json_object_object_add(resources, "memory", memory_value(repository->memory_limit));
+            }
+            json_object_object_add(object, "resources", resources);
+        }
+        if (strcmp(folder, repository->id) != 0)
+        {
+            json_object_object_add(object, "folder", json_object_new_string(folder));
+        }
+        if (repository->deploy_mode)
+        {
+            json_object_object_add(object, "mode", json_object_new_string(repository->deploy_mode));
+        }
+        if (repository->health_path)
+        {
+            json_object_object_add(object, "health", json_object_new_string(repository->health_path));
+        }
+
+        struct json_object *depends_on = json_object_new_array();
+        for (size_t j = 0; j < dependencies.count; j++)
+        {
+            if (strcmp(dependencies.items[j].repo_id, repository->id) == 0)
+            {
+                json_object_array_add(depends_on, json_object_new_string(dependencies.items[j].depends_on));
+            }
+        }
+        if (json_object_array_length(depends_on) > 0)
+        {
+            json_object_object_add(object, "depends_on", depends_on);
+        }
+        else
+        {
+            json_object_put(depends_on);
+        }
+
+        json_object_array_add(array, object);
+    }
+
+    int flags = JSON_C_TO_STRING_PRETTY | JSON_C_TO_STRING_SPACED | JSON_C_TO_STRING_NOSLASHESCAPE;
+    int status = 0;
+    if (path)
+    {
+        status = json_object_to_file_ext(path, root, flags) == 0 ? 0 : -1;
+        char log_msg[PATH_MAX + 64];
+        if (status == 0)
+        {
+            snprintf(log_msg, sizeof(log_msg), "Manifest of %zu repositories written to %s.", repositories.count, path);
+            log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+        }
+        else
+        {
+            snprintf(log_msg, sizeof(log_msg), "Failed to write the manifest to %s.", path);
+            log_message(ERROR, ERROR_SYMBOL, log_msg);
+        }
+    }
+    else
+    {
+        log_flush();
+        printf("%s\n", json_object_to_json_string_ext(root, flags));
+    }
+
+    json_object_put(root);
+    dependency_list_free(&dependencies);
+    repository_list_free(&repositories);
+    return status;
+}
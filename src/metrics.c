@@ -0,0 +1,420 @@
+#include "metrics.h"
+#include "database.h"
+#include "logger.h"
+#include "utils.h"
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Upper bounds (seconds) shared by every duration histogram. run_durations stores folded
+// observations by bound, so only ever add bounds here.
+static const double duration_buckets[] = {0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300, 600};
+#define DURATION_BUCKET_COUNT (sizeof(duration_buckets) / sizeof(duration_buckets[0]))
+
+// Serializes textfile writers so an older snapshot never replaces a newer one
+static pthread_mutex_t textfile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void append_header(struct output_buffer *out, const char *name, const char *type, const char *help)
+{
+    output_buffer_appendf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Label values are quoted strings: escape backslash, double quote and newline
+static void append_label_value(struct output_buffer *out, const char *value)
+{
+    output_buffer_append(out, "\"", 1);
+    for (const char *c = value ? value : ""; *c; c++)
+    {
+        if (*c == '\\' || *c == '"')
+        {
+            char escaped[2] = {'\\', *c};
+            output_buffer_append(out, escaped, 2);
+        }
+        else if (*c == '\n')
+        {
+            output_buffer_append(out, "\\n", 2);
+        }
+        else
+        {
+            output_buffer_append(out, c, 1);
+        }
+    }
+    output_buffer_append(out, "\"", 1);
+}
+
+static void append_labels(struct output_buffer *out, const char *const names[], sqlite3_stmt *stmt, int count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    output_buffer_append(out, "{", 1);
+    for (int i = 0; i < count; i++)
+    {
+        output_buffer_appendf(out, "%s%s=", i > 0 ? "," : "", names[i]);
+        append_label_value(out, (const char *)sqlite3_column_text(stmt, i));
+    }
+    output_buffer_append(out, "}", 1);
+}
+
+static void append_value(struct output_buffer *out, sqlite3_stmt *stmt, int column)
+{
+    if (sqlite3_column_type(stmt, column) == SQLITE_INTEGER)
+    {
+        output_buffer_appendf(out, " %lld\n", (long long)sqlite3_column_int64(stmt, column));
+    }
+    else
+    {
+        output_buffer_appendf(out, " %.6f\n", sqlite3_column_double(stmt, column));
+    }
+}
+
+// One sample per row: the first label_count columns are label values, the next is the value.
+// Rows whose value is NULL are skipped.
+static int append_samples(struct output_buffer *out, const char *name, const char *const labels[], int label_count,
+                          enum database_statement query)
+{
+    sqlite3_stmt *stmt = database_acquire(query);
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        if (sqlite3_column_type(stmt, label_count) == SQLITE_NULL)
+        {
+            continue;
+        }
+        output_buffer_append(out, name, strlen(name));
+        append_labels(out, labels, stmt, label_count);
+        append_value(out, stmt, label_count);
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    }
+    database_release(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+static void append_histogram_series(struct output_buffer *out, const char *name, const char *label, const char *value,
+                                    const unsigned long long *buckets, unsigned long long count, double sum)
+{
+    for (size_t i = 0; i <= DURATION_BUCKET_COUNT; i++)
+    {
+        output_buffer_appendf(out, "%s_bucket{%s=", name, label);
+        append_label_value(out, value);
+        if (i < DURATION_BUCKET_COUNT)
+        {
+            output_buffer_appendf(out, ",le=\"%g\"} %llu\n", duration_buckets[i], buckets[i]);
+        }
+        else
+        {
+            output_buffer_appendf(out, ",le=\"+Inf\"} %llu\n", count);
+        }
+    }
+
+    output_buffer_appendf(out, "%s_sum{%s=", name, label);
+    append_label_value(out, value);
+    output_buffer_appendf(out, "} %.6f\n", sum);
+    output_buffer_appendf(out, "%s_count{%s=", name, label);
+    append_label_value(out, value);
+    output_buffer_appendf(out, "} %llu\n", count);
+}
+
+// Cumulative histogram per label value. The query returns (label value, observations,
+// seconds, bucket value) ordered by label value, so each series is folded in a single
+// pass: recent runs are single observations, folded ones come pre-counted per bucket.
+static int append_histogram(struct output_buffer *out, const char *name, const char *label, enum database_statement query)
+{
+    sqlite3_stmt *stmt = database_acquire(query);
+    int rc;
+    char current[256] = "";
+    unsigned long long buckets[DURATION_BUCKET_COUNT];
+    unsigned long long count = 0;
+    double sum = 0;
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        const char *value = (const char *)sqlite3_column_text(stmt, 0);
+        unsigned long long observations = (unsigned long long)sqlite3_column_int64(stmt, 1);
+        double seconds = sqlite3_column_double(stmt, 2);
+        double bucket_value = sqlite3_column_double(stmt, 3);
+
+        if (count == 0 || strcmp(current, value ? value : "") != 0)
+        {
+            if (count > 0)
+            {
+                append_histogram_series(out, name, label, current, buckets, count, sum);
+            }
+            snprintf(current, sizeof(current), "%s", value ? value : "");
+            memset(buckets, 0, sizeof(buckets));
+            count = 0;
+            sum = 0;
+        }
+
+        for (size_t i = 0; i < DURATION_BUCKET_COUNT; i++)
+        {
+            if (bucket_value <= duration_buckets[i])
+            {
+                buckets[i] += observations;
+            }
+        }
+        count += observations;
+        sum += seconds;
+    }
+
+    if (count > 0)
+    {
+        append_histogram_series(out, name, label, current, buckets, count, sum);
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    }
+    database_release(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Smallest bucket bound that holds `seconds`, INFINITY for the +Inf bucket
+static double bucket_bound(double seconds)
+{
+    for (size_t i = 0; i < DURATION_BUCKET_COUNT; i++)
+    {
+        if (seconds <= duration_buckets[i])
+        {
+            return duration_buckets[i];
+        }
+    }
+    return INFINITY;
+}
+
+static int step_folded_runs(enum database_statement statement, const char *repo_id, const char *kind, sqlite3_int64 cutoff)
+{
+    sqlite3_stmt *stmt = database_acquire(statement);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, kind, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, cutoff);
+    int status = sqlite3_step(stmt) == SQLITE_DONE ? 0 : -1;
+    database_release(stmt);
+    return status;
+}
+
+// Keep the newest `keep` runs of a repository and kind in deploy_runs. Older runs are
+// added to run_totals and run_durations, so counters and histograms still count them,
+// and then deleted with their phases. Call inside a transaction.
+int metrics_fold_runs(const char *repo_id, const char *kind, int keep)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_RUN_HISTORY_CUTOFF);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, kind, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, keep);
+    int rc = sqlite3_step(stmt);
+    sqlite3_int64 cutoff = rc == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+    database_release(stmt);
+    if (rc != SQLITE_ROW)
+    {
+        return rc == SQLITE_DONE ? 0 : -1;
+    }
+
+    int status = 0;
+    stmt = database_acquire(STMT_RUN_DURATIONS_FOLDED);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, kind, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, cutoff);
+    while (status == 0 && (rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        double seconds = sqlite3_column_double(stmt, 2);
+        sqlite3_stmt *add = database_acquire(STMT_RUN_DURATION_ADD);
+        sqlite3_bind_text(add, 1, (const char *)sqlite3_column_text(stmt, 0), -1, SQLITE_STATIC);
+        sqlite3_bind_text(add, 2, (const char *)sqlite3_column_text(stmt, 1), -1, SQLITE_STATIC);
+        sqlite3_bind_double(add, 3, bucket_bound(seconds));
+        sqlite3_bind_double(add, 4, seconds);
+        status = sqlite3_step(add) == SQLITE_DONE ? 0 : -1;
+        database_release(add);
+    }
+    if (status == 0 && rc != SQLITE_DONE)
+    {
+        status = -1;
+    }
+    database_release(stmt);
+
+    // Totals before the rows go, phases before their runs
+    if (status != 0 || step_folded_runs(STMT_RUN_TOTALS_FOLD, repo_id, kind, cutoff) != 0 ||
+        step_folded_runs(STMT_RUN_PHASES_TRIM, repo_id, kind, cutoff) != 0 ||
+        step_folded_runs(STMT_RUN_TRIM, repo_id, kind, cutoff) != 0)
+    {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+    return 0;
+}
+
+// Render every metric in the Prometheus text exposition format (0.0.4).
+// Counters are derived from the run history and the totals of runs trimmed from
+// it, so they survive restarts and only reset if those tables are cleared.
+int render_metrics(struct output_buffer *out)
+{
+    static const char *const repo[] = {"repo"};
+    static const char *const repo_outcome[] = {"repo", "outcome"};
+    static const char *const repo_kind[] = {"repo", "kind"};
+    static const char *const repo_info[] = {"repo", "branch", "image"};
+    int status = 0;
+
+    // Hold the connection mutex so the whole snapshot sees the same rows
+    sqlite3_mutex *mutex = sqlite3_db_mutex(db);
+    sqlite3_mutex_enter(mutex);
+
+    append_header(out, "dployer_repository_info", "gauge", "Registered repositories.");
+    status |= append_samples(out, "dployer_repository_info", repo_info, 3, STMT_METRICS_REPOSITORY_INFO);
+
+    append_header(out, "dployer_deploys_total", "counter", "Deploy runs by repository and outcome (ok, skipped, failed).");
+    status |= append_samples(out, "dployer_deploys_total", repo_outcome, 2, STMT_METRICS_DEPLOYS);
+
+    append_header(out, "dployer_updates_total", "counter", "Update (fetch and integrate) runs by repository and outcome.");
+    status |= append_samples(out, "dployer_updates_total", repo_outcome, 2, STMT_METRICS_UPDATES);
+
+    // Every registered repository gets a series, so increase() works from the first failure
+    append_header(out, "dployer_failures_total", "counter", "Failed deploy and update runs by repository.");
+    status |= append_samples(out, "dployer_failures_total", repo_kind, 2, STMT_METRICS_FAILURES);
+
+    append_header(out, "dployer_deploy_duration_seconds", "histogram", "Wall-clock time of deploy runs that did not fail.");
+    status |= append_histogram(out, "dployer_deploy_duration_seconds", "repo", STMT_METRICS_DEPLOY_DURATIONS);
+
+    append_header(out, "dployer_deploy_phase_duration_seconds", "histogram", "Time spent in each deploy phase.");
+    status |= append_histogram(out, "dployer_deploy_phase_duration_seconds", "phase", STMT_METRICS_PHASE_DURATIONS);
+
+    append_header(out, "dployer_git_fetch_duration_seconds", "histogram", "Time spent in git fetch during updates.");
+    status |= append_histogram(out, "dployer_git_fetch_duration_seconds", "repo", STMT_METRICS_FETCH_DURATIONS);
+
+    append_header(out, "dployer_build_context_bytes_total", "counter", "Build context bytes streamed to the Docker daemon.");
+    status |= append_samples(out, "dployer_build_context_bytes_total", repo, 1, STMT_METRICS_CONTEXT_BYTES_TOTAL);
+
+    append_header(out, "dployer_build_context_bytes", "gauge", "Size of the most recent build context.");
+    status |= append_samples(out, "dployer_build_context_bytes", repo, 1, STMT_METRICS_CONTEXT_BYTES);
+
+    append_header(out, "dployer_build_cache_hit_bytes_total", "counter", "BuildKit cache bytes reused by deploy builds.");
+    status |= append_samples(out, "dployer_build_cache_hit_bytes_total", repo, 1, STMT_METRICS_CACHE_HIT_BYTES_TOTAL);
+
+    // Prefer the timestamp for alerting (time() - value): the age is only as fresh as the last render
+    append_header(out, "dployer_last_successful_deploy_timestamp_seconds", "gauge", "Unix time the last successful deploy finished.");
+    status |= append_samples(out, "dployer_last_successful_deploy_timestamp_seconds", repo, 1, STMT_METRICS_LAST_SUCCESS);
+
+    append_header(out, "dployer_last_successful_deploy_age_seconds", "gauge", "Seconds since the last successful deploy, as of this render.");
+    status |= append_samples(out, "dployer_last_successful_deploy_age_seconds", repo, 1, STMT_METRICS_LAST_SUCCESS_AGE);
+
+    sqlite3_mutex_leave(mutex);
+    return status == 0 ? 0 : -1;
+}
+
+// Write all of `data` to `fd`, retrying short writes
+static int write_all(int fd, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+// Refresh the textfile-collector file if METRICS_TEXTFILE_ENV is set. The file
+// is written next to its final path and renamed into place, so the collector
+// never reads a partial exposition. Returns 0 when disabled or written.
+int write_metrics_textfile()
+{
+    const char *path = getenv(METRICS_TEXTFILE_ENV);
+    if (!path || path[0] == '\0')
+    {
+        return 0;
+    }
+
+    struct output_buffer out;
+    output_buffer_init(&out);
+    if (render_metrics(&out) != 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "Metrics are incomplete: some queries failed.");
+    }
+
+    pthread_mutex_lock(&textfile_lock);
+
+    char temp_path[4096];
+    int fd = -1;
+    int status = -1;
+    int saved_errno = 0;
+    if (snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path) < (int)sizeof(temp_path))
+    {
+        fd = mkstemp(temp_path);
+    }
+
+    if (fd >= 0)
+    {
+        // mkstemp creates 0600; the collector usually runs as another user
+        if (fchmod(fd, 0644) == 0 && write_all(fd, out.data ? out.data : "", out.length) == 0 && fsync(fd) == 0)
+        {
+            status = 0;
+        }
+        if (close(fd) != 0)
+        {
+            status = -1;
+        }
+        if (status == 0 && rename(temp_path, path) != 0)
+        {
+            status = -1;
+        }
+        if (status != 0)
+        {
+            saved_errno = errno;
+            unlink(temp_path);
+        }
+    }
+    else
+    {
+        saved_errno = errno;
+    }
+
+    pthread_mutex_unlock(&textfile_lock);
+
+    if (status != 0)
+    {
+        char error_msg[4200];
+        snprintf(error_msg, sizeof(error_msg), "Failed to write metrics to %s: %s", path, strerror(saved_errno));
+        log_message(WARNING, WARNING_SYMBOL, error_msg);
+    }
+
+    output_buffer_free(&out);
+    return status;
+}
+
+// Print the exposition to stdout and refresh the textfile if one is configured
+int print_metrics()
+{
+    struct output_buffer out;
+    output_buffer_init(&out);
+
+    int status = render_metrics(&out);
+    log_flush();
+    fwrite(out.data ? out.data : "", 1, out.length, stdout);
+    fflush(stdout);
+    output_buffer_free(&out);
+
+    if (write_metrics_textfile() != 0)
+    {
+        status = -1;
+    }
+    return status;
+}
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct worker_pool
+{
+    size_t count;
+    size_t next;
+    pthread_mutex_t lock;
+    pool_task task;
+    void *context;
+};
+
+static void *worker_pool_thread(void *arg)
+{
+    struct worker_pool *pool = arg;
+
+    while (1)
+    {
+        // Claim the next unprocessed index
+        pthread_mutex_lock(&pool->lock);
+        size_t index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (index >= pool->count)
+        {
+            break;
+        }
+
+        pool->task(index, pool->context);
+    }
+
+    return NULL;
+}
+
+// Turn a user supplied job count into a usable one (0 or less means one per CPU)
+int resolve_job_count(int jobs)
+{
+    if (jobs > 0)
+    {
+        return jobs;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+void run_worker_pool(size_t count, int jobs, pool_task task, void *context)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    struct worker_pool pool = {count, 0, PTHREAD_MUTEX_INITIALIZER, task, context};
+
+    size_t thread_count = jobs > 0 ? (size_t)jobs : 1;
+    if (thread_count > count)
+    {
+        thread_count = count;
+    }
+
+    // A single job runs inline so serial runs behave exactly as before
+    if (thread_count == 1)
+    {
+        worker_pool_thread(&pool);
+        return;
+    }
+
+    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+    if (!threads)
+    {
+        worker_pool_thread(&pool);
+        return;
+    }
+
+    size_t started = 0;
+    for (; started < thread_count; started++)
+    {
+        if (pthread_create(&threads[started], NULL, worker_pool_thread, &pool) != 0)
+        {
+            break;
+        }
+    }
+
+    // If no thread could be started, process everything on the caller's thread
+    if (started == 0)
+    {
+        worker_pool_thread(&pool);
+    }
+
+    for (size_t i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    pthread_mutex_destroy(&pool.lock);
+}
+
+struct task_graph
+{
+    size_t count;
+    const size_t *dependent_offsets; // Dependents of node i are dependents[offsets[i] .. offsets[i + 1])
+    const size_t *dependents;
+    size_t *waiting_on;              // Unfinished dependencies per node
+    size_t *ready;                   // Queue of nodes whose dependencies all succeeded
+    size_t ready_head;
+    size_t ready_tail;
+    size_t running;
+    enum graph_node_state *states;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    graph_task task;
+    void *context;
+};
+
+// Mark everything downstream of `node` as skipped. Called with the lock held.
+static void skip_dependents(struct task_graph *graph, size_t node)
+{
+    for (size_t i = graph->dependent_offsets[node]; i < graph->dependent_offsets[node + 1]; i++)
+    {
+        size_t dependent = graph->dependents[i];
+        if (graph->states[dependent] == GRAPH_NODE_PENDING)
+        {
+            graph->states[dependent] = GRAPH_NODE_SKIPPED;
+            skip_dependents(graph, dependent);
+        }
+    }
+}
+
+static void *task_graph_thread(void *arg)
+{
+    struct task_graph *graph = arg;
+
+    pthread_mutex_lock(&graph->lock);
+    while (1)
+    {
+        // Nothing ready: wait for a running node to finish, or stop if none is left to release more
+        while (graph->ready_head == graph->ready_tail && graph->running > 0)
+        {
+            pthread_cond_wait(&graph->changed, &graph->lock);
+        }
+        if (graph->ready_head == graph->ready_tail)
+        {
+            break;
+        }
+
+        size_t node = graph->ready[graph->ready_head++];
+        graph->running++;
+        pthread_mutex_unlock(&graph->lock);
+
+        int status = graph->task(node, graph->context);
+
+        pthread_mutex_lock(&graph->lock);
+        graph->running--;
+        if (status == 0)
+        {
+            graph->states[node] = GRAPH_NODE_DONE;
+            for (size_t i = graph->dependent_offsets[node]; i < graph->dependent_offsets[node + 1]; i++)
+            {
+                size_t dependent = graph->dependents[i];
+                if (--graph->waiting_on[dependent] == 0 && graph->states[dependent] == GRAPH_NODE_PENDING)
+                {
+                    graph->ready[graph->ready_tail++] = dependent;
+                }
+            }
+        }
+        else
+        {
+            graph->states[node] = GRAPH_NODE_FAILED;
+            skip_dependents(graph, node);
+        }
+        pthread_cond_broadcast(&graph->changed);
+    }
+    pthread_mutex_unlock(&graph->lock);
+
+    return NULL;
+}
+
+// Run `task` for every node of a dependency graph, each only after all of its
+// dependencies succeeded, with up to `jobs` nodes at a time. A failed node marks
+// everything downstream of it skipped while unrelated nodes carry on; nodes on a
+// cycle never become ready and are skipped too. `states` receives each node's
+// outcome. Returns 0 when every node succeeded and -1 otherwise.
+int run_task_graph(size_t count, const struct graph_edge *edges, size_t edge_count, int jobs, graph_task task,
+                   void *context, enum graph_node_state *states)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    size_t *offsets = calloc(count + 1, sizeof(size_t));
+    size_t *dependents = malloc((edge_count ? edge_count : 1) * sizeof(size_t));
+    size_t *waiting_on = calloc(count, sizeof(size_t));
+    size_t *ready = malloc(count * sizeof(size_t));
+    size_t *filled = calloc(count, sizeof(size_t));
+    if (!offsets || !dependents || !waiting_on || !ready || !filled)
+    {
+        free(offsets);
+        free(dependents);
+        free(waiting_on);
+        free(ready);
+        free(filled);
+        return -1;
+    }
+
+    // Dependents of every node, grouped per node
+    for (size_t i = 0; i < edge_count; i++)
+    {
+        offsets[edges[i].before + 1]++;
+        waiting_on[edges[i].after]++;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        offsets[i + 1] += offsets[i];
+    }
+    for (size_t i = 0; i < edge_count; i++)
+    {
+        dependents[offsets[edges[i].before] + filled[edges[i].before]++] = edges[i].after;
+    }
+    free(filled);
+
+    struct task_graph graph = {count, offsets, dependents, waiting_on, ready, 0, 0, 0, states,
+                               PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, task, context};
+    for (size_t i = 0; i < count; i++)
+    {
+        states[i] = GRAPH_NODE_PENDING;
+        if (waiting_on[i] == 0)
+        {
+            ready[graph.ready_tail++] = i;
+        }
+    }
+
+    size_t thread_count = jobs > 0 ? (size_t)jobs : 1;
+    if (thread_count > count)
+    {
+        thread_count = count;
+    }
+
+    pthread_t *threads = thread_count > 1 ? malloc(thread_count * sizeof(pthread_t)) : NULL;
+    size_t started = 0;
+    for (; threads && started < thread_count; started++)
+    {
+        if (pthread_create(&threads[started], NULL, task_graph_thread, &graph) != 0)
+        {
+            break;
+        }
+    }
+
+    // Serial runs, and runs where no thread could be started, go on the caller's thread
+    if (started == 0)
+    {
+        task_graph_thread(&graph);
+    }
+    for (size_t i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    int status = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (states[i] == GRAPH_NODE_PENDING)
+        {
+            states[i] = GRAPH_NODE_SKIPPED;
+        }
+        if (states[i] != GRAPH_NODE_DONE)
+        {
+            status = -1;
+        }
+    }
+
+    pthread_cond_destroy(&graph.changed);
+    pthread_mutex_destroy(&graph.lock);
+    free(offsets);
+    free(dependents);
+    free(waiting_on);
+    free(ready);
+    return status;
+}
@@ -0,0 +1,262 @@
+#define _GNU_SOURCE // pipe2()
+
+#include "process.h"
+#include "logger.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Create a pipe whose ends are never inherited by unrelated children. Fleet
+// operations spawn from several threads at once, so on Linux the flag is set
+// atomically; elsewhere there is a small window before fcntl() runs.
+static int open_cloexec_pipe(int fds[2])
+{
+#ifdef __linux__
+    return pipe2(fds, O_CLOEXEC);
+#else
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+static void close_pipe(int fds[2])
+{
+    if (fds[0] >= 0)
+    {
+        close(fds[0]);
+    }
+    if (fds[1] >= 0)
+    {
+        close(fds[1]);
+    }
+}
+
+void process_sink_buffer(const char *data, size_t length, void *context)
+{
+    output_buffer_append((struct output_buffer *)context, data, length);
+}
+
+void process_sink_stdout(const char *data, size_t length, void *context)
+{
+    log_flush();
+    fwrite(data, 1, length, stdout);
+    fflush(stdout);
+}
+
+// Render argv as a single line for log messages
+void process_format_argv(const char *const argv[], char *buffer, size_t size)
+{
+    size_t used = 0;
+    buffer[0] = '\0';
+
+    for (size_t i = 0; argv[i] != NULL && used < size; i++)
+    {
+        int written = snprintf(buffer + used, size - used, i == 0 ? "%s" : " %s", argv[i]);
+        if (written < 0)
+        {
+            break;
+        }
+        used += written;
+    }
+}
+
+// Spawn argv[0] (looked up in PATH) with stdin at /dev/null and stream its
+// stdout/stderr into the sinks until it exits. Returns the exit code, or -1
+// if the process could not be started or died from a signal.
+int process_run(const char *const argv[], const struct process_options *options, struct process_result *result)
+{
+    static const struct process_options discard_all = {NULL, NULL, NULL, NULL};
+    if (!options)
+    {
+        options = &discard_all;
+    }
+
+    struct process_result local_result;
+    if (!result)
+    {
+        result = &local_result;
+    }
+    result->exit_code = -1;
+    result->signal = 0;
+    result->seconds = 0;
+
+    double started = monotonic_seconds();
+
+    int stdout_pipe[2] = {-1, -1};
+    int stderr_pipe[2] = {-1, -1};
+
+    if ((options->stdout_sink && open_cloexec_pipe(stdout_pipe) != 0) ||
+        (options->stderr_sink && open_cloexec_pipe(stderr_pipe) != 0))
+    {
+        close_pipe(stdout_pipe);
+        close_pipe(stderr_pipe);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+    if (options->stdout_sink)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], STDOUT_FILENO);
+    }
+    else
+    {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+
+    if (options->stderr_sink)
+    {
+        posix_spawn_file_actions_adddup2(&actions, stderr_pipe[1], STDERR_FILENO);
+    }
+    else
+    {
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+
+    // Children get default signal dispositions even if we ignore SIGPIPE (daemon mode)
+    posix_spawnattr_t attributes;
+    sigset_t default_signals;
+    posix_spawnattr_init(&attributes);
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &default_signals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid;
+    int spawn_error = posix_spawnp(&pid, argv[0], &actions, &attributes, (char *const *)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+
+    // The parent only keeps the read ends
+    if (stdout_pipe[1] >= 0)
+    {
+        close(stdout_pipe[1]);
+        stdout_pipe[1] = -1;
+    }
+    if (stderr_pipe[1] >= 0)
+    {
+        close(stderr_pipe[1]);
+        stderr_pipe[1] = -1;
+    }
+
+    if (spawn_error != 0)
+    {
+        close_pipe(stdout_pipe);
+        close_pipe(stderr_pipe);
+        errno = spawn_error;
+        return -1;
+    }
+
+    struct pollfd fds[2];
+    process_sink sinks[2] = {options->stdout_sink, options->stderr_sink};
+    void *contexts[2] = {options->stdout_context, options->stderr_context};
+    fds[0].fd = stdout_pipe[0];
+    fds[1].fd = stderr_pipe[0];
+    fds[0].events = fds[1].events = POLLIN;
+
+    int open_streams = (fds[0].fd >= 0) + (fds[1].fd >= 0);
+    char chunk[4096];
+
+    while (open_streams > 0)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+
+            ssize_t read_bytes = read(fds[i].fd, chunk, sizeof(chunk));
+            if (read_bytes > 0)
+            {
+                sinks[i](chunk, (size_t)read_bytes, contexts[i]);
+            }
+            else if (read_bytes == 0 || errno != EINTR)
+            {
+                // EOF: poll() ignores negative descriptors from now on
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                open_streams--;
+            }
+        }
+    }
+
+    // Streams still open here only if poll() failed
+    for (int i = 0; i < 2; i++)
+    {
+        if (fds[i].fd >= 0)
+        {
+            close(fds[i].fd);
+        }
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            result->seconds = monotonic_seconds() - started;
+            return -1;
+        }
+    }
+
+    result->seconds = monotonic_seconds() - started;
+
+    if (WIFEXITED(status))
+    {
+        result->exit_code = WEXITSTATUS(status);
+    }
+    else if (WIFSIGNALED(status))
+    {
+        result->signal = WTERMSIG(status);
+    }
+
+    return result->exit_code;
+}
+
+// Run a process with stdout and stderr interleaved into one buffer (may be NULL)
+int process_run_captured(const char *const argv[], struct output_buffer *output, struct process_result *result)
+{
+    struct process_options options = {NULL, NULL, NULL, NULL};
+    if (output)
+    {
+        options.stdout_sink = process_sink_buffer;
+        options.stdout_context = output;
+        options.stderr_sink = process_sink_buffer;
+        options.stderr_context = output;
+    }
+
+    return process_run(argv, &options, result);
+}
+
+// Run a process keeping only its stdout (stderr is discarded), e.g. for parsing
+int process_run_stdout(const char *const argv[], struct output_buffer *output, struct process_result *result)
+{
+    struct process_options options = {process_sink_buffer, output, NULL, NULL};
+    return process_run(argv, &options, result);
+}
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include "prune.h"
+#include "build_cache.h"
+#include "database.h"
+#include "docker.h"
+#include "logger.h"
+#include "utils.h"
+#include <ctype.h>
+#include <json-c/json.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int retention_count()
+{
+    const char *configured = getenv(PRUNE_RETENTION_ENV);
+    char *end = NULL;
+    long count = configured ? strtol(configured, &end, 10) : 0;
+
+    // The newest image is the one being deployed; it always stays
+    return configured && *end == '\0' && count >= 1 ? (int)count : PRUNE_DEFAULT_RETENTION;
+}
+
+// Parse "45", "90s", "30m", "12h" or "7d" into seconds
+static int parse_interval(const char *text, long long *seconds)
+{
+    char *end;
+    long long value = strtoll(text, &end, 10);
+    if (end == text || value < 0)
+    {
+        return -1;
+    }
+
+    switch (tolower((unsigned char)*end))
+    {
+    case '\0':
+    case 's':
+        break;
+    case 'm':
+        value *= 60;
+        break;
+    case 'h':
+        value *= 60 * 60;
+        break;
+    case 'd':
+        value *= 24 * 60 * 60;
+        break;
+    default:
+        return -1;
+    }
+
+    if (*end != '\0' && end[1] != '\0')
+    {
+        return -1;
+    }
+    *seconds = value;
+    return 0;
+}
+
+static long long prune_interval()
+{
+    const char *configured = getenv(PRUNE_INTERVAL_ENV);
+    long long seconds;
+    if (configured && parse_interval(configured, &seconds) == 0)
+    {
+        return seconds;
+    }
+    return PRUNE_DEFAULT_INTERVAL_SECONDS;
+}
+
+// Disk taken by images, summed from /images/json, which is much cheaper than the full
+// /system/df scan. A layer shared by several images counts once per image, so the sum
+// errs high. Returns 0 on success.
+static int image_disk_usage(long long *bytes)
+{
+    struct output_buffer body;
+    output_buffer_init(&body);
+
+    int status = docker_api_request("GET", "/images/json", NULL, NULL, 0, &body);
+    if (status != 200 || !body.data)
+    {
+        docker_log_api_error("Docker image list", status, &body);
+        output_buffer_free(&body);
+        return -1;
+    }
+
+    struct json_object *images = json_tokener_parse(body.data);
+    int result = -1;
+    if (images && json_object_is_type(images, json_type_array))
+    {
+        *bytes = 0;
+        for (size_t i = 0; i < json_object_array_length(images); i++)
+        {
+            struct json_object *size;
+            if (json_object_object_get_ex(json_object_array_get_idx(images, i), "Size", &size))
+            {
+                *bytes += json_object_get_int64(size);
+            }
+        }
+        result = 0;
+    }
+
+    json_object_put(images);
+    output_buffer_free(&body);
+    return result;
+}
+
+// Remove this repository's images beyond the newest DPLOYER_IMAGE_RETENTION. Images a
+// container still runs (an old task draining during a rolling update) are left for the
+// next deploy. Returns the number of images removed, or -1 if they could not be listed.
+int prune_repository_images(const char *repo_id)
+{
+    struct image_id_list superseded;
+    if (repository_image_list_superseded(repo_id, retention_count(), &superseded) != 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "Failed to list superseded images.");
+        return -1;
+    }
+
+    int removed = 0;
+    int kept = 0;
+    for (size_t i = 0; i < superseded.count; i++)
+    {
+        int status = docker_image_remove(superseded.items[i]);
+        if (status == 0 || status == 1)
+        {
+            // Gone either way; an image removed by hand counts as removed
+            repository_image_mark_removed(repo_id, superseded.items[i]);
+            removed += status == 0;
+        }
+        else
+        {
+            kept++;
+        }
+    }
+
+    if (superseded.count > 0)
+    {
+        char log_msg[256];
+        snprintf(log_msg, sizeof(log_msg), "Removed %d superseded image%s of %s%s.", removed, removed == 1 ? "" : "s", repo_id,
+                 kept > 0 ? "; the rest are still in use and will be retried" : "");
+        log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+    }
+
+    image_id_list_free(&superseded);
+    return removed;
+}
+
+static void run_global_prune()
+{
+    clean_up_unused_resources();
+    if (maintenance_touch(PRUNE_GLOBAL_TASK) != 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "Failed to record the global prune.");
+    }
+}
+
+// Run the daemon-wide prune when DPLOYER_PRUNE_INTERVAL has passed since the last one,
+// or when images exceed DPLOYER_PRUNE_THRESHOLD. Returns 1 if it ran, 0 if not.
+int prune_if_due()
+{
+    long long age = 0;
+    int found = maintenance_age(PRUNE_GLOBAL_TASK, &age);
+    const char *reason = NULL;
+    char reason_text[128];
+
+    if (found == 1)
+    {
+        reason = "first run";
+    }
+    else if (found == 0 && age >= prune_interval())
+    {
+        snprintf(reason_text, sizeof(reason_text), "last run %.1fh ago", (double)age / 3600.0);
+        reason = reason_text;
+    }
+
+    // The threshold is only looked at when the interval has not already made the prune due
+    const char *threshold_text = getenv(PRUNE_THRESHOLD_ENV);
+    long long threshold = 0;
+    long long layers = 0;
+    if (!reason && threshold_text && parse_byte_size(threshold_text, &threshold) == 0 &&
+        image_disk_usage(&layers) == 0 && layers > threshold)
+    {
+        snprintf(reason_text, sizeof(reason_text), "images use %.1f GiB, over %s",
+                 (double)layers / (1024.0 * 1024.0 * 1024.0), threshold_text);
+        reason = reason_text;
+    }
+
+    if (!reason)
+    {
+        return 0;
+    }
+
+    char log_msg[192];
+    snprintf(log_msg, sizeof(log_msg), "Global prune due (%s).", reason);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+    run_global_prune();
+    return 1;
+}
+
+// Apply the retention to every repository, then prune the daemon right away
+int prune_now()
+{
+    struct repository_list list;
+    if (repository_list_all(&list) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to list repositories.");
+        return -1;
+    }
+
+    for (size_t i = 0; i < list.count; i++)
+    {
+        prune_repository_images(list.items[i].id);
+    }
+    repository_list_free(&list);
+
+    run_global_prune();
+    return 0;
+}
\ No newline at end of file
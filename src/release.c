@@ -0,0 +1,469 @@
+#include "release.h"
+#include "logger.h"
+#include "utils.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Kept out of releases: git metadata, the staged docker/ config and storage/, which every
+// release shares from shared/storage so that logs, sessions and uploads survive deploys
+static const char *const excluded_entries[] = {".git", "docker", "storage", NULL};
+
+// Installed by the container on first start; carried over from the current release when
+// the checkout has none
+static const char *const dependency_directories[] = {"vendor", "node_modules", NULL};
+
+static int retention_count()
+{
+    const char *configured = getenv(RELEASE_RETENTION_ENV);
+    char *end = NULL;
+    long count = configured ? strtol(configured, &end, 10) : 0;
+    if (!configured || *end != '\0' || count < 1)
+    {
+        return RELEASE_DEFAULT_RETENTION;
+    }
+
+    // Tasks of the previous rollout may still run from the release before the current one
+    return count < 2 ? 2 : (int)count;
+}
+
+static int is_listed(const char *name, const char *const list[])
+{
+    for (size_t i = 0; list[i]; i++)
+    {
+        if (strcmp(name, list[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int make_directory(const char *path)
+{
+    return mkdir(path, 0755) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+// Releases of one repository live in {HOME}/.config/dployer/apps/<repo_id>
+static int app_directory(const char *repo_id, char *path, size_t size)
+{
+    const char *home_dir = getenv("HOME");
+    if (!home_dir)
+    {
+        return -1;
+    }
+
+    char apps_dir[PATH_MAX];
+    char releases_dir[PATH_MAX + 16];
+    snprintf(apps_dir, sizeof(apps_dir), "%s/.config/dployer/apps", home_dir);
+    if (snprintf(path, size, "%s/%s", apps_dir, repo_id) >= (int)size)
+    {
+        return -1;
+    }
+    snprintf(releases_dir, sizeof(releases_dir), "%s/releases", path);
+
+    return make_directory(apps_dir) == 0 && make_directory(path) == 0 && make_directory(releases_dir) == 0 ? 0 : -1;
+}
+
+// Path of release `name`, or of the "current" symlink that services mount when `name` is NULL
+int release_path(const char *repo_id, const char *name, char *path, size_t size)
+{
+    char app_dir[PATH_MAX];
+    if (app_directory(repo_id, app_dir, sizeof(app_dir)) != 0)
+    {
+        return -1;
+    }
+
+    int length = name ? snprintf(path, size, "%s/releases/%s", app_dir, name) : snprintf(path, size, "%s/current", app_dir);
+    return length < (int)size ? 0 : -1;
+}
+
+// Reflink or copy a regular file, keeping its mode and mtime. Never a hard link: the
+// container writes into its release (composer.lock, chmod), which must not reach others.
+static int copy_release_file(const char *source_path, const char *destination_path, const struct stat *source,
+                             struct release_copy_stats *stats)
+{
+    mode_t mode = source->st_mode & 07777;
+    int cloned = clone_file(source_path, destination_path, mode);
+    struct timespec times[2] = {source->st_atim, source->st_mtim};
+    if (cloned < 0 || chmod(destination_path, mode) != 0 || utimensat(AT_FDCWD, destination_path, times, 0) != 0)
+    {
+        return -1;
+    }
+
+    if (cloned)
+    {
+        stats->cloned++;
+    }
+    else
+    {
+        stats->copied++;
+    }
+    return 0;
+}
+
+// Copy the tree at `source_dir` into `destination_dir`; the top level skips the excluded entries
+static int copy_release_tree(const char *source_dir, const char *destination_dir, int top_level, struct release_copy_stats *stats)
+{
+    DIR *dir = opendir(source_dir);
+    if (!dir)
+    {
+        return -1;
+    }
+
+    int status = 0;
+    struct dirent *entry;
+    while (status == 0 && (entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            (top_level && is_listed(entry->d_name, excluded_entries)))
+        {
+            continue;
+        }
+
+        char source_path[PATH_MAX];
+        char destination_path[PATH_MAX];
+        if (snprintf(source_path, sizeof(source_path), "%s/%s", source_dir, entry->d_name) >= (int)sizeof(source_path) ||
+            snprintf(destination_path, sizeof(destination_path), "%s/%s", destination_dir, entry->d_name) >= (int)sizeof(destination_path))
+        {
+            status = -1;
+            break;
+        }
+
+        struct stat st;
+        if (lstat(source_path, &st) != 0)
+        {
+            status = -1;
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            status = mkdir(destination_path, (st.st_mode & 07777) | 0700) == 0
+                         ? copy_release_tree(source_path, destination_path, 0, stats)
+                         : -1;
+        }
+        else if (S_ISLNK(st.st_mode))
+        {
+            char target[PATH_MAX];
+            ssize_t length = readlink(source_path, target, sizeof(target) - 1);
+            if (length < 0)
+            {
+                status = -1;
+            }
+            else
+            {
+                target[length] = '\0';
+                status = symlink(target, destination_path);
+            }
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            status = copy_release_file(source_path, destination_path, &st, stats);
+            if (status == 0)
+            {
+                stats->files++;
+                stats->bytes += (unsigned long long)st.st_size;
+            }
+        }
+    }
+
+    closedir(dir);
+    return status;
+}
+
+// storage/ shared by every release, seeded once from the checkout's own storage/
+int release_shared_storage(const char *repo_id, const char *source_dir, char *path, size_t size)
+{
+    char app_dir[PATH_MAX];
+    char shared_dir[PATH_MAX + 16];
+    if (app_directory(repo_id, app_dir, sizeof(app_dir)) != 0)
+    {
+        return -1;
+    }
+    snprintf(shared_dir, sizeof(shared_dir), "%s/shared", app_dir);
+    if (make_directory(shared_dir) != 0 || snprintf(path, size, "%s/storage", shared_dir) >= (int)size)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == 0)
+    {
+        return 0;
+    }
+
+    // Seed under a temporary name, so an interrupted copy is started over next time
+    char source_storage[PATH_MAX + 16];
+    char temp_path[PATH_MAX + 32];
+    snprintf(source_storage, sizeof(source_storage), "%s/storage", source_dir);
+    snprintf(temp_path, sizeof(temp_path), "%s/.tmp-storage", shared_dir);
+    remove_directory(temp_path);
+
+    struct release_copy_stats stats = {0};
+    if (mkdir(temp_path, 0775) != 0 ||
+        (stat(source_storage, &st) == 0 && copy_release_tree(source_storage, temp_path, 0, &stats) != 0) ||
+        rename(temp_path, path) != 0)
+    {
+        remove_directory(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Commit tag of a release name, after its time prefix. Names from before the prefix had
+// nanoseconds are YYYYmmddHHMMSS-<commit_tag>. NULL for anything else.
+static const char *release_tag(const char *name)
+{
+    const char *c = name;
+    while (*c >= '0' && *c <= '9')
+    {
+        c++;
+    }
+    if (*c == '.')
+    {
+        for (c++; *c >= '0' && *c <= '9'; c++)
+        {
+        }
+    }
+    return c > name && *c == '-' ? c + 1 : NULL;
+}
+
+// Copy a checkout into a new release named <YYYYmmddHHMMSS.nnnnnnnnn>-<commit_tag>. The time is
+// UTC down to the nanosecond, so sorting names sorts releases by age and two deploys of one
+// commit never share a name. vendor/ and node_modules/ come over from the current release
+// when the checkout has none. Nothing is visible under releases/ until it is complete.
+int release_create(const char *repo_id, const char *source_dir, const char *commit_tag, char *name, size_t size,
+                   struct release_copy_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    struct timespec now;
+    struct tm utc;
+    char timestamp[16]; // YYYYmmddHHMMSS
+    clock_gettime(CLOCK_REALTIME, &now);
+    gmtime_r(&now.tv_sec, &utc);
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d%H%M%S", &utc);
+    if (snprintf(name, size, "%s.%09ld-%s", timestamp, now.tv_nsec, commit_tag) >= (int)size)
+    {
+        return -1;
+    }
+
+    char final_path[PATH_MAX];
+    char temp_path[PATH_MAX];
+    char temp_name[300];
+    snprintf(temp_name, sizeof(temp_name), ".tmp-%s", name);
+    if (release_path(repo_id, name, final_path, sizeof(final_path)) != 0 ||
+        release_path(repo_id, temp_name, temp_path, sizeof(temp_path)) != 0)
+    {
+        return -1;
+    }
+
+    char current_path[PATH_MAX];
+    char current_release[PATH_MAX];
+    int have_current = release_path(repo_id, NULL, current_path, sizeof(current_path)) == 0 && realpath(current_path, current_release);
+
+    remove_directory(temp_path);
+    int status = mkdir(temp_path, 0755) == 0 ? copy_release_tree(source_dir, temp_path, 1, stats) : -1;
+
+    for (size_t i = 0; status == 0 && have_current && dependency_directories[i]; i++)
+    {
+        char source_path[PATH_MAX];
+        char base_path[PATH_MAX];
+        char destination_path[PATH_MAX];
+        struct stat st;
+        snprintf(source_path, sizeof(source_path), "%s/%s", source_dir, dependency_directories[i]);
+        snprintf(base_path, sizeof(base_path), "%s/%s", current_release, dependency_directories[i]);
+        snprintf(destination_path, sizeof(destination_path), "%s/%s", temp_path, dependency_directories[i]);
+        if (lstat(source_path, &st) != 0 && lstat(base_path, &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            status = mkdir(destination_path, st.st_mode & 07777) == 0 ? copy_release_tree(base_path, destination_path, 0, stats) : -1;
+        }
+    }
+
+    // Mount point for the shared storage
+    char storage_path[PATH_MAX];
+    snprintf(storage_path, sizeof(storage_path), "%s/storage", temp_path);
+    if (status != 0 || make_directory(storage_path) != 0 || rename(temp_path, final_path) != 0)
+    {
+        remove_directory(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Name of the release "current" points at. Returns 0, 1 if there is none and -1 on failure.
+int release_current(const char *repo_id, char *name, size_t size)
+{
+    char current_path[PATH_MAX];
+    char target[PATH_MAX];
+    if (release_path(repo_id, NULL, current_path, sizeof(current_path)) != 0)
+    {
+        return -1;
+    }
+
+    ssize_t length = readlink(current_path, target, sizeof(target) - 1);
+    if (length < 0)
+    {
+        return errno == ENOENT ? 1 : -1;
+    }
+    target[length] = '\0';
+
+    const char *base = strrchr(target, '/');
+    snprintf(name, size, "%s", base ? base + 1 : target);
+    return 0;
+}
+
+// Newest release built from `commit_tag`. Returns 0, 1 if there is none and -1 on failure.
+int release_find(const char *repo_id, const char *commit_tag, char *name, size_t size)
+{
+    char releases_dir[PATH_MAX];
+    if (release_path(repo_id, "", releases_dir, sizeof(releases_dir)) != 0)
+    {
+        return -1;
+    }
+
+    DIR *dir = opendir(releases_dir);
+    if (!dir)
+    {
+        return -1;
+    }
+
+    int status = 1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *entry_name = entry->d_name;
+        const char *tag = release_tag(entry_name);
+        if (tag && strcmp(tag, commit_tag) == 0 && (status != 0 || strcmp(entry_name, name) > 0))
+        {
+            snprintf(name, size, "%s", entry_name);
+            status = 0;
+        }
+    }
+
+    closedir(dir);
+    return status;
+}
+
+// Point "current" at release `name`. The new link is renamed over the old one, so
+// anything that resolves "current" sees either release, never a missing path.
+int release_activate(const char *repo_id, const char *name)
+{
+    char current_path[PATH_MAX];
+    char temp_path[PATH_MAX + 8];
+    char target[PATH_MAX];
+    if (release_path(repo_id, NULL, current_path, sizeof(current_path)) != 0 ||
+        snprintf(target, sizeof(target), "releases/%s", name) >= (int)sizeof(target))
+    {
+        return -1;
+    }
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", current_path);
+
+    unlink(temp_path);
+    if (symlink(target, temp_path) != 0 || rename(temp_path, current_path) != 0)
+    {
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_names_descending(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)b, *(char *const *)a);
+}
+
+// Remove the oldest releases beyond the retention count, never the current one
+int release_collect_garbage(const char *repo_id)
+{
+    char releases_dir[PATH_MAX];
+    char current[PATH_MAX];
+    if (release_path(repo_id, "", releases_dir, sizeof(releases_dir)) != 0)
+    {
+        return -1;
+    }
+    if (release_current(repo_id, current, sizeof(current)) != 0)
+    {
+        current[0] = '\0';
+    }
+
+    DIR *dir = opendir(releases_dir);
+    if (!dir)
+    {
+        return -1;
+    }
+
+    char **names = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        // Skips ".", ".." and the temporary directories of releases still being created
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            char **grown = realloc(names, capacity * sizeof(*names));
+            if (!grown)
+            {
+                break;
+            }
+            names = grown;
+        }
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+
+    qsort(names, count, sizeof(*names), compare_names_descending);
+
+    int status = 0;
+    int removed = 0;
+    size_t keep = (size_t)retention_count();
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i >= keep && strcmp(names[i], current) != 0)
+        {
+            char path[PATH_MAX + 16];
+            snprintf(path, sizeof(path), "%s%s", releases_dir, names[i]);
+            if (remove_directory(path) == 0)
+            {
+                removed++;
+            }
+            else
+            {
+                status = -1;
+            }
+        }
+        free(names[i]);
+    }
+    free(names);
+
+    if (removed > 0)
+    {
+        char log_msg[256];
+        snprintf(log_msg, sizeof(log_msg), "Removed %d old release%s of %s.", removed, removed == 1 ? "" : "s", repo_id);
+        log_message(INFO, INFO_SYMBOL, log_msg);
+    }
+    return status;
+}
+
+// Remove every release of a repository, its "current" link and its shared storage
+int release_remove_all(const char *repo_id)
+{
+    char app_dir[PATH_MAX];
+    if (app_directory(repo_id, app_dir, sizeof(app_dir)) != 0)
+    {
+        return -1;
+    }
+    return remove_directory(app_dir);
+}
@@ -3,6 +3,12 @@
 #include "database.h"
 #include "utils.h"
 #include "docker.h"
+#include "pool.h"
+#include "stats.h"
+#include "metrics.h"
+#include "git_cache.h"
+#include "worktree.h"
+#include "release.h"
 #include <json-c/json.h>
 #include <sys/stat.h>
 #include <ctype.h>
@@ -65,8 +71,9 @@ int check_laravel_and_php_versions(const char *repo_path)
       snprintf(version_message, sizeof(version_message), "Minimum PHP version required: %s", php_version_str);
       log_message(INFO, INFO_SYMBOL, version_message);
 
-      // Split version string by "|"
-      char *version_token = strtok((char *)php_version_str, "|");
+      // Split version string by "|" (strtok_r, since fleet deploys run this from worker threads)
+      char *save_ptr = NULL;
+      char *version_token = strtok_r((char *)php_version_str, "|", &save_ptr);
       while (version_token != NULL)
       {
         if (is_php_version_82_or_higher(version_token))
@@ -74,7 +81,7 @@ int check_laravel_and_php_versions(const char *repo_path)
           use_php82 = 1;
           break;
         }
-        version_token = strtok(NULL, "|");
+        version_token = strtok_r(NULL, "|", &save_ptr);
       }
     }
   }
@@ -131,9 +138,30 @@ void ensure_repositories_folder_exists()
   }
 }
 
-void clone_new_repo(const char *repo_id, const char *git_url, const char *destination_folder, const char *branch_name, const char *docker_image_prefix, const char *docker_port)
+// Whether `path` is itself a clone of `git_url`, bare or not, rather than a folder inside one
+static int is_clone_of(const char *path, const char *git_url)
+{
+  char git_dir[PATH_MAX];
+  char common_dir[PATH_MAX];
+  char checkout_git_dir[PATH_MAX + 8];
+  snprintf(checkout_git_dir, sizeof(checkout_git_dir), "%s/.git", path);
+  if (git_dirs(path, git_dir, sizeof(git_dir), common_dir, sizeof(common_dir)) != 0 ||
+      (strcmp(common_dir, path) != 0 && strcmp(common_dir, checkout_git_dir) != 0))
+  {
+    return 0;
+  }
+
+  struct output_buffer origin;
+  output_buffer_init(&origin);
+  const char *origin_command[] = {"git", "-C", path, "config", "--get", "remote.origin.url", NULL};
+  int same_origin = run_command(origin_command, &origin) == 0 && origin.data &&
+                    (origin.data[strcspn(origin.data, "\r\n")] = '\0', strcmp(origin.data, git_url) == 0);
+  output_buffer_free(&origin);
+  return same_origin;
+}
+
+int clone_new_repo(const char *repo_id, const char *git_url, const char *destination_folder, const char *branch_name, const char *docker_image_prefix, const char *docker_port)
 {
-  char command[MAX_PATH_LEN + 512];
   char docker_image_tag[256];
   char backup_folder[MAX_PATH_LEN + 512];
   char rename_message[1024];
@@ -143,7 +171,7 @@ void clone_new_repo(const char *repo_id, const char *git_url, const char *destin
   if (!home_dir)
   {
     log_message(ERROR, ERROR_SYMBOL, "Failed to get home directory.");
-    exit(1);
+    return -1;
   }
 
   // Construct the path to the configuration directory
@@ -151,7 +179,7 @@ void clone_new_repo(const char *repo_id, const char *git_url, const char *destin
   if (snprintf(config_dir, sizeof(config_dir), "%s/.config/dployer", home_dir) >= sizeof(config_dir))
   {
     log_message(ERROR, ERROR_SYMBOL, "Config directory path is too long.");
-    exit(1);
+    return -1;
   }
 
   // Ensure the configuration directory exists
@@ -162,7 +190,7 @@ void clone_new_repo(const char *repo_id, const char *git_url, const char *destin
     {
       perror("mkdir");
       log_message(ERROR, ERROR_SYMBOL, "Failed to create configuration directory.");
-      exit(1);
+      return -1;
     }
   }
 
@@ -171,15 +199,26 @@ void clone_new_repo(const char *repo_id, const char *git_url, const char *destin
   if (snprintf(actual_destination_folder, sizeof(actual_destination_folder), "%s/repositories/%s", config_dir, destination_folder) >= sizeof(actual_destination_folder))
   {
     log_message(ERROR, ERROR_SYMBOL, "Destination folder path is too long.");
-    exit(1);
+    return -1;
+  }
+
+  // An earlier clone of the same origin becomes the object store; anything else is moved aside
+  char store_folder[PATH_MAX + 16];
+  snprintf(store_folder, sizeof(store_folder), "%s/%s", actual_destination_folder, WORKTREE_STORE_NAME);
+  int reuse_store = worktree_store_exists(actual_destination_folder) ? is_clone_of(store_folder, git_url)
+                                                                       : is_clone_of(actual_destination_folder, git_url);
+  if (reuse_store && !worktree_store_exists(actual_destination_folder))
+  {
+    snprintf(store_folder, sizeof(store_folder), "%s", actual_destination_folder);
   }
 
   // Check if the destination folder exists
-  if (stat(actual_destination_folder, &st) == 0 && S_ISDIR(st.st_mode))
+  if (!reuse_store && stat(actual_destination_folder, &st) == 0 && S_ISDIR(st.st_mode))
   {
     // Generate a timestamp for the backup folder name
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
+    struct tm local_time;
+    struct tm *t = localtime_r(&now, &local_time);
     int ret = snprintf(backup_folder, sizeof(backup_folder), "%s_backup_%04d%02d%02d_%02d%02d%02d",
                        actual_destination_folder,
                        t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
@@ -187,8 +226,8 @@ void clone_new_repo(const char *repo_id, const char *git_url, const char *destin
 
     if (ret >= sizeof(backup_folder))
     {
-      log_message(ERROR, ERROR_SYMBOL, "Backup folder path is too long. Exiting.");
-      exit(1);
+      log_message(ERROR, ERROR_SYMBOL, "Backup folder path is too long.");
+      return -1;
     }
 
     // Rename the existing folder
@@ -196,7 +235,7 @@ void clone_new_repo(const char *repo_id, const char *git_url, const char *destin
     {
       perror("rename");
       log_message(ERROR, ERROR_SYMBOL, "Failed to rename existing directory.");
-      exit(1);
+      return -1;
     }
     else
     {
@@ -227,49 +266,78 @@ void clone_new_repo(const char *repo_id, const char *git_url, const char *destin
     snprintf(docker_image_tag, sizeof(docker_image_tag), "%s:%s", docker_image_prefix, branch_name);
   }
 
-  // Clone the repository
-  int ret = snprintf(command, sizeof(command), "git clone -b %s %s %s > /dev/null 2>&1", branch_name, git_url, actual_destination_folder);
-  if (ret >= sizeof(command))
+  int is_tag = is_version_tag(branch_name);
+  if (reuse_store)
+  {
+    char reuse_message[PATH_MAX + 64];
+    snprintf(reuse_message, sizeof(reuse_message), "Reusing the existing clone in %s.", store_folder);
+    log_message(INFO, INFO_SYMBOL, reuse_message);
+
+    if ((!is_tag && git_track_branch(store_folder, branch_name) != 0) ||
+        git_fetch_ref(store_folder, git_url, branch_name, is_tag, 1, "Failed to fetch the branch or tag.") != 0)
+    {
+      return -1;
+    }
+  }
+  else
   {
-    log_message(ERROR, ERROR_SYMBOL, "Command buffer overflow. Exiting.");
-    exit(1);
+    // Clone only the branch or tag being deployed into a bare store, borrowing objects from the shared cache
+    if (git_clone_repo(git_url, branch_name, is_tag, 1, store_folder) != 0)
+    {
+      return -1;
+    }
+
+    // A bare clone has no remote-tracking branch; start origin/<branch> where the clone is
+    char local_ref[256];
+    char upstream_ref[256];
+    snprintf(local_ref, sizeof(local_ref), "refs/heads/%s", branch_name);
+    snprintf(upstream_ref, sizeof(upstream_ref), "refs/remotes/origin/%s", branch_name);
+    const char *upstream_command[] = {"git", "-C", store_folder, "update-ref", upstream_ref, local_ref, NULL};
+    if (!is_tag && (run_git_step(upstream_command, "Failed to record the upstream branch.") != 0 ||
+                    git_track_branch(store_folder, branch_name) != 0))
+    {
+      return -1;
+    }
+    log_message(SUCCESS, SUCCESS_SYMBOL, "Repository cloned successfully.");
   }
-  execute_command(command);
 
-  log_message(SUCCESS, SUCCESS_SYMBOL, "Repository cloned successfully.");
+  // The branch or tag is checked out as a worktree of the store; that is what gets deployed
+  char worktree_folder[PATH_MAX];
+  if (worktree_checkout(store_folder, branch_name, is_tag, worktree_folder, sizeof(worktree_folder)) != 0)
+  {
+    log_message(ERROR, ERROR_SYMBOL, "Failed to check out the repository.");
+    return -1;
+  }
 
-  // Determine the framework (this function would need to be adapted to use actual_destination_folder)
-  const char *framework = check_repo_framework(actual_destination_folder);
+  const char *framework = check_repo_framework(worktree_folder);
   char framework_message[256];
   snprintf(framework_message, sizeof(framework_message), "Detected framework: %s", framework);
   log_message(INFO, INFO_SYMBOL, framework_message);
 
   // Save the repository information to the database, including Docker port
-  char sql[MAX_PATH_LEN + 512];
-  ret = snprintf(sql, sizeof(sql),
-                 "INSERT INTO repositories (id, git_url, destination_folder, branch_name, docker_image_tag, docker_port) "
-                 "VALUES ('%s', '%s', '%s', '%s', '%s', '%s');",
-                 repo_id, git_url, actual_destination_folder, branch_name, docker_image_tag, docker_port);
-
-  if (ret >= sizeof(sql))
+  struct repository repository = {
+      .id = (char *)repo_id,
+      .git_url = (char *)git_url,
+      .destination_folder = worktree_folder,
+      .branch_name = (char *)branch_name,
+      .docker_image_tag = docker_image_tag,
+      .docker_port = (char *)docker_port,
+  };
+  if (repository_insert(&repository) != 0)
   {
-    log_message(ERROR, ERROR_SYMBOL, "SQL query buffer overflow. Exiting.");
-    exit(1);
+    log_message(ERROR, ERROR_SYMBOL, "Failed to save the repository information to the database.");
+    return -1;
   }
-
-  execute_query(sql);
   log_message(SUCCESS, SUCCESS_SYMBOL, "Repository information saved to database.");
+  return 0;
 }
 
 void list_repositories()
 {
-  const char *sql = "SELECT id, git_url, destination_folder, branch_name, docker_image_tag, docker_port FROM repositories;";
-  sqlite3_stmt *stmt;
-
-  if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK)
+  struct repository_list repositories;
+  if (repository_list_all(&repositories) != 0)
   {
     log_message(ERROR, ERROR_SYMBOL, "Failed to fetch repositories.");
-    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
     return;
   }
 
@@ -282,6 +350,7 @@ void list_repositories()
   int docker_port_width = 15;
 
   // Print the list after logging
+  log_flush();
   printf("\n%-*s %-*s %-*s %-*s %-*s %-*s\n",
          id_width, "ID",
          git_url_width, "Git URL",
@@ -299,177 +368,431 @@ void list_repositories()
          docker_tag_width, "-----------------------------------",
          docker_port_width, "--------------");
 
-  while (sqlite3_step(stmt) == SQLITE_ROW)
+  for (size_t i = 0; i < repositories.count; i++)
   {
-    const unsigned char *repo_id = sqlite3_column_text(stmt, 0);
-    const unsigned char *git_url = sqlite3_column_text(stmt, 1);
-    const unsigned char *destination_folder = sqlite3_column_text(stmt, 2);
-    const unsigned char *branch_name = sqlite3_column_text(stmt, 3);
-    const unsigned char *docker_image_tag = sqlite3_column_text(stmt, 4);
-    const unsigned char *docker_port = sqlite3_column_text(stmt, 5);
+    const struct repository *repository = &repositories.items[i];
 
     printf("%-*s %-*s %-*s %-*s %-*s %-*s\n",
-           id_width, repo_id,
-           git_url_width, git_url,
-           dest_folder_width, destination_folder,
-           branch_width, branch_name,
-           docker_tag_width, docker_image_tag,
-           docker_port_width, docker_port);
+           id_width, repository->id,
+           git_url_width, repository->git_url,
+           dest_folder_width, repository->destination_folder,
+           branch_width, repository->branch_name,
+           docker_tag_width, repository->docker_image_tag,
+           docker_port_width, repository->docker_port);
   }
 
-  sqlite3_finalize(stmt);
+  repository_list_free(&repositories);
 }
 
-void pull_latest_repo(const char *repo_id)
+// Checkout details needed by the update phases
+struct repo_checkout
 {
-  sqlite3_stmt *stmt;
-  char sql[256];
-  snprintf(sql, sizeof(sql), "SELECT destination_folder, branch_name FROM repositories WHERE id = ?;");
+  char git_url[1024];
+  char destination_folder[PATH_MAX];
+  char branch_name[256];
+  char docker_image_tag[256];
+};
 
-  if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK)
+// Per-repository bookkeeping for a fleet update
+struct update_job
+{
+  char *repo_id;
+  int fetch_status;
+  int update_status;
+  double fetch_seconds;
+  double update_seconds;
+  struct output_buffer output;
+};
+
+static int load_repo_checkout(const char *repo_id, struct repo_checkout *checkout)
+{
+  struct repository repository;
+  int status = repository_find(repo_id, &repository);
+
+  if (status == 0)
   {
-    log_message(ERROR, ERROR_SYMBOL, "Failed to prepare statement.");
-    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
-    return;
+    snprintf(checkout->git_url, sizeof(checkout->git_url), "%s", repository.git_url);
+    snprintf(checkout->destination_folder, sizeof(checkout->destination_folder), "%s", repository.destination_folder);
+    snprintf(checkout->branch_name, sizeof(checkout->branch_name), "%s", repository.branch_name);
+    snprintf(checkout->docker_image_tag, sizeof(checkout->docker_image_tag), "%s", repository.docker_image_tag);
+    repository_free(&repository);
+  }
+  else
+  {
+    log_message(ERROR, ERROR_SYMBOL, status < 0 ? "Failed to look up the repository." : "Repository ID not found.");
   }
 
-  sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+  return status == 0 ? 0 : -1;
+}
 
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    const char *destination_folder = (const char *)sqlite3_column_text(stmt, 0);
-    const char *branch_or_tag = (const char *)sqlite3_column_text(stmt, 1);
+int is_version_tag(const char *branch_or_tag)
+{
+  return branch_or_tag[0] == 'v' || strchr(branch_or_tag, '.') != NULL;
+}
 
-    char command[512];
-    char log_msg[256];
+// Run one git step, logging the captured output only when it fails
+int run_git_step(const char *const argv[], const char *failure_message)
+{
+  struct output_buffer output;
+  output_buffer_init(&output);
 
-    if (branch_or_tag[0] == 'v' || strchr(branch_or_tag, '.') != NULL)
+  int ret = run_command(argv, &output);
+  if (ret != 0)
+  {
+    log_message(ERROR, ERROR_SYMBOL, failure_message);
+    if (output.length > 0)
     {
-      // It's a version tag
-      snprintf(command, sizeof(command), "cd %s && git fetch --tags > /dev/null 2>&1 && git checkout `git describe --tags $(git rev-list --tags --max-count=1)` > /dev/null 2>&1", destination_folder);
+      log_message(ERROR, ERROR_SYMBOL, output.data);
+    }
+  }
+
+  output_buffer_free(&output);
+  return ret == 0 ? 0 : -1;
+}
+
+// Network phase of an update: download new objects without touching the working tree
+int fetch_repo(const char *repo_id)
+{
+  struct repo_checkout checkout;
+  if (load_repo_checkout(repo_id, &checkout) != 0)
+  {
+    return -1;
+  }
+
+  char log_msg[512];
+  snprintf(log_msg, sizeof(log_msg), "Fetching repository %s...", repo_id);
+  log_message(INFO, INFO_SYMBOL, log_msg);
+
+  // Only the tracked branch, or the tags when following version tags; never every branch
+  if (is_version_tag(checkout.branch_name))
+  {
+    return git_fetch_ref(checkout.destination_folder, checkout.git_url, NULL, 1, 1, "Failed to fetch from the remote.");
+  }
+  return git_fetch_ref(checkout.destination_folder, checkout.git_url, checkout.branch_name, 0, 0, "Failed to fetch from the remote.");
+}
+
+// Local phase of an update: move the checkout to what the last fetch brought in
+int integrate_repo(const char *repo_id)
+{
+  struct repo_checkout checkout;
+  if (load_repo_checkout(repo_id, &checkout) != 0)
+  {
+    return -1;
+  }
+
+  const char *destination_folder = checkout.destination_folder;
+  const char *branch_or_tag = checkout.branch_name;
 
-      snprintf(log_msg, sizeof(log_msg), "Updating repository %s to the latest version tag...", repo_id);
-      log_message(INFO, INFO_SYMBOL, log_msg);
+  char log_msg[512];
 
-      execute_command(command);
+  if (is_version_tag(branch_or_tag))
+  {
+    // It's a version tag
+    snprintf(log_msg, sizeof(log_msg), "Updating repository %s to the latest version tag...", repo_id);
+    log_message(INFO, INFO_SYMBOL, log_msg);
 
-      // Update the database with the latest version tag
-      snprintf(sql, sizeof(sql), "UPDATE repositories SET branch_name = (SELECT `git describe --tags $(git rev-list --tags --max-count=1)`), docker_image_tag = ? WHERE id = ?;");
-      sqlite3_stmt *update_stmt;
+    // Find the most recently created tag: git describe --tags $(git rev-list --tags --max-count=1)
+    struct output_buffer latest_commit;
+    struct output_buffer latest_tag;
+    output_buffer_init(&latest_commit);
+    output_buffer_init(&latest_tag);
+
+    const char *rev_list_command[] = {"git", "-C", destination_folder, "rev-list", "--tags", "--max-count=1", NULL};
+    if (run_command(rev_list_command, &latest_commit) == 0 && latest_commit.length > 0)
+    {
+      latest_commit.data[strcspn(latest_commit.data, "\r\n")] = '\0';
 
-      if (sqlite3_prepare_v2(db, sql, -1, &update_stmt, 0) != SQLITE_OK)
+      const char *describe_command[] = {"git", "-C", destination_folder, "describe", "--tags", latest_commit.data, NULL};
+      if (run_command(describe_command, &latest_tag) != 0)
       {
-        log_message(ERROR, ERROR_SYMBOL, "Failed to prepare update statement.");
-        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        latest_tag.length = 0;
       }
-      else
-      {
-        char new_docker_image_tag[256];
-        snprintf(new_docker_image_tag, sizeof(new_docker_image_tag), "%s:%s", repo_id, branch_or_tag);
+    }
+    output_buffer_free(&latest_commit);
 
-        sqlite3_bind_text(update_stmt, 1, new_docker_image_tag, -1, SQLITE_STATIC);
-        sqlite3_bind_text(update_stmt, 2, repo_id, -1, SQLITE_STATIC);
+    if (latest_tag.length == 0)
+    {
+      log_message(ERROR, ERROR_SYMBOL, "Failed to determine the latest version tag.");
+      output_buffer_free(&latest_tag);
+      return -1;
+    }
+    latest_tag.data[strcspn(latest_tag.data, "\r\n")] = '\0';
 
-        if (sqlite3_step(update_stmt) != SQLITE_DONE)
-        {
-          log_message(ERROR, ERROR_SYMBOL, "Failed to update repository information.");
-          fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
-        }
-        else
-        {
-          log_message(SUCCESS, SUCCESS_SYMBOL, "Repository updated to latest version tag.");
-        }
+    // The new tag gets a worktree of its own; the running service keeps the old one until the deploy
+    char worktree_folder[PATH_MAX];
+    if (worktree_checkout(destination_folder, latest_tag.data, 1, worktree_folder, sizeof(worktree_folder)) != 0)
+    {
+      log_message(ERROR, ERROR_SYMBOL, "Failed to check out the latest version tag.");
+      output_buffer_free(&latest_tag);
+      return -1;
+    }
 
-        sqlite3_finalize(update_stmt);
-      }
+    // Update the database with the latest version tag
+    char docker_image_prefix[256];
+    snprintf(docker_image_prefix, sizeof(docker_image_prefix), "%s", checkout.docker_image_tag);
+    docker_image_prefix[strcspn(docker_image_prefix, ":")] = '\0';
+
+    char new_docker_image_tag[512];
+    snprintf(new_docker_image_tag, sizeof(new_docker_image_tag), "%s:%s", docker_image_prefix, latest_tag.data);
+
+    int status = -1;
+    if (repository_update_ref(repo_id, worktree_folder, latest_tag.data, new_docker_image_tag) != 0)
+    {
+      log_message(ERROR, ERROR_SYMBOL, "Failed to update repository information.");
     }
     else
     {
-      // It's a branch, check for unstaged changes
-      snprintf(command, sizeof(command), "cd %s && git diff --quiet --ignore-submodules HEAD", destination_folder);
-      int has_unstaged_changes = system(command);
+      log_message(SUCCESS, SUCCESS_SYMBOL, "Repository updated to latest version tag.");
+      status = 0;
+    }
 
-      if (has_unstaged_changes != 0)
-      {
-        log_message(WARNING, WARNING_SYMBOL, "Unstaged changes detected, stashing changes...");
-        snprintf(command, sizeof(command), "cd %s && git stash > /dev/null 2>&1", destination_folder);
-        execute_command(command);
+    output_buffer_free(&latest_tag);
+    return status;
+  }
 
-        // Check for uncommitted changes after stashing
-        snprintf(command, sizeof(command), "cd %s && git diff --quiet --ignore-submodules HEAD", destination_folder);
-        int has_uncommitted_changes = system(command);
+  // It's a branch, check for unstaged changes
+  const char *diff_command[] = {"git", "-C", destination_folder, "diff", "--quiet", "--ignore-submodules", "HEAD", NULL};
+  int has_unstaged_changes = run_command(diff_command, NULL);
 
-        if (has_uncommitted_changes != 0)
-        {
-          log_message(WARNING, WARNING_SYMBOL, "Uncommitted changes detected, restoring working directory...");
-          snprintf(command, sizeof(command), "cd %s && git restore --staged . > /dev/null 2>&1", destination_folder);
-          execute_command(command);
-        }
+  if (has_unstaged_changes != 0)
+  {
+    log_message(WARNING, WARNING_SYMBOL, "Unstaged changes detected, stashing changes...");
+    const char *stash_command[] = {"git", "-C", destination_folder, "stash", NULL};
+    if (run_git_step(stash_command, "Failed to stash local changes.") != 0)
+    {
+      return -1;
+    }
+
+    // Check for uncommitted changes after stashing
+    int has_uncommitted_changes = run_command(diff_command, NULL);
+
+    if (has_uncommitted_changes != 0)
+    {
+      log_message(WARNING, WARNING_SYMBOL, "Uncommitted changes detected, restoring working directory...");
+      const char *restore_command[] = {"git", "-C", destination_folder, "restore", "--staged", ".", NULL};
+      if (run_git_step(restore_command, "Failed to restore the working directory.") != 0)
+      {
+        return -1;
       }
+    }
+  }
+
+  // Rebase onto the upstream fetched in the network phase; no second round trip needed
+  const char *rebase_command[] = {"git", "-C", destination_folder, "rebase", NULL};
+  snprintf(log_msg, sizeof(log_msg), "Rebasing branch %s in repository %s...", branch_or_tag, repo_id);
+  log_message(INFO, INFO_SYMBOL, log_msg);
 
-      // Perform a rebase
-      snprintf(command, sizeof(command), "cd %s && git fetch --all > /dev/null 2>&1 && git rebase > /dev/null 2>&1", destination_folder);
-      snprintf(log_msg, sizeof(log_msg), "Rebasing branch %s in repository %s...", branch_or_tag, repo_id);
-      log_message(INFO, INFO_SYMBOL, log_msg);
+  if (run_git_step(rebase_command, "Failed to rebase onto the upstream branch.") != 0)
+  {
+    return -1;
+  }
 
-      execute_command(command);
+  // Apply stashed changes if any
+  if (has_unstaged_changes != 0)
+  {
+    log_message(INFO, INFO_SYMBOL, "Applying stashed changes...");
+    const char *stash_pop_command[] = {"git", "-C", destination_folder, "stash", "pop", NULL};
+    int stash_pop_result = run_command(stash_pop_command, NULL);
 
-      // After rebasing, pull the latest changes
-      snprintf(command, sizeof(command), "cd %s && git pull > /dev/null 2>&1", destination_folder);
-      snprintf(log_msg, sizeof(log_msg), "Pulling the latest changes for branch %s in repository %s...", branch_or_tag, repo_id);
-      log_message(INFO, INFO_SYMBOL, log_msg);
+    if (stash_pop_result != 0)
+    {
+      log_message(ERROR, ERROR_SYMBOL, "Merge conflicts detected when applying stashed changes.");
+      log_message(WARNING, WARNING_SYMBOL, "Please resolve conflicts manually. The stash entry has been kept.");
+      return -1;
+    }
+  }
 
-      execute_command(command);
+  log_message(SUCCESS, SUCCESS_SYMBOL, "Repository updated successfully.");
+  return 0;
+}
 
-      // Apply stashed changes if any
-      if (has_unstaged_changes != 0)
-      {
-        log_message(INFO, INFO_SYMBOL, "Applying stashed changes...");
-        snprintf(command, sizeof(command), "cd %s && git stash pop > /dev/null 2>&1", destination_folder);
-        int stash_pop_result = system(command);
+int pull_latest_repo(const char *repo_id)
+{
+  struct run_timer timer;
+  run_timer_start(&timer, RUN_KIND_UPDATE, repo_id);
 
-        if (stash_pop_result != 0)
-        {
-          log_message(ERROR, ERROR_SYMBOL, "Merge conflicts detected when applying stashed changes.");
-          log_message(WARNING, WARNING_SYMBOL, "Please resolve conflicts manually. The stash entry has been kept.");
-          // Exit or return to allow the user to resolve conflicts manually
-          return;
-        }
-      }
+  run_timer_phase(&timer, "fetch");
+  int status = fetch_repo(repo_id);
 
-      log_message(SUCCESS, SUCCESS_SYMBOL, "Repository updated successfully.");
-    }
+  if (status == 0)
+  {
+    run_timer_phase(&timer, "integrate");
+    status = integrate_repo(repo_id);
   }
-  else
+
+  run_timer_finish(&timer, status);
+  return status;
+}
+
+static void fetch_job_task(size_t index, void *context)
+{
+  struct update_job *job = &((struct update_job *)context)[index];
+
+  log_capture(&job->output);
+  double started = monotonic_seconds();
+  job->fetch_status = fetch_repo(job->repo_id);
+  job->fetch_seconds = monotonic_seconds() - started;
+  log_capture(NULL);
+}
+
+static void integrate_job_task(size_t index, void *context)
+{
+  struct update_job *job = &((struct update_job *)context)[index];
+
+  // Repositories whose fetch failed are left untouched
+  if (job->fetch_status != 0)
   {
-    log_message(ERROR, ERROR_SYMBOL, "Repository ID not found.");
+    return;
   }
 
-  sqlite3_finalize(stmt);
+  log_capture(&job->output);
+  double started = monotonic_seconds();
+  job->update_status = integrate_repo(job->repo_id);
+  job->update_seconds = monotonic_seconds() - started;
+  log_capture(NULL);
+}
+
+static const char *update_status_label(int status)
+{
+  return status == 0 ? "OK" : "FAILED";
 }
 
-void pull_all_repos()
+static void print_update_summary(const struct update_job *jobs, size_t count, double total_seconds)
 {
-  const char *sql = "SELECT id FROM repositories;";
-  sqlite3_stmt *stmt;
+  int id_width = 25;
+  int status_width = 10;
+  int time_width = 12;
+
+  log_flush();
+  printf("\n%-*s %-*s %-*s %*s %*s\n",
+         id_width, "ID",
+         status_width, "Fetch",
+         status_width, "Update",
+         time_width, "Fetch Time",
+         time_width, "Update Time");
+  printf("%-*s %-*s %-*s %*s %*s\n",
+         id_width, "-------------------------",
+         status_width, "----------",
+         status_width, "----------",
+         time_width, "------------",
+         time_width, "------------");
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const char *update_label = jobs[i].fetch_status == 0 ? update_status_label(jobs[i].update_status) : "SKIPPED";
+
+    printf("%-*s %-*s %-*s %*.1fs %*.1fs\n",
+           id_width, jobs[i].repo_id,
+           status_width, update_status_label(jobs[i].fetch_status),
+           status_width, update_label,
+           time_width - 1, jobs[i].fetch_seconds,
+           time_width - 1, jobs[i].update_seconds);
+  }
+
+  printf("\nTotal wall time: %.1fs\n\n", total_seconds);
+}
 
+// Returns 0 when every repository updated, -1 otherwise
+int pull_all_repos(int jobs)
+{
   log_message(INFO, INFO_SYMBOL, "Fetching all repositories to pull latest updates...");
 
-  if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK)
+  struct repository_list repositories;
+  if (repository_list_all(&repositories) != 0)
   {
     log_message(ERROR, ERROR_SYMBOL, "Failed to fetch repository IDs.");
-    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
-    return;
+    return -1;
+  }
+
+  size_t count = repositories.count;
+  struct update_job *update_jobs = calloc(count ? count : 1, sizeof(struct update_job));
+  if (!update_jobs)
+  {
+    log_message(ERROR, ERROR_SYMBOL, "Out of memory while collecting repositories.");
+    repository_list_free(&repositories);
+    return -1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    struct update_job *job = &update_jobs[i];
+    job->repo_id = strdup(repositories.items[i].id);
+    job->fetch_status = -1;
+    job->update_status = -1;
+    job->fetch_seconds = 0;
+    job->update_seconds = 0;
+    output_buffer_init(&job->output);
+  }
+  repository_list_free(&repositories);
+
+  int job_count = resolve_job_count(jobs);
+  double started = monotonic_seconds();
+
+  // Network round trips dominate, so every fetch runs before any checkout is touched
+  run_worker_pool(count, job_count, fetch_job_task, update_jobs);
+  run_worker_pool(count, job_count, integrate_job_task, update_jobs);
+
+  double total_seconds = monotonic_seconds() - started;
+
+  // Only failed repositories get their captured log printed
+  int failed = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (update_jobs[i].fetch_status != 0 || update_jobs[i].update_status != 0)
+    {
+      failed++;
+      log_flush();
+      printf("\n===== %s =====\n", update_jobs[i].repo_id);
+      if (update_jobs[i].output.data)
+      {
+        fputs(update_jobs[i].output.data, stdout);
+      }
+    }
+  }
+
+  print_update_summary(update_jobs, count, total_seconds);
+
+  // Both phases were timed by the workers; record them in one commit once the pool is done
+  database_begin();
+  for (size_t i = 0; i < count; i++)
+  {
+    struct run_timer timer;
+    run_timer_start(&timer, RUN_KIND_UPDATE, update_jobs[i].repo_id);
+    run_timer_add(&timer, "fetch", update_jobs[i].fetch_seconds);
+    if (update_jobs[i].fetch_status == 0)
+    {
+      run_timer_add(&timer, "integrate", update_jobs[i].update_seconds);
+    }
+    // Back-date the start so the recorded total is the time both phases took
+    timer.started -= update_jobs[i].fetch_seconds + update_jobs[i].update_seconds;
+    run_timer_stop(&timer, update_jobs[i].fetch_status != 0 ? update_jobs[i].fetch_status : update_jobs[i].update_status);
+    run_timer_record(&timer);
   }
+  if (database_commit() != 0)
+  {
+    log_message(WARNING, WARNING_SYMBOL, "Failed to record the update timings.");
+  }
+  write_metrics_textfile();
 
-  while (sqlite3_step(stmt) == SQLITE_ROW)
+  for (size_t i = 0; i < count; i++)
+  {
+    free(update_jobs[i].repo_id);
+    output_buffer_free(&update_jobs[i].output);
+  }
+  free(update_jobs);
+
+  if (failed > 0)
+  {
+    char log_msg[256];
+    snprintf(log_msg, sizeof(log_msg), "%d of %zu repositories failed to update.", failed, count);
+    log_message(ERROR, ERROR_SYMBOL, log_msg);
+  }
+  else
   {
-    const char *repo_id = (const char *)sqlite3_column_text(stmt, 0);
-    pull_latest_repo(repo_id);
+    log_message(SUCCESS, SUCCESS_SYMBOL, "All repositories have been updated.");
   }
 
-  sqlite3_finalize(stmt);
-  log_message(SUCCESS, SUCCESS_SYMBOL, "All repositories have been updated.");
+  return failed > 0 ? -1 : 0;
 }
 
 int validate_docker_image_tag(const char *docker_image_tag)
@@ -500,58 +823,49 @@ int validate_docker_image_tag(const char *docker_image_tag)
 
 void switch_to_branch_or_tag(const char *repo_id, const char *branch_or_tag)
 {
-  sqlite3_stmt *stmt;
-  char sql[256];
-  snprintf(sql, sizeof(sql), "SELECT destination_folder, docker_image_tag FROM repositories WHERE id = ?;");
+  struct repository repository;
+  int lookup_status = repository_find(repo_id, &repository);
 
-  if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK)
+  if (lookup_status < 0)
   {
-    log_message(ERROR, ERROR_SYMBOL, "Failed to prepare statement.");
-    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    log_message(ERROR, ERROR_SYMBOL, "Failed to look up the repository.");
     return;
   }
 
-  sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
-
-  if (sqlite3_step(stmt) == SQLITE_ROW)
+  if (lookup_status == 0)
   {
-    const char *destination_folder = (const char *)sqlite3_column_text(stmt, 0);
-    const char *docker_image_prefix = strtok((char *)sqlite3_column_text(stmt, 1), ":");
-
-    char command[512];
-    snprintf(command, sizeof(command), "cd %s && git fetch --all > /dev/null 2>&1", destination_folder);
+    const char *destination_folder = repository.destination_folder;
+    char docker_image_prefix[256];
+    docker_image_repository(repository.docker_image_tag, docker_image_prefix, sizeof(docker_image_prefix));
 
     // Determine if branch_or_tag is a branch or a tag
     char log_msg[256];
-    if (strncmp(branch_or_tag, "v", 1) == 0 || strchr(branch_or_tag, '.') != NULL)
+    int is_tag = is_version_tag(branch_or_tag);
+    if (is_tag)
     {
       // Assume it's a version tag if it starts with "v" or contains a "."
       snprintf(log_msg, sizeof(log_msg), "Switching %s repository to version tag %s...", repo_id, branch_or_tag);
-      snprintf(command + strlen(command), sizeof(command) - strlen(command), " && git checkout tags/%s > /dev/null 2>&1", branch_or_tag);
     }
     else
     {
       // Otherwise, treat it as a branch
       snprintf(log_msg, sizeof(log_msg), "Switching %s repository to branch %s...", repo_id, branch_or_tag);
-      snprintf(command + strlen(command), sizeof(command) - strlen(command), " && git checkout %s > /dev/null 2>&1", branch_or_tag);
     }
 
     log_message(INFO, INFO_SYMBOL, log_msg);
 
-    execute_command(command);
-    log_message(SUCCESS, SUCCESS_SYMBOL, "Repository switched successfully.");
-
-    // Update the branch and Docker image tag in the database
-    snprintf(sql, sizeof(sql), "UPDATE repositories SET branch_name = ?, docker_image_tag = ? WHERE id = ?;");
-    sqlite3_stmt *update_stmt;
-
-    if (sqlite3_prepare_v2(db, sql, -1, &update_stmt, 0) != SQLITE_OK)
+    // Fetch just the target ref, since single-branch clones don't track the others, and check it
+    // out as a worktree. The live checkout is left alone; the next deploy mounts the new one.
+    char worktree_folder[PATH_MAX];
+    if ((!is_tag && git_track_branch(destination_folder, branch_or_tag) != 0) ||
+        git_fetch_ref(destination_folder, repository.git_url, branch_or_tag, is_tag, 1, "Failed to fetch the branch or tag.") != 0 ||
+        worktree_checkout(destination_folder, branch_or_tag, is_tag, worktree_folder, sizeof(worktree_folder)) != 0)
     {
-      log_message(ERROR, ERROR_SYMBOL, "Failed to prepare update statement.");
-      fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
-      sqlite3_finalize(stmt);
+      log_message(ERROR, ERROR_SYMBOL, "Failed to switch the repository.");
+      repository_free(&repository);
       return;
     }
+    log_message(SUCCESS, SUCCESS_SYMBOL, "Repository switched successfully.");
 
     // Determine the new Docker image tag
     char new_docker_image_tag[256];
@@ -566,55 +880,125 @@ void switch_to_branch_or_tag(const char *repo_id, const char *branch_or_tag)
       snprintf(new_docker_image_tag, sizeof(new_docker_image_tag), "%s:%s", docker_image_prefix, branch_or_tag);
     }
 
-    sqlite3_bind_text(update_stmt, 1, branch_or_tag, -1, SQLITE_STATIC);
-    sqlite3_bind_text(update_stmt, 2, new_docker_image_tag, -1, SQLITE_STATIC);
-    sqlite3_bind_text(update_stmt, 3, repo_id, -1, SQLITE_STATIC);
-
-    if (sqlite3_step(update_stmt) != SQLITE_DONE)
+    // Update the checkout, branch and Docker image tag in the database
+    if (repository_update_ref(repo_id, worktree_folder, branch_or_tag, new_docker_image_tag) != 0)
     {
       log_message(ERROR, ERROR_SYMBOL, "Failed to update repository information.");
-      fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
     }
     else
     {
       log_message(SUCCESS, SUCCESS_SYMBOL, "Repository branch or tag and Docker image tag updated successfully.");
     }
-
-    sqlite3_finalize(update_stmt);
   }
   else
   {
     log_message(ERROR, ERROR_SYMBOL, "Repository ID not found.");
   }
 
-  sqlite3_finalize(stmt);
+  repository_free(&repository);
 }
 
-void delete_repo(const char *repo_id)
+// Resolved checkouts of every registered repository but `except_id` (may be NULL); the
+// caller frees each path and the array. Returns 0 on success.
+static int checkouts_in_use(const char *except_id, char ***paths, size_t *count)
 {
-  sqlite3_stmt *stmt;
-  char sql[256];
-  snprintf(sql, sizeof(sql), "SELECT destination_folder FROM repositories WHERE id = ?;");
+  struct repository_list repositories;
+  *paths = NULL;
+  *count = 0;
+  if (repository_list_all(&repositories) != 0)
+  {
+    return -1;
+  }
 
-  if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK)
+  *paths = calloc(repositories.count + 1, sizeof(char *));
+  for (size_t i = 0; *paths && i < repositories.count; i++)
   {
-    log_message(ERROR, ERROR_SYMBOL, "Failed to prepare statement.");
-    fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
-    return;
+    const struct repository *repository = &repositories.items[i];
+    if (except_id && strcmp(repository->id, except_id) == 0)
+    {
+      continue;
+    }
+    char resolved[PATH_MAX];
+    char *path = strdup(realpath(repository->destination_folder, resolved) ? resolved : repository->destination_folder);
+    if (path)
+    {
+      (*paths)[(*count)++] = path;
+    }
+  }
+
+  repository_list_free(&repositories);
+  return *paths ? 0 : -1;
+}
+
+// Whether any repository is cloned from `git_url`: 1 if so, 0 if not, -1 on SQL errors
+static int origin_in_use(const char *git_url)
+{
+  struct repository_list repositories;
+  if (repository_list_all(&repositories) != 0)
+  {
+    return -1;
+  }
+
+  int used = 0;
+  for (size_t i = 0; i < repositories.count && !used; i++)
+  {
+    used = strcmp(repositories.items[i].git_url, git_url) == 0;
+  }
+  repository_list_free(&repositories);
+  return used;
+}
+
+static void free_paths(char **paths, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    free(paths[i]);
   }
+  free(paths);
+}
 
-  sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+// Remove the worktrees of the store behind `repo_path` that no repository uses any more,
+// such as the ones a switch or a new version tag left behind
+void prune_stale_worktrees(const char *repo_path)
+{
+  char **in_use;
+  size_t in_use_count;
+  if (checkouts_in_use(NULL, &in_use, &in_use_count) != 0)
+  {
+    return;
+  }
 
-  if (sqlite3_step(stmt) == SQLITE_ROW)
+  int removed = worktree_collect_garbage(repo_path, (const char *const *)in_use, in_use_count);
+  if (removed > 0)
   {
-    const char *destination_folder = (const char *)sqlite3_column_text(stmt, 0);
+    char log_msg[128];
+    snprintf(log_msg, sizeof(log_msg), "Removed %d unused worktree%s.", removed, removed == 1 ? "" : "s");
+    log_message(INFO, INFO_SYMBOL, log_msg);
+  }
+  free_paths(in_use, in_use_count);
+}
+
+void delete_repo(const char *repo_id)
+{
+  struct repository repository;
+  int lookup_status = repository_find(repo_id, &repository);
 
-    // Remove the repository directory
-    char remove_command[512];
-    snprintf(remove_command, sizeof(remove_command), "rm -rf %s > /dev/null 2>&1", destination_folder);
+  if (lookup_status < 0)
+  {
+    log_message(ERROR, ERROR_SYMBOL, "Failed to look up the repository.");
+    return;
+  }
 
-    int ret = system(remove_command);
-    if (ret != 0)
+  if (lookup_status == 0)
+  {
+    // Remove this repository's worktree, and the object store unless other repositories share it
+    char **in_use;
+    size_t in_use_count;
+    if (checkouts_in_use(repo_id, &in_use, &in_use_count) != 0)
+    {
+      log_message(WARNING, WARNING_SYMBOL, "Failed to read the repositories; keeping the repository directory.");
+    }
+    else if (worktree_remove(repository.destination_folder, (const char *const *)in_use, in_use_count) != 0)
     {
       log_message(WARNING, WARNING_SYMBOL, "Failed to remove repository directory.");
     }
@@ -622,20 +1006,28 @@ void delete_repo(const char *repo_id)
     {
       log_message(SUCCESS, SUCCESS_SYMBOL, "Repository directory removed successfully.");
     }
+    free_paths(in_use, in_use_count);
 
-    // Delete the repository entry from the database
-    snprintf(sql, sizeof(sql), "DELETE FROM repositories WHERE id = ?;");
-    sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    // Releases and the shared storage/ go with it
+    if (release_remove_all(repo_id) != 0)
+    {
+      log_message(WARNING, WARNING_SYMBOL, "Failed to remove the repository's releases.");
+    }
 
-    if (sqlite3_step(stmt) == SQLITE_DONE)
+    // Delete the repository entry from the database
+    if (repository_delete(repo_id) == 0)
     {
       log_message(SUCCESS, SUCCESS_SYMBOL, "Repository deleted successfully from the database.");
+
+      // The origin's object cache goes with the last repository cloned from it
+      if (origin_in_use(repository.git_url) == 0 && git_cache_remove(repository.git_url) != 0)
+      {
+        log_message(WARNING, WARNING_SYMBOL, "Failed to remove the git object cache.");
+      }
     }
     else
     {
       log_message(ERROR, ERROR_SYMBOL, "Failed to delete repository from the database.");
-      fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
     }
   }
   else
@@ -643,5 +1035,5 @@ void delete_repo(const char *repo_id)
     log_message(ERROR, ERROR_SYMBOL, "Repository ID not found.");
   }
 
-  sqlite3_finalize(stmt);
+  repository_free(&repository);
 }
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "rollback.h"
+#include "database.h"
+#include "health.h"
+#include "logger.h"
+#include "release.h"
+#include "stats.h"
+#include "utils.h"
+#include <json-c/json.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Point the service at a recorded image without building anything. The image is
+// tagged again first: its commit tag may since have moved to a rebuild of the same
+// commit, and images recorded before per-commit tags get a rollback-<id> tag.
+// With a health path the new tasks must also answer on it. Returns 0 on success.
+static int repoint_service(const char *repo_id, const char *image_id, const char *recorded_tag, const char *image_name,
+                           struct docker_service_spec *spec, const char *health_path, struct run_timer *timer,
+                           char *image, size_t image_size)
+{
+    char repository[512];
+    const char *tag = NULL;
+    if (recorded_tag[0] != '\0')
+    {
+        docker_image_repository(recorded_tag, repository, sizeof(repository));
+        tag = recorded_tag[strlen(repository)] == ':' ? recorded_tag + strlen(repository) + 1 : NULL;
+    }
+
+    char fallback_tag[64];
+    if (!tag)
+    {
+        const char *short_id = strncmp(image_id, "sha256:", 7) == 0 ? image_id + 7 : image_id;
+        snprintf(fallback_tag, sizeof(fallback_tag), "rollback-%.12s", short_id);
+        snprintf(repository, sizeof(repository), "%s", image_name);
+        tag = fallback_tag;
+    }
+    snprintf(image, image_size, "%s:%s", repository, tag);
+
+    struct json_object *current_service = NULL;
+    if (docker_image_add_tag(image_id, repository, tag) != 0 ||
+        docker_service_inspect(spec->name, &current_service) != 0)
+    {
+        return -1;
+    }
+
+    // Services that mount a release get the code of the same commit back as well
+    char current_release[256];
+    char release_name[256];
+    int release_swapped = 0;
+    if (release_current(repo_id, current_release, sizeof(current_release)) == 0)
+    {
+        if (release_find(repo_id, tag, release_name, sizeof(release_name)) == 0)
+        {
+            release_swapped = release_activate(repo_id, release_name) == 0;
+        }
+        else
+        {
+            log_message(WARNING, WARNING_SYMBOL, "No release matches the image; the service keeps the current code.");
+        }
+    }
+
+    if (timer)
+    {
+        run_timer_phase(timer, "service_update");
+    }
+    spec->image = image;
+    time_t started = time(NULL);
+    int status = docker_service_update(spec, current_service);
+    json_object_put(current_service);
+    if (status != 0)
+    {
+        if (release_swapped)
+        {
+            release_activate(repo_id, current_release);
+        }
+        return -1;
+    }
+
+    if (timer)
+    {
+        run_timer_phase(timer, health_path ? "health" : "rollout");
+    }
+    status = health_path ? health_gate(spec->name, image, 1, started, spec->port, health_path)
+                         : health_wait_for_rollout(spec->name, image, 1, started, health_deadline());
+    if (status != 0)
+    {
+        return -1;
+    }
+
+    repository_image_mark_deployed(repo_id, image_id);
+    return 0;
+}
+
+// Point a service whose new image failed its health gate back at the last image
+// that deployed successfully
+int roll_back_failed_deploy(const char *repo_id, const char *failed_image_id, struct docker_service_spec *spec)
+{
+    char previous_id[160];
+    char previous_tag[512];
+    if (failed_image_id[0] == '\0' ||
+        repository_image_previous(repo_id, failed_image_id, previous_id, sizeof(previous_id), previous_tag, sizeof(previous_tag)) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "No earlier healthy image to roll back to; the service keeps the new image.");
+        return -1;
+    }
+
+    char image_name[512];
+    docker_image_repository(spec->image, image_name, sizeof(image_name));
+
+    char log_msg[700];
+    snprintf(log_msg, sizeof(log_msg), "Rolling back to %s...", previous_tag[0] != '\0' ? previous_tag : previous_id);
+    log_message(WARNING, WARNING_SYMBOL, log_msg);
+
+    char image[600];
+    if (repoint_service(repo_id, previous_id, previous_tag, image_name, spec, NULL, NULL, image, sizeof(image)) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Rollback failed.");
+        return -1;
+    }
+
+    snprintf(log_msg, sizeof(log_msg), "Rolled back to %s.", image);
+    log_message(WARNING, WARNING_SYMBOL, log_msg);
+    return 0;
+}
+
+static int run_rollback(const char *repo_id, int steps_back, struct run_timer *timer)
+{
+    run_timer_phase(timer, "lookup");
+
+    struct repository repository;
+    int lookup_status = repository_find(repo_id, &repository);
+    if (lookup_status != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, lookup_status < 0 ? "Failed to look up the repository." : "Repository ID not found.");
+        return -1;
+    }
+
+    char image_id[160];
+    char recorded_tag[512];
+    int found = repository_image_deployed(repo_id, steps_back, image_id, sizeof(image_id), recorded_tag, sizeof(recorded_tag));
+    if (found != 0)
+    {
+        char error_msg[512];
+        snprintf(error_msg, sizeof(error_msg), "%s has no image deployed %d deploys ago; see 'images %s'.", repo_id, steps_back, repo_id);
+        log_message(ERROR, ERROR_SYMBOL, found < 0 ? "Failed to look up the repository's images." : error_msg);
+        repository_free(&repository);
+        return -1;
+    }
+
+    char service_name[256];
+    char image_name[512];
+    snprintf(service_name, sizeof(service_name), "%s_service", repo_id);
+    docker_image_repository(repository.docker_image_tag, image_name, sizeof(image_name));
+
+    char log_msg[700];
+    snprintf(log_msg, sizeof(log_msg), "Rolling %s back %d deploy%s to %s...", repo_id, steps_back, steps_back == 1 ? "" : "s",
+             recorded_tag[0] != '\0' ? recorded_tag : image_id);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+
+    // Only the image changes; ports and mounts stay as the service has them
+    run_timer_phase(timer, "retag");
+    struct docker_service_spec spec = {.name = service_name, .port = repository.docker_port};
+    const char *health_path = repository.health_path;
+    char image[600];
+    int status = repoint_service(repo_id, image_id, recorded_tag, image_name, &spec, health_path, timer, image, sizeof(image));
+
+    if (status == 0)
+    {
+        snprintf(log_msg, sizeof(log_msg), "%s now runs %s (%.1fs, no build).", repo_id, image, monotonic_seconds() - timer->started);
+        log_message(SUCCESS, SUCCESS_SYMBOL, log_msg);
+    }
+    else
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Rollback failed.");
+    }
+
+    repository_free(&repository);
+    return status;
+}
+
+// Point a repository's service at the image it ran `steps_back` successful
+// deploys ago. Returns 0 on success and -1 on failure.
+int rollback_repository(const char *repo_id, int steps_back)
+{
+    struct run_timer timer;
+    run_timer_start(&timer, RUN_KIND_ROLLBACK, repo_id);
+    int status = run_rollback(repo_id, steps_back, &timer);
+    run_timer_finish(&timer, status);
+    return status;
+}
+
+// List the images kept for a repository; N is what to pass to "rollback <ID> N"
+void print_repository_images(const char *repo_id)
+{
+    sqlite3_stmt *stmt = database_acquire(STMT_IMAGE_LIST);
+    sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+
+    log_flush();
+    printf("\n%-4s %-55s %-12s %-20s %-20s\n", "N", "Tag", "Image", "Built", "Deployed");
+    printf("%-4s %-55s %-12s %-20s %-20s\n", "----", "-------------------------------------------------------", "------------",
+           "--------------------", "--------------------");
+
+    int rows = 0;
+    int deployed = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const char *image_id = (const char *)sqlite3_column_text(stmt, 0);
+        const char *deployed_at = (const char *)sqlite3_column_text(stmt, 3);
+        char steps_back[16] = "-";
+        if (deployed_at)
+        {
+            snprintf(steps_back, sizeof(steps_back), "%d", deployed++);
+        }
+
+        printf("%-4s %-55s %-12.12s %-20s %-20s\n", steps_back, (const char *)sqlite3_column_text(stmt, 1),
+               strncmp(image_id, "sha256:", 7) == 0 ? image_id + 7 : image_id, (const char *)sqlite3_column_text(stmt, 2),
+               deployed_at ? deployed_at : "never");
+        rows++;
+    }
+    database_release(stmt);
+
+    if (rows == 0)
+    {
+        printf("No images recorded for %s.\n", repo_id);
+    }
+    printf("\n");
+}
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "sha256.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(struct sha256_context *context, const uint8_t block[64])
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = context->state[0], b = context->state[1], c = context->state[2], d = context->state[3];
+    uint32_t e = context->state[4], f = context->state[5], g = context->state[6], h = context->state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t temp1 = h + s1 + choice + round_constants[i] + w[i];
+        uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t temp2 = s0 + majority;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    context->state[0] += a;
+    context->state[1] += b;
+    context->state[2] += c;
+    context->state[3] += d;
+    context->state[4] += e;
+    context->state[5] += f;
+    context->state[6] += g;
+    context->state[7] += h;
+}
+
+void sha256_init(struct sha256_context *context)
+{
+    static const uint32_t initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    memcpy(context->state, initial_state, sizeof(initial_state));
+    context->bit_count = 0;
+    context->block_length = 0;
+}
+
+void sha256_update(struct sha256_context *context, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    context->bit_count += (uint64_t)length * 8;
+
+    while (length > 0)
+    {
+        size_t chunk = 64 - context->block_length;
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        memcpy(context->block + context->block_length, bytes, chunk);
+        context->block_length += chunk;
+        bytes += chunk;
+        length -= chunk;
+
+        if (context->block_length == 64)
+        {
+            sha256_transform(context, context->block);
+            context->block_length = 0;
+        }
+    }
+}
+
+void sha256_final(struct sha256_context *context, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bit_count = context->bit_count;
+
+    // Pad with a single 1 bit, zeros, then the message length in bits
+    uint8_t padding = 0x80;
+    sha256_update(context, &padding, 1);
+
+    padding = 0;
+    while (context->block_length != 56)
+    {
+        sha256_update(context, &padding, 1);
+    }
+
+    uint8_t length_bytes[8];
+    for (int i = 0; i < 8; i++)
+    {
+        length_bytes[i] = (uint8_t)(bit_count >> (56 - i * 8));
+    }
+    sha256_update(context, length_bytes, 8);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[i * 4] = (uint8_t)(context->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(context->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(context->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)context->state[i];
+    }
+}
+
+void sha256_final_hex(struct sha256_context *context, char hex[SHA256_HEX_SIZE])
+{
+    static const char digits[] = "0123456789abcdef";
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(context, digest);
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+    {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0f];
+    }
+    hex[SHA256_HEX_SIZE - 1] = '\0';
+}
+
+// Hash a file's contents. Returns 0 on success and -1 if it could not be read.
+int sha256_file_hex(const char *path, char hex[SHA256_HEX_SIZE])
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct sha256_context context;
+    sha256_init(&context);
+
+    uint8_t chunk[65536];
+    ssize_t read_bytes;
+    while ((read_bytes = read(fd, chunk, sizeof(chunk))) > 0)
+    {
+        sha256_update(&context, chunk, (size_t)read_bytes);
+    }
+    close(fd);
+
+    if (read_bytes < 0)
+    {
+        return -1;
+    }
+
+    sha256_final_hex(&context, hex);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,335 @@
+#include "stats.h"
+#include "database.h"
+#include "logger.h"
+#include "metrics.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void run_timer_start(struct run_timer *timer, const char *kind, const char *repo_id)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->kind = kind;
+    snprintf(timer->repo_id, sizeof(timer->repo_id), "%s", repo_id);
+    timer->started = monotonic_seconds();
+
+    // Tag the run's log lines with its repository and current phase
+    log_context_push(&timer->log_context, repo_id);
+}
+
+// Record a phase that was timed elsewhere
+void run_timer_add(struct run_timer *timer, const char *phase, double seconds)
+{
+    if (timer->phase_count < RUN_TIMER_MAX_PHASES)
+    {
+        timer->phases[timer->phase_count].name = phase;
+        timer->phases[timer->phase_count].seconds = seconds;
+        timer->phase_count++;
+    }
+}
+
+// Close the running phase (if any) and start timing `phase`; NULL just closes
+void run_timer_phase(struct run_timer *timer, const char *phase)
+{
+    double now = monotonic_seconds();
+
+    if (timer->current_phase)
+    {
+        run_timer_add(timer, timer->current_phase, now - timer->phase_started);
+    }
+
+    timer->current_phase = phase;
+    timer->phase_started = now;
+    log_set_phase(phase);
+}
+
+// Close the run: stop the clock, settle the outcome and restore the log context.
+// Nothing is written until run_timer_record().
+void run_timer_stop(struct run_timer *timer, int status)
+{
+    run_timer_phase(timer, NULL);
+
+    if (!timer->outcome)
+    {
+        timer->outcome = status == 0 ? "ok" : "failed";
+    }
+    timer->total_seconds = monotonic_seconds() - timer->started;
+    timer->finished_at = (long long)time(NULL);
+
+    log_context_pop(&timer->log_context);
+}
+
+// Append a stopped run and its phases to deploy_runs in one transaction (joining
+// the caller's, if any). Failures to record are only logged: timing must never
+// fail a deploy, so a failed insert is undone through a savepoint instead of
+// rolling back the caller's transaction with it.
+void run_timer_record(const struct run_timer *timer)
+{
+    database_begin();
+    if (database_savepoint() != 0)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "Failed to record run timings.");
+        database_commit();
+        return;
+    }
+
+    sqlite3_stmt *stmt = database_acquire(STMT_RUN_INSERT);
+    sqlite3_bind_text(stmt, 1, timer->repo_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, timer->kind, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, timer->outcome, -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, 4, timer->total_seconds);
+    if (timer->context_bytes > 0)
+    {
+        sqlite3_bind_int64(stmt, 5, (sqlite3_int64)timer->context_bytes);
+    }
+    if (timer->cache_hit_bytes > 0)
+    {
+        sqlite3_bind_int64(stmt, 6, (sqlite3_int64)timer->cache_hit_bytes);
+    }
+    sqlite3_bind_int64(stmt, 7, (sqlite3_int64)timer->finished_at);
+    int rc = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+    // Read while the statement (and the connection mutex) is still ours
+    sqlite3_int64 run_id = sqlite3_last_insert_rowid(db);
+    database_release(stmt);
+
+    for (size_t i = 0; rc == SQLITE_OK && i < timer->phase_count; i++)
+    {
+        stmt = database_acquire(STMT_RUN_PHASE_INSERT);
+        sqlite3_bind_int64(stmt, 1, run_id);
+        sqlite3_bind_int(stmt, 2, (int)i);
+        sqlite3_bind_text(stmt, 3, timer->phases[i].name, -1, SQLITE_STATIC);
+        sqlite3_bind_double(stmt, 4, timer->phases[i].seconds);
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+        {
+            rc = SQLITE_ERROR;
+        }
+        database_release(stmt);
+    }
+
+    if (rc != SQLITE_OK)
+    {
+        log_message(WARNING, WARNING_SYMBOL, "Failed to record run timings.");
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    }
+    // Trimming the history may fail on its own without losing the run just recorded
+    else if (database_savepoint() == 0)
+    {
+        int trim_failed = metrics_fold_runs(timer->repo_id, timer->kind, RUN_HISTORY_KEEP) != 0;
+        if (database_savepoint_end(trim_failed) != 0 || trim_failed)
+        {
+            log_message(WARNING, WARNING_SYMBOL, "Failed to trim the run history.");
+        }
+    }
+    database_savepoint_end(rc != SQLITE_OK);
+    database_commit();
+}
+
+// Stop, record and export a run that is not part of a batch
+void run_timer_finish(struct run_timer *timer, int status)
+{
+    run_timer_stop(timer, status);
+    run_timer_record(timer);
+    write_metrics_textfile();
+}
+
+// Samples of one (kind, phase) pair
+struct phase_samples
+{
+    char kind[16];
+    char phase[64];
+    double *values;
+    size_t count;
+    size_t capacity;
+};
+
+struct sample_set
+{
+    struct phase_samples *groups;
+    size_t count;
+    size_t capacity;
+};
+
+static void add_sample(struct sample_set *set, const char *kind, const char *phase, double seconds)
+{
+    struct phase_samples *group = NULL;
+    for (size_t i = 0; i < set->count; i++)
+    {
+        if (strcmp(set->groups[i].kind, kind) == 0 && strcmp(set->groups[i].phase, phase) == 0)
+        {
+            group = &set->groups[i];
+            break;
+        }
+    }
+
+    if (!group)
+    {
+        if (set->count == set->capacity)
+        {
+            size_t capacity = set->capacity ? set->capacity * 2 : 16;
+            struct phase_samples *groups = realloc(set->groups, capacity * sizeof(*groups));
+            if (!groups)
+            {
+                return;
+            }
+            set->groups = groups;
+            set->capacity = capacity;
+        }
+        group = &set->groups[set->count++];
+        memset(group, 0, sizeof(*group));
+        snprintf(group->kind, sizeof(group->kind), "%s", kind);
+        snprintf(group->phase, sizeof(group->phase), "%s", phase);
+    }
+
+    if (group->count == group->capacity)
+    {
+        size_t capacity = group->capacity ? group->capacity * 2 : 32;
+        double *values = realloc(group->values, capacity * sizeof(double));
+        if (!values)
+        {
+            return;
+        }
+        group->values = values;
+        group->capacity = capacity;
+    }
+    group->values[group->count++] = seconds;
+}
+
+static int compare_doubles(const void *left, const void *right)
+{
+    double a = *(const double *)left;
+    double b = *(const double *)right;
+    return (a > b) - (a < b);
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const double *sorted, size_t count, double fraction)
+{
+    size_t rank = (size_t)(fraction * (double)count + 0.999999);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    if (rank > count)
+    {
+        rank = count;
+    }
+    return sorted[rank - 1];
+}
+
+// Samples of the last `last_runs` runs of each kind, optionally for one repository
+static int load_samples(struct sample_set *set, const char *repo_id, int last_runs)
+{
+    // Phases first, in pipeline order, then one "total" row per kind
+    const enum database_statement queries[] = {STMT_RUN_RECENT_PHASES, STMT_RUN_RECENT_TOTALS};
+
+    for (size_t q = 0; q < 2; q++)
+    {
+        sqlite3_stmt *stmt = database_acquire(queries[q]);
+        if (repo_id)
+        {
+            sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+        }
+        sqlite3_bind_int(stmt, 2, last_runs);
+
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            add_sample(set, (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1), sqlite3_column_double(stmt, 2));
+        }
+        if (rc != SQLITE_DONE)
+        {
+            fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        }
+        database_release(stmt);
+        if (rc != SQLITE_DONE)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void print_outcomes(const char *kind, const char *repo_id, int last_runs)
+{
+    log_flush();
+    sqlite3_stmt *stmt = database_acquire(STMT_RUN_RECENT_OUTCOMES);
+    if (repo_id)
+    {
+        sqlite3_bind_text(stmt, 1, repo_id, -1, SQLITE_STATIC);
+    }
+    sqlite3_bind_int(stmt, 2, last_runs);
+    sqlite3_bind_text(stmt, 3, kind, -1, SQLITE_STATIC);
+
+    printf("\n%s runs:", kind);
+    const char *separator = " ";
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        printf("%s%d %s", separator, sqlite3_column_int(stmt, 1), (const char *)sqlite3_column_text(stmt, 0));
+        separator = ", ";
+    }
+    printf("\n");
+    database_release(stmt);
+}
+
+// Print p50/p95/max for every phase over the last `last_runs` runs of each kind
+void print_run_stats(const char *repo_id, int last_runs)
+{
+    struct sample_set set = {NULL, 0, 0};
+    if (load_samples(&set, repo_id, last_runs) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to read run timings.");
+        return;
+    }
+
+    if (set.count == 0)
+    {
+        log_message(INFO, INFO_SYMBOL, "No recorded runs yet.");
+        free(set.groups);
+        return;
+    }
+
+    log_flush();
+    printf("\nRun timings for %s (last %d runs per kind)\n", repo_id ? repo_id : "all repositories", last_runs);
+
+    // Groups arrive phase rows first and totals last; print them kind by kind
+    for (size_t i = 0; i < set.count; i++)
+    {
+        int printed = 0;
+        for (size_t k = 0; k < i && !printed; k++)
+        {
+            printed = strcmp(set.groups[k].kind, set.groups[i].kind) == 0;
+        }
+        if (printed)
+        {
+            continue;
+        }
+
+        print_outcomes(set.groups[i].kind, repo_id, last_runs);
+        printf("  %-20s %6s %10s %10s %10s\n", "Phase", "Runs", "p50", "p95", "max");
+
+        for (size_t j = i; j < set.count; j++)
+        {
+            struct phase_samples *group = &set.groups[j];
+            if (strcmp(group->kind, set.groups[i].kind) != 0)
+            {
+                continue;
+            }
+
+            qsort(group->values, group->count, sizeof(double), compare_doubles);
+            printf("  %-20s %6zu %9.3fs %9.3fs %9.3fs\n", group->phase, group->count,
+                   percentile(group->values, group->count, 0.50),
+                   percentile(group->values, group->count, 0.95),
+                   group->values[group->count - 1]);
+        }
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < set.count; i++)
+    {
+        free(set.groups[i].values);
+    }
+    free(set.groups);
+}
\ No newline at end of file
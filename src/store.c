@@ -0,0 +1,213 @@
+#include "store.h"
+#include "sha256.h"
+#include "utils.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Objects live in {HOME}/.config/dployer/store/objects, named <sha256>-<mode>
+static int objects_directory(char *path, size_t size)
+{
+    const char *home_dir = getenv("HOME");
+    if (!home_dir)
+    {
+        return -1;
+    }
+
+    char store_dir[PATH_MAX];
+    if (snprintf(store_dir, sizeof(store_dir), "%s/.config/dployer/store", home_dir) >= (int)sizeof(store_dir) ||
+        snprintf(path, size, "%s/objects", store_dir) >= (int)size)
+    {
+        return -1;
+    }
+
+    if ((mkdir(store_dir, 0700) != 0 && errno != EEXIST) || (mkdir(path, 0700) != 0 && errno != EEXIST))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int set_store_mtime(const char *path)
+{
+    struct timespec times[2] = {{CONFIG_STORE_MTIME, 0}, {CONFIG_STORE_MTIME, 0}};
+    return utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW);
+}
+
+// Make sure the store holds `source_path` and return the object's path. Hard links share
+// the mode and mtime, so both are fixed on the object and the mode is part of its name.
+static int store_object(const char *objects_dir, const char *source_path, mode_t mode, char *object_path, size_t size,
+                        struct config_stage_stats *stats)
+{
+    char hash[SHA256_HEX_SIZE];
+    if (sha256_file_hex(source_path, hash) != 0 ||
+        snprintf(object_path, size, "%s/%s-%04o", objects_dir, hash, (unsigned)mode) >= (int)size)
+    {
+        return -1;
+    }
+
+    if (access(object_path, F_OK) == 0)
+    {
+        return 0;
+    }
+
+    // Write under a temporary name and rename, so a concurrent deploy never links a partial object
+    char temp_path[PATH_MAX];
+    if (snprintf(temp_path, sizeof(temp_path), "%s/.tmp-XXXXXX", objects_dir) >= (int)sizeof(temp_path))
+    {
+        return -1;
+    }
+    int fd = mkstemp(temp_path);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    close(fd);
+
+    // Re-hash the copy: the source may have been edited since it was hashed
+    char copied_hash[SHA256_HEX_SIZE];
+    if (copy_file(source_path, temp_path, mode) != 0 || chmod(temp_path, mode) != 0 ||
+        sha256_file_hex(temp_path, copied_hash) != 0 || strcmp(copied_hash, hash) != 0 ||
+        set_store_mtime(temp_path) != 0 || rename(temp_path, object_path) != 0)
+    {
+        unlink(temp_path);
+        return -1;
+    }
+
+    stats->stored++;
+    return 0;
+}
+
+// Put a store object at `destination_path`: a hard link, else a reflink, else a copy
+static int place_object(const char *object_path, const char *destination_path, mode_t mode, struct config_stage_stats *stats)
+{
+    // A leftover from an interrupted deploy, or a file the repository tracks, would make link() fail
+    if (unlink(destination_path) != 0 && errno != ENOENT)
+    {
+        return -1;
+    }
+
+    if (link(object_path, destination_path) == 0)
+    {
+        stats->linked++;
+        return 0;
+    }
+    if (errno != EXDEV && errno != EPERM && errno != EMLINK)
+    {
+        return -1;
+    }
+
+    int cloned = clone_file(object_path, destination_path, mode);
+    if (cloned < 0)
+    {
+        return -1;
+    }
+    if (chmod(destination_path, mode) != 0 || set_store_mtime(destination_path) != 0)
+    {
+        return -1;
+    }
+
+    if (cloned)
+    {
+        stats->cloned++;
+    }
+    else
+    {
+        stats->copied++;
+    }
+    return 0;
+}
+
+static int stage_directory(const char *objects_dir, const char *source_dir, const char *destination_dir, struct config_stage_stats *stats)
+{
+    DIR *dir = opendir(source_dir);
+    if (!dir)
+    {
+        return -1;
+    }
+
+    int status = 0;
+    struct dirent *entry;
+    while (status == 0 && (entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        char source_path[PATH_MAX];
+        char destination_path[PATH_MAX];
+        if (snprintf(source_path, sizeof(source_path), "%s/%s", source_dir, entry->d_name) >= (int)sizeof(source_path) ||
+            snprintf(destination_path, sizeof(destination_path), "%s/%s", destination_dir, entry->d_name) >= (int)sizeof(destination_path))
+        {
+            status = -1;
+            break;
+        }
+
+        struct stat st;
+        if (stat(source_path, &st) != 0)
+        {
+            status = -1;
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            if (mkdir(destination_path, st.st_mode & 0777) != 0 && errno != EEXIST)
+            {
+                status = -1;
+            }
+            else
+            {
+                status = stage_directory(objects_dir, source_path, destination_path, stats);
+            }
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            char object_path[PATH_MAX];
+            status = store_object(objects_dir, source_path, st.st_mode & 0777, object_path, sizeof(object_path), stats);
+            if (status == 0)
+            {
+                status = place_object(object_path, destination_path, st.st_mode & 0777, stats);
+            }
+            if (status == 0)
+            {
+                stats->files++;
+                stats->bytes += (unsigned long long)st.st_size;
+            }
+        }
+    }
+
+    closedir(dir);
+
+    // Last, because adding entries above moved the directory's mtime
+    if (status == 0 && set_store_mtime(destination_dir) != 0)
+    {
+        status = -1;
+    }
+    return status;
+}
+
+// Stage the contents of `source_dir` into `destination_dir` through the store. Files are
+// hashed on every call, but only new content is written; the rest is linked in place.
+int config_store_stage(const char *source_dir, const char *destination_dir, struct config_stage_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    char objects_dir[PATH_MAX];
+    if (objects_directory(objects_dir, sizeof(objects_dir)) != 0)
+    {
+        return -1;
+    }
+    return stage_directory(objects_dir, source_dir, destination_dir, stats);
+}
+
+void format_stage_stats(const struct config_stage_stats *stats, char *summary, size_t size)
+{
+    snprintf(summary, size, "%zu files, %llu bytes (%zu linked, %zu reflinked, %zu copied; %zu new in the store)",
+             stats->files, stats->bytes, stats->linked, stats->cloned, stats->copied, stats->stored);
+}
\ No newline at end of file
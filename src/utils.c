@@ -1,40 +1,25 @@
 #include "utils.h"
 #include "logger.h"
-#include <pthread.h>
+#include "process.h"
+#include "docker.h"
 #include <unistd.h>
+#include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
 
-extern int loading; // Assuming 'loading' is declared in another file (like main.c)
-
-// Loader animation function
-void *loader_animation(void *arg)
-{
-  const char *spinner = "|/-\\";
-  int i = 0;
-
-  // Log the initial message once, without the timestamp and log level
-  printf("%s[LOG] INFO ", INFO);
-
-  while (loading)
-  {
-    printf("\r"); // Return the cursor to the beginning of the line
-    char message[256];
-    snprintf(message, sizeof(message), "[%c] Processing...", spinner[i % 4]);
-    printf("%s%s%s", INFO, message, NC);
-    fflush(stdout);
-    i++;
-    usleep(100000); // Sleep for 100ms
-  }
-
-  // Clear the line by overwriting with spaces and return to the beginning
-  printf("\r%*s\r", 80, ""); // Assumes 80 characters wide; adjust if needed
-  log_message(SUCCESS, SUCCESS_SYMBOL, "[✔] Done!");
-
-  pthread_exit(NULL);
-}
+#if defined(__linux__)
+#include <linux/fs.h> // FICLONE
+#endif
 
 // Function to get input from the user
 void get_input(const char *prompt, char *input, size_t size)
 {
+  log_flush();
   printf("\033[1;33m%s %s \033[0m", INPUT_SYMBOL, prompt); // Yellow prompt text with cyan arrow
   fgets(input, size, stdin);
 
@@ -46,81 +31,231 @@ void get_input(const char *prompt, char *input, size_t size)
   }
 }
 
-// Function to execute a command in the system shell
-void execute_command(const char *command)
+// Run a command, capturing stdout and stderr into `output` (may be NULL).
+// Returns the exit code, or -1 if it could not run.
+int run_command(const char *const argv[], struct output_buffer *output)
 {
-  // Log the command being executed
-  char log_msg[512];
-  snprintf(log_msg, sizeof(log_msg), "Executing command: %s", command);
-  log_message(INFO, INFO_SYMBOL, log_msg);
+  return process_run_captured(argv, output, NULL);
+}
 
-  // Create a thread for the loader animation
-  pthread_t loader_thread;
-  loading = 1; // Set the loading flag to true
-  pthread_create(&loader_thread, NULL, loader_animation, NULL);
+int copy_file(const char *source_path, const char *destination_path, mode_t mode)
+{
+  int in = open(source_path, O_RDONLY);
+  if (in < 0)
+  {
+    return -1;
+  }
 
-  int ret = system(command);
-  loading = 0; // Stop the loader
+  int out = open(destination_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  if (out < 0)
+  {
+    close(in);
+    return -1;
+  }
 
-  // Wait for the loader thread to finish
-  pthread_join(loader_thread, NULL);
+  char chunk[65536];
+  ssize_t read_bytes;
+  int status = 0;
+  while ((read_bytes = read(in, chunk, sizeof(chunk))) > 0)
+  {
+    if (write(out, chunk, read_bytes) != read_bytes)
+    {
+      status = -1;
+      break;
+    }
+  }
+  if (read_bytes < 0)
+  {
+    status = -1;
+  }
 
-  if (ret == -1)
+  close(in);
+  if (close(out) != 0)
   {
-    perror("system");
-    exit(1);
+    status = -1;
+  }
+  return status;
+}
+
+// Create `destination_path` as a reflink of `source_path` where the filesystem supports it,
+// else as a plain copy. Returns 1 for a reflink, 0 for a copy and -1 on failure.
+int clone_file(const char *source_path, const char *destination_path, mode_t mode)
+{
+  int cloned = 0;
+#ifdef FICLONE
+  int in = open(source_path, O_RDONLY);
+  int out = in >= 0 ? open(destination_path, O_WRONLY | O_CREAT | O_EXCL, mode) : -1;
+  cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+  if (in >= 0)
+  {
+    close(in);
+  }
+  if (out >= 0)
+  {
+    close(out);
+  }
+#endif
+
+  if (!cloned && copy_file(source_path, destination_path, mode) != 0)
+  {
+    return -1;
+  }
+  return cloned;
+}
+
+// Remove a directory tree without following symlinks (the equivalent of rm -rf)
+int remove_directory(const char *path)
+{
+  struct stat st;
+  if (lstat(path, &st) != 0)
+  {
+    return errno == ENOENT ? 0 : -1;
+  }
+
+  if (!S_ISDIR(st.st_mode))
+  {
+    return unlink(path);
+  }
+
+  DIR *dir = opendir(path);
+  if (!dir)
+  {
+    return -1;
   }
-  else if (ret != 0)
+
+  int status = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
   {
-    // Handle non-zero return codes
-    fprintf(stderr, "Command failed with exit code %d: %s\n", WEXITSTATUS(ret), command);
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+    {
+      continue;
+    }
 
-    // Remove redirection to /dev/null for debugging
-    char debug_command[512];
-    snprintf(debug_command, sizeof(debug_command), "%s", command);
-    for (char *p = debug_command; *p; p++)
+    char child_path[PATH_MAX];
+    if (snprintf(child_path, sizeof(child_path), "%s/%s", path, entry->d_name) >= (int)sizeof(child_path) ||
+        remove_directory(child_path) != 0)
     {
-      if (strncmp(p, "> /dev/null 2>&1", 16) == 0)
-      {
-        *p = '\0'; // Truncate at redirection
-        break;
-      }
+      status = -1;
     }
-    system(debug_command); // Run the command again without redirection to see the output
-    exit(1);
   }
+
+  closedir(dir);
+  if (status == 0 && rmdir(path) != 0)
+  {
+    status = -1;
+  }
+  return status;
 }
 
 void check_requirements()
 {
-
   // Check if Git is installed
-  if (system("command -v git > /dev/null") != 0)
+  const char *git_version[] = {"git", "--version", NULL};
+  if (run_command(git_version, NULL) != 0)
   {
     log_message(ERROR, ERROR_SYMBOL, "Git is not installed. Please install Git.");
     exit(1);
   }
 
-  // Check if Docker is installed
-  if (system("command -v docker > /dev/null") != 0)
+  // Check that the Docker daemon is reachable over its API socket
+  if (docker_ping() != 0)
   {
-    log_message(ERROR, ERROR_SYMBOL, "Docker is not installed. Please install Docker.");
+    char error_msg[PATH_MAX + 128];
+    snprintf(error_msg, sizeof(error_msg), "Cannot reach the Docker daemon at %s. Please install and start Docker.", docker_socket_path());
+    log_message(ERROR, ERROR_SYMBOL, error_msg);
     exit(1);
   }
 
-  // Initialize Docker Swarm
-  int swarm_init = system("docker swarm init > /dev/null 2>&1");
-  if (swarm_init != 0)
+  // Initialize Docker Swarm unless this node is already part of one
+  int swarm_status = docker_swarm_ensure();
+  if (swarm_status < 0)
+  {
+    log_message(WARNING, WARNING_SYMBOL, "Failed to initialize Docker Swarm. It might already be initialized.");
+  }
+  else if (swarm_status > 0)
+  {
+    log_message(SUCCESS, SUCCESS_SYMBOL, "Docker Swarm initialized successfully.");
+  }
+}
+
+void output_buffer_init(struct output_buffer *buffer)
+{
+  buffer->data = NULL;
+  buffer->length = 0;
+  buffer->capacity = 0;
+}
+
+void output_buffer_append(struct output_buffer *buffer, const char *data, size_t length)
+{
+  if (buffer->length + length + 1 > buffer->capacity)
   {
-    // Check if the swarm is already active
-    if (system("docker node ls > /dev/null 2>&1") != 0)
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (buffer->length + length + 1 > capacity)
+    {
+      capacity *= 2;
+    }
+
+    char *data_copy = realloc(buffer->data, capacity);
+    if (!data_copy)
     {
-      log_message(WARNING, WARNING_SYMBOL, "Failed to initialize Docker Swarm. It might already be initialized.");
+      // Keep what was captured so far rather than aborting the job
+      return;
     }
-    // Swarm is already active; no warning needed
+    buffer->data = data_copy;
+    buffer->capacity = capacity;
   }
-  else
+
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+  buffer->data[buffer->length] = '\0';
+}
+
+void output_buffer_appendf(struct output_buffer *buffer, const char *format, ...)
+{
+  char stack_buffer[512];
+  va_list args;
+
+  va_start(args, format);
+  int length = vsnprintf(stack_buffer, sizeof(stack_buffer), format, args);
+  va_end(args);
+
+  if (length < 0)
   {
-    log_message(SUCCESS, SUCCESS_SYMBOL, "Docker Swarm initialized successfully.");
+    return;
   }
+
+  if ((size_t)length < sizeof(stack_buffer))
+  {
+    output_buffer_append(buffer, stack_buffer, length);
+    return;
+  }
+
+  // The formatted text did not fit on the stack; format it again on the heap
+  char *heap_buffer = malloc(length + 1);
+  if (!heap_buffer)
+  {
+    return;
+  }
+
+  va_start(args, format);
+  vsnprintf(heap_buffer, length + 1, format, args);
+  va_end(args);
+
+  output_buffer_append(buffer, heap_buffer, length);
+  free(heap_buffer);
+}
+
+void output_buffer_free(struct output_buffer *buffer)
+{
+  free(buffer->data);
+  output_buffer_init(buffer);
+}
+
+// Seconds from an arbitrary fixed point, unaffected by wall clock changes
+double monotonic_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
 }
\ No newline at end of file
@@ -0,0 +1,687 @@
+#include "watch.h"
+#include "database.h"
+#include "deploy.h"
+#include "logger.h"
+#include "pool.h"
+#include "process.h"
+#include "repo.h"
+#include "utils.h"
+#include "worktree.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define WATCH_EVENTS (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE)
+#endif
+
+// How often refs are re-stat'ed when inotify is unavailable
+#define WATCH_POLL_INTERVAL 2.0
+
+static volatile sig_atomic_t watch_stop_requested = 0;
+static volatile sig_atomic_t watch_reload_requested = 0;
+
+static void handle_watch_stop(int signal_number)
+{
+    watch_stop_requested = 1;
+}
+
+static void handle_watch_reload(int signal_number)
+{
+    watch_reload_requested = 1;
+}
+
+// Reload the watched repositories on SIGHUP, at the next watcher_run()
+void watcher_reload_on_sighup()
+{
+    struct sigaction reload_action;
+    memset(&reload_action, 0, sizeof(reload_action));
+    reload_action.sa_handler = handle_watch_reload;
+    sigemptyset(&reload_action.sa_mask);
+    sigaction(SIGHUP, &reload_action, NULL);
+}
+
+void watch_options_init(struct watch_options *options)
+{
+    options->remote_interval = 60;
+    options->debounce = 2;
+    options->jobs = 1;
+}
+
+// Run a git command in `path` and keep the first line of its output
+static int read_git_line(const char *const argv[], char *value, size_t size)
+{
+    struct output_buffer output;
+    output_buffer_init(&output);
+
+    int ret = process_run_stdout(argv, &output, NULL);
+    if (ret == 0 && output.data)
+    {
+        output.data[strcspn(output.data, "\r\n")] = '\0';
+        snprintf(value, size, "%s", output.data);
+    }
+    else
+    {
+        value[0] = '\0';
+        ret = -1;
+    }
+
+    output_buffer_free(&output);
+    return ret;
+}
+
+static int read_head(const char *path, char *head, size_t size)
+{
+    const char *rev_parse[] = {"git", "-C", path, "rev-parse", "HEAD", NULL};
+    return read_git_line(rev_parse, head, size);
+}
+
+static void mark_changed(struct watched_repo *repo, double now)
+{
+    repo->pending = 1;
+    repo->changed_at = now;
+}
+
+// Digest of the mtimes and sizes of HEAD, packed-refs and everything under refs/
+static void add_ref_signature(const char *path, unsigned long long *signature)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return;
+    }
+
+    *signature = *signature * 1099511628211ULL ^ (unsigned long long)st.st_mtime ^ ((unsigned long long)st.st_size << 20);
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        return;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir)
+    {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        char child[PATH_MAX];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        add_ref_signature(child, signature);
+    }
+    closedir(dir);
+}
+
+static unsigned long long ref_signature(const struct watched_repo *repo)
+{
+    const char *names[] = {"HEAD", "packed-refs", "refs", NULL};
+    unsigned long long signature = 14695981039346656037ULL;
+
+    for (size_t i = 0; names[i]; i++)
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", i == 0 ? repo->git_dir : repo->common_dir, names[i]);
+        add_ref_signature(path, &signature);
+    }
+    return signature;
+}
+
+#ifdef __linux__
+static int add_watch(struct watcher *watcher, size_t repo, const char *path, int is_git_dir)
+{
+    int descriptor = inotify_add_watch(watcher->inotify_fd, path, WATCH_EVENTS | IN_ONLYDIR);
+    if (descriptor < 0)
+    {
+        return -1;
+    }
+
+    if (watcher->handle_count == watcher->handle_capacity)
+    {
+        size_t capacity = watcher->handle_capacity ? watcher->handle_capacity * 2 : 64;
+        struct watch_handle *handles = realloc(watcher->handles, capacity * sizeof(*handles));
+        if (!handles)
+        {
+            inotify_rm_watch(watcher->inotify_fd, descriptor);
+            return -1;
+        }
+        watcher->handles = handles;
+        watcher->handle_capacity = capacity;
+    }
+
+    struct watch_handle *handle = &watcher->handles[watcher->handle_count++];
+    handle->descriptor = descriptor;
+    handle->repo = repo;
+    handle->path = strdup(path);
+    handle->is_git_dir = is_git_dir;
+    return 0;
+}
+
+// inotify is not recursive, so every directory below refs/ gets its own watch
+static void add_watch_tree(struct watcher *watcher, size_t repo, const char *path)
+{
+    if (add_watch(watcher, repo, path, 0) != 0)
+    {
+        return;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir)
+    {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char child[PATH_MAX];
+        struct stat st;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (stat(child, &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            add_watch_tree(watcher, repo, child);
+        }
+    }
+    closedir(dir);
+}
+
+static struct watch_handle *find_handle(struct watcher *watcher, int descriptor)
+{
+    for (size_t i = 0; i < watcher->handle_count; i++)
+    {
+        if (watcher->handles[i].descriptor == descriptor)
+        {
+            return &watcher->handles[i];
+        }
+    }
+    return NULL;
+}
+
+static int is_lock_file(const char *name)
+{
+    size_t length = strlen(name);
+    return length >= 5 && strcmp(name + length - 5, ".lock") == 0;
+}
+
+// Drain pending inotify events and flag the repositories they belong to
+static void read_inotify_events(struct watcher *watcher, double now)
+{
+    char buffer[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    while ((length = read(watcher->inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *cursor = buffer; cursor < buffer + length;)
+        {
+            struct inotify_event *event = (struct inotify_event *)cursor;
+            cursor += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // Events were lost; let the HEAD comparison sort it out
+                for (size_t i = 0; i < watcher->count; i++)
+                {
+                    mark_changed(&watcher->repos[i], now);
+                }
+                continue;
+            }
+
+            struct watch_handle *handle = find_handle(watcher, event->wd);
+            if (!handle || event->len == 0 || is_lock_file(event->name))
+            {
+                continue;
+            }
+
+            if (handle->is_git_dir && strcmp(event->name, "HEAD") != 0 && strcmp(event->name, "packed-refs") != 0)
+            {
+                continue;
+            }
+
+            // New branch namespaces (feature/...) create directories under refs/
+            if ((event->mask & IN_CREATE) && (event->mask & IN_ISDIR) && !handle->is_git_dir)
+            {
+                char child[PATH_MAX];
+                size_t repo = handle->repo;
+                snprintf(child, sizeof(child), "%s/%s", handle->path, event->name);
+                add_watch_tree(watcher, repo, child);
+                mark_changed(&watcher->repos[repo], now);
+                continue;
+            }
+
+            mark_changed(&watcher->repos[handle->repo], now);
+        }
+    }
+}
+#endif
+
+// Load every repository and take its current HEAD as the baseline
+static int load_watched_repos(struct watcher *watcher)
+{
+    struct repository_list repositories;
+    if (repository_list_all(&repositories) != 0)
+    {
+        return -1;
+    }
+
+    size_t capacity = 0;
+    for (size_t i = 0; i < repositories.count; i++)
+    {
+        const struct repository *repository = &repositories.items[i];
+
+        char path[PATH_MAX];
+        if (!realpath(repository->destination_folder, path))
+        {
+            char warning_msg[PATH_MAX + 64];
+            snprintf(warning_msg, sizeof(warning_msg), "Skipping %s: destination folder not found.", repository->id);
+            log_message(WARNING, WARNING_SYMBOL, warning_msg);
+            continue;
+        }
+
+        if (watcher->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            struct watched_repo *repos = realloc(watcher->repos, capacity * sizeof(*repos));
+            if (!repos)
+            {
+                break;
+            }
+            watcher->repos = repos;
+        }
+
+        struct watched_repo *repo = &watcher->repos[watcher->count++];
+        memset(repo, 0, sizeof(*repo));
+        repo->repo_id = strdup(repository->id);
+        repo->path = strdup(path);
+        repo->branch_name = strdup(repository->branch_name);
+
+        // Worktrees keep HEAD in their own git directory and share the store's refs
+        char git_dir[PATH_MAX];
+        char common_dir[PATH_MAX];
+        if (git_dirs(path, git_dir, sizeof(git_dir), common_dir, sizeof(common_dir)) != 0)
+        {
+            snprintf(git_dir, sizeof(git_dir), "%s/.git", path);
+            snprintf(common_dir, sizeof(common_dir), "%s", git_dir);
+        }
+        repo->git_dir = strdup(git_dir);
+        repo->common_dir = strdup(common_dir);
+        read_head(repo->path, repo->head, sizeof(repo->head));
+        repo->ref_signature = ref_signature(repo);
+    }
+
+    repository_list_free(&repositories);
+    return 0;
+}
+
+int watcher_init(struct watcher *watcher, const struct watch_options *options)
+{
+    memset(watcher, 0, sizeof(*watcher));
+    watcher->options = *options;
+    watcher->inotify_fd = -1;
+
+    if (load_watched_repos(watcher) != 0)
+    {
+        return -1;
+    }
+
+    double now = monotonic_seconds();
+    watcher->next_remote_check = now;
+    watcher->next_poll = now + WATCH_POLL_INTERVAL;
+
+#ifdef __linux__
+    watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    for (size_t i = 0; watcher->inotify_fd >= 0 && i < watcher->count; i++)
+    {
+        char path[PATH_MAX];
+        add_watch(watcher, i, watcher->repos[i].git_dir, 1);
+        if (strcmp(watcher->repos[i].common_dir, watcher->repos[i].git_dir) != 0)
+        {
+            add_watch(watcher, i, watcher->repos[i].common_dir, 1);
+        }
+        snprintf(path, sizeof(path), "%s/refs", watcher->repos[i].common_dir);
+        add_watch_tree(watcher, i, path);
+    }
+#endif
+
+    return 0;
+}
+
+// Re-read the repositories after some were added, removed or switched to another
+// checkout. Those still at the same path and branch keep their baseline HEAD and
+// pending changes; the others start from their current HEAD, as at startup.
+int watcher_reload(struct watcher *watcher)
+{
+    struct watcher reloaded;
+    if (watcher_init(&reloaded, &watcher->options) != 0)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < reloaded.count; i++)
+    {
+        struct watched_repo *repo = &reloaded.repos[i];
+        for (size_t j = 0; j < watcher->count; j++)
+        {
+            const struct watched_repo *previous = &watcher->repos[j];
+            if (strcmp(previous->repo_id, repo->repo_id) == 0 && strcmp(previous->path, repo->path) == 0 &&
+                strcmp(previous->branch_name, repo->branch_name) == 0)
+            {
+                memcpy(repo->head, previous->head, sizeof(repo->head));
+                memcpy(repo->remote_signature, previous->remote_signature, sizeof(repo->remote_signature));
+                repo->pending = previous->pending;
+                repo->needs_update = previous->needs_update;
+                repo->changed_at = previous->changed_at;
+                break;
+            }
+        }
+    }
+    reloaded.next_remote_check = watcher->next_remote_check;
+    reloaded.next_poll = watcher->next_poll;
+
+    watcher_free(watcher);
+    *watcher = reloaded;
+
+    char log_msg[128];
+    snprintf(log_msg, sizeof(log_msg), "Watching %zu repositories.", watcher->count);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+    return 0;
+}
+
+// Descriptor to wait on for local ref changes, or -1 when polling
+int watcher_fd(const struct watcher *watcher)
+{
+    return watcher->inotify_fd;
+}
+
+// Milliseconds until watcher_run() has timed work to do, or -1 for none
+int watcher_timeout_ms(const struct watcher *watcher)
+{
+    double now = monotonic_seconds();
+    double deadline = -1;
+
+    if (watcher->options.remote_interval > 0)
+    {
+        deadline = watcher->next_remote_check;
+    }
+    if (watcher->inotify_fd < 0 && (deadline < 0 || watcher->next_poll < deadline))
+    {
+        deadline = watcher->next_poll;
+    }
+    for (size_t i = 0; i < watcher->count; i++)
+    {
+        double ready_at = watcher->repos[i].changed_at + watcher->options.debounce;
+        if (watcher->repos[i].pending && (deadline < 0 || ready_at < deadline))
+        {
+            deadline = ready_at;
+        }
+    }
+
+    if (deadline < 0)
+    {
+        return -1;
+    }
+    return deadline <= now ? 0 : (int)((deadline - now) * 1000.0) + 1;
+}
+
+// Ask the remote whether the tracked branch (or the tag list) moved
+static void check_remote_task(size_t index, void *context)
+{
+    struct watcher *watcher = context;
+    struct watched_repo *repo = &watcher->repos[index];
+    char answer[128];
+
+    if (is_version_tag(repo->branch_name))
+    {
+        const char *ls_remote[] = {"git", "-C", repo->path, "ls-remote", "--tags", "origin", NULL};
+        struct output_buffer output;
+        output_buffer_init(&output);
+        if (process_run_stdout(ls_remote, &output, NULL) == 0)
+        {
+            struct sha256_context sha;
+            char signature[SHA256_HEX_SIZE];
+            sha256_init(&sha);
+            sha256_update(&sha, output.data ? output.data : "", output.length);
+            sha256_final_hex(&sha, signature);
+
+            // The first answer is only a baseline
+            if (repo->remote_signature[0] != '\0' && strcmp(signature, repo->remote_signature) != 0)
+            {
+                repo->needs_update = 1;
+            }
+            memcpy(repo->remote_signature, signature, sizeof(signature));
+        }
+        output_buffer_free(&output);
+        return;
+    }
+
+    char remote_ref[300];
+    char tracking_ref[300];
+    snprintf(remote_ref, sizeof(remote_ref), "refs/heads/%s", repo->branch_name);
+    snprintf(tracking_ref, sizeof(tracking_ref), "refs/remotes/origin/%s", repo->branch_name);
+
+    const char *ls_remote[] = {"git", "-C", repo->path, "ls-remote", "origin", remote_ref, NULL};
+    if (read_git_line(ls_remote, answer, sizeof(answer)) != 0 || answer[0] == '\0')
+    {
+        return;
+    }
+    answer[strcspn(answer, " \t")] = '\0';
+
+    char tracking[128];
+    const char *rev_parse[] = {"git", "-C", repo->path, "rev-parse", "--verify", "--quiet", tracking_ref, NULL};
+    if (read_git_line(rev_parse, tracking, sizeof(tracking)) != 0 || strcmp(answer, tracking) != 0)
+    {
+        repo->needs_update = 1;
+    }
+}
+
+// Pull and deploy every repository whose debounce period has passed
+static void deploy_ready_repos(struct watcher *watcher, double now)
+{
+    const char **ready = malloc((watcher->count ? watcher->count : 1) * sizeof(char *));
+    size_t *ready_index = malloc((watcher->count ? watcher->count : 1) * sizeof(size_t));
+    size_t ready_count = 0;
+
+    if (!ready || !ready_index)
+    {
+        free(ready);
+        free(ready_index);
+        return;
+    }
+
+    for (size_t i = 0; i < watcher->count; i++)
+    {
+        struct watched_repo *repo = &watcher->repos[i];
+        if (!repo->pending || now - repo->changed_at < watcher->options.debounce)
+        {
+            continue;
+        }
+        repo->pending = 0;
+
+        if (repo->needs_update)
+        {
+            repo->needs_update = 0;
+            if (pull_latest_repo(repo->repo_id) != 0)
+            {
+                // Whatever a failed pull left behind (e.g. a stopped rebase) must not be deployed
+                read_head(repo->path, repo->head, sizeof(repo->head));
+                char warning_msg[256];
+                snprintf(warning_msg, sizeof(warning_msg), "Update of %s failed; not deploying until its next change.", repo->repo_id);
+                log_message(WARNING, WARNING_SYMBOL, warning_msg);
+                continue;
+            }
+        }
+
+        // Our own pulls and unrelated ref updates land here too; only a moved HEAD deploys
+        char head[SHA256_HEX_SIZE];
+        if (read_head(repo->path, head, sizeof(head)) != 0 || strcmp(head, repo->head) == 0)
+        {
+            continue;
+        }
+
+        char log_msg[256];
+        snprintf(log_msg, sizeof(log_msg), "%s moved to %.12s; queueing deploy.", repo->repo_id, head);
+        log_message(INFO, INFO_SYMBOL, log_msg);
+
+        memcpy(repo->head, head, sizeof(head));
+        ready[ready_count] = repo->repo_id;
+        ready_index[ready_count] = i;
+        ready_count++;
+    }
+
+    if (ready_count > 0)
+    {
+        struct deploy_options options = {0};
+        options.jobs = watcher->options.jobs;
+        deploy_repos(ready, ready_count, &options);
+
+        // Refs touched by the deploy itself should not retrigger it
+        for (size_t i = 0; i < ready_count; i++)
+        {
+            watcher->repos[ready_index[i]].ref_signature = ref_signature(&watcher->repos[ready_index[i]]);
+        }
+    }
+
+    free(ready);
+    free(ready_index);
+}
+
+// Handle whatever is due: ref events, polling, remote checks and debounced deploys
+void watcher_run(struct watcher *watcher)
+{
+    if (watch_reload_requested)
+    {
+        watch_reload_requested = 0;
+        watcher_reload(watcher);
+    }
+
+    double now = monotonic_seconds();
+
+#ifdef __linux__
+    if (watcher->inotify_fd >= 0)
+    {
+        read_inotify_events(watcher, now);
+    }
+#endif
+
+    if (watcher->inotify_fd < 0 && now >= watcher->next_poll)
+    {
+        for (size_t i = 0; i < watcher->count; i++)
+        {
+            unsigned long long signature = ref_signature(&watcher->repos[i]);
+            if (signature != watcher->repos[i].ref_signature)
+            {
+                watcher->repos[i].ref_signature = signature;
+                mark_changed(&watcher->repos[i], now);
+            }
+        }
+        watcher->next_poll = now + WATCH_POLL_INTERVAL;
+    }
+
+    if (watcher->options.remote_interval > 0 && now >= watcher->next_remote_check)
+    {
+        // ls-remote is a network round trip per repository, so ask them all at once
+        run_worker_pool(watcher->count, resolve_job_count(0), check_remote_task, watcher);
+
+        for (size_t i = 0; i < watcher->count; i++)
+        {
+            if (watcher->repos[i].needs_update)
+            {
+                // Remote changes skip the debounce
+                watcher->repos[i].pending = 1;
+                watcher->repos[i].changed_at = now - watcher->options.debounce;
+            }
+        }
+        watcher->next_remote_check = now + watcher->options.remote_interval;
+    }
+
+    deploy_ready_repos(watcher, now);
+}
+
+void watcher_free(struct watcher *watcher)
+{
+#ifdef __linux__
+    if (watcher->inotify_fd >= 0)
+    {
+        close(watcher->inotify_fd);
+    }
+#endif
+    for (size_t i = 0; i < watcher->handle_count; i++)
+    {
+        free(watcher->handles[i].path);
+    }
+    for (size_t i = 0; i < watcher->count; i++)
+    {
+        free(watcher->repos[i].repo_id);
+        free(watcher->repos[i].path);
+        free(watcher->repos[i].git_dir);
+        free(watcher->repos[i].common_dir);
+        free(watcher->repos[i].branch_name);
+    }
+    free(watcher->handles);
+    free(watcher->repos);
+    memset(watcher, 0, sizeof(*watcher));
+    watcher->inotify_fd = -1;
+}
+
+// Watch in the foreground until SIGINT or SIGTERM
+int watch_repositories(const struct watch_options *options)
+{
+    struct watcher watcher;
+    if (watcher_init(&watcher, options) != 0)
+    {
+        return -1;
+    }
+
+    char log_msg[256];
+    snprintf(log_msg, sizeof(log_msg), "Watching %zu repositories (%s, remote check every %.0fs, debounce %.1fs). Press Ctrl+C to stop, send SIGHUP to reload.",
+             watcher.count, watcher.inotify_fd >= 0 ? "inotify" : "polling", options->remote_interval, options->debounce);
+    log_message(INFO, INFO_SYMBOL, log_msg);
+
+    struct sigaction stop_action;
+    struct sigaction old_int;
+    struct sigaction old_term;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = handle_watch_stop;
+    sigemptyset(&stop_action.sa_mask);
+    sigaction(SIGINT, &stop_action, &old_int);
+    sigaction(SIGTERM, &stop_action, &old_term);
+    watcher_reload_on_sighup();
+    watch_stop_requested = 0;
+
+    while (!watch_stop_requested)
+    {
+        struct pollfd descriptor = {watcher_fd(&watcher), POLLIN, 0};
+        int ready = poll(&descriptor, descriptor.fd >= 0 ? 1 : 0, watcher_timeout_ms(&watcher));
+        if (ready < 0 && errno != EINTR)
+        {
+            break;
+        }
+        if (!watch_stop_requested)
+        {
+            watcher_run(&watcher);
+        }
+    }
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+    watcher_free(&watcher);
+    log_message(INFO, INFO_SYMBOL, "Stopped watching repositories.");
+    return 0;
+}
\ No newline at end of file
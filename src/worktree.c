@@ -0,0 +1,351 @@
+#include "worktree.h"
+#include "logger.h"
+#include "process.h"
+#include "repo.h"
+#include "utils.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Absolute paths of a checkout's own git directory and of the one holding its objects
+// and refs; they differ for worktrees. Returns 0 on success.
+int git_dirs(const char *repo_path, char *git_dir, size_t git_dir_size, char *common_dir, size_t common_dir_size)
+{
+    struct output_buffer output;
+    output_buffer_init(&output);
+
+    const char *command[] = {"git", "-C", repo_path, "rev-parse", "--path-format=absolute", "--git-dir", "--git-common-dir", NULL};
+    int status = process_run_stdout(command, &output, NULL) == 0 && output.data ? 0 : -1;
+    if (status == 0)
+    {
+        char *save_ptr = NULL;
+        const char *own = strtok_r(output.data, "\r\n", &save_ptr);
+        const char *common = strtok_r(NULL, "\r\n", &save_ptr);
+        status = own && common ? 0 : -1;
+        if (status == 0)
+        {
+            snprintf(git_dir, git_dir_size, "%s", own);
+            snprintf(common_dir, common_dir_size, "%s", common);
+        }
+    }
+
+    output_buffer_free(&output);
+    return status;
+}
+
+int worktree_store_exists(const char *destination_folder)
+{
+    char store[PATH_MAX];
+    struct stat st;
+    snprintf(store, sizeof(store), "%s/%s", destination_folder, WORKTREE_STORE_NAME);
+    return stat(store, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Directory the worktrees of a store go in: beside a dployer store, or "<checkout>.worktrees"
+// for checkouts cloned before stores existed, whose own tree is the first worktree
+static void worktree_root(const char *common_dir, char *root, size_t size)
+{
+    snprintf(root, size, "%s", common_dir);
+    char *name = strrchr(root, '/');
+    if (name && strcmp(name + 1, WORKTREE_STORE_NAME) == 0)
+    {
+        *name = '\0';
+    }
+    else if (name && strcmp(name + 1, ".git") == 0)
+    {
+        snprintf(name, size - (size_t)(name - root), ".worktrees");
+    }
+    else
+    {
+        snprintf(root + strlen(root), size - strlen(root), ".worktrees");
+    }
+}
+
+// Find the worktree that has `branch` checked out, or else the one at `path`
+static int find_worktree(const char *common_dir, const char *branch, const char *path, char *found, size_t size)
+{
+    struct output_buffer output;
+    output_buffer_init(&output);
+
+    const char *command[] = {"git", "-C", common_dir, "worktree", "list", "--porcelain", NULL};
+    if (process_run_stdout(command, &output, NULL) != 0 || !output.data)
+    {
+        output_buffer_free(&output);
+        return -1;
+    }
+
+    char branch_ref[512];
+    snprintf(branch_ref, sizeof(branch_ref), "branch refs/heads/%s", branch ? branch : "");
+
+    int status = 1;
+    const char *current = NULL;
+    char *save_ptr = NULL;
+    for (char *line = strtok_r(output.data, "\n", &save_ptr); line && status != 0; line = strtok_r(NULL, "\n", &save_ptr))
+    {
+        if (strncmp(line, "worktree ", 9) == 0)
+        {
+            current = line + 9;
+            if (!branch && strcmp(current, path) == 0)
+            {
+                status = 0;
+            }
+        }
+        else if (branch && current && strcmp(line, branch_ref) == 0)
+        {
+            status = 0;
+        }
+    }
+    if (status == 0)
+    {
+        snprintf(found, size, "%s", current);
+    }
+
+    output_buffer_free(&output);
+    return status;
+}
+
+// Materialize `branch_or_tag`, already fetched into the repository of `repo_path`, as a
+// worktree and return its path. A branch that is checked out somewhere already reuses
+// that worktree; branches track origin/<branch> so updates can rebase them.
+int worktree_checkout(const char *repo_path, const char *branch_or_tag, int is_tag, char *worktree_path, size_t size)
+{
+    char git_dir[PATH_MAX];
+    char common_dir[PATH_MAX];
+    if (git_dirs(repo_path, git_dir, sizeof(git_dir), common_dir, sizeof(common_dir)) != 0)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to locate the repository's object store.");
+        return -1;
+    }
+
+    // Branch names may contain '/'; each worktree is one directory
+    char root[PATH_MAX];
+    char slug[256];
+    char path[PATH_MAX];
+    worktree_root(common_dir, root, sizeof(root));
+    snprintf(slug, sizeof(slug), "%s", branch_or_tag);
+    for (char *c = slug; *c; c++)
+    {
+        *c = *c == '/' ? '-' : *c;
+    }
+    snprintf(path, sizeof(path), "%s/%s", root, slug);
+
+    if (find_worktree(common_dir, is_tag ? NULL : branch_or_tag, path, worktree_path, size) == 0)
+    {
+        char log_msg[PATH_MAX + 64];
+        snprintf(log_msg, sizeof(log_msg), "Reusing worktree %s.", worktree_path);
+        log_message(INFO, INFO_SYMBOL, log_msg);
+        return 0;
+    }
+
+    if (mkdir(root, 0700) != 0 && errno != EEXIST)
+    {
+        log_message(ERROR, ERROR_SYMBOL, "Failed to create the worktree directory.");
+        return -1;
+    }
+
+    // Forget worktrees whose directories were removed by hand, so their branches are free again
+    const char *prune_command[] = {"git", "-C", common_dir, "worktree", "prune", NULL};
+    run_command(prune_command, NULL);
+
+    char target[300];
+    char upstream[300];
+    char local_ref[300];
+    snprintf(target, sizeof(target), is_tag ? "tags/%s" : "%s", branch_or_tag);
+    snprintf(upstream, sizeof(upstream), "origin/%s", branch_or_tag);
+    snprintf(local_ref, sizeof(local_ref), "refs/heads/%s", branch_or_tag);
+
+    const char *verify_command[] = {"git", "-C", common_dir, "rev-parse", "--verify", "--quiet", local_ref, NULL};
+    const char *tag_command[] = {"git", "-C", common_dir, "worktree", "add", "--detach", path, target, NULL};
+    const char *branch_command[] = {"git", "-C", common_dir, "worktree", "add", path, branch_or_tag, NULL};
+    const char *new_branch_command[] = {"git", "-C", common_dir, "worktree", "add", "--track", "-b", branch_or_tag, path, upstream, NULL};
+    const char *upstream_command[] = {"git", "-C", path, "branch", "--set-upstream-to", upstream, NULL};
+
+    int status;
+    if (is_tag)
+    {
+        status = run_git_step(tag_command, "Failed to add a worktree for the tag.");
+    }
+    else if (run_command(verify_command, NULL) == 0)
+    {
+        status = run_git_step(branch_command, "Failed to add a worktree for the branch.");
+        if (status == 0)
+        {
+            status = run_git_step(upstream_command, "Failed to set the branch's upstream.");
+        }
+    }
+    else
+    {
+        status = run_git_step(new_branch_command, "Failed to add a worktree for the branch.");
+    }
+
+    if (status == 0)
+    {
+        snprintf(worktree_path, size, "%s", path);
+    }
+    return status;
+}
+
+// Whether `path` is listed in `paths`
+static int is_listed_path(const char *path, const char *const paths[], size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strcmp(paths[i], path) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether `path` is the checkout `root` belongs to or lies inside `root`
+static int in_store(const char *path, const char *common_dir, const char *root)
+{
+    size_t root_length = strlen(root);
+    if (strncmp(path, root, root_length) == 0 && (path[root_length] == '/' || path[root_length] == '\0'))
+    {
+        return 1;
+    }
+
+    // The checkout of an older clone is the main worktree of its own .git
+    const char *name = strrchr(common_dir, '/');
+    return name && strcmp(name + 1, ".git") == 0 && strlen(path) == (size_t)(name - common_dir) &&
+           strncmp(path, common_dir, (size_t)(name - common_dir)) == 0;
+}
+
+static int git_worktree_remove(const char *common_dir, const char *path)
+{
+    // --force: the staged docker/ config and other untracked files are expected in a worktree
+    const char *remove_command[] = {"git", "-C", common_dir, "worktree", "remove", "--force", path, NULL};
+    const char *prune_command[] = {"git", "-C", common_dir, "worktree", "prune", NULL};
+    int status = run_command(remove_command, NULL);
+    run_command(prune_command, NULL);
+    return status == 0 ? 0 : -1;
+}
+
+// Remove the worktree a deleted repository used. Other repositories may be worktrees of the
+// same store (`in_use` lists their checkouts): then only this worktree goes, and nothing if
+// one of them uses it too. The store itself is removed with its last worktree.
+int worktree_remove(const char *worktree_path, const char *const in_use[], size_t in_use_count)
+{
+    char path[PATH_MAX];
+    if (!realpath(worktree_path, path))
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (is_listed_path(path, in_use, in_use_count))
+    {
+        return 0;
+    }
+
+    char git_dir[PATH_MAX];
+    char common_dir[PATH_MAX];
+    if (git_dirs(path, git_dir, sizeof(git_dir), common_dir, sizeof(common_dir)) != 0)
+    {
+        return remove_directory(path);
+    }
+
+    char root[PATH_MAX];
+    worktree_root(common_dir, root, sizeof(root));
+    int shared = 0;
+    for (size_t i = 0; i < in_use_count && !shared; i++)
+    {
+        shared = in_store(in_use[i], common_dir, root);
+    }
+    if (!shared)
+    {
+        return worktree_remove_store(path);
+    }
+
+    // The checkout of an older clone holds the store; it stays while others need it
+    if (strcmp(git_dir, common_dir) == 0)
+    {
+        return 0;
+    }
+    return git_worktree_remove(common_dir, path);
+}
+
+// Remove the worktrees of the store behind `repo_path` that no repository uses any more, such
+// as those left behind by a switch or a new version tag. Returns the number removed.
+int worktree_collect_garbage(const char *repo_path, const char *const in_use[], size_t in_use_count)
+{
+    char git_dir[PATH_MAX];
+    char common_dir[PATH_MAX];
+    if (git_dirs(repo_path, git_dir, sizeof(git_dir), common_dir, sizeof(common_dir)) != 0)
+    {
+        return 0;
+    }
+
+    struct output_buffer output;
+    output_buffer_init(&output);
+    const char *list_command[] = {"git", "-C", common_dir, "worktree", "list", "--porcelain", NULL};
+    if (process_run_stdout(list_command, &output, NULL) != 0 || !output.data)
+    {
+        output_buffer_free(&output);
+        return 0;
+    }
+
+    char root[PATH_MAX];
+    worktree_root(common_dir, root, sizeof(root));
+    size_t root_length = strlen(root);
+    time_t now = time(NULL);
+
+    // The first entry is the store or the checkout holding it; only worktrees under root go
+    int removed = 0;
+    int first = 1;
+    char *save_ptr = NULL;
+    for (char *line = strtok_r(output.data, "\n", &save_ptr); line; line = strtok_r(NULL, "\n", &save_ptr))
+    {
+        if (strncmp(line, "worktree ", 9) != 0)
+        {
+            continue;
+        }
+        const char *path = line + 9;
+        struct stat st;
+        if (first || strncmp(path, root, root_length) != 0 || path[root_length] != '/' ||
+            is_listed_path(path, in_use, in_use_count) || stat(path, &st) != 0 ||
+            // A clone or switch adds its worktree before it records it
+            difftime(now, st.st_mtime) < WORKTREE_GC_GRACE_SECONDS)
+        {
+            first = 0;
+            continue;
+        }
+        if (git_worktree_remove(common_dir, path) == 0)
+        {
+            removed++;
+        }
+    }
+
+    output_buffer_free(&output);
+    return removed;
+}
+
+// Remove a repository's object store together with every worktree it has
+int worktree_remove_store(const char *repo_path)
+{
+    char git_dir[PATH_MAX];
+    char common_dir[PATH_MAX];
+    if (git_dirs(repo_path, git_dir, sizeof(git_dir), common_dir, sizeof(common_dir)) != 0)
+    {
+        return remove_directory(repo_path);
+    }
+
+    char root[PATH_MAX];
+    worktree_root(common_dir, root, sizeof(root));
+
+    // A dployer store lives inside the worktree root; an older checkout is a sibling of it
+    const char *name = strrchr(common_dir, '/');
+    int status = 0;
+    if (name && strcmp(name + 1, ".git") == 0)
+    {
+        char checkout[PATH_MAX];
+        snprintf(checkout, sizeof(checkout), "%.*s", (int)(name - common_dir), common_dir);
+        status = remove_directory(checkout);
+    }
+    return remove_directory(root) == 0 && status == 0 ? 0 : -1;
+}
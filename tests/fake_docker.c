@@ -0,0 +1,229 @@
+#define _GNU_SOURCE // memmem()
+#include "fake_docker.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Largest request the fake reads; build contexts are not replayed
+#define FAKE_REQUEST_LIMIT (256 * 1024)
+
+// Pause between the pieces of a response, so the client sees partial reads
+#define FAKE_WRITE_PAUSE_US 2000
+
+// Decode a chunked body that starts at `data`. Returns 1 once the terminating
+// chunk has arrived, 0 while more is needed.
+static int chunked_complete(const char *data, size_t length, struct fake_request *request)
+{
+    size_t position = 0;
+    size_t body_length = 0;
+
+    while (1)
+    {
+        const char *line_end = memmem(data + position, length - position, "\r\n", 2);
+        if (!line_end)
+        {
+            return 0;
+        }
+
+        size_t chunk_length = strtoul(data + position, NULL, 16);
+        position = (size_t)(line_end - data) + 2;
+        if (chunk_length == 0)
+        {
+            request->body[body_length] = '\0';
+            return length - position >= 2;
+        }
+        if (length - position < chunk_length + 2)
+        {
+            return 0;
+        }
+
+        size_t copy_length = chunk_length;
+        if (copy_length > sizeof(request->body) - 1 - body_length)
+        {
+            copy_length = sizeof(request->body) - 1 - body_length;
+        }
+        memcpy(request->body + body_length, data + position, copy_length);
+        body_length += copy_length;
+        position += chunk_length + 2;
+    }
+}
+
+// Whether `data` holds a whole request; fills in `request` when it does
+static int request_complete(const char *data, size_t length, struct fake_request *request)
+{
+    const char *header_end = memmem(data, length, "\r\n\r\n", 4);
+    if (!header_end)
+    {
+        return 0;
+    }
+
+    size_t line_length = strcspn(data, "\r");
+    if (line_length >= sizeof(request->line))
+    {
+        line_length = sizeof(request->line) - 1;
+    }
+    memcpy(request->line, data, line_length);
+    request->line[line_length] = '\0';
+
+    const char *body = header_end + 4;
+    size_t body_available = length - (size_t)(body - data);
+    size_t content_length = 0;
+    int chunked = 0;
+    for (const char *line = strstr(data, "\r\n") + 2; line < header_end; line = strstr(line, "\r\n") + 2)
+    {
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            content_length = strtoul(line + 15, NULL, 10);
+        }
+        else if (strncasecmp(line, "Transfer-Encoding: chunked", 26) == 0)
+        {
+            chunked = 1;
+        }
+    }
+
+    if (chunked)
+    {
+        return chunked_complete(body, body_available, request);
+    }
+    if (body_available < content_length)
+    {
+        return 0;
+    }
+
+    size_t copy_length = content_length < sizeof(request->body) ? content_length : sizeof(request->body) - 1;
+    memcpy(request->body, body, copy_length);
+    request->body[copy_length] = '\0';
+    return 1;
+}
+
+static void read_request(int fd, struct fake_request *request)
+{
+    char *data = malloc(FAKE_REQUEST_LIMIT);
+    size_t length = 0;
+
+    while (data && length < FAKE_REQUEST_LIMIT)
+    {
+        ssize_t received = recv(fd, data + length, FAKE_REQUEST_LIMIT - length, 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            break;
+        }
+        length += (size_t)received;
+        if (request_complete(data, length, request))
+        {
+            break;
+        }
+    }
+
+    free(data);
+}
+
+static void send_fixture(int fd, const char *name, size_t write_size)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", TEST_FIXTURES_DIR, name);
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "fake docker: cannot open %s\n", path);
+        return;
+    }
+
+    char data[65536];
+    size_t length = fread(data, 1, sizeof(data), file);
+    fclose(file);
+
+    size_t sent = 0;
+    while (sent < length)
+    {
+        size_t piece = write_size > 0 && write_size < length - sent ? write_size : length - sent;
+        ssize_t written = send(fd, data + sent, piece, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            return;
+        }
+        sent += (size_t)written;
+        if (write_size > 0)
+        {
+            usleep(FAKE_WRITE_PAUSE_US);
+        }
+    }
+}
+
+static void *serve(void *arg)
+{
+    struct fake_docker *fake = arg;
+
+    while (fake->served < fake->count)
+    {
+        int fd = accept(fake->listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        size_t slot = fake->served < FAKE_DOCKER_MAX_REQUESTS ? fake->served : FAKE_DOCKER_MAX_REQUESTS - 1;
+        memset(&fake->requests[slot], 0, sizeof(fake->requests[slot]));
+        read_request(fd, &fake->requests[slot]);
+        send_fixture(fd, fake->responses[fake->served], fake->write_size);
+        fake->served++;
+        close(fd);
+    }
+
+    return NULL;
+}
+
+int fake_docker_start(struct fake_docker *fake, const char *const *responses, size_t count, size_t write_size)
+{
+    static int instances = 0;
+
+    memset(fake, 0, sizeof(*fake));
+    fake->responses = responses;
+    fake->count = count;
+    fake->write_size = write_size;
+    snprintf(fake->socket_path, sizeof(fake->socket_path), "/tmp/dployer-fake-docker-%d-%d.sock", (int)getpid(), instances++);
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, fake->socket_path);
+
+    unlink(fake->socket_path);
+    fake->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fake->listen_fd < 0 || bind(fake->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(fake->listen_fd, 8) != 0)
+    {
+        perror("fake docker");
+        return -1;
+    }
+
+    char docker_host[128];
+    snprintf(docker_host, sizeof(docker_host), "unix://%s", fake->socket_path);
+    setenv("DOCKER_HOST", docker_host, 1);
+
+    return pthread_create(&fake->thread, NULL, serve, fake) == 0 ? 0 : -1;
+}
+
+size_t fake_docker_stop(struct fake_docker *fake)
+{
+    // Wakes up an accept() that is still waiting for a request that never came
+    shutdown(fake->listen_fd, SHUT_RDWR);
+    pthread_join(fake->thread, NULL);
+    close(fake->listen_fd);
+    unlink(fake->socket_path);
+    return fake->served;
+}
@@ -0,0 +1,37 @@
+#ifndef FAKE_DOCKER_H
+#define FAKE_DOCKER_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define FAKE_DOCKER_MAX_REQUESTS 16
+
+// One request as the fake daemon received it
+struct fake_request
+{
+    char line[512]; // "GET /v1.41/_ping HTTP/1.1"
+    char body[8192]; // De-chunked request body, truncated to fit
+};
+
+// Engine API stand-in on a unix socket: every connection is answered with the
+// next recorded response from tests/fixtures, byte for byte
+struct fake_docker
+{
+    char socket_path[108];
+    int listen_fd;
+    pthread_t thread;
+    const char *const *responses; // Fixture file names, one per expected request
+    size_t count;
+    size_t write_size;            // Send responses in pieces of this size (0 = at once)
+    size_t served;
+    struct fake_request requests[FAKE_DOCKER_MAX_REQUESTS];
+};
+
+// Start the fake and point DOCKER_HOST at it. Returns 0 on success.
+int fake_docker_start(struct fake_docker *fake, const char *const *responses, size_t count, size_t write_size);
+
+// Close the socket, also when fewer requests came than there are responses.
+// Returns the number of requests answered.
+size_t fake_docker_stop(struct fake_docker *fake);
+
+#endif // FAKE_DOCKER_H
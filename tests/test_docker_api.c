@@ -0,0 +1,151 @@
+#include "check.h"
+#include "docker.h"
+#include "fake_docker.h"
+#include "logger.h"
+#include <json-c/json.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Engine API client (docker_http.c and docker.c) against recorded daemon responses
+
+static void test_ping()
+{
+    const char *const responses[] = {"ping_ok.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 1, 0) == 0);
+
+    CHECK(docker_ping() == 0);
+
+    CHECK(fake_docker_stop(&fake) == 1);
+    CHECK(strcmp(fake.requests[0].line, "GET /v1.41/_ping HTTP/1.1") == 0);
+}
+
+// Responses written a few bytes at a time, so lines and the body span several reads
+static void test_partial_reads()
+{
+    const char *const responses[] = {"service_inspect.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 1, 7) == 0);
+
+    char image[256] = "";
+    CHECK(docker_service_image("api_service", image, sizeof(image)) == 0);
+    CHECK(strcmp(image, "acme/api:abc123") == 0);
+
+    CHECK(fake_docker_stop(&fake) == 1);
+    CHECK(strcmp(fake.requests[0].line, "GET /v1.41/services/api_service HTTP/1.1") == 0);
+}
+
+static void test_chunked_response()
+{
+    const char *const responses[] = {"service_inspect_chunked.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 1, 5) == 0);
+
+    char image[256] = "";
+    CHECK(docker_service_image("api_service", image, sizeof(image)) == 0);
+    CHECK(strcmp(image, "acme/api:abc123") == 0);
+
+    CHECK(fake_docker_stop(&fake) == 1);
+}
+
+// Without Content-Length the body ends when the daemon closes the connection
+static void test_body_until_close()
+{
+    const char *const responses[] = {"prune_without_length.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 1, 3) == 0);
+
+    long long space_reclaimed = -1;
+    CHECK(docker_prune("images", &space_reclaimed) == 0);
+    CHECK(space_reclaimed == 12345);
+
+    CHECK(fake_docker_stop(&fake) == 1);
+    CHECK(strcmp(fake.requests[0].line, "POST /v1.41/images/prune HTTP/1.1") == 0);
+}
+
+// A connection that closes before Content-Length bytes arrived is an error, not a short body
+static void test_truncated_response()
+{
+    const char *const responses[] = {"service_inspect_truncated.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 1, 0) == 0);
+
+    char image[256] = "";
+    CHECK(docker_service_image("api_service", image, sizeof(image)) == -1);
+
+    CHECK(fake_docker_stop(&fake) == 1);
+}
+
+static void test_error_statuses()
+{
+    const char *const responses[] = {"service_missing.http", "service_remove_error.http", "image_remove_conflict.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 3, 0) == 0);
+
+    struct json_object *service = NULL;
+    CHECK(docker_service_inspect("api_service", &service) == 1);
+    CHECK(docker_service_remove("api_service") == -1);
+    CHECK(docker_image_remove("1a2b3c4d5e6f") == 2);
+
+    CHECK(fake_docker_stop(&fake) == 3);
+    CHECK(strcmp(fake.requests[1].line, "DELETE /v1.41/services/api_service HTTP/1.1") == 0);
+    CHECK(strcmp(fake.requests[2].line, "DELETE /v1.41/images/1a2b3c4d5e6f HTTP/1.1") == 0);
+}
+
+// An update posts the inspected spec back with the changes and a bumped ForceUpdate
+static void test_service_update()
+{
+    const char *const responses[] = {"service_inspect.http", "service_update.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 2, 0) == 0);
+
+    struct json_object *service = NULL;
+    CHECK(docker_service_inspect("api_service", &service) == 0);
+
+    struct docker_service_spec spec = {
+        .name = "api_service",
+        .image = "acme/api:def456",
+        .port = "8002:80",
+        .replicas = 2,
+        .remove_port = "8001:80",
+    };
+    CHECK(service && docker_service_update(&spec, service) == 0);
+    json_object_put(service);
+
+    CHECK(fake_docker_stop(&fake) == 2);
+    CHECK(strcmp(fake.requests[1].line, "POST /v1.41/services/svc123/update?version=42 HTTP/1.1") == 0);
+
+    struct json_object *posted = json_tokener_parse(fake.requests[1].body);
+    struct json_object *task_template = NULL;
+    struct json_object *value = NULL;
+    CHECK(posted && json_object_object_get_ex(posted, "TaskTemplate", &task_template));
+    CHECK(json_object_object_get_ex(task_template, "ForceUpdate", &value) && json_object_get_int(value) == 2);
+    struct json_object *container_spec = NULL;
+    CHECK(json_object_object_get_ex(task_template, "ContainerSpec", &container_spec) &&
+          json_object_object_get_ex(container_spec, "Image", &value) &&
+          strcmp(json_object_get_string(value), "acme/api:def456") == 0);
+    CHECK(strstr(fake.requests[1].body, "\"PublishedPort\":8002") != NULL);
+    CHECK(strstr(fake.requests[1].body, "\"PublishedPort\":8001") == NULL);
+    json_object_put(posted);
+}
+
+static void test_unreachable_daemon()
+{
+    setenv("DOCKER_HOST", "unix:///nonexistent/dployer-test.sock", 1);
+    CHECK(docker_ping() == -1);
+}
+
+int main()
+{
+    test_ping();
+    test_partial_reads();
+    test_chunked_response();
+    test_body_until_close();
+    test_truncated_response();
+    test_error_statuses();
+    test_service_update();
+    test_unreachable_daemon();
+
+    log_flush();
+    return check_failures == 0 ? 0 : 1;
+}
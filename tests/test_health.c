@@ -0,0 +1,212 @@
+#define _GNU_SOURCE // timegm()
+#include "check.h"
+#include "fake_docker.h"
+#include "health.h"
+#include "logger.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Health gate (health.c) against the fake Engine API and an HTTP stub on the published port
+
+#define STUB_MAX_STATUSES 8
+
+// Answers each probe with the next status; the last one repeats
+struct http_stub
+{
+    int listen_fd;
+    int port;
+    pthread_t thread;
+    int statuses[STUB_MAX_STATUSES];
+    size_t count;
+    size_t served;
+    char last_request[256]; // Request line of the latest probe
+};
+
+static void *serve_probes(void *arg)
+{
+    struct http_stub *stub = arg;
+
+    while (1)
+    {
+        int fd = accept(stub->listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        char request[1024];
+        size_t length = 0;
+        while (length < sizeof(request) - 1)
+        {
+            ssize_t received = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+            if (received <= 0)
+            {
+                break;
+            }
+            length += (size_t)received;
+            request[length] = '\0';
+            if (strstr(request, "\r\n\r\n"))
+            {
+                break;
+            }
+        }
+        request[length] = '\0';
+        request[strcspn(request, "\r")] = '\0';
+        snprintf(stub->last_request, sizeof(stub->last_request), "%s", request);
+
+        size_t index = stub->served < stub->count ? stub->served : stub->count - 1;
+        char response[128];
+        int response_length = snprintf(response, sizeof(response), "HTTP/1.1 %d Stub\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                                       stub->statuses[index]);
+        send(fd, response, (size_t)response_length, MSG_NOSIGNAL);
+        stub->served++;
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int http_stub_start(struct http_stub *stub, const int *statuses, size_t count)
+{
+    memset(stub, 0, sizeof(*stub));
+    memcpy(stub->statuses, statuses, count * sizeof(statuses[0]));
+    stub->count = count;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_length = sizeof(address);
+
+    stub->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (stub->listen_fd < 0 || bind(stub->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(stub->listen_fd, 8) != 0 || getsockname(stub->listen_fd, (struct sockaddr *)&address, &address_length) != 0)
+    {
+        perror("http stub");
+        return -1;
+    }
+    stub->port = ntohs(address.sin_port);
+
+    return pthread_create(&stub->thread, NULL, serve_probes, stub) == 0 ? 0 : -1;
+}
+
+static size_t http_stub_stop(struct http_stub *stub)
+{
+    shutdown(stub->listen_fd, SHUT_RDWR);
+    pthread_join(stub->thread, NULL);
+    close(stub->listen_fd);
+    return stub->served;
+}
+
+// Before the UpdateStatus.StartedAt of the rollout fixtures
+static time_t rollout_since()
+{
+    struct tm started = {.tm_year = 2026 - 1900, .tm_mon = 9, .tm_mday = 16, .tm_hour = 20, .tm_min = 59};
+    return timegm(&started);
+}
+
+static void port_mapping(const struct http_stub *stub, char *mapping, size_t size)
+{
+    snprintf(mapping, size, "%d:80", stub->port);
+}
+
+static void test_healthy_rollout()
+{
+    const char *const responses[] = {"service_rollout_completed.http", "tasks_running.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 2, 0) == 0);
+    const int statuses[] = {200, 204, 302};
+    struct http_stub stub;
+    CHECK(http_stub_start(&stub, statuses, 3) == 0);
+    setenv(HEALTH_TIMEOUT_ENV, "10", 1);
+
+    char mapping[32];
+    port_mapping(&stub, mapping, sizeof(mapping));
+    CHECK(health_gate("api_service", "acme/api:def456", 1, rollout_since(), mapping, "/up") == 0);
+
+    CHECK(http_stub_stop(&stub) == HEALTH_REQUIRED_SUCCESSES);
+    CHECK(strcmp(stub.last_request, "GET /up HTTP/1.0") == 0);
+    CHECK(fake_docker_stop(&fake) == 2);
+    CHECK(strcmp(fake.requests[0].line, "GET /v1.41/services/api_service HTTP/1.1") == 0);
+    CHECK(strncmp(fake.requests[1].line, "GET /v1.41/tasks?filters=", 25) == 0);
+}
+
+// An error answer in between starts the count of good answers over
+static void test_flapping_probe()
+{
+    const char *const responses[] = {"service_rollout_completed.http", "tasks_running.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 2, 0) == 0);
+    const int statuses[] = {200, 502, 200};
+    struct http_stub stub;
+    CHECK(http_stub_start(&stub, statuses, 3) == 0);
+    setenv(HEALTH_TIMEOUT_ENV, "10", 1);
+
+    char mapping[32];
+    port_mapping(&stub, mapping, sizeof(mapping));
+    CHECK(health_gate("api_service", "acme/api:def456", 1, rollout_since(), mapping, "/up") == 0);
+
+    CHECK(http_stub_stop(&stub) == 2 + HEALTH_REQUIRED_SUCCESSES);
+    CHECK(fake_docker_stop(&fake) == 2);
+}
+
+static void test_unhealthy_probe()
+{
+    const char *const responses[] = {"service_rollout_completed.http", "tasks_running.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 2, 0) == 0);
+    const int statuses[] = {503};
+    struct http_stub stub;
+    CHECK(http_stub_start(&stub, statuses, 1) == 0);
+    setenv(HEALTH_TIMEOUT_ENV, "1", 1);
+
+    char mapping[32];
+    port_mapping(&stub, mapping, sizeof(mapping));
+    CHECK(health_gate("api_service", "acme/api:def456", 1, rollout_since(), mapping, "/up") == -1);
+
+    CHECK(http_stub_stop(&stub) >= 1);
+    CHECK(fake_docker_stop(&fake) == 2);
+}
+
+// A paused update fails the gate without probing the port
+static void test_paused_rollout()
+{
+    const char *const responses[] = {"service_rollout_paused.http", "tasks_running.http"};
+    struct fake_docker fake;
+    CHECK(fake_docker_start(&fake, responses, 2, 0) == 0);
+    const int statuses[] = {200};
+    struct http_stub stub;
+    CHECK(http_stub_start(&stub, statuses, 1) == 0);
+    setenv(HEALTH_TIMEOUT_ENV, "10", 1);
+
+    char mapping[32];
+    port_mapping(&stub, mapping, sizeof(mapping));
+    CHECK(health_gate("api_service", "acme/api:def456", 1, rollout_since(), mapping, "/up") == -1);
+
+    CHECK(http_stub_stop(&stub) == 0);
+    CHECK(fake_docker_stop(&fake) == 2);
+}
+
+int main()
+{
+    setenv(HEALTH_HOST_ENV, "127.0.0.1", 1);
+
+    test_healthy_rollout();
+    test_flapping_probe();
+    test_unhealthy_probe();
+    test_paused_rollout();
+
+    log_flush();
+    return check_failures == 0 ? 0 : 1;
+}